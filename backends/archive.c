@@ -24,41 +24,36 @@
 
 #include "../pqiv.h"
 #include "../lib/filebuffer.h"
-#include <archive.h>
-#include <archive_entry.h>
-#include <string.h>
+#include "archive_common.h"
+
+typedef struct {
+	// The source archive, shared by all of its entries
+	file_t *file;
+	gint references;
+} file_loader_delegate_archive_source_t;
 
 typedef struct {
 	// The source archive
-	file_t *source_archive;
+	file_loader_delegate_archive_source_t *source_archive;
 
 	// The path to the target file within the archive
 	gchar *entry_name;
-} file_loader_delegate_archive_t;
 
-static struct archive *file_type_archive_gen_archive(GBytes *data) {/*{{{*/
-	struct archive *archive = archive_read_new();
-	archive_read_support_format_zip(archive);
-	archive_read_support_format_rar(archive);
-	archive_read_support_format_7zip(archive);
-	archive_read_support_format_tar(archive);
-	archive_read_support_filter_all(archive);
-
-	gsize data_size;
-	char *data_ptr = (char *)g_bytes_get_data(data, &data_size);
+	// The index of the entry within the archive, and the position of its
+	// header if the entry can be read from there directly, or -1
+	int entry_index;
+	gint64 entry_offset;
+} file_loader_delegate_archive_t;
 
-	if(archive_read_open_memory(archive, data_ptr, data_size) != ARCHIVE_OK) {
-		g_printerr("Failed to load archive: %s\n", archive_error_string(archive));
-		archive_read_free(archive);
-		return NULL;
+void file_type_archive_source_unref(file_loader_delegate_archive_source_t *source) {/*{{{*/
+	if(g_atomic_int_dec_and_test(&source->references)) {
+		file_free(source->file);
+		g_slice_free(file_loader_delegate_archive_source_t, source);
 	}
-
-	return archive;
 }/*}}}*/
-
 void file_type_archive_data_free(file_loader_delegate_archive_t *data) {/*{{{*/
 	if(data->source_archive) {
-		file_free(data->source_archive);
+		file_type_archive_source_unref(data->source_archive);
 		data->source_archive = NULL;
 	}
 	g_free(data);
@@ -66,45 +61,26 @@ void file_type_archive_data_free(file_loader_delegate_archive_t *data) {/*{{{*/
 
 GBytes *file_type_archive_data_loader(file_t *file, GError **error_pointer) {/*{{{*/
 	const file_loader_delegate_archive_t *archive_data = g_bytes_get_data(file->file_data, NULL);
+	file_t *source_archive = archive_data->source_archive->file;
 
-	GBytes *data = buffered_file_as_bytes(archive_data->source_archive, NULL, error_pointer);
+	GBytes *data = buffered_file_as_bytes(source_archive, NULL, error_pointer);
 	if(!data) {
 		g_printerr("Failed to load archive %s: %s\n", file->display_name, error_pointer && *error_pointer ? (*error_pointer)->message : "Unknown error");
 		g_clear_error(error_pointer);
 		return NULL;
 	}
 
-	struct archive *archive = file_type_archive_gen_archive(data);
-	if(!archive) {
-		buffered_file_unref(file);
-		return NULL;
-	}
-
-	// Find the proper entry
 	size_t entry_size = 0;
 	void *entry_data = NULL;
-
-	struct archive_entry *entry;
-	while(archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
-		if(archive_data->entry_name && strcmp(archive_data->entry_name, archive_entry_pathname(entry)) == 0) {
-			entry_size = archive_entry_size(entry);
-			entry_data = g_malloc(entry_size);
-
-			if(archive_read_data(archive, entry_data, entry_size) != (ssize_t)entry_size) {
-				archive_read_free(archive);
-				buffered_file_unref(file);
-				*error_pointer = g_error_new(g_quark_from_static_string("pqiv-archive-error"), 1, "The file had an unexpected size");
-				return NULL;
-			}
-
-			break;
-		}
+	if(archive_data->entry_name) {
+		entry_data = file_type_archive_common_read_entry(source_archive, data, archive_data->entry_name, archive_data->entry_index, archive_data->entry_offset, &entry_size, error_pointer);
 	}
 
-	archive_read_free(archive);
-	buffered_file_unref(archive_data->source_archive);
-	if(!entry_size) {
-		*error_pointer = g_error_new(g_quark_from_static_string("pqiv-archive-error"), 1, "The file has gone within the archive");
+	buffered_file_unref(source_archive);
+	if(!entry_data) {
+		if(!*error_pointer) {
+			*error_pointer = g_error_new(g_quark_from_static_string("pqiv-archive-error"), 1, "The file has gone within the archive");
+		}
 		return NULL;
 	}
 
@@ -121,17 +97,26 @@ BOSNode *file_type_archive_alloc(load_images_state_t state, file_t *file) {/*{{{
 		return FALSE_POINTER;
 	}
 
-	struct archive *archive = file_type_archive_gen_archive(data);
+	struct archive *archive = file_type_archive_common_gen_archive(data);
 	if(!archive) {
 		buffered_file_unref(file);
 		file_free(file);
 		return FALSE_POINTER;
 	}
 
+	// The entries share file as their source. It is freed along with the last
+	// of them, or below if there are none.
+	file_loader_delegate_archive_source_t *source_archive = g_slice_new(file_loader_delegate_archive_source_t);
+	source_archive->file = file;
+	source_archive->references = 1;
+
 	GtkFileFilterInfo file_filter_info;
 	file_filter_info.contains = GTK_FILE_FILTER_FILENAME | GTK_FILE_FILTER_DISPLAY_NAME;
 
 	BOSNode *first_node = FALSE_POINTER;
+	GHashTable *zip_index = NULL;
+	gboolean zip_index_parsed = FALSE;
+	int entry_index = 0;
 
 	struct archive_entry *entry;
 	while(archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
@@ -143,9 +128,12 @@ BOSNode *file_type_archive_alloc(load_images_state_t state, file_t *file) {/*{{{
 				const char *archive_format = archive_format_name(archive);
 				if(strncmp("ZIP", archive_format, 3) == 0) {
 					g_printerr("Failed to load archive %s: This ZIP file is affected by libarchive bug #869, which was fixed in v3.3.2. Skipping file.\n", file->display_name);
+					if(zip_index) {
+						g_hash_table_unref(zip_index);
+					}
 					archive_read_free(archive);
 					buffered_file_unref(file);
-					file_free(file);
+					file_type_archive_source_unref(source_archive);
 					return FALSE_POINTER;
 				}
 			}
@@ -161,9 +149,12 @@ BOSNode *file_type_archive_alloc(load_images_state_t state, file_t *file) {/*{{{
 		}
 		size_t delegate_struct_alloc_size = sizeof(file_loader_delegate_archive_t) + strlen(entry_name) + 2;
 		file_loader_delegate_archive_t *new_file_data = g_malloc(delegate_struct_alloc_size);
-		new_file_data->source_archive = image_loader_duplicate_file(file, NULL, NULL, NULL);
+		g_atomic_int_inc(&source_archive->references);
+		new_file_data->source_archive = source_archive;
 		new_file_data->entry_name     = (char *)(new_file_data) + sizeof(file_loader_delegate_archive_t) + 1;
 		memcpy(new_file_data->entry_name, entry_name, strlen(entry_name) + 1);
+		new_file_data->entry_index    = entry_index++;
+		new_file_data->entry_offset   = file_type_archive_common_entry_offset(archive, entry, data, &zip_index, &zip_index_parsed);
 		new_file->file_data = g_bytes_new_with_free_func(new_file_data, delegate_struct_alloc_size, (GDestroyNotify)file_type_archive_data_free, new_file_data);
 		new_file->file_flags |= FILE_FLAGS_MEMORY_IMAGE;
 		new_file->file_data_loader = file_type_archive_data_loader;
@@ -191,9 +182,12 @@ BOSNode *file_type_archive_alloc(load_images_state_t state, file_t *file) {/*{{{
 		archive_read_data_skip(archive);
 	}
 
+	if(zip_index) {
+		g_hash_table_unref(zip_index);
+	}
 	archive_read_free(archive);
 	buffered_file_unref(file);
-	file_free(file);
+	file_type_archive_source_unref(source_archive);
 	return first_node;
 }/*}}}*/
 
@@ -218,4 +212,5 @@ void file_type_archive_initializer(file_type_handler_t *info) {/*{{{*/
 
 	// Assign the handlers
 	info->alloc_fn                 =  file_type_archive_alloc;
+	info->gc_fn                    =  file_type_archive_common_gc;
 }/*}}}*/
@@ -26,38 +26,21 @@
 
 #include "../pqiv.h"
 #include "../lib/filebuffer.h"
-#include <archive.h>
-#include <archive_entry.h>
-#include <string.h>
+#include "archive_common.h"
 
 typedef struct {
 	// The archive object and raw archive data
 	gchar *entry_name;
 
+	// The index of the entry within the archive, and the position of its
+	// header if the entry can be read from there directly, or -1
+	int entry_index;
+	gint64 entry_offset;
+
 	// The surface where the image is stored.
 	cairo_surface_t *image_surface;
 } file_private_data_archive_t;
 
-static struct archive *file_type_archive_cbx_gen_archive(GBytes *data) {/*{{{*/
-	struct archive *archive = archive_read_new();
-	archive_read_support_format_zip(archive);
-	archive_read_support_format_rar(archive);
-	archive_read_support_format_7zip(archive);
-	archive_read_support_format_tar(archive);
-	archive_read_support_filter_all(archive);
-
-	gsize data_size;
-	char *data_ptr = (char *)g_bytes_get_data(data, &data_size);
-
-	if(archive_read_open_memory(archive, data_ptr, data_size) != ARCHIVE_OK) {
-		g_printerr("Failed to load archive: %s\n", archive_error_string(archive));
-		archive_read_free(archive);
-		return NULL;
-	}
-
-	return archive;
-}/*}}}*/
-
 BOSNode *file_type_archive_cbx_alloc(load_images_state_t state, file_t *file) {/*{{{*/
 	GError *error_pointer = NULL;
 	GBytes *data = buffered_file_as_bytes(file, NULL, &error_pointer);
@@ -68,13 +51,16 @@ BOSNode *file_type_archive_cbx_alloc(load_images_state_t state, file_t *file) {/
 		return FALSE_POINTER;
 	}
 
-	struct archive *archive = file_type_archive_cbx_gen_archive(data);
+	struct archive *archive = file_type_archive_common_gen_archive(data);
 	if(!archive) {
 		file_free(file);
 		return FALSE_POINTER;
 	}
 
 	BOSNode *first_node = FALSE_POINTER;
+	GHashTable *zip_index = NULL;
+	gboolean zip_index_parsed = FALSE;
+	int entry_index = 0;
 
 	struct archive_entry *entry;
 	while(archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
@@ -83,6 +69,8 @@ BOSNode *file_type_archive_cbx_alloc(load_images_state_t state, file_t *file) {/
 		file_t *new_file = image_loader_duplicate_file(file, NULL, g_strdup_printf("%s#%s", file->display_name, entry_name), g_strdup_printf("%s#%s", file->sort_name, entry_name));
 		new_file->private = g_slice_new0(file_private_data_archive_t);
 		((file_private_data_archive_t *)new_file->private)->entry_name = g_strdup(entry_name);
+		((file_private_data_archive_t *)new_file->private)->entry_index = entry_index++;
+		((file_private_data_archive_t *)new_file->private)->entry_offset = file_type_archive_common_entry_offset(archive, entry, data, &zip_index, &zip_index_parsed);
 
 		if(first_node == FALSE_POINTER) {
 			first_node = load_images_handle_parameter_add_file(state, new_file);
@@ -95,6 +83,9 @@ BOSNode *file_type_archive_cbx_alloc(load_images_state_t state, file_t *file) {/
 		archive_read_data_skip(archive);
 	}
 
+	if(zip_index) {
+		g_hash_table_unref(zip_index);
+	}
 	archive_read_free(archive);
 	buffered_file_unref(file);
 	file_free(file);
@@ -133,38 +124,17 @@ void file_type_archive_cbx_load(file_t *file, GInputStream *data_stream, GError
 		return;
 	}
 
-	struct archive *archive = file_type_archive_cbx_gen_archive(data);
-	if(!archive) {
-		buffered_file_unref(file);
-		*error_pointer = g_error_new(g_quark_from_static_string("pqiv-archive-error"), 1, "Failed to open archive file");
-		return;
-	}
-
-	// Find the proper entry
 	size_t entry_size = 0;
 	gchar *entry_data = NULL;
-
-	struct archive_entry *entry;
-	while(archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
-		if(private->entry_name && strcmp(private->entry_name, archive_entry_pathname(entry)) == 0) {
-			entry_size = archive_entry_size(entry);
-			entry_data = g_malloc(entry_size);
-
-			if(archive_read_data(archive, entry_data, entry_size) != (ssize_t)entry_size) {
-				archive_read_free(archive);
-				buffered_file_unref(file);
-				*error_pointer = g_error_new(g_quark_from_static_string("pqiv-archive-error"), 1, "The file had an unexpected size");
-				return;
-			}
-
-			break;
-		}
+	if(private->entry_name) {
+		entry_data = file_type_archive_common_read_entry(file, data, private->entry_name, private->entry_index, private->entry_offset, &entry_size, error_pointer);
 	}
 
-	archive_read_free(archive);
 	buffered_file_unref(file);
-	if(!entry_size) {
-		*error_pointer = g_error_new(g_quark_from_static_string("pqiv-archive-error"), 1, "The file has gone within the archive");
+	if(!entry_data) {
+		if(!*error_pointer) {
+			*error_pointer = g_error_new(g_quark_from_static_string("pqiv-archive-error"), 1, "The file has gone within the archive");
+		}
 		return;
 	}
 
@@ -191,10 +161,12 @@ void file_type_archive_cbx_load(file_t *file, GInputStream *data_stream, GError
 		*error_pointer = g_error_new(g_quark_from_static_string("pqiv-archive-error"), 1, "Failed to create a cairo image surface for the loaded image (cairo status %d)\n", cairo_surface_status(surface));
 		return;
 	}
-	cairo_t *sf_cr = cairo_create(surface);
-	gdk_cairo_set_source_pixbuf(sf_cr, pixbuf, 0, 0);
-	cairo_paint(sf_cr);
-	cairo_destroy(sf_cr);
+	if(!pixbuf_import_to_surface(pixbuf, surface)) {
+		cairo_t *sf_cr = cairo_create(surface);
+		gdk_cairo_set_source_pixbuf(sf_cr, pixbuf, 0, 0);
+		cairo_paint(sf_cr);
+		cairo_destroy(sf_cr);
+	}
 
 	cairo_surface_t *old_surface = private->image_surface;
 	private->image_surface = surface;
@@ -230,4 +202,5 @@ void file_type_archive_cbx_initializer(file_type_handler_t *info) {/*{{{*/
 	info->load_fn                  =  file_type_archive_cbx_load;
 	info->unload_fn                =  file_type_archive_cbx_unload;
 	info->draw_fn                  =  file_type_archive_cbx_draw;
+	info->gc_fn                    =  file_type_archive_common_gc;
 }/*}}}*/
@@ -0,0 +1,410 @@
+/**
+ * pqiv
+ *
+ * Copyright (c) 2013-2017, Phillip Berndt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * Entry access shared by the libarchive backends
+ *
+ * Both backends may be built as separate shared modules, so this is
+ * included into each of them rather than linked.
+ *
+ * Entries are read in one of two ways: Directly from the position of their
+ * header, for formats that allow that (see
+ * file_type_archive_common_entry_offset()), or through a cursor that keeps
+ * the archive open. For solid archives, where reaching an entry requires
+ * decompressing all earlier ones anyway, the cursor makes a forward read
+ * through the archive a single pass.
+ *
+ */
+
+#ifndef PQIV_ARCHIVE_COMMON_H
+#define PQIV_ARCHIVE_COMMON_H
+
+#include "../pqiv.h"
+#include "../lib/zipindex.h"
+#include <archive.h>
+#include <archive_entry.h>
+#include <string.h>
+
+// Maximum number of archives to keep open cursors for, and their maximum
+// total size. Each cursor keeps its archive's data, which for files that
+// are not local is a copy in memory.
+#define ARCHIVE_CURSOR_MAX_COUNT 4
+#define ARCHIVE_CURSOR_MAX_BYTES (1 << 28)
+
+// Number of entries a cursor keeps decoded after having skipped over them
+// to reach a later one, e.g. if the preloader requested pages out of order
+#define ARCHIVE_CURSOR_READ_AHEAD 8
+
+struct file_type_archive_read_ahead_entry {
+	int entry_index;
+	void *data;
+	size_t size;
+};
+
+struct file_type_archive_cursor {
+	// Protected by the archive_cursors lock
+	gint ref_count;
+
+	// Protects all of the following
+	GMutex lock;
+
+	gchar *archive_name;
+	GBytes *data;
+	struct archive *archive;
+
+	// Identifies the version of a local archive that data holds, see
+	// file_type_archive_common_stamp()
+	gboolean has_stamp;
+	guint64 device, inode, mtime;
+	goffset size;
+
+	// Whether the cursor has been used since the last garbage collector
+	// pass, protected by the archive_cursors lock
+	gboolean used;
+
+	// Index of the entry the next archive_read_next_header() call returns
+	int next_entry_index;
+
+	// struct file_type_archive_read_ahead_entry, oldest first
+	GQueue read_ahead;
+};
+
+// Open cursors, most recently used first
+static GQueue archive_cursors = G_QUEUE_INIT;
+G_LOCK_DEFINE_STATIC(archive_cursors);
+
+static struct archive *file_type_archive_common_gen_archive(GBytes *data) {/*{{{*/
+	struct archive *archive = archive_read_new();
+	archive_read_support_format_zip(archive);
+	archive_read_support_format_rar(archive);
+	archive_read_support_format_7zip(archive);
+	archive_read_support_format_tar(archive);
+	archive_read_support_filter_all(archive);
+
+	gsize data_size;
+	char *data_ptr = (char *)g_bytes_get_data(data, &data_size);
+
+	if(archive_read_open_memory(archive, data_ptr, data_size) != ARCHIVE_OK) {
+		g_printerr("Failed to load archive: %s\n", archive_error_string(archive));
+		archive_read_free(archive);
+		return NULL;
+	}
+
+	return archive;
+}/*}}}*/
+
+static struct archive *file_type_archive_common_gen_archive_at(GBytes *data, gint64 offset) {/*{{{*/
+	// Open a reader directly at an entry's header. This only works for
+	// formats without state spanning entries, i.e. for uncompressed tar
+	// files, and ZIP files if read as a stream
+	struct archive *archive = archive_read_new();
+	archive_read_support_format_zip_streamable(archive);
+	archive_read_support_format_tar(archive);
+
+	gsize data_size;
+	char *data_ptr = (char *)g_bytes_get_data(data, &data_size);
+
+	if(offset < 0 || (gsize)offset >= data_size || archive_read_open_memory(archive, data_ptr + offset, data_size - offset) != ARCHIVE_OK) {
+		archive_read_free(archive);
+		return NULL;
+	}
+
+	return archive;
+}/*}}}*/
+
+static gint64 file_type_archive_common_entry_offset(struct archive *archive, struct archive_entry *entry, GBytes *data, GHashTable **zip_index, gboolean *zip_index_parsed) {/*{{{*/
+	// Determine where file_type_archive_common_gen_archive_at() can open the
+	// entry that has just been read, or -1 if it can not
+	if(archive_filter_code(archive, 0) != ARCHIVE_FILTER_NONE) {
+		return -1;
+	}
+
+	switch(archive_format(archive) & ARCHIVE_FORMAT_BASE_MASK) {
+		case ARCHIVE_FORMAT_TAR:
+			return archive_read_header_position(archive);
+
+		case ARCHIVE_FORMAT_ZIP:
+			// libarchive's header position is meaningless for ZIP files, since
+			// it reads them using the central directory. Parse that once.
+			if(!*zip_index_parsed) {
+				gsize data_size;
+				const char *data_ptr = g_bytes_get_data(data, &data_size);
+				*zip_index = zip_index_new(data_ptr, data_size);
+				*zip_index_parsed = TRUE;
+			}
+			if(*zip_index) {
+				gint64 *offset = g_hash_table_lookup(*zip_index, archive_entry_pathname(entry));
+				if(offset) {
+					return *offset;
+				}
+			}
+			return -1;
+
+		default:
+			return -1;
+	}
+}/*}}}*/
+
+static void *file_type_archive_common_read_entry_at(GBytes *data, const gchar *entry_name, gint64 entry_offset, size_t *entry_size) {/*{{{*/
+	// Returns NULL if the entry could not be read from entry_offset, in which
+	// case the caller should fall back to a cursor
+	struct archive *archive = file_type_archive_common_gen_archive_at(data, entry_offset);
+	if(!archive) {
+		return NULL;
+	}
+
+	void *entry_data = NULL;
+	struct archive_entry *entry;
+	if(archive_read_next_header(archive, &entry) == ARCHIVE_OK && strcmp(entry_name, archive_entry_pathname(entry)) == 0 && archive_entry_size(entry) > 0) {
+		*entry_size = archive_entry_size(entry);
+		entry_data = g_malloc(*entry_size);
+		if(archive_read_data(archive, entry_data, *entry_size) != (ssize_t)*entry_size) {
+			g_free(entry_data);
+			entry_data = NULL;
+		}
+	}
+
+	archive_read_free(archive);
+	return entry_data;
+}/*}}}*/
+
+static void file_type_archive_common_cursor_unref(struct file_type_archive_cursor *cursor) {/*{{{*/
+	// Must be called with the archive_cursors lock held
+	if(--cursor->ref_count > 0) {
+		return;
+	}
+	if(cursor->archive) {
+		archive_read_free(cursor->archive);
+	}
+	struct file_type_archive_read_ahead_entry *read_ahead_entry;
+	while((read_ahead_entry = g_queue_pop_head(&cursor->read_ahead))) {
+		g_free(read_ahead_entry->data);
+		g_slice_free(struct file_type_archive_read_ahead_entry, read_ahead_entry);
+	}
+	g_bytes_unref(cursor->data);
+	g_free(cursor->archive_name);
+	g_mutex_clear(&cursor->lock);
+	g_slice_free(struct file_type_archive_cursor, cursor);
+}/*}}}*/
+
+static gboolean file_type_archive_common_stamp(file_t *archive_file, struct file_type_archive_cursor *cursor) {/*{{{*/
+	// Store what identifies the current version of a local archive in cursor.
+	// Returns FALSE for other archives.
+	if(archive_file->file_flags & FILE_FLAGS_MEMORY_IMAGE) {
+		return FALSE;
+	}
+	GFile *file = gfile_for_commandline_arg(archive_file->file_name);
+	GFileInfo *file_info = g_file_query_info(file, G_FILE_ATTRIBUTE_UNIX_DEVICE "," G_FILE_ATTRIBUTE_UNIX_INODE "," G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC "," G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NONE, NULL, NULL);
+	g_object_unref(file);
+	if(!file_info) {
+		return FALSE;
+	}
+	gboolean retval = g_file_info_has_attribute(file_info, G_FILE_ATTRIBUTE_UNIX_INODE) && g_file_info_has_attribute(file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+	if(retval) {
+		cursor->device = g_file_info_get_attribute_uint32(file_info, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+		cursor->inode = g_file_info_get_attribute_uint64(file_info, G_FILE_ATTRIBUTE_UNIX_INODE);
+		cursor->mtime = g_file_info_get_attribute_uint64(file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * 1000000 + g_file_info_get_attribute_uint32(file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+		cursor->size = g_file_info_get_size(file_info);
+	}
+	g_object_unref(file_info);
+	return retval;
+}/*}}}*/
+
+static struct file_type_archive_cursor *file_type_archive_common_cursor_get(file_t *archive_file, GBytes *data) {/*{{{*/
+	// Returns a new reference to the cursor for the archive
+	struct file_type_archive_cursor current;
+	gboolean has_stamp = file_type_archive_common_stamp(archive_file, &current);
+
+	G_LOCK(archive_cursors);
+	struct file_type_archive_cursor *cursor = NULL;
+	for(GList *iter = archive_cursors.head; iter; iter = iter->next) {
+		struct file_type_archive_cursor *candidate = iter->data;
+		if(strcmp(candidate->archive_name, archive_file->file_name) == 0) {
+			g_queue_delete_link(&archive_cursors, iter);
+			// The file buffer is usually released and mapped anew between two
+			// loads, while the cursor keeps reading from its own reference. It
+			// can continue if it reads the same buffer, or the same version of
+			// a local file.
+			if(candidate->data == data || (has_stamp && candidate->has_stamp &&
+					candidate->device == current.device && candidate->inode == current.inode &&
+					candidate->mtime == current.mtime && candidate->size == current.size &&
+					(goffset)g_bytes_get_size(candidate->data) == current.size)) {
+				cursor = candidate;
+			}
+			else {
+				file_type_archive_common_cursor_unref(candidate);
+			}
+			break;
+		}
+	}
+	if(!cursor) {
+		cursor = g_slice_new0(struct file_type_archive_cursor);
+		cursor->ref_count = 1;
+		g_mutex_init(&cursor->lock);
+		cursor->archive_name = g_strdup(archive_file->file_name);
+		cursor->data = g_bytes_ref(data);
+		cursor->has_stamp = has_stamp;
+		if(has_stamp) {
+			cursor->device = current.device;
+			cursor->inode = current.inode;
+			cursor->mtime = current.mtime;
+			cursor->size = current.size;
+		}
+		g_queue_init(&cursor->read_ahead);
+	}
+	cursor->used = TRUE;
+	g_queue_push_head(&archive_cursors, cursor);
+
+	gsize total_bytes = 0;
+	for(GList *iter = archive_cursors.head; iter; iter = iter->next) {
+		total_bytes += g_bytes_get_size(((struct file_type_archive_cursor *)iter->data)->data);
+	}
+	while(archive_cursors.length > ARCHIVE_CURSOR_MAX_COUNT || (archive_cursors.length > 1 && total_bytes > ARCHIVE_CURSOR_MAX_BYTES)) {
+		struct file_type_archive_cursor *evicted = g_queue_pop_tail(&archive_cursors);
+		total_bytes -= g_bytes_get_size(evicted->data);
+		file_type_archive_common_cursor_unref(evicted);
+	}
+	cursor->ref_count++;
+	G_UNLOCK(archive_cursors);
+	return cursor;
+}/*}}}*/
+
+static void file_type_archive_common_gc() {/*{{{*/
+	// Close the cursors that have not been used since the last pass, such that
+	// archives are not kept in memory once the user moved on. Used as the
+	// backends' gc_fn.
+	G_LOCK(archive_cursors);
+	for(GList *iter = archive_cursors.head; iter; ) {
+		GList *next = iter->next;
+		struct file_type_archive_cursor *cursor = iter->data;
+		if(cursor->used) {
+			cursor->used = FALSE;
+		}
+		else {
+			g_queue_delete_link(&archive_cursors, iter);
+			file_type_archive_common_cursor_unref(cursor);
+		}
+		iter = next;
+	}
+	G_UNLOCK(archive_cursors);
+}/*}}}*/
+
+static void *file_type_archive_common_cursor_read_entry(struct file_type_archive_cursor *cursor, const gchar *entry_name, int entry_index, size_t *entry_size, GError **error_pointer) {/*{{{*/
+	// Must be called with cursor->lock held
+	for(GList *iter = cursor->read_ahead.head; iter; iter = iter->next) {
+		struct file_type_archive_read_ahead_entry *read_ahead_entry = iter->data;
+		if(read_ahead_entry->entry_index == entry_index) {
+			void *entry_data = read_ahead_entry->data;
+			*entry_size = read_ahead_entry->size;
+			g_slice_free(struct file_type_archive_read_ahead_entry, read_ahead_entry);
+			g_queue_delete_link(&cursor->read_ahead, iter);
+			return entry_data;
+		}
+	}
+
+	// Going backwards requires starting over. So does not finding the name
+	// after the cursor's position, in which case the second pass searches
+	// the whole archive.
+	int first_searched_entry_index = 0;
+	for(int pass=0; pass<2; pass++) {
+		if(pass == 1 && first_searched_entry_index == 0) {
+			break;
+		}
+		if(!cursor->archive || entry_index < cursor->next_entry_index || pass == 1) {
+			if(cursor->archive) {
+				archive_read_free(cursor->archive);
+			}
+			cursor->archive = file_type_archive_common_gen_archive(cursor->data);
+			cursor->next_entry_index = 0;
+			if(!cursor->archive) {
+				return NULL;
+			}
+		}
+		first_searched_entry_index = cursor->next_entry_index;
+
+		struct archive_entry *entry;
+		while(archive_read_next_header(cursor->archive, &entry) == ARCHIVE_OK) {
+			int current_entry_index = cursor->next_entry_index++;
+			size_t current_entry_size = archive_entry_size(entry);
+			gboolean is_target = strcmp(entry_name, archive_entry_pathname(entry)) == 0;
+
+			if(!is_target && (current_entry_index > entry_index || current_entry_index + ARCHIVE_CURSOR_READ_AHEAD < entry_index || current_entry_size == 0)) {
+				archive_read_data_skip(cursor->archive);
+				continue;
+			}
+
+			void *entry_data = g_malloc(current_entry_size ? current_entry_size : 1);
+			if(current_entry_size && archive_read_data(cursor->archive, entry_data, current_entry_size) != (ssize_t)current_entry_size) {
+				g_free(entry_data);
+				archive_read_free(cursor->archive);
+				cursor->archive = NULL;
+				if(is_target) {
+					*error_pointer = g_error_new(g_quark_from_static_string("pqiv-archive-error"), 1, "The file had an unexpected size");
+				}
+				return NULL;
+			}
+
+			if(is_target) {
+				if(!current_entry_size) {
+					g_free(entry_data);
+					return NULL;
+				}
+				*entry_size = current_entry_size;
+				return entry_data;
+			}
+
+			// Skipped on the way to the target. Keep it for when it is requested.
+			struct file_type_archive_read_ahead_entry *read_ahead_entry = g_slice_new(struct file_type_archive_read_ahead_entry);
+			read_ahead_entry->entry_index = current_entry_index;
+			read_ahead_entry->data = entry_data;
+			read_ahead_entry->size = current_entry_size;
+			g_queue_push_tail(&cursor->read_ahead, read_ahead_entry);
+			while(cursor->read_ahead.length > ARCHIVE_CURSOR_READ_AHEAD) {
+				read_ahead_entry = g_queue_pop_head(&cursor->read_ahead);
+				g_free(read_ahead_entry->data);
+				g_slice_free(struct file_type_archive_read_ahead_entry, read_ahead_entry);
+			}
+		}
+
+		// Reached the end of the archive
+		archive_read_free(cursor->archive);
+		cursor->archive = NULL;
+	}
+
+	return NULL;
+}/*}}}*/
+
+static void *file_type_archive_common_read_entry(file_t *archive_file, GBytes *data, const gchar *entry_name, int entry_index, gint64 entry_offset, size_t *entry_size, GError **error_pointer) {/*{{{*/
+	// Read an entry from an archive. Returns NULL with error_pointer unset
+	// if the entry does not exist (anymore).
+	if(entry_offset >= 0) {
+		void *entry_data = file_type_archive_common_read_entry_at(data, entry_name, entry_offset, entry_size);
+		if(entry_data) {
+			return entry_data;
+		}
+	}
+
+	struct file_type_archive_cursor *cursor = file_type_archive_common_cursor_get(archive_file, data);
+	g_mutex_lock(&cursor->lock);
+	void *entry_data = file_type_archive_common_cursor_read_entry(cursor, entry_name, entry_index, entry_size, error_pointer);
+	g_mutex_unlock(&cursor->lock);
+	G_LOCK(archive_cursors);
+	file_type_archive_common_cursor_unref(cursor);
+	G_UNLOCK(archive_cursors);
+	return entry_data;
+}/*}}}*/
+
+#endif
@@ -20,6 +20,7 @@
 
 #include "../pqiv.h"
 #include <math.h>
+#include <string.h>
 
 /* Default (GdkPixbuf) file type implementation {{{ */
 typedef struct {
@@ -35,6 +36,23 @@ typedef struct {
 	GTimeVal animation_time;
 } file_private_data_gdkpixbuf_t;
 
+typedef struct {
+	file_t *file;
+	gint width;
+	gint height;
+} file_type_gdkpixbuf_full_size_t;
+
+typedef struct {
+	file_t *file;
+	// The surfaces published as progressive previews take turns, such that
+	// one can be updated while the other might be displayed. For each, the
+	// range of rows that changed since it was last updated.
+	cairo_surface_t *surfaces[2];
+	int dirty_begin[2];
+	int dirty_end[2];
+	int next;
+} file_type_gdkpixbuf_progress_t;
+
 BOSNode *file_type_gdkpixbuf_alloc(load_images_state_t state, file_t *file) {/*{{{*/
 	file->private = (void *)g_slice_new0(file_private_data_gdkpixbuf_t);
 	return load_images_handle_parameter_add_file(state, file);
@@ -91,8 +109,15 @@ double file_type_gdkpixbuf_animation_next_frame(file_t *file) {/*{{{*/
 	cairo_set_operator(sf_cr, CAIRO_OPERATOR_SOURCE);
 	cairo_paint(sf_cr);
 	cairo_restore(sf_cr);
-	gdk_cairo_set_source_pixbuf(sf_cr, pixbuf, 0, 0);
-	cairo_paint(sf_cr);
+	if(gdk_pixbuf_get_width(pixbuf) != cairo_image_surface_get_width(surface)) {
+		// The image surface has been decoded at a reduced resolution, but the
+		// loader does not scale the animation's frames
+		cairo_scale(sf_cr, cairo_image_surface_get_width(surface) * 1. / gdk_pixbuf_get_width(pixbuf), cairo_image_surface_get_height(surface) * 1. / gdk_pixbuf_get_height(pixbuf));
+	}
+	if(!pixbuf_import_to_surface(pixbuf, surface)) {
+		gdk_cairo_set_source_pixbuf(sf_cr, pixbuf, 0, 0);
+		cairo_paint(sf_cr);
+	}
 	cairo_destroy(sf_cr);
 
 	cairo_surface_destroy(surface);
@@ -103,42 +128,167 @@ gboolean file_type_gdkpixbuf_load_destroy_old_image_callback(gpointer old_surfac
 	cairo_surface_destroy((cairo_surface_t *)old_surface);
 	return FALSE;
 }/*}}}*/
+void file_type_gdkpixbuf_size_prepared_callback(GdkPixbufLoader *loader, gint width, gint height, gpointer user_data) {/*{{{*/
+	// Decode at a reduced resolution if the image is not needed at full size.
+	// We remember the full size for later; the file structure is only updated
+	// once the image is complete, because the main thread might still display
+	// an older decode of it.
+	file_type_gdkpixbuf_full_size_t *full_size = (file_type_gdkpixbuf_full_size_t *)user_data;
+	full_size->width = width;
+	full_size->height = height;
+
+	const double scale_level = image_loader_get_decode_scale_level(full_size->file, width, height);
+	if(scale_level < 1.) {
+		gdk_pixbuf_loader_set_size(loader, MAX(1, (int)ceil(width * scale_level)), MAX(1, (int)ceil(height * scale_level)));
+	}
+}/*}}}*/
+void file_type_gdkpixbuf_area_updated_callback(GdkPixbufLoader *loader, gint x, gint y, gint width, gint height, gpointer user_data) {/*{{{*/
+	// Show what has been decoded so far
+	file_type_gdkpixbuf_progress_t *progress = (file_type_gdkpixbuf_progress_t *)user_data;
+	for(int i=0; i<2; i++) {
+		progress->dirty_begin[i] = MIN(progress->dirty_begin[i], y);
+		progress->dirty_end[i] = MAX(progress->dirty_end[i], y + height);
+	}
+	if(!image_loader_progress_due(progress->file) || gdk_pixbuf_loader_get_pixbuf(loader) == NULL) {
+		return;
+	}
+
+	GdkPixbuf *pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+	const gchar *orientation = gdk_pixbuf_get_option(pixbuf, "orientation");
+	if(orientation != NULL && strcmp(orientation, "1") != 0) {
+		// Rare enough to not bother with updating the rotated copy in place
+		pixbuf = gdk_pixbuf_apply_embedded_orientation(pixbuf);
+		if(pixbuf == NULL) {
+			return;
+		}
+		cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf));
+		if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+			cairo_surface_destroy(surface);
+			g_object_unref(pixbuf);
+			return;
+		}
+		if(!pixbuf_import_to_surface(pixbuf, surface)) {
+			cairo_t *sf_cr = cairo_create(surface);
+			gdk_cairo_set_source_pixbuf(sf_cr, pixbuf, 0, 0);
+			cairo_paint(sf_cr);
+			cairo_destroy(sf_cr);
+		}
+		g_object_unref(pixbuf);
+		image_loader_publish_progress(progress->file, surface);
+		return;
+	}
+
+	// The surface published two updates ago has been replaced since. Unless
+	// the main thread still draws it, only the rows that changed since then
+	// need to be updated.
+	const int i = progress->next;
+	cairo_surface_t *surface = progress->surfaces[i];
+	if(surface != NULL && (cairo_surface_get_reference_count(surface) > 1
+			|| cairo_image_surface_get_width(surface) != gdk_pixbuf_get_width(pixbuf)
+			|| cairo_image_surface_get_height(surface) != gdk_pixbuf_get_height(pixbuf))) {
+		cairo_surface_destroy(surface);
+		surface = progress->surfaces[i] = NULL;
+	}
+	if(surface == NULL) {
+		surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf));
+		if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+			cairo_surface_destroy(surface);
+			return;
+		}
+		progress->surfaces[i] = surface;
+		progress->dirty_begin[i] = 0;
+		progress->dirty_end[i] = gdk_pixbuf_get_height(pixbuf);
+	}
+
+	const int first_row = CLAMP(progress->dirty_begin[i], 0, gdk_pixbuf_get_height(pixbuf));
+	const int end_row = CLAMP(progress->dirty_end[i], first_row, gdk_pixbuf_get_height(pixbuf));
+	if(!pixbuf_import_rows_to_surface(pixbuf, surface, first_row, end_row - first_row)) {
+		cairo_t *sf_cr = cairo_create(surface);
+		cairo_rectangle(sf_cr, 0, first_row, gdk_pixbuf_get_width(pixbuf), end_row - first_row);
+		cairo_clip(sf_cr);
+		cairo_set_operator(sf_cr, CAIRO_OPERATOR_SOURCE);
+		gdk_cairo_set_source_pixbuf(sf_cr, pixbuf, 0, 0);
+		cairo_paint(sf_cr);
+		cairo_destroy(sf_cr);
+	}
+	progress->dirty_begin[i] = G_MAXINT;
+	progress->dirty_end[i] = 0;
+	progress->next = 1 - i;
+	image_loader_publish_progress(progress->file, cairo_surface_reference(surface));
+}/*}}}*/
+GdkPixbufAnimation *file_type_gdkpixbuf_load_incrementally(file_t *file, GInputStream *data, file_type_gdkpixbuf_full_size_t *full_size, GError **error_pointer) {/*{{{*/
+	#define IMAGE_LOADER_BUFFER_SIZE (1024 * 512)
+
+	// If full_size is non-NULL, the image may be decoded at a reduced
+	// resolution, and its full size is stored there
+	GdkPixbufAnimation *pixbuf_animation = NULL;
+	GdkPixbufLoader *loader = gdk_pixbuf_loader_new();
+	if(full_size) {
+		g_signal_connect(loader, "size-prepared", G_CALLBACK(file_type_gdkpixbuf_size_prepared_callback), full_size);
+	}
+	file_type_gdkpixbuf_progress_t progress = { file, { NULL, NULL }, { G_MAXINT, G_MAXINT }, { 0, 0 }, 0 };
+	if(image_loader_progress_wanted(file)) {
+		g_signal_connect(loader, "area-updated", G_CALLBACK(file_type_gdkpixbuf_area_updated_callback), &progress);
+	}
+	guchar *buffer = g_malloc(IMAGE_LOADER_BUFFER_SIZE);
+	while(TRUE) {
+		gssize bytes_read = g_input_stream_read(data, buffer, IMAGE_LOADER_BUFFER_SIZE, image_loader_get_cancellable(), error_pointer);
+		if(bytes_read == 0) {
+			// All OK, finish the image loader
+			gdk_pixbuf_loader_close(loader, error_pointer);
+			pixbuf_animation = gdk_pixbuf_loader_get_animation(loader);
+			if(pixbuf_animation != NULL) {
+				g_object_ref(pixbuf_animation); // see above
+			}
+			break;
+		}
+		if(bytes_read == -1) {
+			// Error. Handle this below.
+			gdk_pixbuf_loader_close(loader, NULL);
+			break;
+		}
+		// In all other cases, write to image loader
+		if(!gdk_pixbuf_loader_write(loader, buffer, bytes_read, error_pointer)) {
+			// In case of an error, abort.
+			break;
+		}
+	}
+	g_free(buffer);
+	g_object_unref(loader);
+	for(int i=0; i<2; i++) {
+		if(progress.surfaces[i] != NULL) {
+			cairo_surface_destroy(progress.surfaces[i]);
+		}
+	}
+
+	return pixbuf_animation;
+}/*}}}*/
 void file_type_gdkpixbuf_load(file_t *file, GInputStream *data, GError **error_pointer) {/*{{{*/
 	file_private_data_gdkpixbuf_t *private = (file_private_data_gdkpixbuf_t *)file->private;
 	GdkPixbufAnimation *pixbuf_animation = NULL;
 
-	#if (GDK_PIXBUF_MAJOR > 2 || (GDK_PIXBUF_MAJOR == 2 && GDK_PIXBUF_MINOR >= 28))
-		pixbuf_animation = gdk_pixbuf_animation_new_from_stream(data, image_loader_cancellable, error_pointer);
-	#else
-		#define IMAGE_LOADER_BUFFER_SIZE (1024 * 512)
-
-		GdkPixbufLoader *loader = gdk_pixbuf_loader_new();
-		guchar *buffer = g_malloc(IMAGE_LOADER_BUFFER_SIZE);
-		while(TRUE) {
-			gssize bytes_read = g_input_stream_read(data, buffer, IMAGE_LOADER_BUFFER_SIZE, image_loader_cancellable, error_pointer);
-			if(bytes_read == 0) {
-				// All OK, finish the image loader
-				gdk_pixbuf_loader_close(loader, error_pointer);
-				pixbuf_animation = gdk_pixbuf_loader_get_animation(loader);
-				if(pixbuf_animation != NULL) {
-					g_object_ref(pixbuf_animation); // see above
-				}
-				break;
-			}
-			if(bytes_read == -1) {
-				// Error. Handle this below.
-				gdk_pixbuf_loader_close(loader, NULL);
-				break;
+	// If the image is not needed at full resolution, have the loader decode it
+	// at the required size right away. JPEG in particular does this
+	// efficiently, by skipping DCT coefficients.
+	const gboolean allow_reduced_resolution = file->load_resolution != LOAD_RESOLUTION_FULL && (file->file_flags & FILE_FLAGS_FULL_RESOLUTION) == 0;
+	file_type_gdkpixbuf_full_size_t full_size = { file, 0, 0 };
+	if(allow_reduced_resolution) {
+		pixbuf_animation = file_type_gdkpixbuf_load_incrementally(file, data, &full_size, error_pointer);
+	}
+	else {
+		#if (GDK_PIXBUF_MAJOR > 2 || (GDK_PIXBUF_MAJOR == 2 && GDK_PIXBUF_MINOR >= 28))
+			// The stream is decoded incrementally anyway if the partial
+			// results are to be shown
+			if(image_loader_progress_wanted(file)) {
+				pixbuf_animation = file_type_gdkpixbuf_load_incrementally(file, data, NULL, error_pointer);
 			}
-			// In all other cases, write to image loader
-			if(!gdk_pixbuf_loader_write(loader, buffer, bytes_read, error_pointer)) {
-				// In case of an error, abort.
-				break;
+			else {
+				pixbuf_animation = gdk_pixbuf_animation_new_from_stream(data, image_loader_get_cancellable(), error_pointer);
 			}
-		}
-		g_free(buffer);
-		g_object_unref(loader);
-	#endif
+		#else
+			pixbuf_animation = file_type_gdkpixbuf_load_incrementally(file, data, NULL, error_pointer);
+		#endif
+	}
 
 	if(pixbuf_animation == NULL) {
 		return;
@@ -159,6 +309,13 @@ void file_type_gdkpixbuf_load(file_t *file, GInputStream *data, GError **error_p
 	g_object_unref(pixbuf_animation);
 
 	if(pixbuf != NULL) {
+		// The full size of the image, if it has been decoded at a reduced
+		// resolution. See file_type_gdkpixbuf_size_prepared_callback().
+		guint full_width = full_size.width;
+		guint full_height = full_size.height;
+		const gboolean is_reduced = allow_reduced_resolution && full_width > 0 && full_height > 0 && (guint)gdk_pixbuf_get_width(pixbuf) != full_width;
+
+		const int unrotated_width = gdk_pixbuf_get_width(pixbuf);
 		GdkPixbuf *new_pixbuf = gdk_pixbuf_apply_embedded_orientation(pixbuf);
 		g_object_unref(pixbuf);
 		pixbuf = new_pixbuf;
@@ -169,8 +326,17 @@ void file_type_gdkpixbuf_load(file_t *file, GInputStream *data, GError **error_p
 			return;
 		}
 
-		file->width = gdk_pixbuf_get_width(pixbuf);
-		file->height = gdk_pixbuf_get_height(pixbuf);
+		if(is_reduced && gdk_pixbuf_get_width(pixbuf) != unrotated_width) {
+			// Rotated by 90 degrees
+			guint swap = full_width;
+			full_width = full_height;
+			full_height = swap;
+		}
+
+		// The file structure keeps the size of the previous decode until the
+		// new surface replaces it below
+		guint width = gdk_pixbuf_get_width(pixbuf);
+		guint height = gdk_pixbuf_get_height(pixbuf);
 
 		// Cairo cannot handle files larger than 32767x32767
 		// See https://lists.freedesktop.org/archives/cairo/2009-August/017881.html
@@ -179,15 +345,15 @@ void file_type_gdkpixbuf_load(file_t *file, GInputStream *data, GError **error_p
 
 		cairo_surface_t *surface = NULL;
 		do {
-			if(file->width > cairo_image_dimensions_limit || file->height > cairo_image_dimensions_limit) {
+			if(width > cairo_image_dimensions_limit || height > cairo_image_dimensions_limit) {
 				double loading_scale_factor = 1.;
-				loading_scale_factor = fmin(cairo_image_dimensions_limit / file->width, cairo_image_dimensions_limit / file->height);
-				file->width *= loading_scale_factor;
-				file->height *= loading_scale_factor;
+				loading_scale_factor = fmin(cairo_image_dimensions_limit / width, cairo_image_dimensions_limit / height);
+				width *= loading_scale_factor;
+				height *= loading_scale_factor;
 				g_printerr("Warning: Resizing file %s down to %dx%d due to Cairo's image size limit / insufficient memory.\n",
-						file->display_name, file->width, file->height);
+						file->display_name, width, height);
 
-				new_pixbuf = gdk_pixbuf_scale_simple(new_pixbuf, file->width, file->height, GDK_INTERP_BILINEAR);
+				new_pixbuf = gdk_pixbuf_scale_simple(new_pixbuf, width, height, GDK_INTERP_BILINEAR);
 				if(!new_pixbuf) {
 					if(cairo_image_dimensions_limit > 10000) {
 						cairo_image_dimensions_limit -= 10000;
@@ -210,12 +376,15 @@ void file_type_gdkpixbuf_load(file_t *file, GInputStream *data, GError **error_p
 				surface = gdk_cairo_surface_create_from_pixbuf(pixbuf, 1., NULL);
 				// TODO Once this works, manually check if surface failed with "out of memory".
 			#else
-				surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, file->width, file->height);
+				surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
 				if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
 					g_object_unref(pixbuf);
 					*error_pointer = g_error_new(g_quark_from_static_string("pqiv-pixbuf-error"), 1, "Failed to create a cairo image surface for the loaded image (cairo status %d)\n", cairo_surface_status(surface));
 					return;
 				}
+				if(pixbuf_import_to_surface(pixbuf, surface)) {
+					break;
+				}
 				cairo_t *sf_cr = cairo_create(surface);
 				gdk_cairo_set_source_pixbuf(sf_cr, pixbuf, 0, 0);
 				cairo_paint(sf_cr);
@@ -238,6 +407,11 @@ void file_type_gdkpixbuf_load(file_t *file, GInputStream *data, GError **error_p
 		}
 		while(TRUE); // Do not ever repeat, only on explicit "continue", see break just above.
 
+		// Report the full size; draw_fn scales the surface up accordingly
+		file->decoded_scale_level = is_reduced ? (double)width / full_width : 1.;
+		file->width = is_reduced ? full_width : width;
+		file->height = is_reduced ? full_height : height;
+
 		cairo_surface_t *old_surface = private->image_surface;
 		private->image_surface = surface;
 		if(old_surface != NULL) {
@@ -252,6 +426,12 @@ void file_type_gdkpixbuf_draw(file_t *file, cairo_t *cr) {/*{{{*/
 	file_private_data_gdkpixbuf_t *private = (file_private_data_gdkpixbuf_t *)file->private;
 
 	cairo_surface_t *current_image_surface = private->image_surface;
+	const int surface_width = cairo_image_surface_get_width(current_image_surface);
+	const int surface_height = cairo_image_surface_get_height(current_image_surface);
+	if((guint)surface_width != file->width || (guint)surface_height != file->height) {
+		// Decoded at a reduced resolution
+		cairo_scale(cr, (double)file->width / surface_width, (double)file->height / surface_height);
+	}
 	cairo_set_source_surface(cr, current_image_surface, 0, 0);
 	apply_interpolation_quality(cr);
 	cairo_paint(cr);
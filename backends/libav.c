@@ -57,6 +57,14 @@ static const char * const ignore_extensions[] = {
 	"w64", "wav", "xa", "xwma", NULL
 };
 
+// Number of frames the decoder thread converts ahead of the one on display
+#define LIBAV_FRAME_RING_SIZE 4
+
+typedef struct {
+	cairo_surface_t *surface;
+	double duration;
+} libav_decoded_frame_t;
+
 typedef struct {
 	GBytes *file_data;
 	gsize file_data_pos;
@@ -66,12 +74,29 @@ typedef struct {
 	AVCodecContext *cocontext;
 	int video_stream_id;
 
-	gboolean pkt_valid;
-	AVPacket pkt;
-
+	// Owned by the decoder thread while it runs
 	AVFrame *frame;
-	AVFrame *rgb_frame;
-	uint8_t *buffer;
+	struct SwsContext *sws_context;
+
+	// Decoded frames, converted to ARGB32, are handed over from the decoder
+	// thread through a ring buffer protected by ring_lock
+	GThread *decoder_thread;
+	GMutex ring_lock;
+	GCond ring_cond;
+	libav_decoded_frame_t ring[LIBAV_FRAME_RING_SIZE];
+	unsigned ring_start;
+	unsigned ring_count;
+	gboolean decoder_stop;
+	gboolean decoder_finished;
+	// Set if the animation waits for the next frame, see
+	// image_animation_frame_ready()
+	gboolean frame_wanted;
+	// The last frame shown, for the decoder thread to convert another one into
+	cairo_surface_t *spare_surface;
+
+	// The frame on display
+	cairo_surface_t *current_surface;
+	double current_duration;
 
 	guint pixel_width;
 	guint pixel_height;
@@ -132,16 +157,215 @@ static int64_t file_type_libav_memory_access_seeker(void *opaque, int64_t offset
 	return -1;
 }/*}}}*/
 
+static double file_type_libav_frame_duration(file_private_data_libav_t *private, AVPacket *pkt) {/*{{{*/
+	if(private->avcontext->streams[private->video_stream_id]->avg_frame_rate.den != 0 && private->avcontext->streams[private->video_stream_id]->avg_frame_rate.num != 0) {
+		// Stream has reliable average framerate
+		return 1000. * private->avcontext->streams[private->video_stream_id]->avg_frame_rate.den / private->avcontext->streams[private->video_stream_id]->avg_frame_rate.num;
+	}
+	else if(private->avcontext->streams[private->video_stream_id]->time_base.den != 0 && private->avcontext->streams[private->video_stream_id]->time_base.num != 0) {
+		// Stream has usable time base
+		return pkt->duration * private->avcontext->streams[private->video_stream_id]->time_base.num * 1000. / private->avcontext->streams[private->video_stream_id]->time_base.den;
+	}
+
+	// TODO What could be done here as a last fallback?! -> Figure this out from ffmpeg!
+	return 10;
+}/*}}}*/
+static gboolean file_type_libav_push_frame(file_t *file, double duration) {/*{{{*/
+	// Convert the decoded frame to ARGB32 and append it to the ring, waiting for
+	// a free slot. Returns FALSE if the decoder thread should stop.
+	file_private_data_libav_t *private = (file_private_data_libav_t *)file->private;
+	AVFrame *frame = private->frame;
+
+	if(!frame->data[0]) {
+		return TRUE;
+	}
+
+	// Reuse the surface of a frame that is no longer on display if the size
+	// did not change
+	g_mutex_lock(&private->ring_lock);
+	cairo_surface_t *surface = private->spare_surface;
+	private->spare_surface = NULL;
+	g_mutex_unlock(&private->ring_lock);
+	if(surface && (cairo_image_surface_get_width(surface) != (int)file->width || cairo_image_surface_get_height(surface) != (int)file->height)) {
+		cairo_surface_destroy(surface);
+		surface = NULL;
+	}
+	if(!surface) {
+		surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, file->width, file->height);
+	}
+	if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		return FALSE;
+	}
+
+	// The scaler is only rebuilt if the stream changes its format midway
+	private->sws_context = sws_getCachedContext(private->sws_context, private->pixel_width, private->pixel_height, private->cocontext->pix_fmt, file->width,
+			file->height, AV_PIX_FMT_RGB32, SWS_BICUBIC, NULL, NULL, NULL);
+	if(!private->sws_context) {
+		cairo_surface_destroy(surface);
+		return FALSE;
+	}
+	uint8_t *surface_data[4] = { cairo_image_surface_get_data(surface), NULL, NULL, NULL };
+	int surface_linesize[4] = { cairo_image_surface_get_stride(surface), 0, 0, 0 };
+	cairo_surface_flush(surface);
+	sws_scale(private->sws_context, (const uint8_t * const*)frame->data, frame->linesize, 0, private->pixel_height, surface_data, surface_linesize);
+	cairo_surface_mark_dirty(surface);
+
+	g_mutex_lock(&private->ring_lock);
+	while(private->ring_count == LIBAV_FRAME_RING_SIZE && !private->decoder_stop) {
+		g_cond_wait(&private->ring_cond, &private->ring_lock);
+	}
+	if(private->decoder_stop) {
+		g_mutex_unlock(&private->ring_lock);
+		cairo_surface_destroy(surface);
+		return FALSE;
+	}
+	libav_decoded_frame_t *slot = &private->ring[(private->ring_start + private->ring_count) % LIBAV_FRAME_RING_SIZE];
+	slot->surface = surface;
+	slot->duration = duration;
+	private->ring_count++;
+	g_cond_broadcast(&private->ring_cond);
+	const gboolean frame_wanted = private->frame_wanted;
+	private->frame_wanted = FALSE;
+	g_mutex_unlock(&private->ring_lock);
+
+	if(frame_wanted) {
+		image_animation_frame_ready();
+	}
+
+	return TRUE;
+}/*}}}*/
+static gpointer file_type_libav_decoder_thread(gpointer user_data) {/*{{{*/
+	// Decode the video stream in a loop until unload_fn stops the thread
+	file_t *file = user_data;
+	file_private_data_libav_t *private = (file_private_data_libav_t *)file->private;
+
+	AVPacket pkt;
+	double duration = 10;
+	guint frames_since_rewind = 0;
+	for(;;) {
+		memset(&pkt, 0, sizeof(AVPacket));
+		if(av_read_frame(private->avcontext, &pkt) < 0) {
+			av_packet_unref(&pkt);
+#ifdef AV_COMPAT_CODEC_DEPRECATED
+			// Collect the frames still buffered in the decoder
+			if(avcodec_send_packet(private->cocontext, NULL) >= 0) {
+				while(avcodec_receive_frame(private->cocontext, private->frame) >= 0) {
+					frames_since_rewind++;
+					if(!file_type_libav_push_frame(file, duration)) {
+						goto stop;
+					}
+				}
+			}
+#endif
+			avcodec_flush_buffers(private->cocontext);
+
+			// Start over. If there was no frame in the whole stream, or
+			// seeking fails, end the stream here; the last frame remains on
+			// display.
+			if(frames_since_rewind == 0 || avformat_seek_file(private->avcontext, -1, 0, 0, 1, 0) < 0) {
+				break;
+			}
+			frames_since_rewind = 0;
+			continue;
+		}
+		if(pkt.stream_index != private->video_stream_id) {
+			av_packet_unref(&pkt);
+			continue;
+		}
+
+		duration = file_type_libav_frame_duration(private, &pkt);
+#ifndef AV_COMPAT_CODEC_DEPRECATED
+		int got_picture_ptr = 0;
+		avcodec_decode_video2(private->cocontext, private->frame, &got_picture_ptr, &pkt);
+		av_packet_unref(&pkt);
+		if(got_picture_ptr) {
+			frames_since_rewind++;
+			if(!file_type_libav_push_frame(file, duration)) {
+				break;
+			}
+		}
+#else
+		int status = avcodec_send_packet(private->cocontext, &pkt);
+		av_packet_unref(&pkt);
+		if(status >= 0) {
+			// With frame threading, the decoder returns frames with a delay,
+			// and possibly several at once
+			while(avcodec_receive_frame(private->cocontext, private->frame) >= 0) {
+				frames_since_rewind++;
+				if(!file_type_libav_push_frame(file, duration)) {
+					goto stop;
+				}
+			}
+		}
+#endif
+	}
+
+#ifdef AV_COMPAT_CODEC_DEPRECATED
+stop:
+#endif
+	g_mutex_lock(&private->ring_lock);
+	private->decoder_finished = TRUE;
+	g_cond_broadcast(&private->ring_cond);
+	const gboolean frame_wanted = private->frame_wanted;
+	private->frame_wanted = FALSE;
+	g_mutex_unlock(&private->ring_lock);
+
+	// Have the animation find out that the stream has ended
+	if(frame_wanted) {
+		image_animation_frame_ready();
+	}
+
+	return NULL;
+}/*}}}*/
 BOSNode *file_type_libav_alloc(load_images_state_t state, file_t *file) {/*{{{*/
-	file->private = g_slice_new0(file_private_data_libav_t);
+	file_private_data_libav_t *private = g_slice_new0(file_private_data_libav_t);
+	g_mutex_init(&private->ring_lock);
+	g_cond_init(&private->ring_cond);
+	file->private = private;
 	return load_images_handle_parameter_add_file(state, file);
 }/*}}}*/
 void file_type_libav_free(file_t *file) {/*{{{*/
-	g_slice_free(file_private_data_libav_t, file->private);
+	file_private_data_libav_t *private = (file_private_data_libav_t *)file->private;
+	g_mutex_clear(&private->ring_lock);
+	g_cond_clear(&private->ring_cond);
+	g_slice_free(file_private_data_libav_t, private);
 }/*}}}*/
 void file_type_libav_unload(file_t *file) {/*{{{*/
 	file_private_data_libav_t *private = (file_private_data_libav_t *)file->private;
 
+	if(private->decoder_thread) {
+		g_mutex_lock(&private->ring_lock);
+		private->decoder_stop = TRUE;
+		g_cond_broadcast(&private->ring_cond);
+		g_mutex_unlock(&private->ring_lock);
+		g_thread_join(private->decoder_thread);
+		private->decoder_thread = NULL;
+	}
+
+	for(; private->ring_count > 0; private->ring_count--) {
+		cairo_surface_destroy(private->ring[private->ring_start].surface);
+		private->ring_start = (private->ring_start + 1) % LIBAV_FRAME_RING_SIZE;
+	}
+	private->ring_start = 0;
+	private->decoder_stop = FALSE;
+	private->decoder_finished = FALSE;
+	private->frame_wanted = FALSE;
+	if(private->spare_surface) {
+		cairo_surface_destroy(private->spare_surface);
+		private->spare_surface = NULL;
+	}
+
+	if(private->current_surface) {
+		cairo_surface_destroy(private->current_surface);
+		private->current_surface = NULL;
+	}
+
+	if(private->sws_context) {
+		sws_freeContext(private->sws_context);
+		private->sws_context = NULL;
+	}
+
 	if(private->file_data) {
 		g_bytes_unref(private->file_data);
 		buffered_file_unref(file);
@@ -149,19 +373,10 @@ void file_type_libav_unload(file_t *file) {/*{{{*/
 		private->file_data_pos = 0;
 	}
 
-	if(private->pkt_valid) {
-		av_packet_unref(&(private->pkt));
-		private->pkt_valid = FALSE;
-	}
-
 	if(private->frame) {
 		av_frame_free(&(private->frame));
 	}
 
-	if(private->rgb_frame) {
-		av_frame_free(&(private->rgb_frame));
-	}
-
 	if(private->avcontext) {
 		avcodec_close(private->cocontext);
 		#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(55,53,0)
@@ -177,12 +392,8 @@ void file_type_libav_unload(file_t *file) {/*{{{*/
 		av_freep(&private->aviocontext);
 		private->aviocontext = NULL;
 	}
-
-	if(private->buffer) {
-		g_free(private->buffer);
-		private->buffer = NULL;
-	}
 }/*}}}*/
+double file_type_libav_animation_next_frame(file_t *file);
 void file_type_libav_load(file_t *file, GInputStream *data, GError **error_pointer) {/*{{{*/
 	file_private_data_libav_t *private = (file_private_data_libav_t *)file->private;
 
@@ -254,6 +465,12 @@ void file_type_libav_load(file_t *file, GInputStream *data, GError **error_point
 	avcodec_copy_context(private->cocontext, private->avcontext->streams[private->video_stream_id]->codec);
 #else
 	avcodec_parameters_to_context(private->cocontext, private->avcontext->streams[private->video_stream_id]->codecpar);
+#endif
+	// Let libavcodec decode on all cores, using frame threading for codecs
+	// that support it and slice threading otherwise
+	private->cocontext->thread_count = 0;
+#ifdef FF_THREAD_FRAME
+	private->cocontext->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
 #endif
 	if(!codec || avcodec_open2(private->cocontext, codec, NULL) < 0) {
 		*error_pointer = g_error_new(g_quark_from_static_string("pqiv-libav-error"), 1, "Failed to open codec.");
@@ -262,7 +479,6 @@ void file_type_libav_load(file_t *file, GInputStream *data, GError **error_point
 	}
 
 	private->frame = av_frame_alloc();
-	private->rgb_frame = av_frame_alloc();
 
 	file->file_flags |= FILE_FLAGS_ANIMATION;
 #ifdef AV_COMPAT_CODEC_DEPRECATED
@@ -288,111 +504,79 @@ void file_type_libav_load(file_t *file, GInputStream *data, GError **error_point
 		file->height = private->sample_aspect_ratio.den * private->pixel_height / private->sample_aspect_ratio.num;
 	}
 
-#if LIBAVUTIL_VERSION_INT < AV_VERSION_INT(55, 0, 0)
-	size_t num_bytes = avpicture_get_size(PIX_FMT_RGB32, file->width, file->height);
-#else
-	size_t num_bytes = av_image_get_buffer_size(AV_PIX_FMT_RGB32, file->width, file->height, 16);
-#endif
-	private->buffer = (uint8_t *)g_malloc(num_bytes * sizeof(uint8_t));
-
 	if(file->width == 0 || file->height == 0) {
 		file_type_libav_unload(file);
 		file->is_loaded = FALSE;
 		return;
 	}
+
+	// Decode in a separate thread, and wait for the first frame such that
+	// the file can be drawn right away
+	private->decoder_thread = g_thread_new("libav-decoder", file_type_libav_decoder_thread, file);
+	g_mutex_lock(&private->ring_lock);
+	while(private->ring_count == 0 && !private->decoder_finished) {
+		g_cond_wait(&private->ring_cond, &private->ring_lock);
+	}
+	g_mutex_unlock(&private->ring_lock);
+	file_type_libav_animation_next_frame(file);
+
 	file->is_loaded = TRUE;
 }/*}}}*/
 double file_type_libav_animation_next_frame(file_t *file) {/*{{{*/
+	// Show the next frame from the decoder thread. This does not block, such
+	// that a decoder which falls behind does not stall the user interface;
+	// the decoder thread signals the frame once it is there instead.
 	file_private_data_libav_t *private = (file_private_data_libav_t *)file->private;
 
-	if(!private->avcontext) {
+	if(!private->decoder_thread) {
 		return -1;
 	}
 
-	AVPacket old_pkt = private->pkt;
-
-	do {
-		// Loop until the next video frame is found
-		memset(&(private->pkt), 0, sizeof(AVPacket));
-		if(av_read_frame(private->avcontext, &(private->pkt)) < 0) {
-			av_packet_unref(&(private->pkt));
-			if(avformat_seek_file(private->avcontext, -1, 0, 0, 1, 0) < 0 || av_read_frame(private->avcontext, &(private->pkt)) < 0) {
-				// Reading failed; end stream here to be on the safe side
-				// Display last frame to the user
-				private->pkt = old_pkt;
-				return -1;
-			}
-		}
-	} while(private->pkt.stream_index != private->video_stream_id);
-
-	if(private->pkt_valid) {
-		av_packet_unref(&old_pkt);
-	}
-	else {
-		private->pkt_valid = TRUE;
+	g_mutex_lock(&private->ring_lock);
+	if(private->ring_count == 0) {
+		// Keep the current frame. If the stream has ended, so does the animation.
+		const gboolean finished = private->decoder_finished;
+		private->frame_wanted = !finished;
+		g_mutex_unlock(&private->ring_lock);
+		return finished ? -1 : FILE_TYPE_ANIMATION_FRAME_PENDING;
 	}
-
-	AVFrame *frame = private->frame;
-#ifndef AV_COMPAT_CODEC_DEPRECATED
-	int got_picture_ptr = 0;
-	avcodec_decode_video2(private->cocontext, frame, &got_picture_ptr, &(private->pkt));
-#else
-	if(avcodec_send_packet(private->cocontext, &(private->pkt)) >= 0) {
-		avcodec_receive_frame(private->cocontext, frame);
+	libav_decoded_frame_t next_frame = private->ring[private->ring_start];
+	private->ring_start = (private->ring_start + 1) % LIBAV_FRAME_RING_SIZE;
+	private->ring_count--;
+
+	// The frame on display so far can take the next one, unless someone else
+	// still holds a reference to it
+	cairo_surface_t *old_surface = private->current_surface;
+	if(old_surface && cairo_surface_get_reference_count(old_surface) == 1 && !private->spare_surface) {
+		private->spare_surface = old_surface;
+		old_surface = NULL;
 	}
-#endif
+	g_cond_broadcast(&private->ring_cond);
+	g_mutex_unlock(&private->ring_lock);
 
-	if(private->avcontext->streams[private->video_stream_id]->avg_frame_rate.den != 0 && private->avcontext->streams[private->video_stream_id]->avg_frame_rate.num != 0) {
-		// Stream has reliable average framerate
-		return 1000. * private->avcontext->streams[private->video_stream_id]->avg_frame_rate.den / private->avcontext->streams[private->video_stream_id]->avg_frame_rate.num;
-	}
-	else if(private->avcontext->streams[private->video_stream_id]->time_base.den != 0 && private->avcontext->streams[private->video_stream_id]->time_base.num != 0) {
-		// Stream has usable time base
-		return private->pkt.duration * private->avcontext->streams[private->video_stream_id]->time_base.num * 1000. / private->avcontext->streams[private->video_stream_id]->time_base.den;
+	if(old_surface) {
+		cairo_surface_destroy(old_surface);
 	}
+	private->current_surface = next_frame.surface;
+	private->current_duration = next_frame.duration;
 
-	// TODO What could be done here as a last fallback?! -> Figure this out from ffmpeg!
-	return 10;
+	return next_frame.duration;
 }/*}}}*/
 double file_type_libav_animation_initialize(file_t *file) {/*{{{*/
-	return file_type_libav_animation_next_frame(file);
+	// load_fn already put the first frame on display
+	file_private_data_libav_t *private = (file_private_data_libav_t *)file->private;
+	if(!private->current_surface) {
+		return file_type_libav_animation_next_frame(file);
+	}
+	return private->current_duration;
 }/*}}}*/
 void file_type_libav_draw(file_t *file, cairo_t *cr) {/*{{{*/
 	file_private_data_libav_t *private = (file_private_data_libav_t *)file->private;
 
-	if(private->pkt_valid) {
-		AVFrame *frame = private->frame;
-		AVFrame *rgb_frame = private->rgb_frame;
-
-#ifdef AV_COMPAT_CODEC_DEPRECATED
-		const int pix_fmt = private->avcontext->streams[private->video_stream_id]->codecpar->format;
-#else
-		const int pix_fmt = private->avcontext->streams[private->video_stream_id]->codec->pix_fmt;
-#endif
-
-		// Prepare buffer for RGB32 version
-		uint8_t *buffer = private->buffer;
-#if LIBAVUTIL_VERSION_INT < AV_VERSION_INT(55, 0, 0)
-		avpicture_fill((AVPicture *)rgb_frame, buffer, PIX_FMT_RGB32, file->width, file->height);
-#else
-		av_image_fill_arrays(rgb_frame->data, rgb_frame->linesize, buffer, AV_PIX_FMT_RGB32, file->width, file->height, 16);
-#endif
-
-		// If a valid frame is available..
-		if(frame->data[0]) {
-			// ..convert to RGB32
-			struct SwsContext *img_convert_ctx = sws_getCachedContext(NULL, private->pixel_width, private->pixel_height, pix_fmt, file->width,
-					file->height, AV_PIX_FMT_RGB32, SWS_BICUBIC, NULL, NULL, NULL);
-			sws_scale(img_convert_ctx, (const uint8_t * const*)frame->data, frame->linesize, 0, private->pixel_height, rgb_frame->data, rgb_frame->linesize);
-			sws_freeContext(img_convert_ctx);
-		}
-
-		// Draw to a temporary image surface and then to cr
-		cairo_surface_t *image_surface = cairo_image_surface_create_for_data(rgb_frame->data[0], CAIRO_FORMAT_ARGB32, file->width, file->height, rgb_frame->linesize[0]);
-		cairo_set_source_surface(cr, image_surface, 0, 0);
+	if(private->current_surface) {
+		cairo_set_source_surface(cr, private->current_surface, 0, 0);
 		apply_interpolation_quality(cr);
 		cairo_paint(cr);
-		cairo_surface_destroy(image_surface);
 	}
 }/*}}}*/
 static gboolean _is_ignored_extension(const char *extension) {/*{{{*/
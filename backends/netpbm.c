@@ -0,0 +1,290 @@
+/**
+ * pqiv
+ *
+ * Copyright (c) 2013-2017, Phillip Berndt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * netpbm backend
+ *
+ * Uncompressed images with 8 bits per sample: PAM with TUPLTYPE RGB_ALPHA,
+ * RGB, GRAYSCALE or CAIRO_ARGB32, and binary PPM and PGM. CAIRO_ARGB32 is
+ * pqiv's own: its samples are cairo's native endian, premultiplied ARGB32
+ * pixels, four bytes each. If they start at a multiple of four bytes, the
+ * image surface uses them in place instead of converting them. This is the
+ * format external image filters are handed, see lib/netpbm.h.
+ *
+ */
+
+#include "../pqiv.h"
+#include "../lib/filebuffer.h"
+#include "../lib/pixelkernels.h"
+#include <stdint.h>
+#include <string.h>
+
+// Cairo does not support larger image surfaces
+#define NETPBM_MAX_SIZE 32767
+
+typedef struct {
+	int width;
+	int height;
+	int channels;
+	// TUPLTYPE CAIRO_ARGB32
+	gboolean native;
+	gsize data_offset;
+} netpbm_header_t;
+
+typedef struct {
+	cairo_surface_t *surface;
+} file_private_data_netpbm_t;
+
+// The bytes a surface uses in place, see file_type_netpbm_load()
+static cairo_user_data_key_t netpbm_bytes_key;
+
+/* Header parsing {{{ */
+static gboolean netpbm_read_token(const guint8 *data, gsize size, gsize *position, gchar *token, gsize token_size) {/*{{{*/
+	// Read the next whitespace separated token, skipping comments. position is
+	// left at the character following the token.
+	while(*position < size) {
+		if(data[*position] == '#') {
+			while(*position < size && data[*position] != '\n') {
+				(*position)++;
+			}
+		}
+		else if(g_ascii_isspace(data[*position])) {
+			(*position)++;
+		}
+		else {
+			break;
+		}
+	}
+	gsize length = 0;
+	while(*position < size && !g_ascii_isspace(data[*position]) && data[*position] != '#') {
+		if(length + 1 >= token_size) {
+			return FALSE;
+		}
+		token[length++] = data[(*position)++];
+	}
+	token[length] = 0;
+	return length > 0;
+}/*}}}*/
+static gboolean netpbm_parse_number(const gchar *token, int *value) {/*{{{*/
+	gchar *end;
+	const gint64 number = g_ascii_strtoll(token, &end, 10);
+	if(*end || number <= 0 || number > NETPBM_MAX_SIZE) {
+		return FALSE;
+	}
+	*value = (int)number;
+	return TRUE;
+}/*}}}*/
+static gboolean netpbm_parse_header(const guint8 *data, gsize size, netpbm_header_t *header) {/*{{{*/
+	if(size < 3 || data[0] != 'P' || (data[1] != '5' && data[1] != '6' && data[1] != '7')) {
+		return FALSE;
+	}
+	gsize position = 2;
+	gchar token[32];
+	int maxval = 0;
+	header->width = header->height = header->channels = 0;
+	header->native = FALSE;
+
+	if(data[1] == '7') {
+		// PAM: Pairs of a keyword and a value, up to ENDHDR
+		gboolean have_tupltype = FALSE;
+		int depth = 0;
+		while(TRUE) {
+			if(!netpbm_read_token(data, size, &position, token, sizeof(token))) {
+				return FALSE;
+			}
+			if(strcmp(token, "ENDHDR") == 0) {
+				break;
+			}
+			gchar value[32];
+			if(!netpbm_read_token(data, size, &position, value, sizeof(value))) {
+				return FALSE;
+			}
+			if(strcmp(token, "WIDTH") == 0) {
+				if(!netpbm_parse_number(value, &header->width)) {
+					return FALSE;
+				}
+			}
+			else if(strcmp(token, "HEIGHT") == 0) {
+				if(!netpbm_parse_number(value, &header->height)) {
+					return FALSE;
+				}
+			}
+			else if(strcmp(token, "DEPTH") == 0) {
+				if(!netpbm_parse_number(value, &depth)) {
+					return FALSE;
+				}
+			}
+			else if(strcmp(token, "MAXVAL") == 0) {
+				if(!netpbm_parse_number(value, &maxval)) {
+					return FALSE;
+				}
+			}
+			else if(strcmp(token, "TUPLTYPE") == 0 && !have_tupltype) {
+				// Only the first word of the first TUPLTYPE is looked at
+				have_tupltype = TRUE;
+				if(strcmp(value, "RGB_ALPHA") == 0) {
+					header->channels = 4;
+				}
+				else if(strcmp(value, "RGB") == 0) {
+					header->channels = 3;
+				}
+				else if(strcmp(value, "GRAYSCALE") == 0) {
+					header->channels = 1;
+				}
+				else if(strcmp(value, "CAIRO_ARGB32") == 0) {
+					header->channels = 4;
+					header->native = TRUE;
+				}
+				else {
+					return FALSE;
+				}
+			}
+		}
+		if(!have_tupltype) {
+			// Guess from the depth, like netpbm does
+			header->channels = depth == 4 || depth == 3 || depth == 1 ? depth : 0;
+		}
+		if(depth != header->channels) {
+			return FALSE;
+		}
+	}
+	else {
+		// PGM (P5) or PPM (P6): Width, height and maxval
+		if(!netpbm_read_token(data, size, &position, token, sizeof(token)) || !netpbm_parse_number(token, &header->width)) {
+			return FALSE;
+		}
+		if(!netpbm_read_token(data, size, &position, token, sizeof(token)) || !netpbm_parse_number(token, &header->height)) {
+			return FALSE;
+		}
+		if(!netpbm_read_token(data, size, &position, token, sizeof(token)) || !netpbm_parse_number(token, &maxval)) {
+			return FALSE;
+		}
+		header->channels = data[1] == '6' ? 3 : 1;
+	}
+
+	// The samples follow after exactly one whitespace character
+	if(header->width == 0 || header->height == 0 || maxval != 255 || position >= size || !g_ascii_isspace(data[position])) {
+		return FALSE;
+	}
+	header->data_offset = position + 1;
+	return (guint64)header->width * header->height * header->channels <= size - header->data_offset;
+}/*}}}*/
+/* }}} */
+/* File type {{{ */
+static BOSNode *file_type_netpbm_alloc(load_images_state_t state, file_t *file) {/*{{{*/
+	file->private = g_slice_new0(file_private_data_netpbm_t);
+	return load_images_handle_parameter_add_file(state, file);
+}/*}}}*/
+static void file_type_netpbm_free(file_t *file) {/*{{{*/
+	g_slice_free(file_private_data_netpbm_t, file->private);
+}/*}}}*/
+static void file_type_netpbm_unload(file_t *file) {/*{{{*/
+	file_private_data_netpbm_t *private = file->private;
+	if(private->surface) {
+		cairo_surface_destroy(private->surface);
+		private->surface = NULL;
+	}
+}/*}}}*/
+static void file_type_netpbm_load(file_t *file, GInputStream *data, GError **error_pointer) {/*{{{*/
+	file_private_data_netpbm_t *private = file->private;
+	file_type_netpbm_unload(file);
+
+	GBytes *image_bytes = buffered_file_as_bytes(file, data, error_pointer);
+	if(!image_bytes) {
+		return;
+	}
+	gsize image_size;
+	const guint8 *image_data = g_bytes_get_data(image_bytes, &image_size);
+	netpbm_header_t header;
+	if(!image_data || !netpbm_parse_header(image_data, image_size, &header)) {
+		buffered_file_unref(file);
+		*error_pointer = g_error_new(g_quark_from_static_string("pqiv-netpbm-error"), 1, "Failed to load image %s: Not a supported PAM, PPM or PGM image", file->display_name);
+		return;
+	}
+
+	guint8 *pixels = (guint8 *)image_data + header.data_offset;
+	const int stride = header.width * header.channels;
+	cairo_surface_t *surface;
+	if(header.native && GPOINTER_TO_SIZE(pixels) % 4 == 0 && cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, header.width) == stride) {
+		// Use the samples in place, keeping the bytes alive as long as the surface
+		surface = cairo_image_surface_create_for_data(pixels, CAIRO_FORMAT_ARGB32, header.width, header.height, stride);
+		if(cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS) {
+			cairo_surface_set_user_data(surface, &netpbm_bytes_key, g_bytes_ref(image_bytes), (cairo_destroy_func_t)g_bytes_unref);
+		}
+	}
+	else {
+		surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, header.width, header.height);
+		if(cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS) {
+			if(header.native || header.channels == 1) {
+				guint8 *surface_data = cairo_image_surface_get_data(surface);
+				const int surface_stride = cairo_image_surface_get_stride(surface);
+				cairo_surface_flush(surface);
+				for(int y = 0; y < header.height; y++) {
+					uint32_t *row = (uint32_t *)(surface_data + (gsize)y * surface_stride);
+					const guint8 *source_row = pixels + (gsize)y * stride;
+					if(header.native) {
+						memcpy(row, source_row, stride);
+					}
+					else {
+						for(int x = 0; x < header.width; x++) {
+							row[x] = 0xff000000 | ((uint32_t)source_row[x] * 0x010101);
+						}
+					}
+				}
+				cairo_surface_mark_dirty(surface);
+			}
+			else {
+				pixel_kernels_import_to_surface(surface, pixels, stride, header.channels);
+			}
+		}
+	}
+	buffered_file_unref(file);
+
+	if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		*error_pointer = g_error_new(g_quark_from_static_string("pqiv-netpbm-error"), 1, "Failed to load image %s: Failed to allocate an image surface", file->display_name);
+		return;
+	}
+
+	private->surface = surface;
+	file->width = header.width;
+	file->height = header.height;
+	file->is_loaded = TRUE;
+}/*}}}*/
+static void file_type_netpbm_draw(file_t *file, cairo_t *cr) {/*{{{*/
+	file_private_data_netpbm_t *private = file->private;
+	if(private->surface) {
+		cairo_set_source_surface(cr, private->surface, 0, 0);
+		apply_interpolation_quality(cr);
+		cairo_paint(cr);
+	}
+}/*}}}*/
+void file_type_netpbm_initializer(file_type_handler_t *info) {/*{{{*/
+	// Fill the file filter pattern. PPM and PGM files from disk are left to
+	// gdk-pixbuf, filter output in any of the formats is found by the PAM
+	// MIME type, see apply_external_image_filter_add_output()
+	info->file_types_handled = gtk_file_filter_new();
+	gtk_file_filter_add_pattern(info->file_types_handled, "*.pam");
+	gtk_file_filter_add_mime_type(info->file_types_handled, "image/x-portable-arbitrarymap");
+
+	// Assign the handlers
+	info->alloc_fn                 =  file_type_netpbm_alloc;
+	info->free_fn                  =  file_type_netpbm_free;
+	info->load_fn                  =  file_type_netpbm_load;
+	info->unload_fn                =  file_type_netpbm_unload;
+	info->draw_fn                  =  file_type_netpbm_draw;
+}/*}}}*/
+/* }}} */
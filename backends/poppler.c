@@ -22,15 +22,110 @@
 #include "../lib/filebuffer.h"
 #include <poppler.h>
 
+// Maximum number of PopplerDocument instances opened per file
+#define POPPLER_DOCUMENT_INSTANCES 4
+
+// The pages of a file share PopplerDocument instances, such that the document
+// is parsed once rather than once per page. A document must not be used by
+// two threads at once, so each instance has a lock that is held while its
+// pages are accessed. If all instances of a file are busy when a page is
+// loaded, another one is opened, such that loader threads can render pages of
+// the same file in parallel.
 typedef struct {
-	// The page to be displayed
 	PopplerDocument *document;
+	gconstpointer data;
+	GMutex lock;
+	guint ref_count;
+} poppler_document_instance_t;
+
+// Indexed by file name, like the buffers in lib/filebuffer.c; the values are
+// GLists of instances
+G_LOCK_DEFINE_STATIC(poppler_documents);
+static GHashTable *poppler_documents = NULL;
+
+typedef struct {
+	// The page to be displayed
+	poppler_document_instance_t *document;
 	PopplerPage *page;
 
 	// The page number, for loading
 	guint page_number;
 } file_private_data_poppler_t;
 
+static poppler_document_instance_t *file_type_poppler_document_acquire(file_t *file, GBytes *data_bytes, GError **error_pointer) {/*{{{*/
+	gsize data_size;
+	gconstpointer data_ptr = g_bytes_get_data(data_bytes, &data_size);
+
+	G_LOCK(poppler_documents);
+	if(!poppler_documents) {
+		poppler_documents = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	}
+	GList *instances = g_hash_table_lookup(poppler_documents, file->file_name);
+	poppler_document_instance_t *instance = NULL;
+	guint instance_count = 0;
+	for(GList *iter = instances; iter; iter = g_list_next(iter)) {
+		poppler_document_instance_t *candidate = iter->data;
+		if(candidate->data != data_ptr) {
+			// Opened from a previous version of the file
+			continue;
+		}
+		instance_count++;
+		// Prefer an instance that no other thread is using right now
+		if(g_mutex_trylock(&candidate->lock)) {
+			g_mutex_unlock(&candidate->lock);
+			instance = candidate;
+			break;
+		}
+	}
+	if(!instance && instance_count >= POPPLER_DOCUMENT_INSTANCES) {
+		// All busy, and no more instances allowed. Share the first one.
+		for(GList *iter = instances; iter && !instance; iter = g_list_next(iter)) {
+			if(((poppler_document_instance_t *)iter->data)->data == data_ptr) {
+				instance = iter->data;
+			}
+		}
+	}
+	if(instance) {
+		instance->ref_count++;
+		G_UNLOCK(poppler_documents);
+		return instance;
+	}
+	G_UNLOCK(poppler_documents);
+
+	// Parsing the document can take a while, so do it without holding the lock
+	PopplerDocument *document = poppler_document_new_from_data((char *)data_ptr, (int)data_size, NULL, error_pointer);
+	if(!document) {
+		return NULL;
+	}
+	instance = g_slice_new0(poppler_document_instance_t);
+	instance->document = document;
+	instance->data = data_ptr;
+	instance->ref_count = 1;
+	g_mutex_init(&instance->lock);
+
+	G_LOCK(poppler_documents);
+	instances = g_list_prepend(g_hash_table_lookup(poppler_documents, file->file_name), instance);
+	g_hash_table_replace(poppler_documents, g_strdup(file->file_name), instances);
+	G_UNLOCK(poppler_documents);
+
+	return instance;
+}/*}}}*/
+static void file_type_poppler_document_release(file_t *file, poppler_document_instance_t *instance) {/*{{{*/
+	G_LOCK(poppler_documents);
+	if(--instance->ref_count == 0) {
+		GList *instances = g_list_remove(g_hash_table_lookup(poppler_documents, file->file_name), instance);
+		if(instances) {
+			g_hash_table_replace(poppler_documents, g_strdup(file->file_name), instances);
+		}
+		else {
+			g_hash_table_remove(poppler_documents, file->file_name);
+		}
+		g_object_unref(instance->document);
+		g_mutex_clear(&instance->lock);
+		g_slice_free(poppler_document_instance_t, instance);
+	}
+	G_UNLOCK(poppler_documents);
+}/*}}}*/
 BOSNode *file_type_poppler_alloc(load_images_state_t state, file_t *file) {/*{{{*/
 	// We have to load the file now to get the number of pages
 	GError *error_pointer = NULL;
@@ -108,25 +203,23 @@ void file_type_poppler_load(file_t *file, GInputStream *data, GError **error_poi
 	}
 	file_private_data_poppler_t *private = file->private;
 
-	// We need to load the data into memory, because poppler has problems with serving from streams; see above
-	#if 0 && POPPLER_CHECK_VERSION(0, 26, 5)
-		PopplerDocument *document = poppler_document_new_from_stream(data, -1, NULL, image_loader_cancellable, error_pointer);
-	#else
-		GBytes *data_bytes = buffered_file_as_bytes(file, data, error_pointer);
-		if(!data_bytes || (error_pointer && *error_pointer)) {
-			return;
-		}
-		gsize data_size;
-		char *data_ptr = (char *)g_bytes_get_data(data_bytes, &data_size);
-		PopplerDocument *document = poppler_document_new_from_data(data_ptr, (int)data_size, NULL, error_pointer);
-	#endif
+	// We need to load the data into memory, because poppler has problems with
+	// serving from streams; see above. The buffer must outlive the document,
+	// so each loaded page holds a reference to it.
+	GBytes *data_bytes = buffered_file_as_bytes(file, data, error_pointer);
+	if(!data_bytes || (error_pointer && *error_pointer)) {
+		return;
+	}
+	poppler_document_instance_t *document = file_type_poppler_document_acquire(file, data_bytes, error_pointer);
 
 	if(document) {
-		PopplerPage *page = poppler_document_get_page(document, private->page_number);
+		g_mutex_lock(&document->lock);
+		PopplerPage *page = poppler_document_get_page(document->document, private->page_number);
 
 		if(page) {
 			double width, height;
 			poppler_page_get_size(page, &width, &height);
+			g_mutex_unlock(&document->lock);
 
 			file->width = width;
 			file->height = height;
@@ -135,27 +228,26 @@ void file_type_poppler_load(file_t *file, GInputStream *data, GError **error_poi
 			private->document = document;
 			return;
 		}
+		g_mutex_unlock(&document->lock);
 
-		g_object_unref(document);
+		file_type_poppler_document_release(file, document);
 	}
 
-	#if !POPPLER_CHECK_VERSION(0, 26, 5)
-		buffered_file_unref(file);
-	#endif
+	buffered_file_unref(file);
 }/*}}}*/
 void file_type_poppler_unload(file_t *file) {/*{{{*/
 	file_private_data_poppler_t *private = file->private;
 	if(private->page) {
+		g_mutex_lock(&private->document->lock);
 		g_object_unref(private->page);
+		g_mutex_unlock(&private->document->lock);
 		private->page = NULL;
 	}
 	if(private->document) {
-		g_object_unref(private->document);
+		file_type_poppler_document_release(file, private->document);
 		private->document = NULL;
 
-		#if !POPPLER_CHECK_VERSION(0, 26, 5)
-			buffered_file_unref(file);
-		#endif
+		buffered_file_unref(file);
 	}
 }/*}}}*/
 void file_type_poppler_draw(file_t *file, cairo_t *cr) {/*{{{*/
@@ -164,7 +256,9 @@ void file_type_poppler_draw(file_t *file, cairo_t *cr) {/*{{{*/
 	cairo_set_source_rgb(cr, 1., 1., 1.);
 	cairo_paint(cr);
 	apply_interpolation_quality(cr);
+	g_mutex_lock(&private->document->lock);
 	poppler_page_render(private->page, cr);
+	g_mutex_unlock(&private->document->lock);
 }/*}}}*/
 
 void file_type_poppler_initializer(file_type_handler_t *info) {/*{{{*/
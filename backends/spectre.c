@@ -206,6 +206,9 @@ void file_type_spectre_initializer(file_type_handler_t *info) {/*{{{*/
 	gtk_file_filter_add_mime_type(info->file_types_handled, "image/ps");
 	gtk_file_filter_add_mime_type(info->file_types_handled, "image/eps");
 
+	// Ghostscript, which libspectre uses for rendering, is not reentrant
+	info->load_not_parallel_safe   =  TRUE;
+
 	// Assign the handlers
 	info->alloc_fn                 =  file_type_spectre_alloc;
 	info->free_fn                  =  file_type_spectre_free;
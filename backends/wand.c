@@ -21,6 +21,7 @@
 
 #include "../pqiv.h"
 #include "../lib/filebuffer.h"
+#include "../lib/pixelkernels.h"
 #include <stdint.h>
 #include <string.h>
 #include <strings.h>
@@ -70,14 +71,10 @@ static gboolean file_type_wand_has_extension(file_t *file, const char *extension
 	return (!(file->file_flags & FILE_FLAGS_MEMORY_IMAGE) && file->file_name && (actual_extension = strrchr(file->file_name, '.')) && strcasecmp(actual_extension, extension) == 0);
 }
 
-// Functions to render the Magick backend to a cairo surface via in-memory PNG export
-cairo_status_t file_type_wand_read_data(void *closure, unsigned char *data, unsigned int length) {/*{{{*/
-	unsigned char **pos = closure;
-	memcpy(data, *pos, length);
-	*pos += length;
-	return CAIRO_STATUS_SUCCESS;
-}/*}}}*/
+// Functions to render the Magick backend to a cairo surface
 void file_type_wand_update_image_surface(file_t *file) {/*{{{*/
+	// Must be called with magick_wand_global_lock held. The lock is given up
+	// while the pixels are converted, which touches only this file's data.
 	file_private_data_wand_t *private = file->private;
 
 	if(private->rendered_image_surface) {
@@ -85,15 +82,55 @@ void file_type_wand_update_image_surface(file_t *file) {/*{{{*/
 		private->rendered_image_surface = NULL;
 	}
 
-	MagickSetImageFormat(private->wand, "PNG32");
+	const size_t width = MagickGetImageWidth(private->wand);
+	const size_t height = MagickGetImageHeight(private->wand);
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		return;
+	}
 
-	size_t image_size;
-	unsigned char *image_data = MagickGetImageBlob(private->wand, &image_size);
-	unsigned char *image_data_loc = image_data;
+	// The PNG32 round trip this replaces converted to sRGB implicitly; do so
+	// explicitly for CMYK, Lab, gray and other images. Images without an
+	// alpha channel get an opaque one, such that A is defined as well.
+	if(MagickGetImageColorspace(private->wand) != sRGBColorspace) {
+		MagickTransformImageColorspace(private->wand, sRGBColorspace);
+	}
+	const gboolean has_alpha = MagickGetImageAlphaChannel(private->wand) != MagickFalse;
+	if(!has_alpha) {
+		MagickSetImageAlphaChannel(private->wand, OpaqueAlphaChannel);
+	}
 
-	private->rendered_image_surface = cairo_image_surface_create_from_png_stream(file_type_wand_read_data, &image_data_loc);
+	// Export the pixels straight into the surface, in the byte order of
+	// cairo's native endian ARGB32
+	const char *channel_map = G_BYTE_ORDER == G_LITTLE_ENDIAN ? "BGRA" : "ARGB";
+	uint8_t *surface_data = cairo_image_surface_get_data(surface);
+	const int stride = cairo_image_surface_get_stride(surface);
+	cairo_surface_flush(surface);
+	MagickBooleanType success = MagickTrue;
+	if((size_t)stride == width * 4) {
+		success = MagickExportImagePixels(private->wand, 0, 0, width, height, channel_map, CharPixel, surface_data);
+	}
+	else {
+		for(size_t y=0; y<height && success != MagickFalse; y++) {
+			success = MagickExportImagePixels(private->wand, 0, y, width, 1, channel_map, CharPixel, surface_data + y * stride);
+		}
+	}
+	if(success == MagickFalse) {
+		cairo_surface_destroy(surface);
+		return;
+	}
+	if(has_alpha) {
+		// Cairo expects premultiplied alpha
+		G_UNLOCK(magick_wand_global_lock);
+		for(size_t y=0; y<height; y++) {
+			pixel_kernels_premultiply((uint32_t *)(surface_data + y * stride), width);
+		}
+		G_LOCK(magick_wand_global_lock);
+	}
+	cairo_surface_mark_dirty(surface);
 
-	MagickRelinquishMemory(image_data);
+	private->rendered_image_surface = surface;
 }/*}}}*/
 
 BOSNode *file_type_wand_alloc(load_images_state_t state, file_t *file) {/*{{{*/
@@ -342,6 +379,9 @@ void file_type_wand_initializer(file_type_handler_t *info) {/*{{{*/
 	// Magick Wand does not give us MIME types. Manually add the most interesting one:
 	gtk_file_filter_add_mime_type(info->file_types_handled, "image/vnd.adobe.photoshop");
 
+	// All ImageMagick calls are serialized by magick_wand_global_lock anyway
+	info->load_not_parallel_safe   =  TRUE;
+
 	// Assign the handlers
 	info->alloc_fn                 =  file_type_wand_alloc;
 	info->free_fn                  =  file_type_wand_free;
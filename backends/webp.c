@@ -22,6 +22,7 @@
 
 #include "../pqiv.h"
 #include "../lib/filebuffer.h"
+#include "../lib/pixelkernels.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,6 +46,49 @@ void file_type_webp_free(file_t *file) {/*{{{*/
 	g_slice_free(file_private_data_webp_t, file->private);
 }/*}}}*/
 
+// Input is passed to the incremental decoder in chunks of this size
+#define WEBP_INCREMENTAL_CHUNK_SIZE (64 * 1024)
+
+gboolean file_type_webp_decode_incrementally(file_t *file, const uint8_t *image_data, size_t image_size, WEBP_CSP_MODE mode, uint8_t *surface_data, int surface_stride, int image_width, int image_height, gboolean has_alpha) {/*{{{*/
+	// Decode the way WebPDecode*Into() does, but publish the rows decoded so
+	// far in between, see image_loader_publish_progress()
+	WebPIDecoder *decoder = WebPINewRGB(mode, surface_data, (size_t)surface_stride * image_height, surface_stride);
+	if(!decoder) {
+		return FALSE;
+	}
+
+	VP8StatusCode status = VP8_STATUS_SUSPENDED;
+	size_t offset = 0;
+	while(status == VP8_STATUS_SUSPENDED && offset < image_size) {
+		const size_t chunk_size = MIN(WEBP_INCREMENTAL_CHUNK_SIZE, image_size - offset);
+		status = WebPIAppend(decoder, image_data + offset, chunk_size);
+		offset += chunk_size;
+
+		int last_y = 0;
+		if(status == VP8_STATUS_SUSPENDED && image_loader_progress_due(file) && WebPIDecGetRGB(decoder, &last_y, NULL, NULL, NULL) != NULL && last_y > 0) {
+			cairo_surface_t *preview = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, image_width, image_height);
+			if(cairo_surface_status(preview) != CAIRO_STATUS_SUCCESS) {
+				cairo_surface_destroy(preview);
+				continue;
+			}
+			uint8_t *preview_data = cairo_image_surface_get_data(preview);
+			const int preview_stride = cairo_image_surface_get_stride(preview);
+			cairo_surface_flush(preview);
+			for(int i = 0; i < last_y; i++) {
+				memcpy(&preview_data[i*preview_stride], &surface_data[i*surface_stride], image_width * 4);
+				if(has_alpha) {
+					pixel_kernels_premultiply((uint32_t *)&preview_data[i*preview_stride], image_width);
+				}
+			}
+			cairo_surface_mark_dirty(preview);
+			image_loader_publish_progress(file, preview);
+		}
+	}
+
+	WebPIDelete(decoder);
+	return status == VP8_STATUS_OK;
+}/*}}}*/
+
 void file_type_webp_load(file_t *file, GInputStream *data, GError **error_pointer) {/*{{{*/
 	file_private_data_webp_t *private = file->private;
 
@@ -86,7 +130,11 @@ void file_type_webp_load(file_t *file, GInputStream *data, GError **error_pointe
 		surface_stride = cairo_image_surface_get_stride(private->rendered_image_surface);
 
 		cairo_surface_flush(private->rendered_image_surface);
-		if(endian_tester.u8arr[0] == 0x12) {
+		if(image_loader_progress_wanted(file)) {
+			const WEBP_CSP_MODE mode = endian_tester.u8arr[0] == 0x12 ? MODE_ARGB : MODE_BGRA;
+			image_decode_ok = file_type_webp_decode_incrementally(file, (const uint8_t*)image_data, image_size, mode, surface_data, surface_stride, image_width, image_height, image_features.has_alpha);
+		}
+		else if(endian_tester.u8arr[0] == 0x12) {
 			// We are in big endian
 			webp_retptr = WebPDecodeARGBInto((const uint8_t*)image_data, image_size, surface_data, surface_stride*image_height*4, surface_stride);
 		} else {
@@ -118,28 +166,9 @@ void file_type_webp_load(file_t *file, GInputStream *data, GError **error_pointe
 	 * alpha precomputation below if the file has an alpha channel.
 	 */
 
-	int i, j;
-	float fR, fG, fB, fA;
-	int R, G, B;
-	uint32_t pixel;
 	if(image_features.has_alpha) {
-		for(i = 0; i < image_height; i++) {
-			for(j = 0; j < image_width; j++) {
-				memcpy(&pixel, &surface_data[i*surface_stride+j*4], sizeof(uint32_t));
-
-				// Unpack into float
-				fR = (pixel&0x0FF)/255.0;
-				fG = ((pixel>>8)&0x0FF)/255.0;
-				fB = ((pixel>>16)&0x0FF)/255.0;
-				fA = ((pixel>>24)&0x0FF)/255.0;
-				// Casting float to int truncates, so for rounding, we add 0.5
-				R = (fR*fA*255.0+0.5);
-				G = (fG*fA*255.0+0.5);
-				B = (fB*fA*255.0+0.5);
-				pixel = R | (G<<8) | (B<<16) | (pixel&0xFF000000);
-
-				memcpy(&surface_data[i*surface_stride+j*4], &pixel, sizeof(uint32_t));
-			}
+		for(int i = 0; i < image_height; i++) {
+			pixel_kernels_premultiply((uint32_t *)&surface_data[i*surface_stride], image_width);
 		}
 	}
 
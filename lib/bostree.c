@@ -174,6 +174,39 @@ unsigned int bostree_node_count(BOSTree *tree) {
 	return tree->root_node ? tree->root_node->left_child_count + tree->root_node->right_child_count + 1 : 0;
 }
 
+BOSNode *bostree_node_new(void *key, void *data) {
+	BOSNode *new_node = malloc(sizeof(BOSNode));
+	memset(new_node, 0, sizeof(BOSNode));
+	new_node->key = key;
+	new_node->data = data;
+	new_node->weak_ref_count = 1;
+	new_node->weak_ref_node_valid = 1;
+	return new_node;
+}
+
+static BOSNode *_bostree_build_subtree(BOSNode **nodes, unsigned int count, BOSNode *parent_node) {
+	// Use the middle node as the root, and build both halves recursively. The
+	// depths of the halves differ by at most one, so this satisfies the AVL
+	// property without any rotations.
+	if(count == 0) {
+		return NULL;
+	}
+	const unsigned int middle = count / 2;
+	BOSNode *node = nodes[middle];
+	node->parent_node = parent_node;
+	node->left_child_node = _bostree_build_subtree(nodes, middle, node);
+	node->left_child_count = middle;
+	node->right_child_node = _bostree_build_subtree(nodes + middle + 1, count - middle - 1, node);
+	node->right_child_count = count - middle - 1;
+	node->depth = _imax(node->left_child_node ? 1 + node->left_child_node->depth : 0, node->right_child_node ? 1 + node->right_child_node->depth : 0);
+	return node;
+}
+
+void bostree_build(BOSTree *tree, BOSNode **nodes, unsigned int count) {
+	assert(tree->root_node == NULL);
+	tree->root_node = _bostree_build_subtree(nodes, count, NULL);
+}
+
 BOSNode *bostree_insert(BOSTree *tree, void *key, void *data) {
 	BOSNode **node = &tree->root_node;
 	BOSNode *parent_node = NULL;
@@ -193,12 +226,7 @@ BOSNode *bostree_insert(BOSTree *tree, void *key, void *data) {
 	}
 
 	// Create new node
-	BOSNode *new_node = malloc(sizeof(BOSNode));
-	memset(new_node, 0, sizeof(BOSNode));
-	new_node->key = key;
-	new_node->data = data;
-	new_node->weak_ref_count = 1;
-	new_node->weak_ref_node_valid = 1;
+	BOSNode *new_node = bostree_node_new(key, data);
 	new_node->parent_node = parent_node;
 
 	*node = new_node;
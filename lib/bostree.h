@@ -94,6 +94,23 @@ unsigned int bostree_node_count(BOSTree *tree);
  */
 BOSNode *bostree_insert(BOSTree *tree, void *key, void *data);
 
+/**
+ * Allocate a node that is not yet part of a tree.
+ *
+ * Such nodes can be weakly referenced right away, and are added to a tree
+ * using bostree_build().
+ */
+BOSNode *bostree_node_new(void *key, void *data);
+
+/**
+ * Add an array of nodes from bostree_node_new() to an empty tree in O(n).
+ *
+ * The nodes must be sorted by their keys in ascending order. Nodes with equal
+ * keys end up in the same order as if they had been inserted one by one in
+ * array order.
+ */
+void bostree_build(BOSTree *tree, BOSNode **nodes, unsigned int count);
+
 /**
  * Remove a given node from a tree.
  */
@@ -56,7 +56,91 @@ static void buffered_file_mmap_free_helper(struct buffered_file_mmap_info *info)
 	close(info->fd);
 	g_slice_free(struct buffered_file_mmap_info, info);
 }
+
+static GBytes *buffered_file_mmap(file_t *file, GError **error_pointer) {
+	// mmap() a local file. Returns NULL without setting error_pointer if the
+	// file is not local or cannot be mapped.
+	GBytes *data_bytes = NULL;
+	GFile *input_file = gfile_for_commandline_arg(file->file_name);
+	char *input_file_abspath = g_file_get_path(input_file);
+	if(input_file_abspath) {
+		GFileInfo *file_info = g_file_query_info(input_file, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NONE, NULL, error_pointer);
+		if(!file_info) {
+			g_free(input_file_abspath);
+			g_object_unref(input_file);
+			return NULL;
+		}
+		goffset input_file_size = g_file_info_get_size(file_info);
+		g_object_unref(file_info);
+
+		int fd = open(input_file_abspath, O_RDONLY);
+		g_free(input_file_abspath);
+		if(fd < 0) {
+			g_object_unref(input_file);
+			*error_pointer = g_error_new(g_quark_from_static_string("pqiv-filebuffer-error"), 1, "Opening the file failed with errno=%d: %s", errno, strerror(errno));
+			return NULL;
+		}
+		void *input_file_data = input_file_size > 0 ? mmap(NULL, input_file_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+
+		if(input_file_data != MAP_FAILED) {
+			struct buffered_file_mmap_info *mmap_info = g_slice_new(struct buffered_file_mmap_info);
+			mmap_info->ptr = input_file_data;
+			mmap_info->fd = fd;
+			mmap_info->size = input_file_size;
+
+			data_bytes = g_bytes_new_with_free_func(input_file_data, input_file_size, (GDestroyNotify)buffered_file_mmap_free_helper, mmap_info);
+		}
+		else {
+			close(fd);
+		}
+	}
+	g_object_unref(input_file);
+	return data_bytes;
+}
+#endif
+
+GInputStream *buffered_file_mmap_stream(file_t *file, GError **error_pointer) {
+#if defined(HAS_MMAP) && GLIB_CHECK_VERSION(2, 34, 0)
+	if(file->file_flags & FILE_FLAGS_MEMORY_IMAGE) {
+		return NULL;
+	}
+	GBytes *data_bytes = buffered_file_mmap(file, error_pointer);
+	if(!data_bytes) {
+		return NULL;
+	}
+
+	// The loader is about to read the whole file front to back
+	gsize size;
+	void *ptr = (void *)g_bytes_get_data(data_bytes, &size);
+	madvise(ptr, size, MADV_SEQUENTIAL);
+	madvise(ptr, size, MADV_WILLNEED);
+
+	GInputStream *stream = g_memory_input_stream_new_from_bytes(data_bytes);
+	// Remember the mapping, such that buffered_file_as_bytes() can use it
+	// instead of reading the stream into memory again
+	g_object_set_data_full(G_OBJECT(stream), "pqiv-filebuffer-bytes", data_bytes, (GDestroyNotify)g_bytes_unref);
+	return stream;
+#else
+	return NULL;
+#endif
+}
+
+void buffered_file_mmap_stream_done(GInputStream *stream) {
+#ifdef HAS_MMAP
+	GBytes *data_bytes = stream ? g_object_get_data(G_OBJECT(stream), "pqiv-filebuffer-bytes") : NULL;
+	if(data_bytes) {
+		// Drop the pages from this process. Backends that still use the
+		// buffer fault them in again from the page cache.
+		gsize size;
+		void *ptr = (void *)g_bytes_get_data(data_bytes, &size);
+		madvise(ptr, size, MADV_DONTNEED);
+
+		// The mapping goes away along with the stream, unless a backend holds
+		// on to it
+		g_object_set_data(G_OBJECT(stream), "pqiv-filebuffer-bytes", NULL);
+	}
 #endif
+}
 
 GBytes *buffered_file_as_bytes(file_t *file, GInputStream *data, GError **error_pointer) {
 	g_rec_mutex_lock(&file_buffer_table_mutex);
@@ -81,44 +165,20 @@ GBytes *buffered_file_as_bytes(file_t *file, GInputStream *data, GError **error_
 			}
 		}
 		else {
-
+			GBytes *stream_bytes = data ? g_object_get_data(G_OBJECT(data), "pqiv-filebuffer-bytes") : NULL;
+			if(stream_bytes) {
+				// The stream is a view on a mapping from buffered_file_mmap_stream()
+				data_bytes = g_bytes_ref(stream_bytes);
+			}
 #ifdef HAS_MMAP
-			// If this is a local file, try to mmap() it first instead of loading it completely
-			GFile *input_file = gfile_for_commandline_arg(file->file_name);
-			char *input_file_abspath = g_file_get_path(input_file);
-			if(input_file_abspath) {
-				GFileInfo *file_info = g_file_query_info(input_file, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NONE, NULL, error_pointer);
-				if(!file_info) {
-					g_object_unref(input_file);
-					g_rec_mutex_unlock(&file_buffer_table_mutex);
-					return NULL;
-				}
-				goffset input_file_size = g_file_info_get_size(file_info);
-				g_object_unref(file_info);
-
-				int fd = open(input_file_abspath, O_RDONLY);
-				g_free(input_file_abspath);
-				if(fd < 0) {
-					g_object_unref(input_file);
+			else {
+				// If this is a local file, try to mmap() it first instead of loading it completely
+				data_bytes = buffered_file_mmap(file, error_pointer);
+				if(!data_bytes && error_pointer && *error_pointer) {
 					g_rec_mutex_unlock(&file_buffer_table_mutex);
-					*error_pointer = g_error_new(g_quark_from_static_string("pqiv-filebuffer-error"), 1, "Opening the file failed with errno=%d: %s", errno, strerror(errno));
 					return NULL;
 				}
-				void *input_file_data = mmap(NULL, input_file_size, PROT_READ, MAP_SHARED, fd, 0);
-
-				if(input_file_data != MAP_FAILED) {
-					struct buffered_file_mmap_info *mmap_info = g_slice_new(struct buffered_file_mmap_info);
-					mmap_info->ptr = input_file_data;
-					mmap_info->fd = fd;
-					mmap_info->size = input_file_size;
-
-					data_bytes = g_bytes_new_with_free_func(input_file_data, input_file_size, (GDestroyNotify)buffered_file_mmap_free_helper, mmap_info);
-				}
-				else {
-					close(fd);
-				}
 			}
-			g_object_unref(input_file);
 #endif
 
 			if(data_bytes) {
@@ -130,11 +190,11 @@ GBytes *buffered_file_as_bytes(file_t *file, GInputStream *data, GError **error_
 					g_rec_mutex_unlock(&file_buffer_table_mutex);
 					return NULL;
 				}
-				data_bytes = g_input_stream_read_completely(data, image_loader_cancellable, error_pointer);
+				data_bytes = g_input_stream_read_completely(data, image_loader_get_cancellable(), error_pointer);
 				g_object_unref(data);
 			}
 			else {
-				data_bytes = g_input_stream_read_completely(data, image_loader_cancellable, error_pointer);
+				data_bytes = g_input_stream_read_completely(data, image_loader_get_cancellable(), error_pointer);
 			}
 
 			if(!data_bytes) {
@@ -209,7 +269,7 @@ char *buffered_file_as_local_file(file_t *file, GInputStream *data, GError **err
 			return NULL;
 		}
 
-		if(g_output_stream_splice(g_io_stream_get_output_stream(G_IO_STREAM(iostream)), data, G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET, image_loader_cancellable, error_pointer) < 0) {
+		if(g_output_stream_splice(g_io_stream_get_output_stream(G_IO_STREAM(iostream)), data, G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET, image_loader_get_cancellable(), error_pointer) < 0) {
 			g_hash_table_remove(file_buffer_table, file->file_name);
 			if(local_data) {
 				g_object_unref(data);
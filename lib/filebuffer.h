@@ -33,6 +33,17 @@ GBytes *buffered_file_as_bytes(file_t *file, GInputStream *data, GError **error_
 // Return a (possibly temporary) file for a file_t
 char *buffered_file_as_local_file(file_t *file, GInputStream *data, GError **error_pointer);
 
+// Return a memory stream on a mmap()ed local file, or NULL if the file is not
+// local. buffered_file_as_bytes() reuses the mapping if given this stream.
+// Only for files that are not written to meanwhile: Reading from the mapping
+// of a file that shrinks raises SIGBUS.
+GInputStream *buffered_file_mmap_stream(file_t *file, GError **error_pointer);
+
+// Release the mapping of a stream from buffered_file_mmap_stream() once it has
+// been decoded, unless buffered_file_as_bytes() handed it out. Does nothing
+// for other streams.
+void buffered_file_mmap_stream_done(GInputStream *stream);
+
 // Unreference one of the above, free'ing memory if
 // necessary
 void buffered_file_unref(file_t *file);
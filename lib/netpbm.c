@@ -0,0 +1,68 @@
+/**
+ * pqiv
+ *
+ * Copyright (c) 2013-2017, Phillip Berndt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "netpbm.h"
+#include "pixelkernels.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+// Rows are converted and written in batches of about this many bytes
+#define NETPBM_WRITE_BATCH_SIZE (1 << 20)
+
+/* Writing {{{ */
+static gboolean netpbm_write_all(int fd, const guint8 *data, gsize length) {/*{{{*/
+	while(length > 0) {
+		const ssize_t written = write(fd, data, length);
+		if(written < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return FALSE;
+		}
+		data += written;
+		length -= written;
+	}
+	return TRUE;
+}/*}}}*/
+gboolean netpbm_write_pam(cairo_surface_t *surface, int fd) {/*{{{*/
+	cairo_surface_flush(surface);
+	const int width = cairo_image_surface_get_width(surface);
+	const int height = cairo_image_surface_get_height(surface);
+	const int stride = cairo_image_surface_get_stride(surface);
+	const guint8 *data = cairo_image_surface_get_data(surface);
+
+	gchar *header = g_strdup_printf("P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", width, height);
+	gboolean success = netpbm_write_all(fd, (const guint8 *)header, strlen(header));
+	g_free(header);
+
+	const gsize row_size = (gsize)width * 4;
+	const int rows_per_batch = row_size > 0 ? MAX(1, NETPBM_WRITE_BATCH_SIZE / row_size) : 1;
+	guint8 *buffer = g_malloc(row_size * rows_per_batch + 1);
+	for(int y = 0; success && y < height; y += rows_per_batch) {
+		const int rows = MIN(rows_per_batch, height - y);
+		for(int i = 0; i < rows; i++) {
+			pixel_kernels_argb32_to_rgba(buffer + i * row_size, (const uint32_t *)(data + (gsize)(y + i) * stride), width);
+		}
+		success = netpbm_write_all(fd, buffer, rows * row_size);
+	}
+	g_free(buffer);
+
+	return success;
+}/*}}}*/
+/* }}} */
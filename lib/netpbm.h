@@ -0,0 +1,31 @@
+/**
+ * pqiv
+ *
+ * Copyright (c) 2013-2017, Phillip Berndt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Write images in the netpbm PAM format, for the exchange with external
+// image filters
+//
+// Images are written with TUPLTYPE RGB_ALPHA and 8 bits per sample. The
+// netpbm backend reads them back, along with the other formats listed in
+// backends/netpbm.c.
+//
+
+#include "../pqiv.h"
+
+// Write an ARGB32 image surface to fd as PAM. Returns FALSE if writing
+// failed, with errno set.
+gboolean netpbm_write_pam(cairo_surface_t *surface, int fd);
@@ -0,0 +1,432 @@
+/**
+ * pqiv
+ *
+ * Copyright (c) 2013-2017, Phillip Berndt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "pixelkernels.h"
+
+// Each SIMD variant processes as many pixels as fit its vector width and
+// returns how many it did; the generic versions then do the rest. SSE2 is
+// part of x86-64 and NEON of AArch64, so those are used whenever the compiler
+// targets them. AVX2 is compiled in regardless and used if the processor has
+// it.
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+	#define PIXEL_KERNELS_AVX2
+	#define PIXEL_KERNELS_AVX2_FUNCTION __attribute__((target("avx2")))
+	#include <immintrin.h>
+#endif
+#if defined(__SSE2__)
+	#define PIXEL_KERNELS_SSE2
+	#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	#define PIXEL_KERNELS_NEON
+	#include <arm_neon.h>
+#endif
+
+/* Generic versions {{{ */
+static inline uint32_t pixel_kernels_multiply(uint32_t value, uint32_t alpha) {/*{{{*/
+	// Equals round(value * alpha / 255) for all 8 bit values
+	const uint32_t product = value * alpha + 128;
+	return (product + (product >> 8)) >> 8;
+}/*}}}*/
+static inline uint32_t pixel_kernels_premultiply_pixel(uint32_t pixel) {/*{{{*/
+	// The same as pixel_kernels_multiply, for red and blue at once
+	const uint32_t alpha = pixel >> 24;
+	const uint32_t rb = (pixel & 0xff00ff) * alpha + 0x800080;
+	const uint32_t g = (pixel & 0x00ff00) * alpha + 0x008000;
+	return (alpha << 24)
+		| ((((rb + ((rb >> 8) & 0xff00ff)) >> 8) & 0xff00ff))
+		| ((((g + ((g >> 8) & 0x00ff00)) >> 8) & 0x00ff00));
+}/*}}}*/
+static inline uint32_t pixel_kernels_negate_pixel(uint32_t pixel) {/*{{{*/
+	uint32_t alpha = pixel >> 24;
+	uint32_t retval = pixel & 0xff000000;
+	for(int shift = 0; shift < 24; shift += 8) {
+		const uint32_t value = (pixel >> shift) & 0xff;
+		retval |= (value < alpha ? alpha - value : 0) << shift;
+	}
+	return retval;
+}/*}}}*/
+static inline uint32_t pixel_kernels_average_pixels(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {/*{{{*/
+	// Two channels at a time; sums of four 8 bit values fit into 16 bits
+	const uint32_t even = ((a & 0xff00ff) + (b & 0xff00ff) + (c & 0xff00ff) + (d & 0xff00ff) + 0x20002) >> 2;
+	const uint32_t odd = (((a >> 8) & 0xff00ff) + ((b >> 8) & 0xff00ff) + ((c >> 8) & 0xff00ff) + ((d >> 8) & 0xff00ff) + 0x20002) >> 2;
+	return (even & 0xff00ff) | ((odd & 0xff00ff) << 8);
+}/*}}}*/
+/* }}} */
+
+#ifdef PIXEL_KERNELS_SSE2
+/* SSE2 {{{ */
+static inline __m128i pixel_kernels_sse2_premultiply_halves(__m128i pixels) {/*{{{*/
+	// pixels holds two pixels B, G, R, A in 16 bit lanes
+	const __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	const __m128i product = _mm_add_epi16(_mm_mullo_epi16(pixels, alpha), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+}/*}}}*/
+static inline __m128i pixel_kernels_sse2_keep_alpha(__m128i pixels, __m128i alpha_source) {/*{{{*/
+	const __m128i alpha_mask = _mm_set1_epi32(0xff000000);
+	return _mm_or_si128(_mm_andnot_si128(alpha_mask, pixels), _mm_and_si128(alpha_mask, alpha_source));
+}/*}}}*/
+static size_t pixel_kernels_sse2_premultiply(uint32_t *pixels, size_t count) {/*{{{*/
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4) {
+		const __m128i source = _mm_loadu_si128((const __m128i *)(pixels + i));
+		const __m128i low = pixel_kernels_sse2_premultiply_halves(_mm_unpacklo_epi8(source, zero));
+		const __m128i high = pixel_kernels_sse2_premultiply_halves(_mm_unpackhi_epi8(source, zero));
+		_mm_storeu_si128((__m128i *)(pixels + i), pixel_kernels_sse2_keep_alpha(_mm_packus_epi16(low, high), source));
+	}
+	return i;
+}/*}}}*/
+static size_t pixel_kernels_sse2_rgba_to_argb32(uint32_t *destination, const uint8_t *source, size_t count) {/*{{{*/
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4) {
+		const __m128i rgba = _mm_loadu_si128((const __m128i *)(source + 4 * i));
+		// Swap R and B while the channels are in 16 bit lanes
+		__m128i low = _mm_unpacklo_epi8(rgba, zero);
+		__m128i high = _mm_unpackhi_epi8(rgba, zero);
+		low = _mm_shufflehi_epi16(_mm_shufflelo_epi16(low, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+		high = _mm_shufflehi_epi16(_mm_shufflelo_epi16(high, _MM_SHUFFLE(3, 0, 1, 2)), _MM_SHUFFLE(3, 0, 1, 2));
+		low = pixel_kernels_sse2_premultiply_halves(low);
+		high = pixel_kernels_sse2_premultiply_halves(high);
+		_mm_storeu_si128((__m128i *)(destination + i), pixel_kernels_sse2_keep_alpha(_mm_packus_epi16(low, high), rgba));
+	}
+	return i;
+}/*}}}*/
+static size_t pixel_kernels_sse2_negate(uint32_t *destination, const uint32_t *source, size_t count) {/*{{{*/
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4) {
+		const __m128i pixels = _mm_loadu_si128((const __m128i *)(source + i));
+		__m128i alpha = _mm_srli_epi32(pixels, 24);
+		alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 8));
+		alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 16));
+		_mm_storeu_si128((__m128i *)(destination + i), pixel_kernels_sse2_keep_alpha(_mm_subs_epu8(alpha, pixels), pixels));
+	}
+	return i;
+}/*}}}*/
+static inline __m128i pixel_kernels_sse2_average_pairs(__m128i row_1, __m128i row_2) {/*{{{*/
+	// Returns the averages of the 2x2 blocks of four pixels from two rows, as
+	// two pixels in 16 bit lanes
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(row_1, zero), _mm_unpacklo_epi8(row_2, zero));
+	const __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(row_1, zero), _mm_unpackhi_epi8(row_2, zero));
+	const __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(low, high), _mm_unpackhi_epi64(low, high));
+	return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}/*}}}*/
+static size_t pixel_kernels_sse2_downscale_2x(uint32_t *destination, size_t count, const uint32_t *source_row_1, const uint32_t *source_row_2, size_t source_count) {/*{{{*/
+	size_t i = 0;
+	for(; i + 4 <= count && 2 * i + 8 <= source_count; i += 4) {
+		const __m128i first = pixel_kernels_sse2_average_pairs(_mm_loadu_si128((const __m128i *)(source_row_1 + 2 * i)), _mm_loadu_si128((const __m128i *)(source_row_2 + 2 * i)));
+		const __m128i second = pixel_kernels_sse2_average_pairs(_mm_loadu_si128((const __m128i *)(source_row_1 + 2 * i + 4)), _mm_loadu_si128((const __m128i *)(source_row_2 + 2 * i + 4)));
+		_mm_storeu_si128((__m128i *)(destination + i), _mm_packus_epi16(first, second));
+	}
+	return i;
+}/*}}}*/
+/* }}} */
+#endif
+
+#ifdef PIXEL_KERNELS_AVX2
+/* AVX2 {{{ */
+static int pixel_kernels_have_avx2() {/*{{{*/
+	return __builtin_cpu_supports("avx2");
+}/*}}}*/
+PIXEL_KERNELS_AVX2_FUNCTION static inline __m256i pixel_kernels_avx2_premultiply_halves(__m256i pixels) {/*{{{*/
+	const __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+	const __m256i product = _mm256_add_epi16(_mm256_mullo_epi16(pixels, alpha), _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(product, _mm256_srli_epi16(product, 8)), 8);
+}/*}}}*/
+PIXEL_KERNELS_AVX2_FUNCTION static inline __m256i pixel_kernels_avx2_keep_alpha(__m256i pixels, __m256i alpha_source) {/*{{{*/
+	return _mm256_blendv_epi8(pixels, alpha_source, _mm256_set1_epi32(0xff000000));
+}/*}}}*/
+PIXEL_KERNELS_AVX2_FUNCTION static size_t pixel_kernels_avx2_premultiply(uint32_t *pixels, size_t count) {/*{{{*/
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+	for(; i + 8 <= count; i += 8) {
+		// Unpacking and packing both work within 128 bit lanes, so the order
+		// of the pixels is retained
+		const __m256i source = _mm256_loadu_si256((const __m256i *)(pixels + i));
+		const __m256i low = pixel_kernels_avx2_premultiply_halves(_mm256_unpacklo_epi8(source, zero));
+		const __m256i high = pixel_kernels_avx2_premultiply_halves(_mm256_unpackhi_epi8(source, zero));
+		_mm256_storeu_si256((__m256i *)(pixels + i), pixel_kernels_avx2_keep_alpha(_mm256_packus_epi16(low, high), source));
+	}
+	return i;
+}/*}}}*/
+PIXEL_KERNELS_AVX2_FUNCTION static size_t pixel_kernels_avx2_rgba_to_argb32(uint32_t *destination, const uint8_t *source, size_t count) {/*{{{*/
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i swap_red_blue = _mm256_setr_epi8(
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	size_t i = 0;
+	for(; i + 8 <= count; i += 8) {
+		const __m256i bgra = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(source + 4 * i)), swap_red_blue);
+		const __m256i low = pixel_kernels_avx2_premultiply_halves(_mm256_unpacklo_epi8(bgra, zero));
+		const __m256i high = pixel_kernels_avx2_premultiply_halves(_mm256_unpackhi_epi8(bgra, zero));
+		_mm256_storeu_si256((__m256i *)(destination + i), pixel_kernels_avx2_keep_alpha(_mm256_packus_epi16(low, high), bgra));
+	}
+	return i;
+}/*}}}*/
+PIXEL_KERNELS_AVX2_FUNCTION static size_t pixel_kernels_avx2_rgb_to_argb32(uint32_t *destination, const uint8_t *source, size_t count) {/*{{{*/
+	// Each 128 bit lane is filled from 12 bytes, four pixels. The loads read
+	// 16 bytes, hence the loop stops early enough not to read past the end.
+	const __m256i expand = _mm256_setr_epi8(
+		2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+		2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const __m256i opaque = _mm256_set1_epi32(0xff000000);
+	size_t i = 0;
+	for(; i + 10 <= count; i += 8) {
+		const __m256i rgb = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(source + 3 * i))), _mm_loadu_si128((const __m128i *)(source + 3 * i + 12)), 1);
+		_mm256_storeu_si256((__m256i *)(destination + i), _mm256_or_si256(_mm256_shuffle_epi8(rgb, expand), opaque));
+	}
+	return i;
+}/*}}}*/
+PIXEL_KERNELS_AVX2_FUNCTION static size_t pixel_kernels_avx2_negate(uint32_t *destination, const uint32_t *source, size_t count) {/*{{{*/
+	const __m256i broadcast_alpha = _mm256_setr_epi8(
+		3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15,
+		3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+	size_t i = 0;
+	for(; i + 8 <= count; i += 8) {
+		const __m256i pixels = _mm256_loadu_si256((const __m256i *)(source + i));
+		const __m256i alpha = _mm256_shuffle_epi8(pixels, broadcast_alpha);
+		_mm256_storeu_si256((__m256i *)(destination + i), pixel_kernels_avx2_keep_alpha(_mm256_subs_epu8(alpha, pixels), pixels));
+	}
+	return i;
+}/*}}}*/
+PIXEL_KERNELS_AVX2_FUNCTION static inline __m256i pixel_kernels_avx2_average_pairs(__m256i row_1, __m256i row_2) {/*{{{*/
+	// See pixel_kernels_sse2_average_pairs; this yields the averages of
+	// pixels 0-3 in the lower and those of pixels 4-7 in the upper lane
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i low = _mm256_add_epi16(_mm256_unpacklo_epi8(row_1, zero), _mm256_unpacklo_epi8(row_2, zero));
+	const __m256i high = _mm256_add_epi16(_mm256_unpackhi_epi8(row_1, zero), _mm256_unpackhi_epi8(row_2, zero));
+	const __m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(low, high), _mm256_unpackhi_epi64(low, high));
+	return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(2)), 2);
+}/*}}}*/
+PIXEL_KERNELS_AVX2_FUNCTION static size_t pixel_kernels_avx2_downscale_2x(uint32_t *destination, size_t count, const uint32_t *source_row_1, const uint32_t *source_row_2, size_t source_count) {/*{{{*/
+	size_t i = 0;
+	for(; i + 8 <= count && 2 * i + 16 <= source_count; i += 8) {
+		const __m256i first = pixel_kernels_avx2_average_pairs(_mm256_loadu_si256((const __m256i *)(source_row_1 + 2 * i)), _mm256_loadu_si256((const __m256i *)(source_row_2 + 2 * i)));
+		const __m256i second = pixel_kernels_avx2_average_pairs(_mm256_loadu_si256((const __m256i *)(source_row_1 + 2 * i + 8)), _mm256_loadu_si256((const __m256i *)(source_row_2 + 2 * i + 8)));
+		// Packing interleaves the lanes of first and second; restore the order
+		_mm256_storeu_si256((__m256i *)(destination + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(first, second), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	return i;
+}/*}}}*/
+/* }}} */
+#endif
+
+#ifdef PIXEL_KERNELS_NEON
+/* NEON {{{ */
+static inline uint8x16_t pixel_kernels_neon_multiply(uint8x16_t value, uint8x16_t alpha) {/*{{{*/
+	// vraddhn(p, vrshr(p, 8)) is (p + ((p + 128) >> 8) + 128) >> 8, see
+	// pixel_kernels_multiply
+	const uint16x8_t low = vmull_u8(vget_low_u8(value), vget_low_u8(alpha));
+	const uint16x8_t high = vmull_u8(vget_high_u8(value), vget_high_u8(alpha));
+	return vcombine_u8(vraddhn_u16(low, vrshrq_n_u16(low, 8)), vraddhn_u16(high, vrshrq_n_u16(high, 8)));
+}/*}}}*/
+static size_t pixel_kernels_neon_premultiply(uint32_t *pixels, size_t count) {/*{{{*/
+	size_t i = 0;
+	for(; i + 16 <= count; i += 16) {
+		// Deinterleaved into B, G, R and A
+		uint8x16x4_t channels = vld4q_u8((const uint8_t *)(pixels + i));
+		channels.val[0] = pixel_kernels_neon_multiply(channels.val[0], channels.val[3]);
+		channels.val[1] = pixel_kernels_neon_multiply(channels.val[1], channels.val[3]);
+		channels.val[2] = pixel_kernels_neon_multiply(channels.val[2], channels.val[3]);
+		vst4q_u8((uint8_t *)(pixels + i), channels);
+	}
+	return i;
+}/*}}}*/
+static size_t pixel_kernels_neon_rgba_to_argb32(uint32_t *destination, const uint8_t *source, size_t count) {/*{{{*/
+	size_t i = 0;
+	for(; i + 16 <= count; i += 16) {
+		const uint8x16x4_t rgba = vld4q_u8(source + 4 * i);
+		uint8x16x4_t bgra;
+		bgra.val[0] = pixel_kernels_neon_multiply(rgba.val[2], rgba.val[3]);
+		bgra.val[1] = pixel_kernels_neon_multiply(rgba.val[1], rgba.val[3]);
+		bgra.val[2] = pixel_kernels_neon_multiply(rgba.val[0], rgba.val[3]);
+		bgra.val[3] = rgba.val[3];
+		vst4q_u8((uint8_t *)(destination + i), bgra);
+	}
+	return i;
+}/*}}}*/
+static size_t pixel_kernels_neon_rgb_to_argb32(uint32_t *destination, const uint8_t *source, size_t count) {/*{{{*/
+	size_t i = 0;
+	for(; i + 16 <= count; i += 16) {
+		const uint8x16x3_t rgb = vld3q_u8(source + 3 * i);
+		uint8x16x4_t bgra;
+		bgra.val[0] = rgb.val[2];
+		bgra.val[1] = rgb.val[1];
+		bgra.val[2] = rgb.val[0];
+		bgra.val[3] = vdupq_n_u8(255);
+		vst4q_u8((uint8_t *)(destination + i), bgra);
+	}
+	return i;
+}/*}}}*/
+static size_t pixel_kernels_neon_negate(uint32_t *destination, const uint32_t *source, size_t count) {/*{{{*/
+	size_t i = 0;
+	for(; i + 16 <= count; i += 16) {
+		uint8x16x4_t channels = vld4q_u8((const uint8_t *)(source + i));
+		channels.val[0] = vqsubq_u8(channels.val[3], channels.val[0]);
+		channels.val[1] = vqsubq_u8(channels.val[3], channels.val[1]);
+		channels.val[2] = vqsubq_u8(channels.val[3], channels.val[2]);
+		vst4q_u8((uint8_t *)(destination + i), channels);
+	}
+	return i;
+}/*}}}*/
+static size_t pixel_kernels_neon_downscale_2x(uint32_t *destination, size_t count, const uint32_t *source_row_1, const uint32_t *source_row_2, size_t source_count) {/*{{{*/
+	size_t i = 0;
+	for(; i + 8 <= count && 2 * i + 16 <= source_count; i += 8) {
+		const uint8x16x4_t row_1 = vld4q_u8((const uint8_t *)(source_row_1 + 2 * i));
+		const uint8x16x4_t row_2 = vld4q_u8((const uint8_t *)(source_row_2 + 2 * i));
+		uint8x8x4_t average;
+		for(int channel = 0; channel < 4; channel++) {
+			average.val[channel] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(row_1.val[channel]), row_2.val[channel]), 2);
+		}
+		vst4_u8((uint8_t *)(destination + i), average);
+	}
+	return i;
+}/*}}}*/
+/* }}} */
+#endif
+
+void pixel_kernels_premultiply(uint32_t *pixels, size_t count) {/*{{{*/
+	size_t i = 0;
+#ifdef PIXEL_KERNELS_AVX2
+	if(pixel_kernels_have_avx2()) {
+		i = pixel_kernels_avx2_premultiply(pixels, count);
+	}
+#endif
+#ifdef PIXEL_KERNELS_SSE2
+	i += pixel_kernels_sse2_premultiply(pixels + i, count - i);
+#endif
+#ifdef PIXEL_KERNELS_NEON
+	i = pixel_kernels_neon_premultiply(pixels, count);
+#endif
+	for(; i < count; i++) {
+		pixels[i] = pixel_kernels_premultiply_pixel(pixels[i]);
+	}
+}/*}}}*/
+void pixel_kernels_rgba_to_argb32(uint32_t *destination, const uint8_t *source, size_t count) {/*{{{*/
+	size_t i = 0;
+#ifdef PIXEL_KERNELS_AVX2
+	if(pixel_kernels_have_avx2()) {
+		i = pixel_kernels_avx2_rgba_to_argb32(destination, source, count);
+	}
+#endif
+#ifdef PIXEL_KERNELS_SSE2
+	i += pixel_kernels_sse2_rgba_to_argb32(destination + i, source + 4 * i, count - i);
+#endif
+#ifdef PIXEL_KERNELS_NEON
+	i = pixel_kernels_neon_rgba_to_argb32(destination, source, count);
+#endif
+	for(; i < count; i++) {
+		const uint8_t *pixel = source + 4 * i;
+		const uint32_t alpha = pixel[3];
+		destination[i] = (alpha << 24) | (pixel_kernels_multiply(pixel[0], alpha) << 16) | (pixel_kernels_multiply(pixel[1], alpha) << 8) | pixel_kernels_multiply(pixel[2], alpha);
+	}
+}/*}}}*/
+void pixel_kernels_rgb_to_argb32(uint32_t *destination, const uint8_t *source, size_t count) {/*{{{*/
+	size_t i = 0;
+#ifdef PIXEL_KERNELS_AVX2
+	if(pixel_kernels_have_avx2()) {
+		i = pixel_kernels_avx2_rgb_to_argb32(destination, source, count);
+	}
+#endif
+#ifdef PIXEL_KERNELS_NEON
+	i = pixel_kernels_neon_rgb_to_argb32(destination, source, count);
+#endif
+	for(; i < count; i++) {
+		const uint8_t *pixel = source + 3 * i;
+		destination[i] = 0xff000000 | ((uint32_t)pixel[0] << 16) | ((uint32_t)pixel[1] << 8) | pixel[2];
+	}
+}/*}}}*/
+void pixel_kernels_argb32_to_rgba(uint8_t *destination, const uint32_t *source, size_t count) {/*{{{*/
+	for(size_t i = 0; i < count; i++) {
+		const uint32_t pixel = source[i];
+		const uint32_t alpha = pixel >> 24;
+		uint8_t *target = destination + 4 * i;
+		if(alpha == 0xff) {
+			target[0] = pixel >> 16;
+			target[1] = pixel >> 8;
+			target[2] = pixel;
+		}
+		else if(alpha == 0) {
+			target[0] = target[1] = target[2] = 0;
+		}
+		else {
+			target[0] = ((((pixel >> 16) & 0xff) * 255) + alpha / 2) / alpha;
+			target[1] = ((((pixel >> 8) & 0xff) * 255) + alpha / 2) / alpha;
+			target[2] = (((pixel & 0xff) * 255) + alpha / 2) / alpha;
+		}
+		target[3] = alpha;
+	}
+}/*}}}*/
+void pixel_kernels_negate(uint32_t *destination, const uint32_t *source, size_t count) {/*{{{*/
+	size_t i = 0;
+#ifdef PIXEL_KERNELS_AVX2
+	if(pixel_kernels_have_avx2()) {
+		i = pixel_kernels_avx2_negate(destination, source, count);
+	}
+#endif
+#ifdef PIXEL_KERNELS_SSE2
+	i += pixel_kernels_sse2_negate(destination + i, source + i, count - i);
+#endif
+#ifdef PIXEL_KERNELS_NEON
+	i = pixel_kernels_neon_negate(destination, source, count);
+#endif
+	for(; i < count; i++) {
+		destination[i] = pixel_kernels_negate_pixel(source[i]);
+	}
+}/*}}}*/
+void pixel_kernels_downscale_2x(uint32_t *destination, size_t count, const uint32_t *source_row_1, const uint32_t *source_row_2, size_t source_count) {/*{{{*/
+	size_t i = 0;
+#ifdef PIXEL_KERNELS_AVX2
+	if(pixel_kernels_have_avx2()) {
+		i = pixel_kernels_avx2_downscale_2x(destination, count, source_row_1, source_row_2, source_count);
+	}
+#endif
+#ifdef PIXEL_KERNELS_SSE2
+	i += pixel_kernels_sse2_downscale_2x(destination + i, count - i, source_row_1 + 2 * i, source_row_2 + 2 * i, source_count - 2 * i);
+#endif
+#ifdef PIXEL_KERNELS_NEON
+	i = pixel_kernels_neon_downscale_2x(destination, count, source_row_1, source_row_2, source_count);
+#endif
+	for(; i < count; i++) {
+		const size_t left = 2 * i < source_count ? 2 * i : source_count - 1;
+		const size_t right = left + 1 < source_count ? left + 1 : left;
+		destination[i] = pixel_kernels_average_pixels(source_row_1[left], source_row_1[right], source_row_2[left], source_row_2[right]);
+	}
+}/*}}}*/
+void pixel_kernels_import_rows_to_surface(cairo_surface_t *surface, const uint8_t *pixels, int stride, int channels, int first_row, int row_count) {/*{{{*/
+	const int width = cairo_image_surface_get_width(surface);
+	const int surface_stride = cairo_image_surface_get_stride(surface);
+	uint8_t *surface_data = cairo_image_surface_get_data(surface);
+
+	cairo_surface_flush(surface);
+	for(int y = first_row; y < first_row + row_count; y++) {
+		uint32_t *row = (uint32_t *)(surface_data + (size_t)y * surface_stride);
+		const uint8_t *source_row = pixels + (size_t)y * stride;
+		if(channels == 4) {
+			pixel_kernels_rgba_to_argb32(row, source_row, width);
+		}
+		else {
+			pixel_kernels_rgb_to_argb32(row, source_row, width);
+		}
+	}
+	cairo_surface_mark_dirty_rectangle(surface, 0, first_row, width, row_count);
+}/*}}}*/
+void pixel_kernels_import_to_surface(cairo_surface_t *surface, const uint8_t *pixels, int stride, int channels) {/*{{{*/
+	pixel_kernels_import_rows_to_surface(surface, pixels, stride, channels, 0, cairo_image_surface_get_height(surface));
+}/*}}}*/
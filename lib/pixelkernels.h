@@ -0,0 +1,58 @@
+/**
+ * pqiv
+ *
+ * Copyright (c) 2013-2017, Phillip Berndt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Pixel conversion kernels for the loops that touch every pixel of an image
+//
+// All kernels write cairo's native endian, premultiplied ARGB32 and work on
+// a run of count pixels, usually one row of a surface. They use SSE2, AVX2
+// or NEON where the processor supports them, selected at runtime, and are
+// exact: Premultiplication rounds to the nearest value, like cairo does.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cairo/cairo.h>
+
+// Premultiply ARGB32 pixels with straight alpha, in place
+void pixel_kernels_premultiply(uint32_t *pixels, size_t count);
+
+// Convert bytes R, G, B, A with straight alpha to ARGB32
+void pixel_kernels_rgba_to_argb32(uint32_t *destination, const uint8_t *source, size_t count);
+
+// Convert bytes R, G, B to opaque ARGB32
+void pixel_kernels_rgb_to_argb32(uint32_t *destination, const uint8_t *source, size_t count);
+
+// Convert ARGB32 pixels to bytes R, G, B, A with straight alpha, rounding
+// like cairo's PNG writer. There is no vectorized version of this one.
+void pixel_kernels_argb32_to_rgba(uint8_t *destination, const uint32_t *source, size_t count);
+
+// Invert the colors of ARGB32 pixels, but not their alpha channel. May work
+// in place.
+void pixel_kernels_negate(uint32_t *destination, const uint32_t *source, size_t count);
+
+// Average the 2x2 blocks of two adjacent ARGB32 rows of source_count pixels
+// into count pixels. If source_count is less than 2 * count, the last source
+// column is repeated.
+void pixel_kernels_downscale_2x(uint32_t *destination, size_t count, const uint32_t *source_row_1, const uint32_t *source_row_2, size_t source_count);
+
+// Fill an ARGB32 image surface from 8 bit RGB (channels = 3) or RGBA
+// (channels = 4) pixels of the same size, e.g. a GdkPixbuf's
+void pixel_kernels_import_to_surface(cairo_surface_t *surface, const uint8_t *pixels, int stride, int channels);
+
+// The same, but only for row_count rows starting at first_row
+void pixel_kernels_import_rows_to_surface(cairo_surface_t *surface, const uint8_t *pixels, int stride, int channels, int first_row, int row_count);
@@ -36,6 +36,8 @@
 
 #include <stddef.h>	/* size_t */
 #include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "strnatcmp.h"
 
@@ -179,3 +181,53 @@ int
 strnatcasecmp(nat_char const *a, nat_char const *b) {
      return strnatcmp0(a, b, 1);
 }
+
+
+/* Build a key that compares with strcmp() the way strnatcasecmp() compares
+ * the original string. Whitespace is dropped and other characters are case
+ * folded. A run of digits that starts with a zero is compared left-aligned by
+ * strnatcmp0, and always before runs without a leading zero; it is encoded as
+ * '0', its digits, and a terminator that sorts before everything else. Other
+ * runs are compared by length first, so they are prefixed with their length,
+ * encoded as a sequence of '9's for each nine digits followed by the
+ * remainder. Both encodings start with a digit, so runs compare against
+ * other characters just like they do in strnatcmp0. */
+nat_char *
+strnatcasekey(nat_char const *a)
+{
+     /* A one-digit run with a leading zero needs three bytes */
+     nat_char *key = malloc(3 * strlen(a) + 1);
+     nat_char *out = key;
+
+     while (*a) {
+	  if (nat_isspace(*a)) {
+	       a++;
+	  } else if (nat_isdigit(*a)) {
+	       size_t length = 0;
+	       while (nat_isdigit(a[length]))
+		    length++;
+
+	       if (*a == '0') {
+		    *out++ = '0';
+		    memcpy(out, a, length);
+		    out += length;
+		    *out++ = '\001';
+	       } else {
+		    size_t remainder = length;
+		    while (remainder >= 9) {
+			 *out++ = '9';
+			 remainder -= 9;
+		    }
+		    *out++ = '0' + remainder;
+		    memcpy(out, a, length);
+		    out += length;
+	       }
+	       a += length;
+	  } else {
+	       *out++ = nat_toupper(*a++);
+	  }
+     }
+     *out = 0;
+
+     return key;
+}
@@ -29,3 +29,7 @@ typedef char nat_char;
 
 int strnatcmp(nat_char const *a, nat_char const *b);
 int strnatcasecmp(nat_char const *a, nat_char const *b);
+
+/* Return a newly malloc()ed key for a, such that strcmp() on two keys orders
+ * like strnatcasecmp() on the original strings. */
+nat_char *strnatcasekey(nat_char const *a);
@@ -92,6 +92,21 @@ static gchar *get_local_filename(file_t *file) {
 	return file_path;
 }
 
+static gchar *get_file_uri(const gchar *local_filename, const gchar *multi_page_suffix) {
+	// The Thumbnail Managing Standard identifies files by their escaped URI.
+	// For pages of multi-page documents, the suffix is appended, see below.
+	gchar *file_uri = g_filename_to_uri(local_filename, NULL, NULL);
+	if(!file_uri) {
+		file_uri = g_strdup_printf("file://%s", local_filename);
+	}
+	if(multi_page_suffix) {
+		gchar *page_uri = g_strdup_printf("%s#%s", file_uri, multi_page_suffix);
+		g_free(file_uri);
+		file_uri = page_uri;
+	}
+	return file_uri;
+}
+
 static const gchar *get_multi_page_suffix(file_t *file) {
 	// Multi-page documents do not have an unambigous file name
 	// Since the Thumbnail Managing Standard does not state how to format an
@@ -280,16 +295,477 @@ static cairo_surface_t *load_thumbnail(gchar *file_name, gchar *file_uri, time_t
 	return thumbnail;
 }
 
-/* This library's public API */
-gboolean load_thumbnail_from_cache(file_t *file, unsigned width, unsigned height, thumbnail_persist_mode_t persist_mode, char *special_thumbnail_directory) {
-	if(persist_mode == THUMBNAILS_PERSIST_OFF) {
+#ifndef _WIN32
+/* Packed thumbnail store
+ *
+ * THUMBNAILS_PERSIST_PACKED keeps all thumbnails of one image directory in a
+ * single append-only pack file, with the pixels stored as raw premultiplied
+ * ARGB32. A pack is mapped into memory once, and hits are wrapped into cairo
+ * surfaces without copying, so a lookup costs one stat() of the image itself
+ * instead of an open/stat/decode of a PNG per image.
+ *
+ * Layout: a struct thumbnail_pack_header, followed by entries. Each entry is
+ * a struct thumbnail_pack_entry_header, the NUL terminated URI (as used for
+ * the freedesktop thumbnails, including the multi-page suffix) and the pixel
+ * data. Entries are padded to THUMBNAIL_PACK_ALIGNMENT bytes. Later entries
+ * for the same URI supersede earlier ones; compact_thumbnail_packs() drops
+ * the superseded and stale ones.
+ */
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#define THUMBNAIL_PACK_MAGIC "PQIVTHPK"
+#define THUMBNAIL_PACK_VERSION 1
+#define THUMBNAIL_PACK_BYTE_ORDER_MARK 0x01020304
+#define THUMBNAIL_PACK_ENTRY_MAGIC 0x45544850
+#define THUMBNAIL_PACK_ALIGNMENT 16
+#define THUMBNAIL_PACK_ALIGN(x) (((x) + THUMBNAIL_PACK_ALIGNMENT - 1) & ~(THUMBNAIL_PACK_ALIGNMENT - 1))
+// Address space mapped beyond the end of a pack, such that appending to it
+// usually does not require mapping it anew
+#define THUMBNAIL_PACK_MAP_RESERVE (1 << 24)
+
+struct thumbnail_pack_header {
+	char magic[8];
+	uint32_t byte_order_mark;
+	uint32_t version;
+};
+
+struct thumbnail_pack_entry_header {
+	uint32_t magic;
+	uint32_t uri_length;
+	int64_t file_mtime;
+	int64_t file_size;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t data_offset;
+	uint64_t entry_length;
+};
+
+struct thumbnail_pack_mapping {
+	gint ref_count;
+	void *data;
+	// The part of the file known to be valid, and the size of the mapping.
+	// Pages past the end of the file become usable as the file grows.
+	size_t length;
+	size_t mapped_length;
+	dev_t device;
+	ino_t inode;
+};
+
+struct thumbnail_pack {
+	struct thumbnail_pack_mapping *mapping;
+	// URI -> offset of the newest entry for it, plus one
+	GHashTable *index;
+	size_t indexed_length;
+};
+
+// Pack file name -> struct thumbnail_pack, for all packs used in this session
+static GHashTable *thumbnail_packs;
+G_LOCK_DEFINE_STATIC(thumbnail_packs);
+
+static cairo_user_data_key_t thumbnail_pack_mapping_key;
+
+static void thumbnail_pack_mapping_unref(struct thumbnail_pack_mapping *mapping) {
+	// This is also the destroy notifier of the surfaces created from a
+	// mapping, which might run on any thread
+	if(g_atomic_int_dec_and_test(&mapping->ref_count)) {
+		munmap(mapping->data, mapping->mapped_length);
+		g_slice_free(struct thumbnail_pack_mapping, mapping);
+	}
+}
+
+static struct thumbnail_pack_mapping *thumbnail_pack_map(const gchar *pack_file_name) {
+	int fd = g_open(pack_file_name, O_RDONLY, 0);
+	if(fd < 0) {
+		return NULL;
+	}
+	struct stat pack_stat;
+	if(fstat(fd, &pack_stat) < 0 || (size_t)pack_stat.st_size < sizeof(struct thumbnail_pack_header)) {
+		g_close(fd, NULL);
+		return NULL;
+	}
+	const size_t mapped_length = pack_stat.st_size + THUMBNAIL_PACK_MAP_RESERVE;
+	void *data = mmap(NULL, mapped_length, PROT_READ, MAP_SHARED, fd, 0);
+	g_close(fd, NULL);
+	if(data == MAP_FAILED) {
+		return NULL;
+	}
+
+	const struct thumbnail_pack_header *header = data;
+	if(memcmp(header->magic, THUMBNAIL_PACK_MAGIC, sizeof(header->magic)) != 0 || header->byte_order_mark != THUMBNAIL_PACK_BYTE_ORDER_MARK || header->version != THUMBNAIL_PACK_VERSION) {
+		munmap(data, mapped_length);
+		return NULL;
+	}
+
+	struct thumbnail_pack_mapping *mapping = g_slice_new(struct thumbnail_pack_mapping);
+	mapping->ref_count = 1;
+	mapping->data = data;
+	mapping->length = pack_stat.st_size;
+	mapping->mapped_length = mapped_length;
+	mapping->device = pack_stat.st_dev;
+	mapping->inode = pack_stat.st_ino;
+	return mapping;
+}
+
+static gboolean thumbnail_pack_mapping_extend(struct thumbnail_pack_mapping *mapping, const gchar *pack_file_name) {
+	// If the pack has only grown, and still fits into the mapping, make the
+	// new part available. Must be called with the thumbnail_packs lock held.
+	struct stat pack_stat;
+	if(stat(pack_file_name, &pack_stat) < 0 || pack_stat.st_dev != mapping->device || pack_stat.st_ino != mapping->inode
+			|| (size_t)pack_stat.st_size < mapping->length || (size_t)pack_stat.st_size > mapping->mapped_length) {
+		return FALSE;
+	}
+	mapping->length = pack_stat.st_size;
+	return TRUE;
+}
+
+static const struct thumbnail_pack_entry_header *thumbnail_pack_entry_at(struct thumbnail_pack_mapping *mapping, size_t offset) {
+	// Returns the entry at offset if it is complete and sane, NULL otherwise
+	if(offset % THUMBNAIL_PACK_ALIGNMENT != 0 || offset + sizeof(struct thumbnail_pack_entry_header) > mapping->length) {
+		return NULL;
+	}
+	const struct thumbnail_pack_entry_header *entry = (const struct thumbnail_pack_entry_header *)((const char *)mapping->data + offset);
+	if(entry->magic != THUMBNAIL_PACK_ENTRY_MAGIC
+			|| entry->uri_length == 0
+			|| entry->entry_length % THUMBNAIL_PACK_ALIGNMENT != 0
+			|| entry->entry_length > mapping->length - offset
+			|| entry->data_offset % THUMBNAIL_PACK_ALIGNMENT != 0
+			|| entry->data_offset < sizeof(struct thumbnail_pack_entry_header) + entry->uri_length
+			|| entry->stride < entry->width * 4
+			|| (uint64_t)entry->data_offset + (uint64_t)entry->stride * entry->height > entry->entry_length) {
+		return NULL;
+	}
+	const char *uri = (const char *)entry + sizeof(struct thumbnail_pack_entry_header);
+	if(uri[entry->uri_length - 1] != 0) {
+		return NULL;
+	}
+	return entry;
+}
+
+static void thumbnail_pack_update_index(struct thumbnail_pack *pack) {
+	size_t offset = pack->indexed_length;
+	if(offset < sizeof(struct thumbnail_pack_header)) {
+		offset = sizeof(struct thumbnail_pack_header);
+	}
+	while(offset + sizeof(struct thumbnail_pack_entry_header) <= pack->mapping->length) {
+		const struct thumbnail_pack_entry_header *entry = thumbnail_pack_entry_at(pack->mapping, offset);
+		if(!entry) {
+			// A partially written entry, e.g. from a crash. Resynchronize at
+			// the next aligned position.
+			offset += THUMBNAIL_PACK_ALIGNMENT;
+			continue;
+		}
+		g_hash_table_replace(pack->index, g_strdup((const char *)entry + sizeof(struct thumbnail_pack_entry_header)), GSIZE_TO_POINTER(offset + 1));
+		offset += entry->entry_length;
+	}
+	pack->indexed_length = offset;
+}
+
+static void thumbnail_pack_free(struct thumbnail_pack *pack) {
+	if(pack->mapping) {
+		thumbnail_pack_mapping_unref(pack->mapping);
+	}
+	g_hash_table_unref(pack->index);
+	g_slice_free(struct thumbnail_pack, pack);
+}
+
+static struct thumbnail_pack *thumbnail_pack_get(const gchar *pack_file_name, gboolean remap) {
+	// Must be called with the thumbnail_packs lock held
+	if(!thumbnail_packs) {
+		thumbnail_packs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)thumbnail_pack_free);
+	}
+	struct thumbnail_pack *pack = g_hash_table_lookup(thumbnail_packs, pack_file_name);
+	if(!pack) {
+		pack = g_slice_new0(struct thumbnail_pack);
+		pack->index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		g_hash_table_insert(thumbnail_packs, g_strdup(pack_file_name), pack);
+		remap = TRUE;
+	}
+	if(remap && pack->mapping && thumbnail_pack_mapping_extend(pack->mapping, pack_file_name)) {
+		thumbnail_pack_update_index(pack);
+	}
+	else if(remap) {
+		// Surfaces created from the old mapping keep it alive
+		struct thumbnail_pack_mapping *mapping = thumbnail_pack_map(pack_file_name);
+		if(pack->mapping) {
+			thumbnail_pack_mapping_unref(pack->mapping);
+		}
+		pack->mapping = mapping;
+		if(!mapping || mapping->length < pack->indexed_length) {
+			// The pack was removed, replaced or truncated
+			g_hash_table_remove_all(pack->index);
+			pack->indexed_length = 0;
+		}
+		if(mapping) {
+			thumbnail_pack_update_index(pack);
+		}
+	}
+	return pack->mapping ? pack : NULL;
+}
+
+static gchar *get_thumbnail_pack_directory(char *special_thumbnail_directory) {
+	return g_build_filename(special_thumbnail_directory ? special_thumbnail_directory : get_thumbnail_cache_directory(), thumbnail_levels[0], "packs", NULL);
+}
+
+static gchar *get_thumbnail_pack_file_name(const gchar *local_filename, unsigned width, unsigned height, char *special_thumbnail_directory) {
+	// One pack per image directory and thumbnail size
+	gchar *file_dirname = g_path_get_dirname(local_filename);
+	gchar *md5_dirname = g_compute_checksum_for_string(G_CHECKSUM_MD5, file_dirname, -1);
+	gchar *pack_directory = get_thumbnail_pack_directory(special_thumbnail_directory);
+	gchar *pack_file_name = g_strdup_printf("%s%s%dx%d%s%s.pack", pack_directory, G_DIR_SEPARATOR_S, width, height, G_DIR_SEPARATOR_S, md5_dirname);
+	g_free(pack_directory);
+	g_free(md5_dirname);
+	g_free(file_dirname);
+	return pack_file_name;
+}
+
+static cairo_surface_t *load_thumbnail_from_pack(const gchar *pack_file_name, const gchar *file_uri, struct stat *file_stat, unsigned width, unsigned height) {
+	cairo_surface_t *thumbnail = NULL;
+
+	G_LOCK(thumbnail_packs);
+	struct thumbnail_pack *pack = thumbnail_pack_get(pack_file_name, FALSE);
+	if(pack) {
+		size_t offset = GPOINTER_TO_SIZE(g_hash_table_lookup(pack->index, file_uri));
+		const struct thumbnail_pack_entry_header *entry = offset ? thumbnail_pack_entry_at(pack->mapping, offset - 1) : NULL;
+		if(entry && entry->file_mtime == (int64_t)file_stat->st_mtime && entry->file_size == (int64_t)file_stat->st_size && entry->width <= width && entry->height <= height && (entry->width == width || entry->height == height)) {
+			// The surface is never drawn to, so the read-only mapping can
+			// back it directly
+			thumbnail = cairo_image_surface_create_for_data((unsigned char *)entry + entry->data_offset, CAIRO_FORMAT_ARGB32, entry->width, entry->height, entry->stride);
+			if(cairo_surface_status(thumbnail) == CAIRO_STATUS_SUCCESS) {
+				g_atomic_int_inc(&pack->mapping->ref_count);
+				cairo_surface_set_user_data(thumbnail, &thumbnail_pack_mapping_key, pack->mapping, (cairo_destroy_func_t)thumbnail_pack_mapping_unref);
+			}
+			else {
+				cairo_surface_destroy(thumbnail);
+				thumbnail = NULL;
+			}
+		}
+	}
+	G_UNLOCK(thumbnail_packs);
+
+	return thumbnail;
+}
+
+static gboolean thumbnail_pack_append(int fd, const gchar *file_uri, struct stat *file_stat, cairo_surface_t *thumbnail) {
+	// fd must be locked. Writes the entry in a single write(2), such that a
+	// failure leaves at most one partial entry for the index to skip.
+	struct stat pack_stat;
+	if(fstat(fd, &pack_stat) < 0) {
+		return FALSE;
+	}
+
+	size_t header_length = pack_stat.st_size == 0 ? sizeof(struct thumbnail_pack_header) : 0;
+	size_t padding_length = THUMBNAIL_PACK_ALIGN((size_t)pack_stat.st_size) - pack_stat.st_size;
+	unsigned thumbnail_width = cairo_image_surface_get_width(thumbnail);
+	unsigned thumbnail_height = cairo_image_surface_get_height(thumbnail);
+	unsigned thumbnail_stride = cairo_image_surface_get_stride(thumbnail);
+	size_t uri_length = strlen(file_uri) + 1;
+	size_t data_offset = THUMBNAIL_PACK_ALIGN(sizeof(struct thumbnail_pack_entry_header) + uri_length);
+	size_t entry_length = THUMBNAIL_PACK_ALIGN(data_offset + (size_t)thumbnail_stride * thumbnail_height);
+
+	size_t buffer_length = header_length + padding_length + entry_length;
+	char *buffer = g_malloc0(buffer_length);
+	if(header_length) {
+		struct thumbnail_pack_header *header = (struct thumbnail_pack_header *)buffer;
+		memcpy(header->magic, THUMBNAIL_PACK_MAGIC, sizeof(header->magic));
+		header->byte_order_mark = THUMBNAIL_PACK_BYTE_ORDER_MARK;
+		header->version = THUMBNAIL_PACK_VERSION;
+	}
+	char *entry_buffer = buffer + header_length + padding_length;
+	struct thumbnail_pack_entry_header *entry = (struct thumbnail_pack_entry_header *)entry_buffer;
+	entry->magic = THUMBNAIL_PACK_ENTRY_MAGIC;
+	entry->uri_length = uri_length;
+	entry->file_mtime = file_stat->st_mtime;
+	entry->file_size = file_stat->st_size;
+	entry->width = thumbnail_width;
+	entry->height = thumbnail_height;
+	entry->stride = thumbnail_stride;
+	entry->data_offset = data_offset;
+	entry->entry_length = entry_length;
+	memcpy(entry_buffer + sizeof(struct thumbnail_pack_entry_header), file_uri, uri_length);
+	memcpy(entry_buffer + data_offset, cairo_image_surface_get_data(thumbnail), (size_t)thumbnail_stride * thumbnail_height);
+
+	ssize_t result = write(fd, buffer, buffer_length);
+	g_free(buffer);
+	return result >= 0 && (size_t)result == buffer_length;
+}
+
+static int thumbnail_pack_open_locked(const gchar *pack_file_name, int flags) {
+	// Open and exclusively lock a pack. Compaction replaces a pack by
+	// renaming a new file over it, so a process that waited for the lock
+	// might hold the replaced file afterwards; entries it appended there
+	// would be lost. Open the pack again in that case.
+	while(TRUE) {
+		int fd = g_open(pack_file_name, flags, 0600);
+		if(fd < 0) {
+			return -1;
+		}
+		if(flock(fd, LOCK_EX) < 0) {
+			g_close(fd, NULL);
+			return -1;
+		}
+		struct stat fd_stat, path_stat;
+		if(fstat(fd, &fd_stat) < 0) {
+			flock(fd, LOCK_UN);
+			g_close(fd, NULL);
+			return -1;
+		}
+		if(stat(pack_file_name, &path_stat) == 0 && fd_stat.st_dev == path_stat.st_dev && fd_stat.st_ino == path_stat.st_ino) {
+			return fd;
+		}
+		flock(fd, LOCK_UN);
+		g_close(fd, NULL);
+	}
+}
+
+static gboolean store_thumbnail_to_pack(const gchar *pack_file_name, const gchar *file_uri, struct stat *file_stat, cairo_surface_t *thumbnail) {
+	// The pixels are stored as-is, so they must be ARGB32
+	if(cairo_image_surface_get_format(thumbnail) == CAIRO_FORMAT_ARGB32) {
+		cairo_surface_reference(thumbnail);
+	}
+	else {
+		cairo_surface_t *argb_thumbnail = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, cairo_image_surface_get_width(thumbnail), cairo_image_surface_get_height(thumbnail));
+		cairo_t *cr = cairo_create(argb_thumbnail);
+		cairo_set_source_surface(cr, thumbnail, 0, 0);
+		cairo_paint(cr);
+		cairo_destroy(cr);
+		thumbnail = argb_thumbnail;
+	}
+	cairo_surface_flush(thumbnail);
+	if(cairo_surface_status(thumbnail) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(thumbnail);
 		return FALSE;
 	}
 
+	gchar *pack_directory = g_path_get_dirname(pack_file_name);
+	if(!g_file_test(pack_directory, G_FILE_TEST_IS_DIR)) {
+		g_mkdir_with_parents(pack_directory, 0700);
+	}
+	g_free(pack_directory);
+
+	gboolean retval = FALSE;
+	// Other instances of pqiv might append to or compact the same pack
+	int fd = thumbnail_pack_open_locked(pack_file_name, O_CREAT | O_WRONLY | O_APPEND);
+	if(fd >= 0) {
+		retval = thumbnail_pack_append(fd, file_uri, file_stat, thumbnail);
+		flock(fd, LOCK_UN);
+		g_close(fd, NULL);
+	}
+	cairo_surface_destroy(thumbnail);
+
+	if(retval) {
+		G_LOCK(thumbnail_packs);
+		thumbnail_pack_get(pack_file_name, TRUE);
+		G_UNLOCK(thumbnail_packs);
+	}
+
+	return retval;
+}
+
+static gboolean thumbnail_pack_entry_is_current(const gchar *file_uri, const struct thumbnail_pack_entry_header *entry) {
+	// The URI of a page of a multi-page document is file://path#suffix, see
+	// get_file_uri(). A '#' within the path is escaped.
+	gchar *document_uri = g_strdup(file_uri);
+	gchar *suffix_separator = strchr(document_uri, '#');
+	if(suffix_separator) {
+		*suffix_separator = 0;
+	}
+	gchar *local_filename = g_filename_from_uri(document_uri, NULL, NULL);
+	g_free(document_uri);
+	if(!local_filename) {
+		return FALSE;
+	}
+	struct stat file_stat;
+	int stat_result = stat(local_filename, &file_stat);
+	g_free(local_filename);
+	return stat_result == 0 && entry->file_mtime == (int64_t)file_stat.st_mtime && entry->file_size == (int64_t)file_stat.st_size;
+}
+
+static int compact_thumbnail_pack(const gchar *pack_file_name) {
+	// Rewrite a pack with only the newest entry per URI, and only for
+	// images that still exist unmodified. Returns the number of dropped
+	// entries, or -1 on failure.
+	int fd = thumbnail_pack_open_locked(pack_file_name, O_RDWR);
+	if(fd < 0) {
+		return -1;
+	}
+
+	struct thumbnail_pack pack = { thumbnail_pack_map(pack_file_name), NULL, 0 };
+	if(!pack.mapping) {
+		flock(fd, LOCK_UN);
+		g_close(fd, NULL);
+		return -1;
+	}
+	pack.index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	thumbnail_pack_update_index(&pack);
+
+	int dropped_entries = 0;
+	size_t offset = sizeof(struct thumbnail_pack_header);
+	while(offset < pack.indexed_length) {
+		const struct thumbnail_pack_entry_header *entry = thumbnail_pack_entry_at(pack.mapping, offset);
+		if(!entry) {
+			offset += THUMBNAIL_PACK_ALIGNMENT;
+			continue;
+		}
+		const gchar *file_uri = (const char *)entry + sizeof(struct thumbnail_pack_entry_header);
+		if(GPOINTER_TO_SIZE(g_hash_table_lookup(pack.index, file_uri)) != offset + 1) {
+			// Superseded by a later entry
+			dropped_entries++;
+		}
+		else if(!thumbnail_pack_entry_is_current(file_uri, entry)) {
+			g_hash_table_remove(pack.index, file_uri);
+			dropped_entries++;
+		}
+		offset += entry->entry_length;
+	}
+
+	int retval = -1;
+	gchar *temporary_file_name = g_strdup_printf("%s.%d.tmp", pack_file_name, (int)getpid());
+	int temporary_fd = g_open(temporary_file_name, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+	if(temporary_fd >= 0) {
+		gboolean success = TRUE;
+		struct thumbnail_pack_header header;
+		memcpy(header.magic, THUMBNAIL_PACK_MAGIC, sizeof(header.magic));
+		header.byte_order_mark = THUMBNAIL_PACK_BYTE_ORDER_MARK;
+		header.version = THUMBNAIL_PACK_VERSION;
+		success = write(temporary_fd, &header, sizeof(header)) == sizeof(header);
+
+		// Entries are self-contained and the header length is aligned, so
+		// they can be copied verbatim. The order is irrelevant.
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, pack.index);
+		while(success && g_hash_table_iter_next(&iter, NULL, &value)) {
+			const struct thumbnail_pack_entry_header *entry = thumbnail_pack_entry_at(pack.mapping, GPOINTER_TO_SIZE(value) - 1);
+			ssize_t result = write(temporary_fd, entry, entry->entry_length);
+			success = result >= 0 && (uint64_t)result == entry->entry_length;
+		}
+
+		g_close(temporary_fd, NULL);
+		if(success && g_rename(temporary_file_name, pack_file_name) == 0) {
+			retval = dropped_entries;
+		}
+		else {
+			g_unlink(temporary_file_name);
+		}
+	}
+	g_free(temporary_file_name);
+
+	g_hash_table_unref(pack.index);
+	thumbnail_pack_mapping_unref(pack.mapping);
+	flock(fd, LOCK_UN);
+	g_close(fd, NULL);
+	return retval;
+}
+#endif
+
+static cairo_surface_t *load_thumbnail_from_png_cache(file_t *file, unsigned width, unsigned height, char *special_thumbnail_directory) {
+
 	// Obtain a local path to the file
 	gchar *local_filename = get_local_filename(file);
 	if(!local_filename) {
-		return FALSE;
+		return NULL;
 	}
 	const gchar *multi_page_suffix = get_multi_page_suffix(file);
 
@@ -297,12 +773,12 @@ gboolean load_thumbnail_from_cache(file_t *file, unsigned width, unsigned height
 	struct stat file_stat;
 	if(stat(local_filename, &file_stat) < 0) {
 		g_free(local_filename);
-		return FALSE;
+		return NULL;
 	}
 	time_t file_mtime = file_stat.st_mtime;
 
 	// Obtain the name of the candidate for the local thumbnail file
-	gchar *file_uri = multi_page_suffix ? g_strdup_printf("file://%s#%s", local_filename, multi_page_suffix) : g_strdup_printf("file://%s", local_filename);
+	gchar *file_uri = get_file_uri(local_filename, multi_page_suffix);
 	gchar *md5_filename = g_compute_checksum_for_string(G_CHECKSUM_MD5, file_uri, -1);
 
 	// Search two directory structures: special_thumbnail_directory, then get_thumbnail_cache_directory()
@@ -323,11 +799,10 @@ gboolean load_thumbnail_from_cache(file_t *file, unsigned width, unsigned height
 				cairo_surface_t *thumbnail = load_thumbnail(thumbnail_candidate, file_uri, file_mtime, width, height);
 				g_free(thumbnail_candidate);
 				if(thumbnail != NULL) {
-					file->thumbnail = thumbnail;
 					g_free(local_filename);
 					g_free(file_uri);
 					g_free(md5_filename);
-					return TRUE;
+					return thumbnail;
 				}
 			}
 			else {
@@ -364,11 +839,11 @@ gboolean load_thumbnail_from_cache(file_t *file, unsigned width, unsigned height
 				cairo_surface_t *thumbnail = load_thumbnail(thumbnail_candidate, file_basename, file_mtime, width, height);
 				g_free(thumbnail_candidate);
 				if(thumbnail != NULL) {
-					file->thumbnail = thumbnail;
 					g_free(md5_basename);
+					g_free(file_basename);
 					g_free(local_filename);
 					g_free(shared_thumbnail_directory);
-					return TRUE;
+					return thumbnail;
 				}
 			}
 			else {
@@ -382,7 +857,54 @@ gboolean load_thumbnail_from_cache(file_t *file, unsigned width, unsigned height
 	g_free(shared_thumbnail_directory);
 	g_free(local_filename);
 
-	return FALSE;
+	return NULL;
+}
+
+#ifndef _WIN32
+static cairo_surface_t *load_thumbnail_from_packed_cache(file_t *file, unsigned width, unsigned height, char *special_thumbnail_directory) {
+	gchar *local_filename = get_local_filename(file);
+	if(!local_filename) {
+		return NULL;
+	}
+	const gchar *multi_page_suffix = get_multi_page_suffix(file);
+
+	struct stat file_stat;
+	if(stat(local_filename, &file_stat) < 0) {
+		g_free(local_filename);
+		return NULL;
+	}
+
+	gchar *file_uri = get_file_uri(local_filename, multi_page_suffix);
+	gchar *pack_file_name = get_thumbnail_pack_file_name(local_filename, width, height, special_thumbnail_directory);
+	g_free(local_filename);
+
+	cairo_surface_t *thumbnail = load_thumbnail_from_pack(pack_file_name, file_uri, &file_stat, width, height);
+	if(!thumbnail) {
+		// Fall back to thumbnails in the PNG based store, e.g. from other
+		// programs, and import them such that the next lookup is a hit
+		thumbnail = load_thumbnail_from_png_cache(file, width, height, special_thumbnail_directory);
+		if(thumbnail) {
+			store_thumbnail_to_pack(pack_file_name, file_uri, &file_stat, thumbnail);
+		}
+	}
+
+	g_free(pack_file_name);
+	g_free(file_uri);
+	return thumbnail;
+}
+#endif
+
+/* This library's public API */
+cairo_surface_t *load_thumbnail_from_cache(file_t *file, unsigned width, unsigned height, thumbnail_persist_mode_t persist_mode, char *special_thumbnail_directory) {
+	if(persist_mode == THUMBNAILS_PERSIST_OFF) {
+		return NULL;
+	}
+#ifndef _WIN32
+	if(persist_mode == THUMBNAILS_PERSIST_PACKED) {
+		return load_thumbnail_from_packed_cache(file, width, height, special_thumbnail_directory);
+	}
+#endif
+	return load_thumbnail_from_png_cache(file, width, height, special_thumbnail_directory);
 }
 
 struct png_writer_info {
@@ -453,14 +975,14 @@ static cairo_status_t png_writer(struct png_writer_info *info, const unsigned ch
 	return CAIRO_STATUS_SUCCESS;
 }
 
-gboolean store_thumbnail_to_cache(file_t *file, unsigned width, unsigned height, thumbnail_persist_mode_t persist_mode, char *special_thumbnail_directory) {
+gboolean store_thumbnail_to_cache(file_t *file, cairo_surface_t *thumbnail, unsigned width, unsigned height, thumbnail_persist_mode_t persist_mode, char *special_thumbnail_directory) {
 	if(persist_mode == THUMBNAILS_PERSIST_OFF || persist_mode == THUMBNAILS_PERSIST_RO) {
 		return FALSE;
 	}
 
 	// We only store thumbnails if they have the correct size
-	unsigned actual_width  = cairo_image_surface_get_width(file->thumbnail);
-	unsigned actual_height = cairo_image_surface_get_height(file->thumbnail);
+	unsigned actual_width  = cairo_image_surface_get_width(thumbnail);
+	unsigned actual_height = cairo_image_surface_get_height(thumbnail);
 	int thumbnail_level;
 
 	// If the file didn't need thumbnailing, don't store a thumbnail either.
@@ -470,6 +992,28 @@ gboolean store_thumbnail_to_cache(file_t *file, unsigned width, unsigned height,
 		return FALSE;
 	}
 
+#ifndef _WIN32
+	if(persist_mode == THUMBNAILS_PERSIST_PACKED) {
+		gchar *local_filename = get_local_filename(file);
+		if(!local_filename) {
+			return FALSE;
+		}
+		const gchar *multi_page_suffix = get_multi_page_suffix(file);
+		struct stat file_stat;
+		if(stat(local_filename, &file_stat) < 0) {
+			g_free(local_filename);
+			return FALSE;
+		}
+		gchar *file_uri = get_file_uri(local_filename, multi_page_suffix);
+		gchar *pack_file_name = get_thumbnail_pack_file_name(local_filename, width, height, special_thumbnail_directory);
+		gboolean retval = store_thumbnail_to_pack(pack_file_name, file_uri, &file_stat, thumbnail);
+		g_free(pack_file_name);
+		g_free(file_uri);
+		g_free(local_filename);
+		return retval;
+	}
+#endif
+
 	if(width == 256 && height == 256) {
 		thumbnail_level = 1;
 	}
@@ -529,12 +1073,7 @@ gboolean store_thumbnail_to_cache(file_t *file, unsigned width, unsigned height,
 	}
 	else {
 		// Use the standardized cache format, possibly with special directory
-		if(multi_page_suffix) {
-			file_uri = g_strdup_printf("file://%s#%s", local_filename, multi_page_suffix);
-		}
-		else {
-			file_uri = g_strdup_printf("file://%s", local_filename);
-		}
+		file_uri = get_file_uri(local_filename, multi_page_suffix);
 		md5_filename = g_compute_checksum_for_string(G_CHECKSUM_MD5, file_uri, -1);
 		if(thumbnail_level == 0) {
 			thumbnail_directory = g_strdup_printf("%s%s%s%s%dx%d", special_thumbnail_directory ? special_thumbnail_directory : get_thumbnail_cache_directory(), G_DIR_SEPARATOR_S, thumbnail_levels[thumbnail_level], G_DIR_SEPARATOR_S, width, height);
@@ -558,7 +1097,7 @@ gboolean store_thumbnail_to_cache(file_t *file, unsigned width, unsigned height,
 	if(file_fd >= 0) {
 		gchar *string_mtime = g_strdup_printf("%" PRIuMAX, (intmax_t)file_mtime);
 		struct png_writer_info writer_info = { file_fd, 0, file_uri, string_mtime };
-		if(cairo_surface_write_to_png_stream(file->thumbnail, (cairo_write_func_t)png_writer, &writer_info) != CAIRO_STATUS_SUCCESS) {
+		if(cairo_surface_write_to_png_stream(thumbnail, (cairo_write_func_t)png_writer, &writer_info) != CAIRO_STATUS_SUCCESS) {
 			g_unlink(thumbnail_file);
 			retval = FALSE;
 		}
@@ -574,6 +1113,54 @@ gboolean store_thumbnail_to_cache(file_t *file, unsigned width, unsigned height,
 	return retval;
 }
 
+int compact_thumbnail_packs(char *special_thumbnail_directory) {
+#ifndef _WIN32
+	// Compacts all packs below the pack directory, one directory per
+	// thumbnail size
+	int dropped_entries = 0;
+	gchar *pack_directory = get_thumbnail_pack_directory(special_thumbnail_directory);
+	GDir *size_dir = g_dir_open(pack_directory, 0, NULL);
+	if(!size_dir) {
+		g_free(pack_directory);
+		return 0;
+	}
+
+	G_LOCK(thumbnail_packs);
+	const gchar *size_dir_entry;
+	while((size_dir_entry = g_dir_read_name(size_dir))) {
+		gchar *size_directory = g_build_filename(pack_directory, size_dir_entry, NULL);
+		GDir *dir = g_dir_open(size_directory, 0, NULL);
+		if(dir) {
+			const gchar *dir_entry;
+			while((dir_entry = g_dir_read_name(dir))) {
+				if(!g_str_has_suffix(dir_entry, ".pack")) {
+					continue;
+				}
+				gchar *pack_file_name = g_build_filename(size_directory, dir_entry, NULL);
+				int pack_dropped_entries = compact_thumbnail_pack(pack_file_name);
+				if(pack_dropped_entries > 0) {
+					dropped_entries += pack_dropped_entries;
+				}
+				// Offsets into the old pack are meaningless now
+				if(thumbnail_packs) {
+					g_hash_table_remove(thumbnail_packs, pack_file_name);
+				}
+				g_free(pack_file_name);
+			}
+			g_dir_close(dir);
+		}
+		g_free(size_directory);
+	}
+	G_UNLOCK(thumbnail_packs);
+
+	g_dir_close(size_dir);
+	g_free(pack_directory);
+	return dropped_entries;
+#else
+	return 0;
+#endif
+}
+
 #else
 void __thumbnailcache__empty_translation_unit() {}
 #endif
@@ -20,8 +20,15 @@
 #include "../pqiv.h"
 
 #ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
-typedef enum { THUMBNAILS_PERSIST_OFF, THUMBNAILS_PERSIST_ON, THUMBNAILS_PERSIST_STANDARD, THUMBNAILS_PERSIST_RO, THUMBNAILS_PERSIST_LOCAL } thumbnail_persist_mode_t;
+typedef enum { THUMBNAILS_PERSIST_OFF, THUMBNAILS_PERSIST_ON, THUMBNAILS_PERSIST_STANDARD, THUMBNAILS_PERSIST_RO, THUMBNAILS_PERSIST_LOCAL, THUMBNAILS_PERSIST_PACKED } thumbnail_persist_mode_t;
 
-gboolean load_thumbnail_from_cache(file_t *file, unsigned width, unsigned height, thumbnail_persist_mode_t persist_mode, char *special_thumbnail_directory);
-gboolean store_thumbnail_to_cache(file_t *file, unsigned width, unsigned height, thumbnail_persist_mode_t persist_mode, char *special_thumbnail_directory);
+// Neither function touches file->thumbnail, so that they can run without holding
+// the file tree's lock: load returns a new surface or NULL, store writes the given one.
+cairo_surface_t *load_thumbnail_from_cache(file_t *file, unsigned width, unsigned height, thumbnail_persist_mode_t persist_mode, char *special_thumbnail_directory);
+gboolean store_thumbnail_to_cache(file_t *file, cairo_surface_t *thumbnail, unsigned width, unsigned height, thumbnail_persist_mode_t persist_mode, char *special_thumbnail_directory);
+
+// Rewrites the pack files of THUMBNAILS_PERSIST_PACKED without superseded
+// entries and entries of changed or removed images. Returns the number of
+// dropped entries.
+int compact_thumbnail_packs(char *special_thumbnail_directory);
 #endif
@@ -0,0 +1,102 @@
+/**
+ * pqiv
+ *
+ * Copyright (c) 2013-2017, Phillip Berndt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * See https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT for the
+ * format description.
+ */
+#include "zipindex.h"
+#include <string.h>
+
+#define ZIP_END_OF_CENTRAL_DIRECTORY_SIGNATURE 0x06054b50
+#define ZIP_END_OF_CENTRAL_DIRECTORY_SIZE 22
+#define ZIP_CENTRAL_DIRECTORY_SIGNATURE 0x02014b50
+#define ZIP_CENTRAL_DIRECTORY_SIZE 46
+#define ZIP_LOCAL_FILE_HEADER_SIGNATURE 0x04034b50
+#define ZIP_MAX_COMMENT_LENGTH 0xffff
+
+static guint16 read_uint16(const unsigned char *data) {
+	return data[0] | (data[1] << 8);
+}
+
+static guint32 read_uint32(const unsigned char *data) {
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((guint32)data[3] << 24);
+}
+
+GHashTable *zip_index_new(const char *data, gsize data_size) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	if(data_size < ZIP_END_OF_CENTRAL_DIRECTORY_SIZE) {
+		return NULL;
+	}
+
+	// The end of central directory record is followed by a comment of up to
+	// 64k, so search backwards for its signature
+	gsize eocd_pos = data_size - ZIP_END_OF_CENTRAL_DIRECTORY_SIZE;
+	gsize eocd_min_pos = eocd_pos > ZIP_MAX_COMMENT_LENGTH ? eocd_pos - ZIP_MAX_COMMENT_LENGTH : 0;
+	while(read_uint32(&bytes[eocd_pos]) != ZIP_END_OF_CENTRAL_DIRECTORY_SIGNATURE) {
+		if(eocd_pos == eocd_min_pos) {
+			return NULL;
+		}
+		eocd_pos--;
+	}
+
+	const unsigned char *eocd = &bytes[eocd_pos];
+	guint16 disk_number = read_uint16(&eocd[4]);
+	guint16 central_directory_disk = read_uint16(&eocd[6]);
+	guint16 entry_count = read_uint16(&eocd[10]);
+	guint32 central_directory_size = read_uint32(&eocd[12]);
+	guint32 central_directory_offset = read_uint32(&eocd[16]);
+	if(disk_number != 0 || central_directory_disk != 0 || entry_count == 0xffff || central_directory_offset == 0xffffffff || central_directory_size > eocd_pos) {
+		// Spanned or ZIP64 archive
+		return NULL;
+	}
+
+	// Offsets are relative to the start of the archive, which need not be
+	// the start of the file, e.g. for self-extracting archives
+	gsize central_directory_pos = eocd_pos - central_directory_size;
+	if(central_directory_pos < central_directory_offset) {
+		return NULL;
+	}
+	gsize base_offset = central_directory_pos - central_directory_offset;
+
+	GHashTable *index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	gsize pos = central_directory_pos;
+	for(guint i=0; i<entry_count; i++) {
+		if(pos + ZIP_CENTRAL_DIRECTORY_SIZE > eocd_pos || read_uint32(&bytes[pos]) != ZIP_CENTRAL_DIRECTORY_SIGNATURE) {
+			g_hash_table_unref(index);
+			return NULL;
+		}
+		const unsigned char *header = &bytes[pos];
+		guint16 name_length = read_uint16(&header[28]);
+		guint16 extra_length = read_uint16(&header[30]);
+		guint16 comment_length = read_uint16(&header[32]);
+		guint32 local_header_offset = read_uint32(&header[42]);
+		if(pos + ZIP_CENTRAL_DIRECTORY_SIZE + name_length > eocd_pos) {
+			g_hash_table_unref(index);
+			return NULL;
+		}
+
+		gsize local_header_pos = base_offset + local_header_offset;
+		if(local_header_offset != 0xffffffff && local_header_pos + 4 <= data_size && read_uint32(&bytes[local_header_pos]) == ZIP_LOCAL_FILE_HEADER_SIGNATURE) {
+			gint64 *offset = g_new(gint64, 1);
+			*offset = local_header_pos;
+			g_hash_table_replace(index, g_strndup((const char *)&header[ZIP_CENTRAL_DIRECTORY_SIZE], name_length), offset);
+		}
+
+		pos += ZIP_CENTRAL_DIRECTORY_SIZE + name_length + extra_length + comment_length;
+	}
+
+	return index;
+}
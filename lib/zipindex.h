@@ -0,0 +1,33 @@
+/**
+ * pqiv
+ *
+ * Copyright (c) 2013-2017, Phillip Berndt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Random access into ZIP files for the archive backends
+//
+// libarchive can only read archives sequentially, which makes loading the
+// n-th entry of an archive O(n). The central directory of a ZIP file lists
+// the offsets of all local file headers, so a reader for the streamable
+// ZIP format can be opened directly at the entry instead.
+//
+
+#include <glib.h>
+
+// Parse the central directory of the in-memory ZIP file data. Returns
+// a table from entry names to the (gint64 *) offset of their local file
+// headers in data, or NULL if data is not a ZIP file this can handle
+// (e.g. ZIP64 or spanned archives).
+GHashTable *zip_index_new(const char *data, gsize data_size);
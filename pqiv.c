@@ -21,7 +21,10 @@
 #include "pqiv.h"
 #include "lib/config_parser.h"
 #include "lib/thumbnailcache.h"
+#include "lib/filebuffer.h"
 #include "lib/strnatcmp.h"
+#include "lib/pixelkernels.h"
+#include "lib/netpbm.h"
 #include <cairo/cairo.h>
 #include <gio/gio.h>
 #include <glib/gstdio.h>
@@ -51,7 +54,13 @@
 	#include <gio/gwin32inputstream.h>
 #else
 	#include <sys/wait.h>
+	#include <sys/stat.h>
+	#include <dirent.h>
+	#include <signal.h>
 	#include <gio/gunixinputstream.h>
+	#ifdef __linux__
+		#include <sys/syscall.h>
+	#endif
 #endif
 #ifdef GDK_WINDOWING_X11
 	#include <gdk/gdkx.h>
@@ -62,6 +71,14 @@
 		#include <X11/Xatom.h>
 	#endif
 #endif
+#ifndef CONFIGURED_WITHOUT_OPENGL /* option --without-opengl: Do not include support for presenting images using OpenGL (--opengl) */
+	// GtkGLArea is available from GTK 3.16 on. The GNUmakefile defines
+	// HAVE_EPOXY if libepoxy, which provides the GL function pointers, is found.
+	#if GTK_CHECK_VERSION(3, 16, 0) && defined(HAVE_EPOXY)
+		#define PQIV_OPENGL
+		#include <epoxy/gl.h>
+	#endif
+#endif
 
 #ifdef DEBUG
 	#ifndef _WIN32
@@ -113,7 +130,7 @@ void initialize_file_type_handlers(const gchar * const * disabled_backends);
 // These lists are accessed from multiple threads:
 //  * The main thread (count, next, prev, ..)
 //  * The option parser thread, if --lazy-load is used
-//  * The image loader thread
+//  * The image loader threads and the loader's garbage collector thread
 // Our thread safety strategy is as follows:
 //  * Wrap all file_tree operations with mutexes
 //  * Use weak references for any operation during which the image might
@@ -124,37 +141,202 @@ void initialize_file_type_handlers(const gchar * const * disabled_backends);
 //  * If an operation takes too long for this to work, redesign the
 //    operation
 G_LOCK_DEFINE_STATIC(file_tree);
+// How long the lock is waited for and held, see the output_statistics action.
+// Protected by the lock itself. Times are in microseconds.
+struct lock_statistics {
+	gint64 acquired_at;
+	guint64 acquisitions;
+	guint64 contentions;
+	gint64 wait_time;
+	gint64 hold_time;
+	gint64 max_hold_time;
+} file_tree_lock_statistics;
+static inline void lock_statistics_acquired(struct lock_statistics *statistics) {/*{{{*/
+	statistics->acquisitions++;
+	statistics->acquired_at = g_get_monotonic_time();
+}/*}}}*/
+static inline void lock_statistics_released(struct lock_statistics *statistics) {/*{{{*/
+	const gint64 hold_time = g_get_monotonic_time() - statistics->acquired_at;
+	statistics->hold_time += hold_time;
+	if(hold_time > statistics->max_hold_time) {
+		statistics->max_hold_time = hold_time;
+	}
+}/*}}}*/
+static inline void lock_statistics_lock(GMutex *mutex, struct lock_statistics *statistics) {/*{{{*/
+	// Only contended acquisitions are timed, the others do not wait
+	if(!g_mutex_trylock(mutex)) {
+		const gint64 begin = g_get_monotonic_time();
+		g_mutex_lock(mutex);
+		statistics->contentions++;
+		statistics->wait_time += g_get_monotonic_time() - begin;
+	}
+	lock_statistics_acquired(statistics);
+}/*}}}*/
+static inline void lock_statistics_unlock(GMutex *mutex, struct lock_statistics *statistics) {/*{{{*/
+	lock_statistics_released(statistics);
+	g_mutex_unlock(mutex);
+}/*}}}*/
+static inline void lock_statistics_cond_wait(GCond *cond, GMutex *mutex, struct lock_statistics *statistics) {/*{{{*/
+	// The lock is not held while waiting
+	lock_statistics_released(statistics);
+	g_cond_wait(cond, mutex);
+	lock_statistics_acquired(statistics);
+}/*}}}*/
 // In case of trouble:
 #if 0
 	#define D_LOCK(x) g_print("Waiting for lock " #x " at line %d\n", __LINE__); G_LOCK(x); g_print("  Locked " #x " at line %d\n", __LINE__)
 	#define D_UNLOCK(x) g_print("Unlocked " #x " at line %d\n", __LINE__); G_UNLOCK(x);
+	#define D_COND_WAIT(cond, x) g_print("Waiting for condition on lock " #x " at line %d\n", __LINE__); g_cond_wait(cond, &G_LOCK_NAME(x))
 #else
-	#define D_LOCK(x) G_LOCK(x)
-	#define D_UNLOCK(x) G_UNLOCK(x)
+	#define D_LOCK(x) lock_statistics_lock(&G_LOCK_NAME(x), &x ## _lock_statistics)
+	#define D_UNLOCK(x) lock_statistics_unlock(&G_LOCK_NAME(x), &x ## _lock_statistics)
+	#define D_COND_WAIT(cond, x) lock_statistics_cond_wait(cond, &G_LOCK_NAME(x), &x ## _lock_statistics)
 #endif
 BOSTree *file_tree;
 BOSNode *current_file_node = NULL;
 BOSNode *earlier_file_node = NULL;
-BOSNode *image_loader_thread_currently_loading = NULL;
+// One slot per image loader thread, holding the node the thread currently
+// works on. Protected by file_tree's lock.
+BOSNode **image_loader_threads_currently_loading = NULL;
+// Each slot's load can be cancelled individually, see
+// cancel_running_image_loads(). A cancellable is only ever reset by the
+// thread that owns the slot, which also finds its own through
+// image_loader_thread_cancellable.
+GCancellable **image_loader_threads_cancellables = NULL;
+GPrivate image_loader_thread_cancellable;
+// Signalled whenever a slot is released or the GC thread completes a pass
+GCond image_loader_threads_currently_loading_cond;
 gboolean file_tree_valid = FALSE;
 
-// We asynchroniously load images in a separate thread
+// We asynchroniously load images in a pool of separate threads
+//
+// The loaders work through a priority queue, which holds at most one item
+// per node. Lower values take precedence.
+typedef enum {
+	LOAD_PRIORITY_CURRENT,      // The image the user is waiting for
+	LOAD_PRIORITY_VISIBLE,      // Thumbnails visible in montage mode
+	LOAD_PRIORITY_ADJACENT,     // Preloading of the adjacent images
+	LOAD_PRIORITY_BACKGROUND,   // Thumbnail generation for images out of view
+	LOAD_PRIORITY_COUNT
+} image_loader_priority_t;
 struct image_loader_queue_item {
 	BOSNode *node_ref;
 	int purpose;
+	image_loader_priority_t priority;
+	// Set once the persistent thumbnail cache has been searched in vain. Such
+	// items are requeued, such that all pending cache lookups are done before
+	// the (much slower) decoding of images for their thumbnails.
+	gboolean thumbnail_cache_checked;
+	// When the item was queued: Merging does not reset this
+	gint64 queued_at;
+};
+struct image_loader_queue {
+	GMutex lock;
+	GCond cond;
+	GQueue items[LOAD_PRIORITY_COUNT];
+	// Maps nodes to their queue item's GList link in items
+	GHashTable *index;
+	// Pending render of the current image at a new scale level, see
+	// queue_scaled_image_render(). Takes precedence over the items.
+	struct scaled_image_render_job *render_job;
+	// How long items waited until a loader thread picked them up, in
+	// microseconds, see the output_statistics action
+	guint64 waits;
+	gint64 wait_time;
+	gint64 max_wait_time;
+} *image_loader_queue = NULL;
+
+// Backends that are not parallel-safe are only ever used by one loader
+// thread at a time
+G_LOCK_DEFINE_STATIC(image_loader_serialized_backends);
+
+// The prerendered views of all files are protected by a lock of their own,
+// which is only ever held briefly. Unlike the files' locks, it is not held
+// while a backend decodes an image, so the main thread can always pick up a
+// prerendered view as a stand-in.
+G_LOCK_DEFINE_STATIC(prerendered_views);
+
+// Unloading of files is handled by a single thread, in a GC fashion, which
+// is notified via the gc queue after each load. For that, we keep a list of
+// weak references to the loaded files. Each file's link in it is stored in
+// file->loaded_files_link.
+GQueue loaded_files_list = G_QUEUE_INIT;
+GAsyncQueue *image_loader_gc_queue = NULL;
+guint image_loader_gc_requests_queued = 0;
+guint image_loader_gc_requests_done = 0;
+
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+// New thumbnails are written to the persistent cache by a separate thread,
+// such that the loader threads do not wait for the PNG encoder and the disk
+struct thumbnail_store_job {
+	BOSNode *node_ref;
+	cairo_surface_t *thumbnail;
 };
-GAsyncQueue *image_loader_queue = NULL;
-GCancellable *image_loader_cancellable = NULL;
+GAsyncQueue *thumbnail_store_queue = NULL;
 
-// Unloading of files is also handled by that thread, in a GC fashion
-// For that, we keep a list of loaded files
-GList *loaded_files_list = NULL;
+// Bytes used by all files' thumbnails, see image_loader_set_thumbnail().
+// Protected by file_tree's lock.
+gsize thumbnails_memory_bytes = 0;
+#endif
+
+// Loaded images outside of the preload window are kept as a cache of up to
+// option_cache_size megabytes. loaded_files_list is ordered by recency of use
+// for that, most recently used first. The counters are protected by
+// file_tree's lock.
+guint image_cache_hits = 0;
+guint image_cache_misses = 0;
 
 // Filter for path traversing upon building the file list
 GHashTable *load_images_file_filter_hash_table;
 GtkFileFilterInfo *load_images_file_filter_info;
 GTimer *load_images_timer;
 
+// Directory listings are read ahead by a pool of scanner threads, such that
+// the recursion in load_images_handle_parameter() does not wait for one
+// directory after the other. Listings are removed from the table once the
+// recursion takes them, or once loading the argument they were read ahead
+// for has finished. Protected by directory_listings_mutex.
+#define DIRECTORY_SCANNER_THREADS 8
+struct directory_listing_entry {
+	gchar *name;
+	// Whether the entry is a directory, and its modification time if
+	// sorting by it, or -1 if unknown
+	gint is_directory;
+	gint64 mtime;
+};
+struct directory_listing {
+	enum { DIRECTORY_LISTING_QUEUED, DIRECTORY_LISTING_READING, DIRECTORY_LISTING_COMPLETE } state;
+	gint depth;
+	gboolean failed;
+	gboolean from_cache;
+	gint64 mtime;
+	GArray *entries;
+	// The number of threads waiting to take the listing, and whether it is to
+	// be dropped once it is complete
+	gint waiters;
+	gboolean abandoned;
+};
+GHashTable *directory_listings = NULL;
+GMutex directory_listings_mutex;
+GCond directory_listings_cond;
+GThreadPool *directory_scanner_pool = NULL;
+
+// With --directory-cache, the listings used while loading a command line
+// argument are stored on disk, and the next run uses them instead of reading
+// the directories. The thread loading the argument owns the cache; once
+// loading has finished, a background pass re-reads directories whose mtime
+// changed and loads new files from them.
+struct directory_cache {
+	gchar *index_file_name;
+	// Path -> struct directory_listing, from the previous run
+	GHashTable *cached;
+	// Path -> struct directory_listing, as used in this run
+	GHashTable *current;
+};
+#define DIRECTORY_CACHE_INDEX_MAGIC "PQIVDIRS2"
+GPrivate directory_cache_active = G_PRIVATE_INIT(NULL);
+GSList *directory_caches_pending_validation = NULL;
+
 // Easy access to the file_t within a node
 // Remember to always lock file_tree!
 #define FILE(x) ((file_t *)(x)->data)
@@ -166,6 +348,11 @@ GTimer *load_images_timer;
 // The node to be displayed first, used in conjunction with --browse
 BOSNode *browse_startup_node = NULL;
 
+// While the initial file list is loaded without --lazy-load, nothing looks at
+// the sorted file tree. Its nodes are collected here instead, and sorted
+// into the tree at once in the end.
+GPtrArray *file_tree_deferred_nodes = NULL;
+
 // When loading additional images via the -r option, we need to know whether the
 // image loader initialization succeeded, because we can't just cancel if it does
 // not (it checks if any image is loadable and fails if not)
@@ -215,6 +402,135 @@ cairo_surface_t *last_visible_surface = NULL;
 cairo_surface_t *fading_surface = NULL;
 cairo_surface_t *current_scaled_image_surface = NULL;
 
+// Scaled images that are much larger than the screen are not rendered in one
+// piece, but in tiles, on demand for the visible part of the image (see
+// window_draw_scaled_image_tiles). The tiles are kept in most recently used
+// order and invalidated along with current_scaled_image_surface.
+#define SCALED_IMAGE_TILE_SIZE 512
+struct scaled_image_tile {
+	int column;
+	int row;
+	cairo_surface_t *surface;
+};
+GQueue scaled_image_tiles = G_QUEUE_INIT;
+
+#ifdef PQIV_OPENGL
+// With --opengl, a GtkGLArea covering the window presents the current image
+// (see opengl_area_render_callback). The image is uploaded as textures at its
+// decoded resolution, in tiles of at most OPENGL_TILE_SIZE pixels, and again
+// only if it is reloaded or for new animation frames; zooming, panning,
+// rotation, the background pattern, negation and fades run on the GPU. The
+// scene is rendered to one of two frame textures; the other keeps the last
+// complete frame to fade from.
+#define OPENGL_TILE_SIZE 4096
+#define OPENGL_TEXTURE_BUDGET (1 << 26) // pixels
+enum opengl_shading_mode { OPENGL_SHADE_CAIRO_TEXTURE, OPENGL_SHADE_TEXTURE, OPENGL_SHADE_CHECKERBOARD, OPENGL_SHADE_COLOR };
+struct opengl_image_tile {
+	GLuint texture;
+	// The part of the image covered by this tile, in texture pixels, and the
+	// texture coordinates of that part: Tiles overlap by a pixel, such that
+	// interpolation does not leave visible seams.
+	int x, y, width, height;
+	GLfloat s0, t0, s1, t1;
+};
+struct {
+	GLuint program;
+	GLint uniform_mode, uniform_color, uniform_alpha, uniform_negate, uniform_texture;
+	GLuint vertex_array, vertex_buffer;
+
+	GLuint framebuffer;
+	GLuint frame_textures[2];
+	int frame_width, frame_height;
+	gboolean last_frame_valid;
+
+	GArray *image_tiles;
+	file_t *image_file;
+	double image_scale;
+	gboolean image_stale;
+
+	GLuint preview_texture;
+
+	GLuint overlay_texture;
+	int overlay_height;
+	gchar *overlay_text;
+	int overlay_x, overlay_y;
+} opengl;
+GtkWidget *opengl_area = NULL;
+gboolean opengl_area_usable = FALSE;
+#endif
+file_t *scaled_image_tiles_file = NULL;
+double scaled_image_tiles_scale_level = 0;
+
+// If the scaled image surface is not cached, the current image is rendered at
+// the new scale level by a loader thread, and a stand-in is drawn meanwhile.
+// A new request supersedes the previous one; jobs for outdated generations
+// are discarded, running ones stop early. All of this is protected by the
+// file_tree lock, but a running job also peeks at the generation without it,
+// after each band of this many rows.
+#define SCALED_IMAGE_RENDER_BAND_HEIGHT 256
+struct scaled_image_render_job {
+	BOSNode *node_ref;
+	double scale_level;
+	guint generation;
+};
+guint scaled_image_render_generation = 0;
+BOSNode *scaled_image_render_node = NULL;
+double scaled_image_render_scale_level = 0;
+gboolean scaled_image_render_in_progress = FALSE;
+
+// Partially decoded versions of images that are being loaded, which the main
+// window and the montage show until the load completes. Loads register here
+// if their image is visible, see image_loader_publish_progress(). Maps file_t
+// pointers to struct progressive_preview, protected by its own lock, which
+// must be acquired after all others.
+#define PROGRESSIVE_PREVIEW_INTERVAL 200000 // usec
+struct progressive_preview {
+	cairo_surface_t *surface;
+	gint64 last_update;
+};
+G_LOCK_DEFINE_STATIC(progressive_previews);
+GHashTable *progressive_previews = NULL;
+gboolean progressive_previews_redraw_queued = FALSE;
+
+// Wall times of the stages an image passes through, see stage_timer_end().
+typedef enum {
+	STAGE_STREAM_OPEN,
+	STAGE_LOAD,
+	STAGE_PRERENDER,
+	STAGE_PRERENDER_PYRAMID,
+	STAGE_THUMBNAIL,
+	STAGE_CACHE_LOOKUP,
+	STAGE_CACHE_STORE,
+	STAGE_DRAW,
+	STAGE_COUNT
+} stage_t;
+static const char * const stage_names[STAGE_COUNT] = { "stream_open", "load", "prerender", "prerender_pyramid", "thumbnail", "cache_lookup", "cache_store", "draw" };
+
+// Diagnostics, see the output_statistics action. The statistics lock is a
+// leaf. It protects the stage timers, their samples, which are only
+// recorded for --benchmark, the trace events, only recorded with
+// --trace-file, and statistics_decoded_bytes. The hit and miss counters are
+// updated atomically. Times are in microseconds.
+struct stage_statistics {
+	guint64 count;
+	gint64 total_time;
+	gint64 max_time;
+};
+G_LOCK_DEFINE_STATIC(statistics);
+struct stage_statistics stage_statistics[STAGE_COUNT];
+GArray *stage_samples[STAGE_COUNT];
+GString *trace_events = NULL;
+GPrivate trace_thread_id;
+gint trace_threads = 0;
+guint64 statistics_decoded_bytes = 0;
+gint statistics_prerender_hits = 0;
+gint statistics_prerender_misses = 0;
+gint statistics_thumbnail_cache_hits = 0;
+gint statistics_thumbnail_cache_misses = 0;
+gboolean option_benchmark = FALSE;
+gchar *option_benchmark_actions = NULL;
+gchar *option_trace_file = NULL;
+
 #if !defined(CONFIGURED_WITHOUT_INFO_TEXT) || !defined(CONFIGURED_WITHOUT_MONTAGE_MODE)
 struct {
 	double fg_red;
@@ -241,8 +557,14 @@ gint current_shift_y = 0;
 guint32 last_button_press_time = 0;
 guint32 last_button_release_time = 0;
 guint current_image_animation_timeout_id = 0;
+// Set while the animation waits for image_animation_frame_ready()
+gboolean current_image_animation_frame_pending = FALSE;
 gdouble current_image_animation_speed_scale = 1.0;
 
+// Direction of the most recent relative movement. The preload window is
+// skewed towards it.
+gint preload_direction = 1;
+
 // -1 means no slideshow, 0 means active slideshow but no current timeout
 // source set, anything bigger than that actually is a slideshow id.
 gint slideshow_timeout_id = -1;
@@ -307,6 +629,9 @@ gboolean option_enforce_window_aspect_ratio = FALSE;
 gboolean cursor_visible = TRUE;
 gboolean cursor_auto_hide_mode_enabled = FALSE;
 gboolean option_negate = FALSE;
+#ifdef PQIV_OPENGL
+gboolean option_opengl = FALSE;
+#endif
 int cursor_auto_hide_timer_id = 0;
 #ifndef CONFIGURED_WITHOUT_ACTIONS
 gboolean option_actions_from_stdin = FALSE;
@@ -317,6 +642,14 @@ static const gboolean option_actions_from_stdin = FALSE;
 double option_fading_duration = .5;
 double option_keyboard_timeout = .5;
 gint option_max_depth = -1;
+gint option_loader_threads = 0;
+struct {
+	gint ahead;
+	gint behind;
+	gint budget;
+} option_preload = { 1, 1, 0 };
+gint option_cache_size = 0;
+gboolean option_directory_cache = FALSE;
 gboolean option_browse = FALSE;
 enum { QUIT, WAIT, WRAP, WRAP_NO_RESHUFFLE } option_end_of_files_action = WRAP;
 enum { ON, OFF, CHANGES_ONLY } option_watch_files = ON;
@@ -332,6 +665,7 @@ enum { AUTO, FAST, GOOD, BEST } option_interpolation_quality = AUTO;
 enum { CHECKERBOARD, BLACK, WHITE } option_background_pattern = CHECKERBOARD;
 
 gboolean options_background_pattern_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error);
+gboolean option_benchmark_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error);
 #ifndef CONFIGURED_WITHOUT_ACTIONS
 gboolean options_bind_key_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error);
 char *key_binding_sequence_to_string(guint key_binding_value, gchar *prefix);
@@ -340,6 +674,7 @@ gboolean help_show_key_bindings(const gchar *option_name, const gchar *value, gp
 gboolean help_show_version(const gchar *option_name, const gchar *value, gpointer data, GError **error);
 gboolean option_window_position_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error);
 gboolean option_thumbnail_size_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error);
+gboolean option_preload_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error);
 gboolean option_thumbnail_preload_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error);
 gboolean option_scale_level_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error);
 gboolean option_thumbnail_persistence_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error);
@@ -366,6 +701,9 @@ struct {
 	gint height;
 	gint auto_generate_for_adjacents;
 } option_thumbnails = { 0, THUMBNAILS_PERSIST_RO, NULL, 128, 128, -1 };
+gboolean option_generate_thumbnails = FALSE;
+// Whether --thumbnail-persistence was given, rather than defaulting to read-only
+gboolean option_thumbnail_persistence_given = FALSE;
 
 struct {
 	int scroll_y;
@@ -373,7 +711,30 @@ struct {
 	gboolean show_binding_overlays;
 } montage_window_control;
 
+// The composited montage, see window_draw_thumbnail_montage(). Each cell
+// remembers what it shows, holding a reference to the thumbnail or the
+// partially decoded image, such that a change can be detected by comparing
+// the pointers. Only used by the main thread.
+struct montage_page_cell {
+	cairo_surface_t *content;
+	gboolean is_preview;
+	gboolean selected;
+	gboolean valid;
+};
+struct {
+	cairo_surface_t *surface;
+	int width;
+	int height;
+	int thumbnail_width;
+	int thumbnail_height;
+	int scroll_y;
+	unsigned n_cells;
+	struct montage_page_cell *cells;
+} montage_page;
+
 enum { MONTAGE_MODE_WRAP_OFF, MONTAGE_MODE_WRAP_ROWS, MONTAGE_MODE_WRAP_FULL, _MONTAGE_MODE_WRAP_SENTINEL } option_montage_mode_wrap_mode = MONTAGE_MODE_WRAP_ROWS;
+#else
+static const gboolean option_generate_thumbnails = FALSE;
 #endif
 
 struct Point {
@@ -405,7 +766,7 @@ GOptionEntry options[] = {
 	{ "zoom-level", 'z', 0, G_OPTION_ARG_DOUBLE, &option_initial_scale, "Set initial zoom level (1.0 is 100%)", "FLOAT" },
 
 #ifndef CONFIGURED_WITHOUT_EXTERNAL_COMMANDS
-	{ "command-1", '1', 0, G_OPTION_ARG_STRING, &external_image_filter_commands[0], "Bind the external COMMAND to key 1. See manpage for extended usage (commands starting with `>' or `|'). Use 2..9 for further commands.", "COMMAND" },
+	{ "command-1", '1', 0, G_OPTION_ARG_STRING, &external_image_filter_commands[0], "Bind the external COMMAND to key 1. See manpage for extended usage (commands starting with `>', `|' or `||'). Use 2..9 for further commands.", "COMMAND" },
 	{ "command-2", '2', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &external_image_filter_commands[1], NULL, NULL },
 	{ "command-3", '3', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &external_image_filter_commands[2], NULL, NULL },
 	{ "command-4", '4', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &external_image_filter_commands[3], NULL, NULL },
@@ -422,6 +783,7 @@ GOptionEntry options[] = {
 	{ "allow-empty-window", 0, 0, G_OPTION_ARG_NONE, &option_allow_empty_window, "Show pqiv/do not quit even though no files are loaded", NULL },
 #endif
 	{ "background-pattern", 0, 0, G_OPTION_ARG_CALLBACK, &options_background_pattern_callback, "Set the background pattern to use for transparent images", "PATTERN" },
+	{ "benchmark", 0, G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK, &option_benchmark_callback, "Visit the images without opening a window, following ACTIONS if given, and write the time spent in each stage as JSON", "ACTIONS" },
 #ifndef CONFIGURED_WITHOUT_ACTIONS
 	{ "bind-key", 0, 0, G_OPTION_ARG_CALLBACK, &options_bind_key_callback, "Rebind a key to another action, see manpage and --show-bindings output for details.", "KEY BINDING" },
 #endif
@@ -429,14 +791,25 @@ GOptionEntry options[] = {
 	{ "box-colors", 0, 0, G_OPTION_ARG_CALLBACK, (gpointer)&option_box_colors_callback, "Set box colors", "TEXT:BACKGROUND" },
 #endif
 	{ "browse", 0, 0, G_OPTION_ARG_NONE, &option_browse, "For each command line argument, additionally load all images from the image's directory", NULL },
+	{ "cache-size", 0, 0, G_OPTION_ARG_INT, &option_cache_size, "Keep up to MB megabytes of recently viewed images in memory", "MB" },
+	{ "directory-cache", 0, 0, G_OPTION_ARG_NONE, &option_directory_cache, "Remember directory listings between runs and validate them in the background", NULL },
 	{ "disable-backends", 0, 0, G_OPTION_ARG_STRING, &option_disable_backends, "Disable the given backends", "BACKENDS" },
 	{ "disable-scaling", 0, G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK, &option_scale_level_callback, "Disable scaling of images", NULL },
 	{ "end-of-files-action", 0, 0, G_OPTION_ARG_CALLBACK, &option_end_of_files_action_callback, "Action to take after all images have been viewed. (`quit', `wait', `wrap', `wrap-no-reshuffle')", "ACTION" },
 	{ "enforce-window-aspect-ratio", 0, 0, G_OPTION_ARG_NONE, &option_enforce_window_aspect_ratio, "Fix the aspect ratio of the window to match the current image's", NULL },
 	{ "fade-duration", 0, 0, G_OPTION_ARG_DOUBLE, &option_fading_duration, "Adjust fades' duration", "SECONDS" },
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+	{ "generate-thumbnails", 0, 0, G_OPTION_ARG_NONE, &option_generate_thumbnails, "Store the thumbnails of all images to the cache and exit, without opening a window", NULL },
+#endif
+	{ "loader-threads", 0, 0, G_OPTION_ARG_INT, &option_loader_threads, "Use COUNT threads to load images (default: number of processors)", "COUNT" },
 	{ "low-memory", 0, 0, G_OPTION_ARG_NONE, &option_lowmem, "Try to keep memory usage to a minimum", NULL },
 	{ "max-depth", 0, 0, G_OPTION_ARG_INT, &option_max_depth, "Descend at most LEVELS levels of directories below the command line arguments", "LEVELS" },
 	{ "negate", 0, 0, G_OPTION_ARG_NONE, &option_negate, "Negate images: show negatives", NULL },
+#ifdef PQIV_OPENGL
+	{ "opengl", 0, 0, G_OPTION_ARG_NONE, &option_opengl, "Present images using OpenGL", NULL },
+#endif
+	{ "preload", 0, 0, G_OPTION_ARG_CALLBACK, &option_preload_callback, "Preload AHEAD images in the direction of navigation and BEHIND in the other", "AHEAD,BEHIND" },
+	{ "preload-budget", 0, 0, G_OPTION_ARG_INT, &option_preload.budget, "Use at most MB megabytes for preloaded images", "MB" },
 	{ "recreate-window", 0, 0, G_OPTION_ARG_NONE, &option_recreate_window, "Create a new window instead of resizing the old one", NULL },
 	{ "scale-mode-screen-fraction", 0, 0, G_OPTION_ARG_DOUBLE, &option_scale_screen_fraction, "Screen fraction to use for auto-scaling", "FLOAT" },
 	{ "shuffle", 0, 0, G_OPTION_ARG_NONE, &option_shuffle, "Shuffle files", NULL },
@@ -449,6 +822,7 @@ GOptionEntry options[] = {
 	{ "thumbnail-preload", 0, 0, G_OPTION_ARG_CALLBACK, &option_thumbnail_preload_callback, "Preload the adjacent COUNT thumbnails", "COUNT" },
 	{ "thumbnail-persistence", 0, 0, G_OPTION_ARG_CALLBACK, &option_thumbnail_persistence_callback, "Persist thumbnails to disk, to DIRECTORY.", "DIRECTORY" },
 #endif
+	{ "trace-file", 0, 0, G_OPTION_ARG_STRING, &option_trace_file, "Record when images pass through which stage, and write that to FILE in Chrome's trace event format upon exit", "FILE" },
 	{ "wait-for-images-to-appear", 0, 0, G_OPTION_ARG_NONE, &option_wait_for_images_to_appear, "If no images are found, wait until at least one appears", NULL },
 	{ "watch-directories", 0, 0, G_OPTION_ARG_NONE, &option_watch_directories, "Watch directories for new files", NULL },
 	{ "watch-files", 0, 0, G_OPTION_ARG_CALLBACK, &option_watch_files_callback, "Watch files for changes on disk (`on`, `off', `changes-only', i.e. do nothing on deletetion)", "VALUE" },
@@ -704,6 +1078,9 @@ const struct pqiv_action_descriptor {
 	{ "move_window", PARAMETER_2SHORT },
 	{ "toggle_background_pattern", PARAMETER_INT },
 	{ "toggle_negate_mode", PARAMETER_INT },
+	{ "output_cache_statistics", PARAMETER_NONE },
+	{ "compact_thumbnail_cache", PARAMETER_NONE },
+	{ "output_statistics", PARAMETER_NONE },
 	{ NULL, 0 }
 };
 /* }}} */
@@ -738,11 +1115,18 @@ typedef int image_loader_purpose_t;
 gboolean test_and_invalidate_thumbnail(file_t *file);
 gboolean image_loader_load_single(BOSNode *node, gboolean called_from_main);
 gboolean fading_timeout_callback(gpointer user_data);
+struct image_loader_queue_item *image_loader_queue_pop(struct scaled_image_render_job **render_job);
+void scaled_image_render_job_run(struct scaled_image_render_job *job, int thread_index);
 void queue_image_load(BOSNode *);
+void image_loader_queue_push_full(BOSNode *, image_loader_purpose_t, image_loader_priority_t, gboolean);
 #ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
-void queue_thumbnail_load(BOSNode *);
+void queue_thumbnail_load(BOSNode *, image_loader_priority_t);
+void image_loader_set_thumbnail(file_t *file, cairo_surface_t *thumbnail);
 #endif
+size_t surface_memory_usage(cairo_surface_t *surface);
+void image_cache_touch(BOSNode *);
 void unload_image(BOSNode *);
+void unload_image_immediately(BOSNode *);
 void remove_image(BOSNode *);
 gboolean initialize_gui_callback(gpointer);
 gboolean initialize_image_loader();
@@ -783,6 +1167,8 @@ gboolean handle_input_event_timeout_callback(gpointer user_data);
 #ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
 gboolean montage_window_get_move_cursor_target(int, int, int, int*, int*, int*, BOSNode **);
 void montage_window_move_cursor(int, int, int);
+void montage_window_queue_draw_node(gconstpointer node);
+void montage_page_invalidate();
 #endif
 // }}}
 /* Helper functions {{{ */
@@ -818,6 +1204,19 @@ gboolean options_background_pattern_callback(const gchar *option_name, const gch
 
 	return TRUE;
 }/*}}}*/
+gboolean option_benchmark_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error) {/*{{{*/
+	option_benchmark = TRUE;
+	if(value) {
+#ifdef CONFIGURED_WITHOUT_ACTIONS
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED, "This pqiv has been built without support for actions, --benchmark does not accept any.");
+		return FALSE;
+#else
+		g_free(option_benchmark_actions);
+		option_benchmark_actions = g_strdup(value);
+#endif
+	}
+	return TRUE;
+}/*}}}*/
 #ifndef CONFIGURED_WITHOUT_ACTIONS /* option --without-actions: Do not include support for configurable key/mouse bindings and actions */
 gboolean options_bind_key_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error) {/*{{{*/
 	// Format for value:
@@ -847,6 +1246,25 @@ gboolean option_thumbnail_size_callback(const gchar *option_name, const gchar *v
 	g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED, "Unexpected argument value for the --thumbnail-size option. Format must be e.g. `320x240'.");
 	return FALSE;
 }/*}}}*/
+gboolean option_preload_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error) {/*{{{*/
+	gchar *second;
+	option_preload.ahead = g_ascii_strtoll(value, &second, 10);
+	if(second != value && option_preload.ahead >= 0) {
+		if(*second == 0) {
+			option_preload.behind = option_preload.ahead;
+			return TRUE;
+		}
+		if(*second == ',') {
+			option_preload.behind = g_ascii_strtoll(second + 1, &second, 10);
+			if(*second == 0 && option_preload.behind >= 0) {
+				return TRUE;
+			}
+		}
+	}
+
+	g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED, "Unexpected argument value for the --preload option. Format must be e.g. `3,1'.");
+	return FALSE;
+}/*}}}*/
 gboolean option_thumbnail_preload_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error) {/*{{{*/
 	option_thumbnails.enabled = 1;
 	option_thumbnails.auto_generate_for_adjacents = g_ascii_strtoll(value, NULL, 10);
@@ -858,6 +1276,7 @@ gboolean option_thumbnail_preload_callback(const gchar *option_name, const gchar
 	return TRUE;
 }/*}}}*/
 gboolean option_thumbnail_persistence_callback(const gchar *option_name, const gchar *value, gpointer data, GError **error) {/*{{{*/
+	option_thumbnail_persistence_given = TRUE;
 	if(option_thumbnails.special_thumbnail_directory != NULL) {
 		g_free(option_thumbnails.special_thumbnail_directory);
 		option_thumbnails.special_thumbnail_directory = NULL;
@@ -877,6 +1296,14 @@ gboolean option_thumbnail_persistence_callback(const gchar *option_name, const g
 	else if(strcasecmp(value, "local") == 0) {
 		option_thumbnails.persist = THUMBNAILS_PERSIST_LOCAL;
 	}
+	else if(strcasecmp(value, "packed") == 0) {
+#ifndef _WIN32
+		option_thumbnails.persist = THUMBNAILS_PERSIST_PACKED;
+#else
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED, "Packed thumbnails are not supported on this platform.");
+		return FALSE;
+#endif
+	}
 	else if(value[0] == '/') {
 		option_thumbnails.persist = THUMBNAILS_PERSIST_ON;
 		option_thumbnails.special_thumbnail_directory = g_strdup(value);
@@ -1277,7 +1704,9 @@ void parse_command_line() {/*{{{*/
 	g_option_context_set_help_enabled(parser, TRUE);
 	g_option_context_set_ignore_unknown_options(parser, FALSE);
 	g_option_context_add_main_entries(parser, options, NULL);
-	g_option_context_add_group(parser, gtk_get_option_group(TRUE));
+	// The display is opened by gtk_init_check() in main(), and not needed for
+	// --generate-thumbnails
+	g_option_context_add_group(parser, gtk_get_option_group(FALSE));
 
 	GError *error_pointer = NULL;
 	if(g_option_context_parse(parser, &global_argc, &global_argv, &error_pointer) == FALSE) {
@@ -1374,7 +1803,7 @@ BOSNode *load_images_handle_parameter_add_file(load_images_state_t state, file_t
 		return NULL;
 	}
 
-	if(bostree_node_count(file_tree) >= INT_MAX) {
+	if(bostree_node_count(file_tree) + (file_tree_deferred_nodes ? file_tree_deferred_nodes->len : 0) >= INT_MAX) {
 		// This is a safegoard. Most image operations should actually have
 		// ULONG_MAX as a limit, but sometimes, I cast to an integer type.
 		g_printerr("Cannot add image %s: Maximum number of images reached.\n", file->display_name);
@@ -1403,7 +1832,16 @@ BOSNode *load_images_handle_parameter_add_file(load_images_state_t state, file_t
 		new_node = bostree_insert(file_tree, (void *)index, file);
 	}
 	else {
-		new_node = bostree_insert(file_tree, file->sort_name, file);
+		// The tree is ordered by a key that compares like strnatcasecmp() does
+		// on the sort names, such that comparisons during sorting are cheap
+		char *sort_key = strnatcasekey(file->sort_name);
+		if(file_tree_deferred_nodes) {
+			new_node = bostree_node_new(sort_key, file);
+			g_ptr_array_add(file_tree_deferred_nodes, new_node);
+		}
+		else {
+			new_node = bostree_insert(file_tree, sort_key, file);
+		}
 	}
 	if(state == BROWSE_ORIGINAL_PARAMETER && browse_startup_node == NULL) {
 		browse_startup_node = bostree_node_weak_ref(new_node);
@@ -1439,24 +1877,70 @@ BOSNode *load_images_handle_parameter_add_file(load_images_state_t state, file_t
 	}
 	return new_node;
 }/*}}}*/
+// Streams of unknown size are read into a buffer that starts at this size and
+// doubles whenever it is full
+#define READ_COMPLETELY_INITIAL_SIZE (1<<23) // 8 MiB
 GBytes *g_input_stream_read_completely(GInputStream *input_stream, GCancellable *cancellable, GError **error_pointer) {/*{{{*/
-	size_t data_length = 0;
-	char *data = g_malloc(1<<23); // + 8 Mib
+	char *data = NULL;
+	gsize data_length = 0;
+	gsize data_size = 0;
+
+	// If the stream knows the file's size, read into a buffer of that size
+	// right away. Read one more byte to be sure the file did not grow.
+	if(G_IS_FILE_INPUT_STREAM(input_stream)) {
+		GFileInfo *file_info = g_file_input_stream_query_info(G_FILE_INPUT_STREAM(input_stream), G_FILE_ATTRIBUTE_STANDARD_SIZE, cancellable, NULL);
+		if(file_info) {
+			goffset expected_size = g_file_info_has_attribute(file_info, G_FILE_ATTRIBUTE_STANDARD_SIZE) ? g_file_info_get_size(file_info) : -1;
+			g_object_unref(file_info);
+
+			if(expected_size >= 0 && (guint64)expected_size < G_MAXSIZE) {
+				// The size might be bogus, so do not abort if it can not be
+				// allocated
+				data_size = expected_size + 1;
+				data = g_try_malloc(data_size);
+				if(!data) {
+					g_set_error(error_pointer, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to allocate %" G_GSIZE_FORMAT " bytes to read the file into", data_size);
+					return NULL;
+				}
+				if(!g_input_stream_read_all(input_stream, data, data_size, &data_length, cancellable, error_pointer)) {
+					g_free(data);
+					return NULL;
+				}
+				if(data_length < data_size) {
+					return g_bytes_new_take((guint8*)data, data_length);
+				}
+				// The file has grown. Read the rest below.
+			}
+		}
+	}
+
+	// Read until the end of the stream, growing the buffer geometrically, such
+	// that every byte is copied only a few times on average
 	while(TRUE) {
+		if(data_length == data_size) {
+			gsize new_size = data_size ? data_size * 2 : READ_COMPLETELY_INITIAL_SIZE;
+			char *new_data = new_size > data_size ? g_try_realloc(data, new_size) : NULL;
+			if(!new_data) {
+				g_free(data);
+				g_set_error(error_pointer, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to allocate %" G_GSIZE_FORMAT " bytes to read the stream into", new_size);
+				return NULL;
+			}
+			data = new_data;
+			data_size = new_size;
+		}
 		gsize bytes_read;
-		if(!g_input_stream_read_all(input_stream, &data[data_length], 1<<23, &bytes_read, cancellable, error_pointer)) {
+		if(!g_input_stream_read_all(input_stream, data + data_length, data_size - data_length, &bytes_read, cancellable, error_pointer)) {
 			g_free(data);
-			return 0;
+			return NULL;
 		}
 		data_length += bytes_read;
-		if(bytes_read < 1<<23) {
-			data = g_realloc(data, data_length);
+		if(data_length < data_size) {
 			break;
 		}
-		else {
-			data = g_realloc(data, data_length + (1<<23));
-		}
 	}
+
+	// Return the unused part of the buffer
+	data = g_realloc(data, data_length ? data_length : 1);
 	return g_bytes_new_take((guint8*)data, data_length);
 }/*}}}*/
 GFile *gfile_for_commandline_arg(const char *parameter) {/*{{{*/
@@ -1509,7 +1993,439 @@ gpointer load_images_handle_parameter_thread(char *param) {/*{{{*/
 int pqiv_utility_strcmp0_data(const void *data1, const void *data2, void *user_data) {/*{{{*/
 	return g_strcmp0(data1, data2);
 }/*}}}*/
+gchar *load_images_directory_entry_path(const gchar *directory, const gchar *entry) {/*{{{*/
+	return g_strdup_printf("%s%s%s", directory, g_str_has_suffix(directory, G_DIR_SEPARATOR_S) ? "" : G_DIR_SEPARATOR_S, entry);
+}/*}}}*/
+void directory_listing_free(struct directory_listing *listing) {/*{{{*/
+	for(guint i=0; i<listing->entries->len; i++) {
+		g_free(g_array_index(listing->entries, struct directory_listing_entry, i).name);
+	}
+	g_array_free(listing->entries, TRUE);
+	g_slice_free(struct directory_listing, listing);
+}/*}}}*/
+void directory_listing_prefetch(const gchar *path, gint depth);
+GArray *directory_listing_read(const gchar *path, gint depth, gboolean read_ahead, gint64 *mtime) {/*{{{*/
+	// Read a directory's entries and its mtime, and if read_ahead is set,
+	// schedule its subdirectories for reading ahead. Returns NULL if the
+	// directory can not be read.
+	GArray *entries = g_array_new(FALSE, FALSE, sizeof(struct directory_listing_entry));
+#ifndef _WIN32
+	// Use the entry types from readdir() instead of a stat() per entry where
+	// possible; that makes the difference on network file systems.
+	DIR *dir = opendir(path);
+	if(!dir) {
+		g_array_free(entries, TRUE);
+		return NULL;
+	}
+	struct stat dir_stat;
+	*mtime = fstat(dirfd(dir), &dir_stat) == 0 ? (gint64)dir_stat.st_mtime : -1;
+	struct dirent *dir_entry;
+	while((dir_entry = readdir(dir))) {
+		if(strcmp(dir_entry->d_name, ".") == 0 || strcmp(dir_entry->d_name, "..") == 0) {
+			continue;
+		}
+
+		struct directory_listing_entry entry = { NULL, -1, -1 };
+		gboolean is_real_directory = FALSE;
+		#ifdef DT_DIR
+			if(dir_entry->d_type == DT_DIR) {
+				entry.is_directory = 1;
+				is_real_directory = TRUE;
+			}
+			else if(dir_entry->d_type == DT_REG) {
+				entry.is_directory = 0;
+			}
+		#endif
+		if(entry.is_directory < 0 || (entry.is_directory == 0 && option_sort && option_sort_key == MTIME)) {
+			struct stat entry_stat;
+			if(fstatat(dirfd(dir), dir_entry->d_name, &entry_stat, 0) == 0) {
+				entry.is_directory = S_ISDIR(entry_stat.st_mode) ? 1 : 0;
+				entry.mtime = entry_stat.st_mtime;
+			}
+			else {
+				// Like g_file_test() would
+				entry.is_directory = 0;
+			}
+		}
+		entry.name = g_strdup(dir_entry->d_name);
+		g_array_append_val(entries, entry);
+
+		// Symlinks to directories are not read ahead, since they might form
+		// loops. The recursion detects those, and reads them when it gets
+		// there.
+		if(read_ahead && is_real_directory && strcmp(entry.name, ".sh_thumbnails") != 0 && (option_max_depth < 0 || depth + 1 < option_max_depth)) {
+			gchar *entry_path = load_images_directory_entry_path(path, entry.name);
+			directory_listing_prefetch(entry_path, depth + 1);
+			g_free(entry_path);
+		}
+	}
+	closedir(dir);
+#else
+	GDir *dir_ptr = g_dir_open(path, 0, NULL);
+	if(!dir_ptr) {
+		g_array_free(entries, TRUE);
+		return NULL;
+	}
+	GStatBuf dir_stat;
+	*mtime = g_stat(path, &dir_stat) == 0 ? (gint64)dir_stat.st_mtime : -1;
+	const gchar *dir_entry;
+	while((dir_entry = g_dir_read_name(dir_ptr))) {
+		struct directory_listing_entry entry = { g_strdup(dir_entry), -1, -1 };
+		g_array_append_val(entries, entry);
+	}
+	g_dir_close(dir_ptr);
+#endif
+	return entries;
+}/*}}}*/
+void directory_listing_complete(const gchar *path, GArray *entries, gint64 mtime) {/*{{{*/
+	// Must be called with directory_listings_mutex locked
+	struct directory_listing *listing = g_hash_table_lookup(directory_listings, path);
+	listing->state = DIRECTORY_LISTING_COMPLETE;
+	listing->mtime = mtime;
+	listing->failed = entries == NULL;
+	listing->entries = entries ? entries : g_array_new(FALSE, FALSE, sizeof(struct directory_listing_entry));
+	if(listing->abandoned) {
+		g_hash_table_remove(directory_listings, path);
+		directory_listing_free(listing);
+		return;
+	}
+	g_cond_broadcast(&directory_listings_cond);
+}/*}}}*/
+void directory_listings_drop_unused() {/*{{{*/
+	// Called once loading a command line argument has finished. Listings read
+	// ahead for it that the recursion did not take, e.g. because it skipped a
+	// directory, would otherwise be kept until pqiv exits. Those still being
+	// read are dropped once complete.
+	g_mutex_lock(&directory_listings_mutex);
+	if(directory_listings) {
+		GHashTableIter iter;
+		gpointer listing_ptr;
+		g_hash_table_iter_init(&iter, directory_listings);
+		while(g_hash_table_iter_next(&iter, NULL, &listing_ptr)) {
+			struct directory_listing *listing = listing_ptr;
+			if(listing->waiters > 0) {
+				continue;
+			}
+			if(listing->state == DIRECTORY_LISTING_READING) {
+				listing->abandoned = TRUE;
+				continue;
+			}
+			// The scanner threads skip queued paths without a listing
+			g_hash_table_iter_remove(&iter);
+			if(listing->state == DIRECTORY_LISTING_COMPLETE) {
+				directory_listing_free(listing);
+			}
+			else {
+				g_slice_free(struct directory_listing, listing);
+			}
+		}
+	}
+	g_mutex_unlock(&directory_listings_mutex);
+}/*}}}*/
+void directory_scanner_thread(gpointer path, gpointer user_data) {/*{{{*/
+	g_mutex_lock(&directory_listings_mutex);
+	struct directory_listing *listing = g_hash_table_lookup(directory_listings, path);
+	if(!listing || listing->state != DIRECTORY_LISTING_QUEUED || !file_tree_valid) {
+		// The recursion got here first, or pqiv is exiting
+		g_mutex_unlock(&directory_listings_mutex);
+		g_free(path);
+		return;
+	}
+	listing->state = DIRECTORY_LISTING_READING;
+	gint depth = listing->depth;
+	g_mutex_unlock(&directory_listings_mutex);
+
+	gint64 mtime;
+	GArray *entries = directory_listing_read(path, depth, TRUE, &mtime);
+
+	g_mutex_lock(&directory_listings_mutex);
+	directory_listing_complete(path, entries, mtime);
+	g_mutex_unlock(&directory_listings_mutex);
+	g_free(path);
+}/*}}}*/
+void directory_listing_prefetch(const gchar *path, gint depth) {/*{{{*/
+	g_mutex_lock(&directory_listings_mutex);
+	if(!directory_listings) {
+		directory_listings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+		directory_scanner_pool = g_thread_pool_new(directory_scanner_thread, NULL, DIRECTORY_SCANNER_THREADS, FALSE, NULL);
+	}
+	if(!g_hash_table_lookup(directory_listings, path)) {
+		struct directory_listing *listing = g_slice_new0(struct directory_listing);
+		listing->state = DIRECTORY_LISTING_QUEUED;
+		listing->depth = depth;
+		g_hash_table_insert(directory_listings, g_strdup(path), listing);
+		g_thread_pool_push(directory_scanner_pool, g_strdup(path), NULL);
+	}
+	g_mutex_unlock(&directory_listings_mutex);
+}/*}}}*/
+struct directory_listing *directory_listing_take(const gchar *path, gint depth) {/*{{{*/
+	// Obtain a directory's listing, from the directory cache or the scanner
+	// threads if possible. Hand the result to directory_listing_release().
+	struct directory_cache *cache = g_private_get(&directory_cache_active);
+	if(cache) {
+		gpointer cached_path, cached_listing;
+		if(g_hash_table_lookup_extended(cache->cached, path, &cached_path, &cached_listing)) {
+			g_hash_table_steal(cache->cached, path);
+			g_free(cached_path);
+			((struct directory_listing *)cached_listing)->depth = depth;
+			return cached_listing;
+		}
+	}
+
+	// Reading ahead makes no sense if the listings of the subdirectories are
+	// most likely cached
+	gboolean read_ahead = cache == NULL;
+	if(read_ahead) {
+		directory_listing_prefetch(path, depth);
+	}
+	else {
+		gint64 mtime;
+		GArray *entries = directory_listing_read(path, depth, FALSE, &mtime);
+		if(!entries) {
+			return NULL;
+		}
+		struct directory_listing *listing = g_slice_new0(struct directory_listing);
+		listing->state = DIRECTORY_LISTING_COMPLETE;
+		listing->depth = depth;
+		listing->mtime = mtime;
+		listing->entries = entries;
+		return listing;
+	}
+
+	g_mutex_lock(&directory_listings_mutex);
+	struct directory_listing *listing = g_hash_table_lookup(directory_listings, path);
+	if(!listing) {
+		// Dropped by directory_listings_drop_unused() in the meantime
+		listing = g_slice_new0(struct directory_listing);
+		listing->state = DIRECTORY_LISTING_QUEUED;
+		listing->depth = depth;
+		g_hash_table_insert(directory_listings, g_strdup(path), listing);
+	}
+	listing->waiters++;
+	listing->abandoned = FALSE;
+	if(listing->state == DIRECTORY_LISTING_QUEUED) {
+		// Do not wait for the scanner threads to work through their queue
+		listing->state = DIRECTORY_LISTING_READING;
+		g_mutex_unlock(&directory_listings_mutex);
+		gint64 mtime;
+		GArray *entries = directory_listing_read(path, depth, TRUE, &mtime);
+		g_mutex_lock(&directory_listings_mutex);
+		directory_listing_complete(path, entries, mtime);
+	}
+	while(listing->state != DIRECTORY_LISTING_COMPLETE) {
+		g_cond_wait(&directory_listings_cond, &directory_listings_mutex);
+	}
+	listing->waiters--;
+	g_hash_table_remove(directory_listings, path);
+	g_mutex_unlock(&directory_listings_mutex);
+
+	if(listing->failed) {
+		directory_listing_free(listing);
+		return NULL;
+	}
+	return listing;
+}/*}}}*/
+void directory_listing_release(const gchar *path, struct directory_listing *listing) {/*{{{*/
+	// Record the listing in the directory cache, if any
+	struct directory_cache *cache = g_private_get(&directory_cache_active);
+	if(cache) {
+		g_hash_table_replace(cache->current, g_strdup(path), listing);
+	}
+	else {
+		directory_listing_free(listing);
+	}
+}/*}}}*/
+void directory_cache_load_index(struct directory_cache *cache) {/*{{{*/
+	// The index is a sequence of NUL terminated fields: For each directory,
+	// its path, mtime and number of entries, followed by is_directory and name
+	// for each entry. The entries' mtimes are not stored, because modifying a
+	// file does not change its directory's mtime, such that they could not be
+	// told apart from stale ones. Sorting by mtime stats the files instead.
+	gchar *contents;
+	gsize length;
+	if(!g_file_get_contents(cache->index_file_name, &contents, &length, NULL)) {
+		return;
+	}
+	const gchar *iter = contents, *end = contents + length;
+	#define DIRECTORY_CACHE_NEXT_FIELD(field) { \
+		const gchar *field_end = memchr(iter, 0, end - iter); \
+		if(!field_end) break; \
+		field = iter; \
+		iter = field_end + 1; \
+	}
+	if(length < sizeof(DIRECTORY_CACHE_INDEX_MAGIC) || memcmp(contents, DIRECTORY_CACHE_INDEX_MAGIC, sizeof(DIRECTORY_CACHE_INDEX_MAGIC)) != 0) {
+		g_free(contents);
+		return;
+	}
+	iter += sizeof(DIRECTORY_CACHE_INDEX_MAGIC);
+	while(iter < end) {
+		const gchar *path = NULL, *mtime = NULL, *count = NULL;
+		DIRECTORY_CACHE_NEXT_FIELD(path);
+		DIRECTORY_CACHE_NEXT_FIELD(mtime);
+		DIRECTORY_CACHE_NEXT_FIELD(count);
+
+		struct directory_listing *listing = g_slice_new0(struct directory_listing);
+		listing->state = DIRECTORY_LISTING_COMPLETE;
+		listing->from_cache = TRUE;
+		listing->mtime = g_ascii_strtoll(mtime, NULL, 10);
+		listing->entries = g_array_new(FALSE, FALSE, sizeof(struct directory_listing_entry));
+		guint64 entry_count = g_ascii_strtoull(count, NULL, 10);
+		for(guint64 i=0; i<entry_count; i++) {
+			const gchar *is_directory = NULL, *name = NULL;
+			DIRECTORY_CACHE_NEXT_FIELD(is_directory);
+			DIRECTORY_CACHE_NEXT_FIELD(name);
+			struct directory_listing_entry entry = { g_strdup(name), atoi(is_directory), -1 };
+			g_array_append_val(listing->entries, entry);
+		}
+		if(listing->entries->len != entry_count) {
+			// Truncated index
+			directory_listing_free(listing);
+			break;
+		}
+		g_hash_table_replace(cache->cached, g_strdup(path), listing);
+	}
+	#undef DIRECTORY_CACHE_NEXT_FIELD
+	g_free(contents);
+}/*}}}*/
+void directory_cache_store_index(struct directory_cache *cache) {/*{{{*/
+	GString *index = g_string_new_len(DIRECTORY_CACHE_INDEX_MAGIC, sizeof(DIRECTORY_CACHE_INDEX_MAGIC));
+	GHashTableIter iter;
+	gpointer path, listing_ptr;
+	g_hash_table_iter_init(&iter, cache->current);
+	while(g_hash_table_iter_next(&iter, &path, &listing_ptr)) {
+		struct directory_listing *listing = listing_ptr;
+		g_string_append_printf(index, "%s%c%" G_GINT64_FORMAT "%c%u%c", (gchar *)path, 0, listing->mtime, 0, listing->entries->len, 0);
+		for(guint i=0; i<listing->entries->len; i++) {
+			struct directory_listing_entry *entry = &g_array_index(listing->entries, struct directory_listing_entry, i);
+			g_string_append_printf(index, "%d%c%s%c", entry->is_directory, 0, entry->name, 0);
+		}
+	}
+
+	gchar *index_directory = g_path_get_dirname(cache->index_file_name);
+	g_mkdir_with_parents(index_directory, 0700);
+	g_free(index_directory);
+	GError *error_pointer = NULL;
+	if(!g_file_set_contents(cache->index_file_name, index->str, index->len, &error_pointer)) {
+		g_printerr("Failed to store the directory cache: %s\n", error_pointer->message);
+		g_clear_error(&error_pointer);
+	}
+	g_string_free(index, TRUE);
+}/*}}}*/
+void directory_cache_free(struct directory_cache *cache) {/*{{{*/
+	g_hash_table_unref(cache->cached);
+	g_hash_table_unref(cache->current);
+	g_free(cache->index_file_name);
+	g_slice_free(struct directory_cache, cache);
+}/*}}}*/
+void directory_cache_begin(const gchar *abs_path) {/*{{{*/
+	// Start using the cache for the command line argument abs_path in this thread
+	struct directory_cache *cache = g_slice_new0(struct directory_cache);
+	gchar *md5_path = g_compute_checksum_for_string(G_CHECKSUM_MD5, abs_path, -1);
+	gchar *index_base_name = g_strdup_printf("%s.index", md5_path);
+	cache->index_file_name = g_build_filename(g_get_user_cache_dir(), "pqiv", "directories", index_base_name, NULL);
+	g_free(index_base_name);
+	g_free(md5_path);
+	cache->cached = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)directory_listing_free);
+	cache->current = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)directory_listing_free);
+	directory_cache_load_index(cache);
+	g_private_set(&directory_cache_active, cache);
+}/*}}}*/
+void directory_cache_end() {/*{{{*/
+	// Stop using the cache in this thread, and queue it for validation once
+	// all arguments have been loaded
+	struct directory_cache *cache = g_private_get(&directory_cache_active);
+	g_private_set(&directory_cache_active, NULL);
+	// Directories not visited this time are gone or out of reach now
+	g_hash_table_remove_all(cache->cached);
+	directory_caches_pending_validation = g_slist_prepend(directory_caches_pending_validation, cache);
+}/*}}}*/
+gboolean directory_cache_validated_callback(gpointer user_data) {/*{{{*/
+	// Update the image count after new files have been found
+	if(main_window_visible) {
+		update_info_text(NULL);
+		info_text_queue_redraw();
+	}
+	return FALSE;
+}/*}}}*/
+void load_images_handle_parameter_with_info(char *param, load_images_state_t state, gint depth, GSList *recursion_folder_stack, const struct directory_listing_entry *entry_info);
+gpointer directory_cache_validate_thread(gpointer user_data) {/*{{{*/
+	// Re-read directories whose mtime changed since the index was stored,
+	// and load files not known before. Removed files are handled as for
+	// --watch-directories: They are dropped once pqiv tries to load them.
+	gboolean files_added = FALSE;
+	for(GSList *caches = user_data; caches; caches = g_slist_next(caches)) {
+		struct directory_cache *cache = caches->data;
+		// New subdirectories are recorded in the cache as well
+		g_private_set(&directory_cache_active, cache);
+
+		GList *paths = g_hash_table_get_keys(cache->current);
+		for(GList *path_iter = paths; path_iter && file_tree_valid; path_iter = g_list_next(path_iter)) {
+			gchar *path = g_strdup(path_iter->data);
+			struct directory_listing *listing = g_hash_table_lookup(cache->current, path);
+			if(!listing || !listing->from_cache) {
+				g_free(path);
+				continue;
+			}
+
+			GStatBuf dir_stat;
+			if(g_stat(path, &dir_stat) == 0 && (gint64)dir_stat.st_mtime == listing->mtime) {
+				g_free(path);
+				continue;
+			}
+
+			gint64 mtime;
+			GArray *entries = directory_listing_read(path, listing->depth, FALSE, &mtime);
+			if(!entries) {
+				g_hash_table_remove(cache->current, path);
+				g_free(path);
+				continue;
+			}
+
+			GHashTable *known_names = g_hash_table_new(g_str_hash, g_str_equal);
+			for(guint i=0; i<listing->entries->len; i++) {
+				g_hash_table_insert(known_names, g_array_index(listing->entries, struct directory_listing_entry, i).name, GINT_TO_POINTER(1));
+			}
+
+			struct directory_listing *new_listing = g_slice_new0(struct directory_listing);
+			new_listing->state = DIRECTORY_LISTING_COMPLETE;
+			new_listing->depth = listing->depth;
+			new_listing->mtime = mtime;
+			new_listing->entries = entries;
+			for(guint i=0; i<entries->len; i++) {
+				const struct directory_listing_entry *dir_entry = &g_array_index(entries, struct directory_listing_entry, i);
+				if(g_hash_table_lookup(known_names, dir_entry->name) || strcmp(dir_entry->name, ".sh_thumbnails") == 0) {
+					continue;
+				}
+				gchar *dir_entry_full = load_images_directory_entry_path(path, dir_entry->name);
+				load_images_handle_parameter_with_info(dir_entry_full, RECURSION, listing->depth + 1, NULL, dir_entry);
+				g_free(dir_entry_full);
+				files_added = TRUE;
+			}
+			g_hash_table_unref(known_names);
+
+			// This frees the old listing, which known_names referred to
+			g_hash_table_replace(cache->current, path, new_listing);
+		}
+		g_list_free(paths);
+
+		g_private_set(&directory_cache_active, NULL);
+		if(file_tree_valid) {
+			directory_cache_store_index(cache);
+		}
+		directory_cache_free(cache);
+	}
+	g_slist_free(user_data);
+
+	if(files_added) {
+		gdk_threads_add_idle(directory_cache_validated_callback, NULL);
+	}
+	return NULL;
+}/*}}}*/
 void load_images_handle_parameter(char *param, load_images_state_t state, gint depth, GSList *recursion_folder_stack) {/*{{{*/
+	load_images_handle_parameter_with_info(param, state, depth, recursion_folder_stack, NULL);
+}/*}}}*/
+void load_images_handle_parameter_with_info(char *param, load_images_state_t state, gint depth, GSList *recursion_folder_stack, const struct directory_listing_entry *entry_info) {/*{{{*/
+	// entry_info holds what the directory scanner already knows about param
 	file_t *file;
 
 	// If the file tree has been invalidated, cancel.
@@ -1521,11 +2437,11 @@ void load_images_handle_parameter(char *param, load_images_state_t state, gint d
 	if(state == PARAMETER && g_strcmp0(param, "-") == 0) {
 		file = g_slice_new0(file_t);
 		file->file_flags = FILE_FLAGS_MEMORY_IMAGE;
-		file->display_name = g_strdup("-");
+		file->display_name = file_name_intern(g_strdup("-"));
 		if(option_sort) {
-			file->sort_name = g_strdup("-");
+			file->sort_name = file_name_ref(file->display_name);
 		}
-		file->file_name = g_strdup("-");
+		file->file_name = file_name_ref(file->display_name);
 		g_mutex_init(&file->lock);
 
 		GError *error_ptr = NULL;
@@ -1586,7 +2502,9 @@ void load_images_handle_parameter(char *param, load_images_state_t state, gint d
 		}
 
 		// Recurse into directories
-		if(g_file_test(param, G_FILE_TEST_IS_DIR) == TRUE) {
+		if(entry_info && entry_info->is_directory >= 0 ? entry_info->is_directory == 1 : g_file_test(param, G_FILE_TEST_IS_DIR) == TRUE) {
+			gboolean owns_directory_cache = FALSE;
+
 			if(option_max_depth >= 0 && option_max_depth <= depth) {
 				// Maximum depth exceeded, abort.
 				if(original_parameter != NULL) {
@@ -1618,6 +2536,11 @@ void load_images_handle_parameter(char *param, load_images_state_t state, gint d
 					return;
 				}
 				recursion_folder_stack = g_slist_prepend(recursion_folder_stack, g_strdup(abs_path));
+
+				if(option_directory_cache && state == PARAMETER && !g_private_get(&directory_cache_active)) {
+					directory_cache_begin(abs_path);
+					owns_directory_cache = TRUE;
+				}
 			}
 			else {
 				// Consider this an error
@@ -1637,40 +2560,49 @@ void load_images_handle_parameter(char *param, load_images_state_t state, gint d
 				#endif
 			}
 
-			GDir *dir_ptr = g_dir_open(param, 0, NULL);
-			if(dir_ptr == NULL) {
+			struct directory_listing *listing = directory_listing_take(param, depth);
+			if(listing == NULL) {
 				if(state == PARAMETER) {
 					g_printerr("Failed to open directory: %s\n", param);
 				}
+				if(owns_directory_cache) {
+					directory_cache_end();
+				}
 				if(original_parameter != NULL) {
 					g_free(param);
 				}
 				return;
 			}
-			while(TRUE) {
-				const gchar *dir_entry = g_dir_read_name(dir_ptr);
-				if(dir_entry == NULL) {
-					break;
-				}
-				if(strcmp(dir_entry, ".sh_thumbnails") == 0) {
+			for(guint i=0; i<listing->entries->len; i++) {
+				const struct directory_listing_entry *dir_entry = &g_array_index(listing->entries, struct directory_listing_entry, i);
+				if(strcmp(dir_entry->name, ".sh_thumbnails") == 0) {
 					// Do not traverse into local thumbnail directories
 					continue;;
 				}
 
-				gchar *dir_entry_full = g_strdup_printf("%s%s%s", param, g_str_has_suffix(param, G_DIR_SEPARATOR_S) ? "" : G_DIR_SEPARATOR_S, dir_entry);
+				gchar *dir_entry_full = load_images_directory_entry_path(param, dir_entry->name);
 				if(!(original_parameter != NULL && g_strcmp0(dir_entry_full, original_parameter) == 0)) {
 					// Skip if we are in --browse mode and this is the file which we have already added above.
-					load_images_handle_parameter(dir_entry_full, RECURSION, depth + 1, recursion_folder_stack);
+					load_images_handle_parameter_with_info(dir_entry_full, RECURSION, depth + 1, recursion_folder_stack, dir_entry);
 				}
 				g_free(dir_entry_full);
 
 				// If the file tree has been invalidated, cancel.
-				// Do not bother to free stuff, because pqiv will exit anyway.
 				if(!file_tree_valid) {
+					directory_listing_free(listing);
+					if(original_parameter != NULL) {
+						g_free(param);
+					}
 					return;
 				}
 			}
-			g_dir_close(dir_ptr);
+			directory_listing_release(param, listing);
+			if(owns_directory_cache) {
+				directory_cache_end();
+			}
+			if(state == PARAMETER) {
+				directory_listings_drop_unused();
+			}
 
 			// Add a watch for new files in this directory
 			if(option_watch_directories && !g_hash_table_lookup(active_directory_watches, abs_path)) {
@@ -1717,11 +2649,14 @@ void load_images_handle_parameter(char *param, load_images_state_t state, gint d
 
 		// Prepare file structure
 		file = g_slice_new0(file_t);
-		file->file_name = g_strdup(param);
-		file->display_name = g_filename_display_name(param);
+		file->file_name = file_name_intern(g_strdup(param));
+		file->display_name = file_name_intern(g_filename_display_name(param));
 		g_mutex_init(&file->lock);
 		if(option_sort) {
-			if(option_sort_key == MTIME) {
+			if(option_sort_key == MTIME && entry_info && entry_info->mtime >= 0) {
+				file->sort_name = file_name_intern(g_strdup_printf("%lu;%s", (unsigned long)entry_info->mtime, file->display_name));
+			}
+			else if(option_sort_key == MTIME) {
 				// Prepend the modification time to the display name
 				GFile *param_file = gfile_for_commandline_arg(param);
 				if(param_file) {
@@ -1730,13 +2665,13 @@ void load_images_handle_parameter(char *param, load_images_state_t state, gint d
 						GTimeVal result;
 						g_file_info_get_modification_time(file_info, &result);
 						g_object_unref(file_info);
-						file->sort_name = g_strdup_printf("%lu;%s", result.tv_sec, file->display_name);
+						file->sort_name = file_name_intern(g_strdup_printf("%lu;%s", result.tv_sec, file->display_name));
 					}
 					g_object_unref(param_file);
 				}
 			}
 			if(file->sort_name == NULL) {
-				file->sort_name = g_strdup(file->display_name);
+				file->sort_name = file_name_ref(file->display_name);
 			}
 		}
 
@@ -1823,25 +2758,102 @@ void load_images_handle_parameter(char *param, load_images_state_t state, gint d
 int image_tree_float_compare(const float *a, const float *b) {/*{{{*/
 	return *a > *b;
 }/*}}}*/
+// The names of files are stored once, along with a reference count. Many
+// files share names with others, or use the same string for all of them, and
+// there may be millions of them.
+//
+// The reference counts are atomic, and the table's lock is only taken to
+// insert and remove names: A holder of a reference may add or drop others
+// without it, except for dropping the last one, which is done under the lock
+// such that file_name_intern() cannot pick the name up while it is freed.
+struct file_name {
+	gint references;
+	gchar name[];
+};
+#define FILE_NAME_HEADER(interned_name) ((struct file_name *)((interned_name) - G_STRUCT_OFFSET(struct file_name, name)))
+G_LOCK_DEFINE_STATIC(file_names);
+GHashTable *file_names = NULL;
+gchar *file_name_intern(gchar *name) {/*{{{*/
+	if(!name) {
+		return NULL;
+	}
+	G_LOCK(file_names);
+	if(!file_names) {
+		file_names = g_hash_table_new(g_str_hash, g_str_equal);
+	}
+	gchar *interned_name = g_hash_table_lookup(file_names, name);
+	if(interned_name) {
+		g_atomic_int_inc(&FILE_NAME_HEADER(interned_name)->references);
+	}
+	else {
+		size_t length = strlen(name) + 1;
+		struct file_name *header = g_malloc(sizeof(struct file_name) + length);
+		header->references = 1;
+		memcpy(header->name, name, length);
+		interned_name = header->name;
+		g_hash_table_insert(file_names, interned_name, interned_name);
+	}
+	G_UNLOCK(file_names);
+	g_free(name);
+	return interned_name;
+}/*}}}*/
+gchar *file_name_ref(gchar *name) {/*{{{*/
+	g_atomic_int_inc(&FILE_NAME_HEADER(name)->references);
+	return name;
+}/*}}}*/
+void file_name_release(gchar *name) {/*{{{*/
+	if(!name) {
+		return;
+	}
+	struct file_name *header = FILE_NAME_HEADER(name);
+	while(TRUE) {
+		const gint references = g_atomic_int_get(&header->references);
+		if(references <= 1) {
+			break;
+		}
+		if(g_atomic_int_compare_and_exchange(&header->references, references, references - 1)) {
+			return;
+		}
+	}
+	G_LOCK(file_names);
+	if(g_atomic_int_dec_and_test(&header->references)) {
+		g_hash_table_remove(file_names, name);
+		g_free(header);
+	}
+	G_UNLOCK(file_names);
+}/*}}}*/
 void file_free(file_t *file) {/*{{{*/
 	if(file->file_type && file->file_type->free_fn != NULL && file->private) {
 		file->file_type->free_fn(file);
 	}
-	g_free(file->display_name);
-	g_free(file->file_name);
+	file_name_release(file->display_name);
+	file_name_release(file->file_name);
 	if(file->sort_name) {
-		g_free(file->sort_name);
+		file_name_release(file->sort_name);
 	}
 	if(file->file_data) {
 		g_bytes_unref(file->file_data);
 		file->file_data = NULL;
 	}
 #ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
-	if(file->thumbnail) {
-		cairo_surface_destroy(file->thumbnail);
-		file->thumbnail = NULL;
-	}
+	image_loader_set_thumbnail(file, NULL);
 #endif
+	if(file->prerendered) {
+		// Not using image_unload_prerendered_views(), because the file is
+		// gone and nobody else can access its views
+		if(file->prerendered->view) {
+			cairo_surface_destroy(file->prerendered->view);
+		}
+		for(int i=0; i<PRERENDERED_PYRAMID_LEVELS; i++) {
+			if(file->prerendered->pyramid[i]) {
+				cairo_surface_destroy(file->prerendered->pyramid[i]);
+			}
+		}
+		if(file->prerendered->scaled) {
+			cairo_surface_destroy(file->prerendered->scaled);
+		}
+		g_slice_free(prerendered_views_t, file->prerendered);
+	}
 	g_mutex_clear(&file->lock);
 	g_slice_free(file_t, file);
 }/*}}}*/
@@ -1858,17 +2870,26 @@ void file_tree_free_helper(BOSNode *node) {
 	if(!option_sort) {
 		g_slice_free(float, node->key);
 	}
+	else {
+		free(node->key);
+	}
 }
+gint file_tree_deferred_nodes_compare(gconstpointer a, gconstpointer b) {/*{{{*/
+	return strcmp((*(BOSNode **)a)->key, (*(BOSNode **)b)->key);
+}/*}}}*/
 void load_images() {/*{{{*/
 	int * const argc = &global_argc;
 	char ** const argv = global_argv;
 
 	// Allocate memory for the file list (Used for unsorted and random order file lists)
 	file_tree = bostree_new(
-		option_sort ? (BOSTree_cmp_function)strnatcasecmp : (BOSTree_cmp_function)image_tree_float_compare,
+		option_sort ? (BOSTree_cmp_function)strcmp : (BOSTree_cmp_function)image_tree_float_compare,
 		file_tree_free_helper
 	);
 	file_tree_valid = TRUE;
+	if(option_sort && !option_lazy_load) {
+		file_tree_deferred_nodes = g_ptr_array_new();
+	}
 
 	// Allocate memory for the timer
 	if(!option_actions_from_stdin) {
@@ -1919,6 +2940,17 @@ void load_images() {/*{{{*/
 		g_io_channel_unref(stdin_reader);
 	}
 
+	if(file_tree_deferred_nodes) {
+		// g_ptr_array_sort() is stable, such that files with equal sort names
+		// remain in the order they were found in
+		D_LOCK(file_tree);
+		g_ptr_array_sort(file_tree_deferred_nodes, file_tree_deferred_nodes_compare);
+		bostree_build(file_tree, (BOSNode **)file_tree_deferred_nodes->pdata, file_tree_deferred_nodes->len);
+		g_ptr_array_free(file_tree_deferred_nodes, TRUE);
+		file_tree_deferred_nodes = NULL;
+		D_UNLOCK(file_tree);
+	}
+
 	if(load_images_timer) {
 		g_timer_destroy(load_images_timer);
 	}
@@ -1934,8 +2966,7 @@ gboolean test_and_invalidate_thumbnail(file_t *file) {/*{{{*/
 		if(!((thumb_width == option_thumbnails.width && thumb_height <= option_thumbnails.height) ||
 			  (thumb_width <= option_thumbnails.width && thumb_height == option_thumbnails.height) ||
 			  (thumb_width == (int)file->width && thumb_height == (int)file->height))) {
-			cairo_surface_destroy(file->thumbnail);
-			file->thumbnail = NULL;
+			image_loader_set_thumbnail(file, NULL);
 		}
 	}
 	return !!file->thumbnail;
@@ -1946,8 +2977,27 @@ void invalidate_current_scaled_image_surface() {/*{{{*/
 		cairo_surface_destroy(current_scaled_image_surface);
 		current_scaled_image_surface = NULL;
 	}
+	struct scaled_image_tile *tile;
+	while((tile = g_queue_pop_head(&scaled_image_tiles)) != NULL) {
+		cairo_surface_destroy(tile->surface);
+		g_slice_free(struct scaled_image_tile, tile);
+	}
+}/*}}}*/
+gboolean scaled_image_size_requires_tiles(double width, double height) {/*{{{*/
+	// Cairo cannot create image surfaces beyond 32767 pixels in either
+	// dimension
+	if(width > 32767 || height > 32767) {
+		return TRUE;
+	}
+	// Also, do not render and keep surfaces that are much larger than the
+	// screen could ever show at once
+	if(screen_geometry.width > 0 && screen_geometry.height > 0) {
+		return width * height > 4. * screen_geometry.width * screen_geometry.height;
+	}
+	return FALSE;
 }/*}}}*/
 gboolean image_animation_timeout_callback(gpointer user_data) {/*{{{*/
+	current_image_animation_frame_pending = FALSE;
 	D_LOCK(file_tree);
 	if(!file_tree_valid || (BOSNode *)user_data != current_file_node || FILE(current_file_node)->force_reload || !FILE(current_file_node)->is_loaded) {
 		D_UNLOCK(file_tree);
@@ -1961,10 +3011,19 @@ gboolean image_animation_timeout_callback(gpointer user_data) {/*{{{*/
 	}
 
 	g_mutex_lock(&CURRENT_FILE->lock);
-	double delay = (1./current_image_animation_speed_scale) * CURRENT_FILE->file_type->animation_next_frame_fn(CURRENT_FILE);
+	const double frame_duration = CURRENT_FILE->file_type->animation_next_frame_fn(CURRENT_FILE);
 	g_mutex_unlock(&CURRENT_FILE->lock);
 	D_UNLOCK(file_tree);
 
+	if(frame_duration == FILE_TYPE_ANIMATION_FRAME_PENDING) {
+		// The current frame stays on display until the backend calls
+		// image_animation_frame_ready()
+		current_image_animation_timeout_id = 0;
+		current_image_animation_frame_pending = TRUE;
+		return FALSE;
+	}
+
+	const double delay = (1./current_image_animation_speed_scale) * frame_duration;
 	if(delay >= 0 && current_image_animation_speed_scale > 0) {
 		current_image_animation_timeout_id = gdk_threads_add_timeout(
 			delay,
@@ -1976,10 +3035,24 @@ gboolean image_animation_timeout_callback(gpointer user_data) {/*{{{*/
 	}
 
 	invalidate_current_scaled_image_surface();
+#ifdef PQIV_OPENGL
+	opengl.image_stale = TRUE;
+#endif
 	gtk_widget_queue_draw(GTK_WIDGET(main_window));
 
 	return FALSE;
 }/*}}}*/
+gboolean image_animation_frame_ready_callback(gpointer user_data) {/*{{{*/
+	if(current_image_animation_frame_pending && current_image_animation_timeout_id == 0 && current_file_node) {
+		image_animation_timeout_callback(current_file_node);
+	}
+	return FALSE;
+}/*}}}*/
+void image_animation_frame_ready() {/*{{{*/
+	// The callback checks whether the animation still waits, which is the case
+	// only for the current image
+	gdk_threads_add_idle(image_animation_frame_ready_callback, NULL);
+}/*}}}*/
 void image_file_updated_callback(GFileMonitor *monitor, GFile *file, GFile *other_file, GFileMonitorEvent event_type, gpointer user_data) {/*{{{*/
 	BOSNode *node = (BOSNode *)user_data;
 
@@ -2219,12 +3292,27 @@ void main_window_adjust_for_image() {/*{{{*/
 		queue_draw();
 	}
 }/*}}}*/
+gboolean image_resolution_increased_handler(gconstpointer node) {/*{{{*/
+	// Called instead of image_loaded_handler() once an image has been decoded
+	// again at a higher resolution. The view stays as it is, only the image
+	// is drawn again from the new decode.
+	D_LOCK(file_tree);
+	if(node == current_file_node) {
+		invalidate_current_scaled_image_surface();
+#ifdef PQIV_OPENGL
+		opengl.image_stale = TRUE;
+#endif
+		gtk_widget_queue_draw(GTK_WIDGET(main_window));
+	}
+	D_UNLOCK(file_tree);
+	return FALSE;
+}/*}}}*/
 gboolean image_loaded_handler(gconstpointer node) {/*{{{*/
 	// Execute logic below only if the loaded image is the current one
 	if(node != NULL && node != current_file_node) {
 #ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
 		if(application_mode == MONTAGE) {
-			gtk_widget_queue_draw(GTK_WIDGET(main_window));
+			montage_window_queue_draw_node(node);
 		}
 #endif
 		return FALSE;
@@ -2240,6 +3328,7 @@ gboolean image_loaded_handler(gconstpointer node) {/*{{{*/
 		g_source_remove(current_image_animation_timeout_id);
 		current_image_animation_timeout_id = 0;
 	}
+	current_image_animation_frame_pending = FALSE;
 
 	// Only react if the loaded node is still current
 	if(node && node != current_file_node) {
@@ -2247,6 +3336,11 @@ gboolean image_loaded_handler(gconstpointer node) {/*{{{*/
 		return FALSE;
 	}
 
+#ifdef PQIV_OPENGL
+	// The image might have been reloaded; upload it to the GPU again
+	opengl.image_stale = TRUE;
+#endif
+
 	// If in shuffle mode, mark the current image as viewed, and possibly
 	// reset the list once all images have been
 	if(option_shuffle) {
@@ -2379,8 +3473,16 @@ GInputStream *image_loader_stream_file(file_t *file, GError **error_pointer) {/*
 	else {
 		// Classical file or URI
 
-		if(image_loader_cancellable) {
-			g_cancellable_reset(image_loader_cancellable);
+		// Local files are read through a view on a mmap()ed copy, which
+		// avoids copying them through read() calls. Not so if the file might
+		// be written to while it is decoded, because reading from the mapping
+		// of a file that shrinks raises SIGBUS instead of a read error. This
+		// rules out watched files, and files that are being reloaded.
+		if(option_watch_files == OFF && (file->file_flags & FILE_FLAGS_RELOAD) == 0) {
+			data = buffered_file_mmap_stream(file, error_pointer);
+			if(data || (error_pointer && *error_pointer)) {
+				return data;
+			}
 		}
 
 		GFile *input_file = gfile_for_commandline_arg(file->file_name);
@@ -2389,7 +3491,7 @@ GInputStream *image_loader_stream_file(file_t *file, GError **error_pointer) {/*
 			return NULL;
 		}
 
-		data = G_INPUT_STREAM(g_file_read(input_file, image_loader_cancellable, error_pointer));
+		data = G_INPUT_STREAM(g_file_read(input_file, image_loader_get_cancellable(), error_pointer));
 
 		g_object_unref(input_file);
 	}
@@ -2403,46 +3505,338 @@ file_t *image_loader_duplicate_file(file_t *file, gchar *custom_file_name, gchar
 	if(file->file_data) {
 		g_bytes_ref(new_file->file_data);
 	}
-	new_file->file_name = custom_file_name ? custom_file_name : g_strdup(file->file_name);
-	new_file->display_name = custom_display_name ? custom_display_name : g_strdup(file->display_name);
-	new_file->sort_name = custom_sort_name ? custom_sort_name : (file->sort_name ? g_strdup(file->sort_name) : NULL);
+	new_file->file_name = custom_file_name ? file_name_intern(custom_file_name) : file_name_ref(file->file_name);
+	new_file->display_name = custom_display_name ? file_name_intern(custom_display_name) : file_name_ref(file->display_name);
+	new_file->sort_name = custom_sort_name ? file_name_intern(custom_sort_name) : (file->sort_name ? file_name_ref(file->sort_name) : NULL);
 
 	new_file->private = NULL;
 	new_file->file_monitor = NULL;
 	new_file->is_loaded = FALSE;
+	new_file->prerendered = NULL;
+	new_file->loaded_files_link = NULL;
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+	// The thumbnail belongs to file, and is accounted for once, see
+	// image_loader_set_thumbnail()
+	new_file->thumbnail = NULL;
+#endif
+	g_mutex_init(&new_file->lock);
 
 	return new_file;
 }/*}}}*/
-gboolean image_loader_load_single(BOSNode *node, gboolean called_from_main) {/*{{{*/
-	// Sanity check
-	assert(bostree_node_weak_unref(file_tree, bostree_node_weak_ref(node)) != NULL);
+gint64 stage_timer_begin() {/*{{{*/
+	return g_get_monotonic_time();
+}/*}}}*/
+void stage_timer_end(stage_t stage, gint64 begin) {/*{{{*/
+	// Account the time since begin, which stage_timer_begin() returned, to
+	// stage
+	const gint64 duration = g_get_monotonic_time() - begin;
 
-	// Already loaded?
-	file_t *file = (file_t *)node->data;
-	if(file->is_loaded) {
-		return TRUE;
+	int thread_id = 0;
+	if(option_trace_file) {
+		// Trace events need a small number for each thread
+		thread_id = GPOINTER_TO_INT(g_private_get(&trace_thread_id));
+		if(!thread_id) {
+			thread_id = g_atomic_int_add(&trace_threads, 1) + 1;
+			g_private_set(&trace_thread_id, GINT_TO_POINTER(thread_id));
+		}
 	}
 
-	GError *error_pointer = NULL;
-
-	if(file->file_type->load_fn != NULL) {
-		// Create an input stream for the image to be loaded
-		GInputStream *data = image_loader_stream_file(file, &error_pointer);
-
-		if(data) {
-			// Let the file type handler handle the details
-			g_mutex_lock(&file->lock);
-			file->file_type->load_fn(file, data, &error_pointer);
-			g_mutex_unlock(&file->lock);
-			g_object_unref(data);
+	G_LOCK(statistics);
+	struct stage_statistics *statistics = &stage_statistics[stage];
+	statistics->count++;
+	statistics->total_time += duration;
+	if(duration > statistics->max_time) {
+		statistics->max_time = duration;
+	}
+	if(option_benchmark) {
+		if(!stage_samples[stage]) {
+			stage_samples[stage] = g_array_new(FALSE, FALSE, sizeof(gint64));
 		}
+		g_array_append_val(stage_samples[stage], duration);
 	}
-
-	if(file->is_loaded) {
-		if(error_pointer) {
-			g_printerr("A recoverable error occurred: %s\n", error_pointer->message);
+	if(option_trace_file) {
+		if(!trace_events) {
+			trace_events = g_string_new(NULL);
+		}
+		g_string_append_printf(trace_events, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":1,\"tid\":%d}",
+			trace_events->len > 0 ? "," : "", stage_names[stage], begin, duration, thread_id);
+	}
+	G_UNLOCK(statistics);
+}/*}}}*/
+void statistics_write_trace() {/*{{{*/
+	// Write the trace events recorded for --trace-file, in Chrome's trace
+	// event format. Complete events are used, whose ts and dur are in
+	// microseconds.
+	if(!option_trace_file) {
+		return;
+	}
+	G_LOCK(statistics);
+	gchar *contents = g_strdup_printf("{\"traceEvents\":[%s\n],\"displayTimeUnit\":\"ms\"}\n", trace_events ? trace_events->str : "");
+	G_UNLOCK(statistics);
+
+	GError *error_pointer = NULL;
+	if(!g_file_set_contents(option_trace_file, contents, -1, &error_pointer)) {
+		g_printerr("Failed to write the trace to %s: %s\n", option_trace_file, error_pointer->message);
+		g_clear_error(&error_pointer);
+	}
+	g_free(contents);
+}/*}}}*/
+void progressive_preview_free(struct progressive_preview *preview) {/*{{{*/
+	if(preview->surface) {
+		cairo_surface_destroy(preview->surface);
+	}
+	g_slice_free(struct progressive_preview, preview);
+}/*}}}*/
+void image_loader_progress_begin(file_t *file) {/*{{{*/
+	struct progressive_preview *preview = g_slice_new0(struct progressive_preview);
+	// The first update is due only after an interval, such that images that
+	// load quickly are shown at once, without an intermediate step
+	preview->last_update = g_get_monotonic_time();
+
+	G_LOCK(progressive_previews);
+	if(!progressive_previews) {
+		progressive_previews = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify)progressive_preview_free);
+	}
+	g_hash_table_insert(progressive_previews, file, preview);
+	G_UNLOCK(progressive_previews);
+}/*}}}*/
+void image_loader_progress_end(file_t *file) {/*{{{*/
+	G_LOCK(progressive_previews);
+	if(progressive_previews) {
+		g_hash_table_remove(progressive_previews, file);
+	}
+	G_UNLOCK(progressive_previews);
+}/*}}}*/
+gboolean image_loader_progress_wanted(file_t *file) {/*{{{*/
+	G_LOCK(progressive_previews);
+	const gboolean wanted = progressive_previews && g_hash_table_lookup(progressive_previews, file) != NULL;
+	G_UNLOCK(progressive_previews);
+	return wanted;
+}/*}}}*/
+gboolean image_loader_progress_due(file_t *file) {/*{{{*/
+	G_LOCK(progressive_previews);
+	const struct progressive_preview *preview = progressive_previews ? g_hash_table_lookup(progressive_previews, file) : NULL;
+	const gboolean due = preview && g_get_monotonic_time() - preview->last_update >= PROGRESSIVE_PREVIEW_INTERVAL;
+	G_UNLOCK(progressive_previews);
+	return due;
+}/*}}}*/
+gboolean progressive_preview_redraw_callback(gpointer user_data) {/*{{{*/
+	G_LOCK(progressive_previews);
+	progressive_previews_redraw_queued = FALSE;
+	G_UNLOCK(progressive_previews);
+	queue_draw();
+	return FALSE;
+}/*}}}*/
+void image_loader_publish_progress(file_t *file, cairo_surface_t *surface) {/*{{{*/
+	G_LOCK(progressive_previews);
+	struct progressive_preview *preview = progressive_previews ? g_hash_table_lookup(progressive_previews, file) : NULL;
+	if(preview) {
+		if(preview->surface) {
+			cairo_surface_destroy(preview->surface);
+		}
+		preview->surface = surface;
+		preview->last_update = g_get_monotonic_time();
+		if(!progressive_previews_redraw_queued) {
+			progressive_previews_redraw_queued = TRUE;
+			gdk_threads_add_idle(progressive_preview_redraw_callback, NULL);
+		}
+	}
+	else {
+		cairo_surface_destroy(surface);
+	}
+	G_UNLOCK(progressive_previews);
+}/*}}}*/
+cairo_surface_t *get_progressive_preview(file_t *file) {/*{{{*/
+	// Returns a new reference to the partially decoded version of file, or NULL
+	G_LOCK(progressive_previews);
+	const struct progressive_preview *preview = progressive_previews ? g_hash_table_lookup(progressive_previews, file) : NULL;
+	cairo_surface_t *surface = preview && preview->surface ? cairo_surface_reference(preview->surface) : NULL;
+	G_UNLOCK(progressive_previews);
+	return surface;
+}/*}}}*/
+void draw_progressive_preview(cairo_t *cr, cairo_surface_t *preview, int width, int height, gboolean as_current_image) {/*{{{*/
+	// Draw a partially decoded image centered into a width x height area,
+	// scaled to fit. The final image's scale level is not known yet. If
+	// as_current_image is set, rotate/flip and negate it like the current
+	// image.
+	const int preview_width = cairo_image_surface_get_width(preview);
+	const int preview_height = cairo_image_surface_get_height(preview);
+	cairo_matrix_t transformation;
+	cairo_matrix_init_identity(&transformation);
+	if(as_current_image) {
+		transformation = current_transformation;
+		transformation.x0 = transformation.y0 = 0;
+	}
+	const double transformed_width = fabs(transformation.xx * preview_width) + fabs(transformation.xy * preview_height);
+	const double transformed_height = fabs(transformation.yx * preview_width) + fabs(transformation.yy * preview_height);
+	double scale_level = fmin(width / transformed_width, height / transformed_height);
+	if(scale_level > 1. && option_scale != AUTO_SCALEUP) {
+		scale_level = 1.;
+	}
+
+	cairo_save(cr);
+	cairo_translate(cr, width / 2., height / 2.);
+	cairo_scale(cr, scale_level, scale_level);
+	cairo_transform(cr, &transformation);
+	cairo_translate(cr, -preview_width / 2., -preview_height / 2.);
+	if(as_current_image && option_negate) {
+		// The preview changes with every update, so do not use
+		// get_negated_image_surface() here, which keeps its copy. See
+		// paint_scaled_image_surface() for how this works.
+		cairo_rectangle(cr, 0, 0, preview_width, preview_height);
+		cairo_clip(cr);
+		cairo_push_group(cr);
+		cairo_set_source_surface(cr, preview, 0, 0);
+		cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+		cairo_paint(cr);
+		cairo_pattern_t *image = cairo_pop_group(cr);
+		cairo_set_source_rgb(cr, 1., 1., 1.);
+		cairo_mask(cr, image);
+		cairo_set_operator(cr, CAIRO_OPERATOR_DIFFERENCE);
+		cairo_set_source(cr, image);
+		cairo_paint(cr);
+		cairo_pattern_destroy(image);
+	}
+	else {
+		cairo_set_source_surface(cr, preview, 0, 0);
+		cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+		cairo_paint(cr);
+	}
+	cairo_restore(cr);
+}/*}}}*/
+double image_loader_get_decode_scale_level(file_t *file, int width, int height) {/*{{{*/
+	// Backends call this from their load_fn, see pqiv.h. Backends do not know
+	// yet whether the image will be rotated according to embedded orientation
+	// information, so consider both orientations for the screen size.
+	if(file->load_resolution == LOAD_RESOLUTION_FULL || (file->file_flags & FILE_FLAGS_FULL_RESOLUTION) || width <= 0 || height <= 0) {
+		return 1.;
+	}
+
+	double scale_level = 0.;
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+	if(file->load_resolution == LOAD_RESOLUTION_THUMBNAIL || option_thumbnails.enabled || application_mode == MONTAGE) {
+		scale_level = fmin(option_thumbnails.width * 1. / width, option_thumbnails.height * 1. / height);
+	}
+#endif
+	if(file->load_resolution == LOAD_RESOLUTION_SCREEN) {
+		scale_level = fmax(scale_level, fmax(calculate_auto_scale_level_for_screen(width, height), calculate_auto_scale_level_for_screen(height, width)));
+	}
+
+	if(scale_level <= 0. || scale_level > 1.) {
+		return 1.;
+	}
+	return scale_level;
+}/*}}}*/
+void image_loader_decode(file_t *file, gboolean show_progress, GError **error_pointer) {/*{{{*/
+	// Have the file type handler decode the image from its file
+	const gint64 stream_open_begin = stage_timer_begin();
+	GInputStream *data = image_loader_stream_file(file, error_pointer);
+	stage_timer_end(STAGE_STREAM_OPEN, stream_open_begin);
+	if(!data) {
+		return;
+	}
+
+	if(show_progress) {
+		image_loader_progress_begin(file);
+	}
+
+	g_mutex_lock(&file->lock);
+	if(file->file_type->load_not_parallel_safe) {
+		G_LOCK(image_loader_serialized_backends);
+	}
+	const gint64 load_begin = stage_timer_begin();
+	file->file_type->load_fn(file, data, error_pointer);
+	stage_timer_end(STAGE_LOAD, load_begin);
+	if(file->file_type->load_not_parallel_safe) {
+		G_UNLOCK(image_loader_serialized_backends);
+	}
+	g_mutex_unlock(&file->lock);
+
+	if(show_progress) {
+		image_loader_progress_end(file);
+	}
+	buffered_file_mmap_stream_done(data);
+	g_object_unref(data);
+}/*}}}*/
+void image_loader_count_decoded_bytes(file_t *file) {/*{{{*/
+	// Estimated like in image_memory_usage()
+	const guint64 decoded_bytes = (guint64)(file->width * file->decoded_scale_level + .5) * (guint64)(file->height * file->decoded_scale_level + .5) * 4;
+	G_LOCK(statistics);
+	statistics_decoded_bytes += decoded_bytes;
+	G_UNLOCK(statistics);
+}/*}}}*/
+gboolean image_loader_load_single_at_higher_resolution(BOSNode *node) {/*{{{*/
+	// Decode an image that is loaded at a reduced resolution again, because
+	// it is needed at a higher one. Unlike a reload with force_reload set,
+	// this does not unload the image first: The backend replaces its decode
+	// only once the new one is complete, see file_type_load_fn_t, and until
+	// then, the main thread displays the prerendered views, which the decode
+	// does not block.
+	file_t *file = (file_t *)node->data;
+	GError *error_pointer = NULL;
+	const double old_decoded_scale_level = file->decoded_scale_level;
+	image_loader_decode(file, FALSE, &error_pointer);
+
+	if(error_pointer) {
+		if(error_pointer->code != G_IO_ERROR_CANCELLED) {
+			g_printerr("Failed to load image %s at a higher resolution: %s\n", file->display_name, error_pointer->message);
+		}
+		g_clear_error(&error_pointer);
+	}
+	if(file->decoded_scale_level <= old_decoded_scale_level) {
+		return FALSE;
+	}
+	image_loader_count_decoded_bytes(file);
+
+	// The scaled render has been drawn from the old decode
+	G_LOCK(prerendered_views);
+	if(file->prerendered && file->prerendered->scaled) {
+		cairo_surface_destroy(file->prerendered->scaled);
+		file->prerendered->scaled = NULL;
+	}
+	G_UNLOCK(prerendered_views);
+	return TRUE;
+}/*}}}*/
+gboolean image_loader_load_single(BOSNode *node, gboolean called_from_main) {/*{{{*/
+	// Sanity check
+	assert(bostree_node_weak_unref(file_tree, bostree_node_weak_ref(node)) != NULL);
+
+	// Already loaded?
+	file_t *file = (file_t *)node->data;
+	if(file->is_loaded) {
+		return TRUE;
+	}
+
+	GError *error_pointer = NULL;
+
+	if(file->file_type->load_fn != NULL) {
+		// If the image is visible, backends that decode incrementally may
+		// publish what they have decoded so far. Zooming into an image that
+		// is shown at a reduced resolution should not display a partial
+		// version instead of the complete one.
+		D_LOCK(file_tree);
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+		const gboolean thumbnail_visible = application_mode == MONTAGE && !file->thumbnail;
+#else
+		const gboolean thumbnail_visible = FALSE;
+#endif
+		const gboolean show_progress = main_window_visible && !option_lowmem && (node == current_file_node ? (file->file_flags & FILE_FLAGS_FULL_RESOLUTION) == 0 : thumbnail_visible);
+		D_UNLOCK(file_tree);
+
+		// Let the file type handler handle the details
+		file->decoded_scale_level = 1.;
+		image_loader_decode(file, show_progress, &error_pointer);
+		if(file->is_loaded) {
+			image_loader_count_decoded_bytes(file);
+		}
+	}
+
+	if(file->is_loaded) {
+		if(error_pointer) {
+			g_printerr("A recoverable error occurred: %s\n", error_pointer->message);
 			g_clear_error(&error_pointer);
 		}
+		file->file_flags &= ~FILE_FLAGS_RELOAD;
 
 		if((file->file_flags & FILE_FLAGS_MEMORY_IMAGE) == 0) {
 			GFile *the_file = g_file_new_for_path(file->file_name);
@@ -2455,9 +3849,16 @@ gboolean image_loader_load_single(BOSNode *node, gboolean called_from_main) {/*{
 			}
 		}
 
-		// Mark the image as loaded for the GC
+		// Mark the image as loaded for the GC. It may still be listed from an
+		// earlier load if it was unloaded by other means than the GC
 		D_LOCK(file_tree);
-		loaded_files_list = g_list_prepend(loaded_files_list, bostree_node_weak_ref(node));
+		if(file->loaded_files_link) {
+			image_cache_touch(node);
+		}
+		else {
+			g_queue_push_head(&loaded_files_list, bostree_node_weak_ref(node));
+			file->loaded_files_link = g_queue_peek_head_link(&loaded_files_list);
+		}
 		D_UNLOCK(file_tree);
 
 		return TRUE;
@@ -2472,7 +3873,7 @@ gboolean image_loader_load_single(BOSNode *node, gboolean called_from_main) {/*{
 			g_clear_error(&error_pointer);
 		}
 		else {
-			if(g_cancellable_is_cancelled(image_loader_cancellable)) {
+			if(g_cancellable_is_cancelled(image_loader_get_cancellable())) {
 				return FALSE;
 			}
 			g_printerr("Failed to load image %s: Reason unknown\n", file->display_name);
@@ -2480,6 +3881,11 @@ gboolean image_loader_load_single(BOSNode *node, gboolean called_from_main) {/*{
 
 		// The node is invalid.  Unload it.
 		D_LOCK(file_tree);
+		if(!bostree_node_weak_unref(file_tree, bostree_node_weak_ref(node))) {
+			// Another thread has already removed it
+			D_UNLOCK(file_tree);
+			return FALSE;
+		}
 		if(node == current_file_node) {
 			current_file_node = next_file();
 			if(current_file_node == node) {
@@ -2533,7 +3939,8 @@ gboolean image_loader_load_single(BOSNode *node, gboolean called_from_main) {/*{
 	return FALSE;
 }/*}}}*/
 #ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
-void image_loader_create_thumbnail(file_t *file) {/*{{{*/
+cairo_surface_t *image_loader_create_thumbnail(file_t *file) {/*{{{*/
+	const gint64 begin = stage_timer_begin();
 	const double scale_level_w = option_thumbnails.width * 1.0 / file->width;
 	const double scale_level_h = option_thumbnails.height * 1.0 / file->height;
 	double scale_level = scale_level_w > scale_level_h ? scale_level_h : scale_level_w;
@@ -2544,7 +3951,7 @@ void image_loader_create_thumbnail(file_t *file) {/*{{{*/
 	cairo_surface_t *surf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, scale_level * file->width + .5, scale_level * file->height + .5);
 	if(cairo_surface_status(surf) != CAIRO_STATUS_SUCCESS) {
 		cairo_surface_destroy(surf);
-		return;
+		return NULL;
 	}
 
 	cairo_t *cr = cairo_create(surf);
@@ -2585,91 +3992,672 @@ void image_loader_create_thumbnail(file_t *file) {/*{{{*/
 	}
 
 	cairo_destroy(cr);
-	file->thumbnail = surf;
+	stage_timer_end(STAGE_THUMBNAIL, begin);
+	return surf;
+}/*}}}*/
+cairo_surface_t *thumbnail_cache_lookup(file_t *file) {/*{{{*/
+	// Load the cached thumbnail of a file, see load_thumbnail_from_cache()
+	const gint64 begin = stage_timer_begin();
+	cairo_surface_t *thumbnail = load_thumbnail_from_cache(file, option_thumbnails.width, option_thumbnails.height, option_thumbnails.persist, option_thumbnails.special_thumbnail_directory);
+	stage_timer_end(STAGE_CACHE_LOOKUP, begin);
+	g_atomic_int_inc(thumbnail ? &statistics_thumbnail_cache_hits : &statistics_thumbnail_cache_misses);
+	return thumbnail;
+}/*}}}*/
+gboolean thumbnail_cache_store(file_t *file, cairo_surface_t *thumbnail) {/*{{{*/
+	// Store the thumbnail of a file, see store_thumbnail_to_cache()
+	const gint64 begin = stage_timer_begin();
+	gboolean retval = store_thumbnail_to_cache(file, thumbnail, option_thumbnails.width, option_thumbnails.height, option_thumbnails.persist, option_thumbnails.special_thumbnail_directory);
+	stage_timer_end(STAGE_CACHE_STORE, begin);
+	return retval;
+}/*}}}*/
+void image_loader_set_thumbnail(file_t *file, cairo_surface_t *thumbnail) {/*{{{*/
+	// Takes over the reference. Must be called with file_tree locked.
+	if(file->thumbnail) {
+		thumbnails_memory_bytes -= surface_memory_usage(file->thumbnail);
+		cairo_surface_destroy(file->thumbnail);
+	}
+	file->thumbnail = thumbnail;
+	thumbnails_memory_bytes += surface_memory_usage(thumbnail);
+}/*}}}*/
+void queue_thumbnail_store(BOSNode *node, cairo_surface_t *thumbnail) {/*{{{*/
+	// Must be called with file_tree locked.
+	if(option_thumbnails.persist == THUMBNAILS_PERSIST_OFF || option_thumbnails.persist == THUMBNAILS_PERSIST_RO) {
+		return;
+	}
+	struct thumbnail_store_job *job = g_slice_new(struct thumbnail_store_job);
+	job->node_ref = bostree_node_weak_ref(node);
+	job->thumbnail = cairo_surface_reference(thumbnail);
+	g_async_queue_push(thumbnail_store_queue, job);
+}/*}}}*/
+gboolean thumbnail_cache_compaction_done_callback(gpointer user_data) {/*{{{*/
+	UPDATE_INFO_TEXT("Compacted thumbnail cache, dropped %d entries", GPOINTER_TO_INT(user_data));
+	info_text_queue_redraw();
+	return FALSE;
+}/*}}}*/
+void queue_thumbnail_cache_compaction() {/*{{{*/
+	// A job without a node compacts the packed thumbnail store. Running it
+	// from the store thread serializes it with the stores.
+	if(!image_loader_initialization_succeeded) {
+		// The store thread does not run yet, e.g. for actions from the
+		// command line, so there are no stores to serialize with either
+		int dropped_entries = compact_thumbnail_packs(option_thumbnails.special_thumbnail_directory);
+		gdk_threads_add_idle(thumbnail_cache_compaction_done_callback, GINT_TO_POINTER(dropped_entries));
+		return;
+	}
+	struct thumbnail_store_job *job = g_slice_new0(struct thumbnail_store_job);
+	g_async_queue_push(thumbnail_store_queue, job);
+}/*}}}*/
+gpointer thumbnail_store_thread(gpointer user_data) {/*{{{*/
+	while(TRUE) {
+		struct thumbnail_store_job *job = g_async_queue_pop(thumbnail_store_queue);
+
+		if(!job->node_ref) {
+			int dropped_entries = compact_thumbnail_packs(option_thumbnails.special_thumbnail_directory);
+			gdk_threads_add_idle(thumbnail_cache_compaction_done_callback, GINT_TO_POINTER(dropped_entries));
+			g_slice_free(struct thumbnail_store_job, job);
+			continue;
+		}
+
+		// The weak reference keeps the file structure alive, and the fields
+		// used for storing do not change, so the lock is not needed for
+		// writing.
+		D_LOCK(file_tree);
+		gboolean is_valid = bostree_node_weak_unref(file_tree, bostree_node_weak_ref(job->node_ref)) != NULL;
+		D_UNLOCK(file_tree);
+
+		if(is_valid) {
+			thumbnail_cache_store(FILE(job->node_ref), job->thumbnail);
+		}
+		cairo_surface_destroy(job->thumbnail);
+
+		D_LOCK(file_tree);
+		bostree_node_weak_unref(file_tree, job->node_ref);
+		D_UNLOCK(file_tree);
+		g_slice_free(struct thumbnail_store_job, job);
+	}
+	return NULL;
 }/*}}}*/
 #endif
+#define PRERENDERED_VIEW(file) ((file)->prerendered ? (file)->prerendered->view : NULL)
+#define PRERENDERED_PYRAMID_LEVEL(file, i) ((file)->prerendered ? (file)->prerendered->pyramid[i] : NULL)
+#define PRERENDERED_SCALED(file) ((file)->prerendered ? (file)->prerendered->scaled : NULL)
+prerendered_views_t *image_prerendered_views(file_t *file) {/*{{{*/
+	// Must be called with prerendered_views locked. The structure is kept until
+	// the file is freed, such that the lock-free peeks at it remain valid.
+	if(!file->prerendered) {
+		file->prerendered = g_slice_new0(prerendered_views_t);
+	}
+	return file->prerendered;
+}/*}}}*/
+cairo_surface_t *image_prerendered_source_for_size(file_t *file, int width, int height) {/*{{{*/
+	// Find the smallest prerendered surface that is at least width x height
+	// pixels large. Returns a new reference, or NULL if rendering at that size
+	// must be done from the full image.
+	cairo_surface_t *retval = NULL;
+	G_LOCK(prerendered_views);
+	for(int i=PRERENDERED_PYRAMID_LEVELS-1; i>=0; i--) {
+		cairo_surface_t *level = PRERENDERED_PYRAMID_LEVEL(file, i);
+		if(level && cairo_image_surface_get_width(level) >= width && cairo_image_surface_get_height(level) >= height) {
+			retval = level;
+			break;
+		}
+	}
+	cairo_surface_t *renders[] = { PRERENDERED_VIEW(file), PRERENDERED_SCALED(file) };
+	for(int i=0; i<2; i++) {
+		cairo_surface_t *render = renders[i];
+		if(render && cairo_image_surface_get_width(render) >= width && cairo_image_surface_get_height(render) >= height &&
+				(!retval || cairo_image_surface_get_width(render) < cairo_image_surface_get_width(retval))) {
+			retval = render;
+		}
+	}
+	if(retval) {
+		cairo_surface_reference(retval);
+	}
+	G_UNLOCK(prerendered_views);
+	return retval;
+}/*}}}*/
+void image_draw_at_size(file_t *file, cairo_t *cr, double scale_level, int width, int height) {/*{{{*/
+	// Draw an image at the given scale level, which results in width x height
+	// pixels. This scales down from a prerendered surface if there is one large
+	// enough, and uses the file type's draw_fn otherwise.
+	cairo_surface_t *source = image_prerendered_source_for_size(file, width, height);
+	if(source) {
+		cairo_scale(cr, (double)width / cairo_image_surface_get_width(source), (double)height / cairo_image_surface_get_height(source));
+		cairo_set_source_surface(cr, source, 0, 0);
+		cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+		cairo_paint(cr);
+		cairo_surface_destroy(source);
+		return;
+	}
+
+	cairo_scale(cr, scale_level, scale_level);
+	if(file->file_type->draw_fn != NULL) {
+		g_mutex_lock(&file->lock);
+		file->file_type->draw_fn(file, cr);
+		g_mutex_unlock(&file->lock);
+	}
+}/*}}}*/
 void image_generate_prerendered_view(file_t *file, gboolean force, double scale_level) {/*{{{*/
 	if(option_lowmem) {
 		return;
 	}
-	if(file->file_flags && FILE_FLAGS_ANIMATION) {
+	if(file->file_flags & FILE_FLAGS_ANIMATION) {
 		return;
 	}
-	if(force && file->prerendered_view) {
-		cairo_surface_destroy(file->prerendered_view);
-		file->prerendered_view = NULL;
+	if(force && PRERENDERED_VIEW(file)) {
+		G_LOCK(prerendered_views);
+		cairo_surface_destroy(file->prerendered->view);
+		file->prerendered->view = NULL;
+		G_UNLOCK(prerendered_views);
 	}
 	if(scale_level < 0) {
 		scale_level = calculate_auto_scale_level_for_screen(file->width, file->height);
 	}
 	int width = scale_level * file->width + .5;
 	int height = scale_level * file->height + .5;
+	if(scaled_image_size_requires_tiles(width, height)) {
+		// This view would be drawn in tiles anyway, see window_draw_scaled_image_tiles
+		return;
+	}
 
-	if(file->prerendered_view) {
-		int old_width = cairo_image_surface_get_width(file->prerendered_view);
-		int old_height = cairo_image_surface_get_height(file->prerendered_view);
+	cairo_surface_t *old_view = PRERENDERED_VIEW(file);
+	if(old_view) {
+		int old_width = cairo_image_surface_get_width(old_view);
+		int old_height = cairo_image_surface_get_height(old_view);
 
-		if(old_width != width || old_height != height) {
-			cairo_surface_destroy(file->prerendered_view);
-			file->prerendered_view = NULL;
+		if(old_width == width && old_height == height) {
+			return;
 		}
 	}
 
-	if(!file->prerendered_view) {
-		cairo_surface_t *prerendered_view = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
-		if(cairo_surface_status(prerendered_view) == CAIRO_STATUS_SUCCESS) {
-			cairo_t *cr = cairo_create(prerendered_view);
-			cairo_scale(cr, scale_level, scale_level);
+	// The old view is kept until the new one is done, because it might be the
+	// best source to render the new one from
+	const gint64 begin = stage_timer_begin();
+	cairo_surface_t *prerendered_view = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	if(cairo_surface_status(prerendered_view) == CAIRO_STATUS_SUCCESS) {
+		cairo_t *cr = cairo_create(prerendered_view);
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		image_draw_at_size(file, cr, scale_level, width, height);
+		cairo_destroy(cr);
+
+		G_LOCK(prerendered_views);
+		prerendered_views_t *views = image_prerendered_views(file);
+		if(views->view) {
+			cairo_surface_destroy(views->view);
+		}
+		views->view = cairo_surface_reference(prerendered_view);
+		G_UNLOCK(prerendered_views);
+		stage_timer_end(STAGE_PRERENDER, begin);
+	}
+	cairo_surface_destroy(prerendered_view);
+}/*}}}*/
+gboolean image_downscale_surface_2x(cairo_surface_t *target, cairo_surface_t *source) {/*{{{*/
+	// Fill target with a box filtered copy of source at half its size, where
+	// odd sizes round either way. Returns FALSE if the sizes or formats do
+	// not fit.
+	const int width = cairo_image_surface_get_width(target);
+	const int height = cairo_image_surface_get_height(target);
+	const int source_width = cairo_image_surface_get_width(source);
+	const int source_height = cairo_image_surface_get_height(source);
+	if(cairo_image_surface_get_format(target) != CAIRO_FORMAT_ARGB32 || cairo_image_surface_get_format(source) != CAIRO_FORMAT_ARGB32
+			|| source_width < 2 * width - 1 || source_width > 2 * width
+			|| source_height < 2 * height - 1 || source_height > 2 * height) {
+		return FALSE;
+	}
+
+	cairo_surface_flush(source);
+	cairo_surface_flush(target);
+	const uint8_t *source_data = cairo_image_surface_get_data(source);
+	const int source_stride = cairo_image_surface_get_stride(source);
+	uint8_t *target_data = cairo_image_surface_get_data(target);
+	const int target_stride = cairo_image_surface_get_stride(target);
+	for(int y=0; y<height; y++) {
+		const uint32_t *row_1 = (const uint32_t *)(source_data + (size_t)(2 * y) * source_stride);
+		const uint32_t *row_2 = (const uint32_t *)(source_data + (size_t)MIN(2 * y + 1, source_height - 1) * source_stride);
+		pixel_kernels_downscale_2x((uint32_t *)(target_data + (size_t)y * target_stride), width, row_1, row_2, source_width);
+	}
+	cairo_surface_mark_dirty(target);
+	return TRUE;
+}/*}}}*/
+void image_generate_prerendered_pyramid(file_t *file) {/*{{{*/
+	// Render power-of-two reductions of the image, each one from the previous
+	// level, until the levels become smaller than the default render. Scaling
+	// to any level in between can then start from a surface at most twice as
+	// large as the result, instead of the full image.
+	if(option_lowmem) {
+		return;
+	}
+	if(file->file_flags & FILE_FLAGS_ANIMATION) {
+		return;
+	}
+	const double fit_scale_level = calculate_auto_scale_level_for_screen(file->width, file->height);
+
+	const gint64 begin = stage_timer_begin();
+	gboolean rendered = FALSE;
+	cairo_surface_t *previous_level = NULL;
+	double scale_level = 1.;
+	for(int i=0; i<PRERENDERED_PYRAMID_LEVELS; i++) {
+		scale_level /= 2.;
+		if(scale_level < fit_scale_level) {
+			break;
+		}
+		int width = scale_level * file->width + .5;
+		int height = scale_level * file->height + .5;
+		if(width < 1 || height < 1) {
+			break;
+		}
+		if(scaled_image_size_requires_tiles(width, height) || scale_level > file->decoded_scale_level) {
+			// Too large to be kept around, or more detailed than the decoded
+			// image; start with the next level
+			continue;
+		}
+
+		G_LOCK(prerendered_views);
+		gboolean present = PRERENDERED_PYRAMID_LEVEL(file, i) != NULL;
+		if(present) {
+			if(previous_level) {
+				cairo_surface_destroy(previous_level);
+			}
+			previous_level = cairo_surface_reference(file->prerendered->pyramid[i]);
+		}
+		G_UNLOCK(prerendered_views);
+		if(present) {
+			continue;
+		}
+
+		cairo_surface_t *level = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+		if(cairo_surface_status(level) != CAIRO_STATUS_SUCCESS) {
+			cairo_surface_destroy(level);
+			break;
+		}
+		if(previous_level && image_downscale_surface_2x(level, previous_level)) {
+			cairo_surface_destroy(previous_level);
+		}
+		else {
+			cairo_t *cr = cairo_create(level);
 			cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-			if(file->file_type->draw_fn != NULL) {
-				g_mutex_lock(&file->lock);
-				file->file_type->draw_fn(file, cr);
-				g_mutex_unlock(&file->lock);
+			if(previous_level) {
+				cairo_scale(cr, (double)width / cairo_image_surface_get_width(previous_level), (double)height / cairo_image_surface_get_height(previous_level));
+				cairo_set_source_surface(cr, previous_level, 0, 0);
+				cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+				cairo_paint(cr);
+				cairo_surface_destroy(previous_level);
+			}
+			else {
+				cairo_scale(cr, scale_level, scale_level);
+				if(file->file_type->draw_fn != NULL) {
+					g_mutex_lock(&file->lock);
+					file->file_type->draw_fn(file, cr);
+					g_mutex_unlock(&file->lock);
+				}
 			}
 			cairo_destroy(cr);
-			file->prerendered_view = cairo_surface_reference(prerendered_view);
 		}
-		cairo_surface_destroy(prerendered_view);
+
+		G_LOCK(prerendered_views);
+		prerendered_views_t *views = image_prerendered_views(file);
+		if(views->pyramid[i]) {
+			// Another thread rendered this level meanwhile. Continue from its
+			// render instead.
+			cairo_surface_destroy(level);
+			level = views->pyramid[i];
+		}
+		else {
+			views->pyramid[i] = level;
+		}
+		previous_level = cairo_surface_reference(level);
+		G_UNLOCK(prerendered_views);
+		rendered = TRUE;
+	}
+	if(previous_level) {
+		cairo_surface_destroy(previous_level);
+	}
+	if(rendered) {
+		stage_timer_end(STAGE_PRERENDER_PYRAMID, begin);
+	}
+}/*}}}*/
+void image_unload_prerendered_views(file_t *file) {/*{{{*/
+	G_LOCK(prerendered_views);
+	prerendered_views_t *views = file->prerendered;
+	if(views && views->view) {
+		cairo_surface_destroy(views->view);
+		views->view = NULL;
+	}
+	for(int i=0; views && i<PRERENDERED_PYRAMID_LEVELS; i++) {
+		if(views->pyramid[i]) {
+			cairo_surface_destroy(views->pyramid[i]);
+			views->pyramid[i] = NULL;
+		}
+	}
+	if(views && views->scaled) {
+		cairo_surface_destroy(views->scaled);
+		views->scaled = NULL;
+	}
+	G_UNLOCK(prerendered_views);
+}/*}}}*/
+size_t surface_memory_usage(cairo_surface_t *surface) {/*{{{*/
+	if(!surface || cairo_surface_get_type(surface) != CAIRO_SURFACE_TYPE_IMAGE) {
+		return 0;
+	}
+	return (size_t)cairo_image_surface_get_stride(surface) * cairo_image_surface_get_height(surface);
+}/*}}}*/
+size_t prerendered_memory_usage(file_t *file) {/*{{{*/
+	size_t bytes = surface_memory_usage(PRERENDERED_VIEW(file)) + surface_memory_usage(PRERENDERED_SCALED(file));
+	for(int i=0; i<PRERENDERED_PYRAMID_LEVELS; i++) {
+		bytes += surface_memory_usage(PRERENDERED_PYRAMID_LEVEL(file, i));
+	}
+	return bytes;
+}/*}}}*/
+size_t image_memory_usage(file_t *file) {/*{{{*/
+	// Memory occupied by a loaded image: The backend's representation, which we
+	// estimate from the image's size, plus the prerendered views. Thumbnails are
+	// accounted for separately, because they survive unloading.
+	if(!file->is_loaded) {
+		return 0;
+	}
+	return (size_t)(file->width * file->decoded_scale_level + .5) * (size_t)(file->height * file->decoded_scale_level + .5) * 4 + prerendered_memory_usage(file);
+}/*}}}*/
+void loaded_images_memory_usage(guint *loaded_count, gsize *image_bytes, gsize *prerendered_bytes, gsize *thumbnail_bytes) {/*{{{*/
+	// Add up the memory used by the loaded images, their prerendered views and
+	// all thumbnails. Must be called with file_tree locked.
+	for(GList *node_list = g_queue_peek_head_link(&loaded_files_list); node_list; node_list = g_list_next(node_list)) {
+		BOSNode *loaded_node = bostree_node_weak_unref(file_tree, bostree_node_weak_ref((BOSNode *)node_list->data));
+		if(loaded_node && FILE(loaded_node)->is_loaded) {
+			(*loaded_count)++;
+			*image_bytes += image_memory_usage(FILE(loaded_node)) - prerendered_memory_usage(FILE(loaded_node));
+			*prerendered_bytes += prerendered_memory_usage(FILE(loaded_node));
+		}
 	}
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+	*thumbnail_bytes += thumbnails_memory_bytes;
+#endif
+}/*}}}*/
+void image_cache_touch(BOSNode *node) {/*{{{*/
+	// Mark a loaded image as most recently used. Must be called with file_tree
+	// locked.
+	GList *link = FILE(node)->loaded_files_link;
+	if(link && link != g_queue_peek_head_link(&loaded_files_list)) {
+		g_queue_unlink(&loaded_files_list, link);
+		g_queue_push_head_link(&loaded_files_list, link);
+	}
+}/*}}}*/
+size_t estimate_image_memory_usage(file_t *file) {/*{{{*/
+	// Estimate the amount of memory an image and its prerendered view occupy
+	// once loaded. For images that have never been loaded, assume that they
+	// are about as large as the current one.
+	guint width = file->width;
+	guint height = file->height;
+	if((width == 0 || height == 0) && current_file_node) {
+		width = CURRENT_FILE->width;
+		height = CURRENT_FILE->height;
+	}
+	if(width == 0 || height == 0) {
+		return 0;
+	}
+
+	size_t bytes = (size_t)width * height * 4;
+	if(PRERENDERED_VIEW(file)) {
+		bytes += prerendered_memory_usage(file);
+	}
+	else if(!option_lowmem && (file->file_flags & FILE_FLAGS_ANIMATION) == 0) {
+		const double fit_scale_level = calculate_auto_scale_level_for_screen(width, height);
+		bytes += (size_t)(fit_scale_level * width + .5) * (size_t)(fit_scale_level * height + .5) * 4;
+
+		// The pyramid levels, see image_generate_prerendered_pyramid()
+		double scale_level = 1.;
+		for(int i=0; i<PRERENDERED_PYRAMID_LEVELS; i++) {
+			scale_level /= 2.;
+			if(scale_level < fit_scale_level) {
+				break;
+			}
+			bytes += (size_t)(scale_level * width + .5) * (size_t)(scale_level * height + .5) * 4;
+		}
+	}
+	return bytes;
+}/*}}}*/
+GList *preload_window_nodes() {/*{{{*/
+	// Return the nodes that should be kept in memory besides the current one,
+	// most important first, in a list that does not hold references.
+	// Must be called with file_tree locked.
+	//
+	// option_preload.ahead images in the direction of the last movement and
+	// option_preload.behind images in the other one are preloaded, closest
+	// first, until the memory budget is exhausted.
+	GList *window = NULL;
+	if(option_lowmem || !current_file_node) {
+		return NULL;
+	}
+
+	const size_t budget = (size_t)option_preload.budget * 1024 * 1024;
+	const int depth = option_preload.ahead > option_preload.behind ? option_preload.ahead : option_preload.behind;
+	const int count = bostree_node_count(file_tree);
+	size_t used = 0;
+
+	for(int distance=1; distance<=depth && distance<count; distance++) {
+		for(int side=0; side<2; side++) {
+			if(distance > (side == 0 ? option_preload.ahead : option_preload.behind)) {
+				continue;
+			}
+
+			BOSNode *node = relative_image_pointer((side == 0 ? 1 : -1) * preload_direction * distance);
+			if(!node || node == current_file_node || g_list_find(window, node)) {
+				continue;
+			}
+
+			if(budget > 0) {
+				used += estimate_image_memory_usage(FILE(node));
+				if(used > budget) {
+					return g_list_reverse(window);
+				}
+			}
+
+			window = g_list_prepend(window, node);
+		}
+	}
+
+	return g_list_reverse(window);
+}/*}}}*/
+gboolean image_loader_node_is_being_loaded(BOSNode *node, int except_thread) {/*{{{*/
+	// Must be called with file_tree locked
+	for(int i=0; i<option_loader_threads; i++) {
+		if(i != except_thread && image_loader_threads_currently_loading[i] == node) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}/*}}}*/
+gpointer image_loader_gc_thread(gpointer user_data) {/*{{{*/
+	while(TRUE) {
+		// Wait for a loader thread to announce that it (is about to have) loaded
+		// a new image
+		BOSNode *node = g_async_queue_pop(image_loader_gc_queue);
+
+		// Unload the old images to free up memory.
+		// Doing this in a single thread avoids a race condition between the image
+		// loaders, and keeps them from contending for the file_tree lock
+		D_LOCK(file_tree);
+		GHashTable *preload_window = g_hash_table_new(g_direct_hash, g_direct_equal);
+		GList *preload_window_list = preload_window_nodes();
+		for(GList *window_node = preload_window_list; window_node; window_node = window_node->next) {
+			g_hash_table_insert(preload_window, window_node->data, window_node->data);
+		}
+		g_list_free(preload_window_list);
+
+		// The images that are kept in any case count against the cache's budget
+		// first, the remainder is filled with the most recently used ones.
+		const size_t cache_budget = option_lowmem ? 0 : (size_t)option_cache_size * 1024 * 1024;
+		size_t cache_used = 0;
+		for(GList *node_list = g_queue_peek_head_link(&loaded_files_list); node_list; node_list = g_list_next(node_list)) {
+			BOSNode *loaded_node = bostree_node_weak_unref(file_tree, bostree_node_weak_ref((BOSNode *)node_list->data));
+			if(loaded_node && !FILE(loaded_node)->force_reload && (loaded_node == node || loaded_node == current_file_node || g_hash_table_lookup(preload_window, loaded_node) || image_loader_node_is_being_loaded(loaded_node, -1))) {
+				cache_used += image_memory_usage(FILE(loaded_node));
+			}
+		}
+
+		for(GList *node_list = g_queue_peek_head_link(&loaded_files_list); node_list; ) {
+			GList *next = g_list_next(node_list);
+
+			BOSNode *loaded_node = bostree_node_weak_unref(file_tree, bostree_node_weak_ref((BOSNode *)node_list->data));
+			if(!loaded_node) {
+				// The file stays around until the last weak reference is gone
+				FILE((BOSNode *)node_list->data)->loaded_files_link = NULL;
+				bostree_node_weak_unref(file_tree, (BOSNode *)node_list->data);
+				g_queue_delete_link(&loaded_files_list, node_list);
+			}
+			else {
+				// If the image to be loaded has force_reload set and this has the same file name, also set force_reload
+				if(FILE(node)->force_reload && strcmp(FILE(node)->file_name, FILE(loaded_node)->file_name) == 0) {
+					FILE(loaded_node)->force_reload = TRUE;
+				}
+
+				// Images a loader thread currently works on are never unloaded, except
+				// for the one that requested this pass, whose thread waits for us if
+				// force_reload is set
+				gboolean unload = FALSE;
+				if(loaded_node == node || !image_loader_node_is_being_loaded(loaded_node, -1)) {
+					if(FILE(loaded_node)->force_reload) {
+						// Unloading due to force_reload being set on either this image
+						// This is required because an image can be in a filebuffer, and would thus not be reloaded even if it changed on disk.
+						unload = TRUE;
+					}
+					else if(loaded_node != node && loaded_node != current_file_node && !g_hash_table_lookup(preload_window, loaded_node)) {
+						// Regular unloading: The image will not be seen by the user in the foreseeable feature.
+						// Keep it nonetheless if there is room left in the cache.
+						const size_t usage = image_memory_usage(FILE(loaded_node));
+						if(cache_used + usage <= cache_budget) {
+							cache_used += usage;
+						}
+						else {
+							unload = TRUE;
+						}
+					}
+				}
+
+				if(unload) {
+					// If this node had force_reload set, we must reload it to populate the cache
+					if(FILE(loaded_node)->force_reload && loaded_node == node) {
+						queue_image_load(bostree_node_weak_ref(node));
+					}
+
+					unload_image(loaded_node);
+					// It is important to unref after unloading, because the image data structure
+					// might be reduced to zero if it has been deleted before!
+					FILE(loaded_node)->loaded_files_link = NULL;
+					bostree_node_weak_unref(file_tree, (BOSNode *)node_list->data);
+					g_queue_delete_link(&loaded_files_list, node_list);
+				}
+			}
+
+			node_list = next;
+		}
+		g_hash_table_destroy(preload_window);
+		bostree_node_weak_unref(file_tree, node);
+		image_loader_gc_requests_done++;
+		g_cond_broadcast(&image_loader_threads_currently_loading_cond);
+		D_UNLOCK(file_tree);
+
+		// Have the backends drop what they keep for later loads
+		for(file_type_handler_t *file_type_handler = &file_type_handlers[0]; file_type_handler->file_types_handled; file_type_handler++) {
+			if(file_type_handler->gc_fn != NULL) {
+				file_type_handler->gc_fn();
+			}
+		}
+	}
+}/*}}}*/
+GCancellable *image_loader_get_cancellable() {/*{{{*/
+	return g_private_get(&image_loader_thread_cancellable);
 }/*}}}*/
 gpointer image_loader_thread(gpointer user_data) {/*{{{*/
+	const int thread_index = GPOINTER_TO_INT(user_data);
+	g_private_set(&image_loader_thread_cancellable, image_loader_threads_cancellables[thread_index]);
+
 	while(TRUE) {
 		// Handle new queued image load
-		struct image_loader_queue_item *it = g_async_queue_pop(image_loader_queue);
+		struct scaled_image_render_job *render_job = NULL;
+		struct image_loader_queue_item *it = image_loader_queue_pop(&render_job);
+		if(render_job) {
+			scaled_image_render_job_run(render_job, thread_index);
+			continue;
+		}
 		BOSNode *node = it->node_ref;
-		#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
 		image_loader_purpose_t purpose = it->purpose;
+		#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+		const image_loader_priority_t priority = it->priority;
+		const gboolean thumbnail_cache_checked = it->thumbnail_cache_checked;
 		#endif
 		g_slice_free(struct image_loader_queue_item, it);
 
 		// The image might still be in the loader queue though it has already
 		// been invalidated. In this case, skip it.
+		D_LOCK(file_tree);
 		if(!bostree_node_weak_unref(file_tree, bostree_node_weak_ref(node))) {
-			D_LOCK(file_tree);
 			bostree_node_weak_unref(file_tree, node);
 			D_UNLOCK(file_tree);
 			continue;
 		}
 
+		// If another thread is already working on this image, wait for it to
+		// finish. Most of the work below will then be a no-op.
+		while(image_loader_node_is_being_loaded(node, thread_index)) {
+			D_COND_WAIT(&image_loader_threads_currently_loading_cond, file_tree);
+		}
+		image_loader_threads_currently_loading[thread_index] = node;
+		g_cancellable_reset(image_loader_threads_cancellables[thread_index]);
+
+		// Thumbnails and the first view of an image do not need the full
+		// resolution. Images that have been decoded at a resolution that is
+		// too low for this request are decoded again, while they remain
+		// loaded.
+		FILE(node)->load_resolution = purpose == DEFAULT ? LOAD_RESOLUTION_SCREEN : LOAD_RESOLUTION_THUMBNAIL;
+		const gboolean needs_higher_resolution = FILE(node)->is_loaded && !FILE(node)->force_reload && FILE(node)->decoded_scale_level < 1. &&
+				FILE(node)->decoded_scale_level + 1e-3 < image_loader_get_decode_scale_level(FILE(node), FILE(node)->width, FILE(node)->height);
+
+		// Requests for the full image are answered from the cache if possible
+		if(purpose == DEFAULT) {
+			if(FILE(node)->is_loaded && !FILE(node)->force_reload && !needs_higher_resolution) {
+				image_cache_hits++;
+				image_cache_touch(node);
+			}
+			else {
+				image_cache_misses++;
+			}
+		}
+		D_UNLOCK(file_tree);
+
 		// Short-circuit: If we want to load this image for its thumbnail, check the cache first.
 		// We might not have to load it at all.
 		#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
-		if(purpose == MONTAGE) {
+		if(purpose == MONTAGE && !thumbnail_cache_checked && option_thumbnails.persist != THUMBNAILS_PERSIST_OFF) {
 			// Unload an old thumbnail if it does not have the correct size
 			D_LOCK(file_tree);
-			test_and_invalidate_thumbnail(FILE(node));
-			if(!FILE(node)->thumbnail && (option_thumbnails.enabled || application_mode == MONTAGE) && option_thumbnails.persist != THUMBNAILS_PERSIST_OFF) {
-				if(load_thumbnail_from_cache(FILE(node), option_thumbnails.width, option_thumbnails.height, option_thumbnails.persist, option_thumbnails.special_thumbnail_directory) == TRUE) {
+			const gboolean needs_thumbnail = !test_and_invalidate_thumbnail(FILE(node)) && (option_thumbnails.enabled || application_mode == MONTAGE);
+			D_UNLOCK(file_tree);
+
+			if(needs_thumbnail) {
+				// The PNG is decoded without holding the lock; the slot keeps the
+				// node from being unloaded and the weak reference from being freed
+				cairo_surface_t *thumbnail = thumbnail_cache_lookup(FILE(node));
+
+				D_LOCK(file_tree);
+				image_loader_threads_currently_loading[thread_index] = NULL;
+				g_cond_broadcast(&image_loader_threads_currently_loading_cond);
+				if(thumbnail) {
 					// Loading the thumbnail succeeded. We may break here.
+					image_loader_set_thumbnail(FILE(node), thumbnail);
 					bostree_node_weak_unref(file_tree, node);
 					D_UNLOCK(file_tree);
 
 					// Notify the main thread about this.
 					gdk_threads_add_idle((GSourceFunc)image_loaded_handler, node);
-					continue;
 				}
+				else {
+					// Not cached. Decode the image only after the other pending
+					// lookups, which are much faster.
+					image_loader_queue_push_full(node, purpose, priority, TRUE);
+					D_UNLOCK(file_tree);
+				}
+				continue;
 			}
-			D_UNLOCK(file_tree);
 		}
 		#endif
 
@@ -2679,104 +4667,113 @@ gpointer image_loader_thread(gpointer user_data) {/*{{{*/
 		// As a compromise, load the new image first unless option_lowmem is
 		// set.  Note that a node that has force_reload set will not be loaded
 		// here, because it still is_loaded.
-		if(!option_lowmem && !FILE(node)->is_loaded) {
-			// Load image
-			image_loader_thread_currently_loading = node;
-			image_loader_load_single(node, FALSE);
-			image_loader_thread_currently_loading = NULL;
+		gboolean resolution_increased = FALSE;
+		if(!option_lowmem) {
+			if(!FILE(node)->is_loaded) {
+				image_loader_load_single(node, FALSE);
+			}
+			else if(needs_higher_resolution) {
+				resolution_increased = image_loader_load_single_at_higher_resolution(node);
+			}
 		}
 
-		// Before trying to load the image, unload the old ones to free
-		// up memory.
-		// We do that here to avoid a race condition with the image loaders
+		// Have the GC thread unload the old images. If this image is to be
+		// reloaded, the GC unloads it as well, so we must wait for it to finish
+		// before continuing. In low memory mode, the old images must be gone
+		// before the new one is loaded.
 		D_LOCK(file_tree);
-		for(GList *node_list = loaded_files_list; node_list; ) {
-			GList *next = g_list_next(node_list);
-
-			BOSNode *loaded_node = bostree_node_weak_unref(file_tree, bostree_node_weak_ref((BOSNode *)node_list->data));
-			if(!loaded_node) {
-				bostree_node_weak_unref(file_tree, (BOSNode *)node_list->data);
-				loaded_files_list = g_list_delete_link(loaded_files_list, node_list);
-			}
-			else {
-				// If the image to be loaded has force_reload set and this has the same file name, also set force_reload
-				if(FILE(node)->force_reload && strcmp(FILE(node)->file_name, FILE(loaded_node)->file_name) == 0) {
-					FILE(loaded_node)->force_reload = TRUE;
-				}
-
-				if(
-					// Unloading due to force_reload being set on either this image
-					// This is required because an image can be in a filebuffer, and would thus not be reloaded even if it changed on disk.
-					FILE(loaded_node)->force_reload ||
-					// Regular unloading: The image will not be seen by the user in the foreseeable feature
-					(loaded_node != node && loaded_node != current_file_node && (option_lowmem || (loaded_node != previous_file() && loaded_node != next_file())))
-				) {
-					// If this node had force_reload set, we must reload it to populate the cache
-					if(FILE(loaded_node)->force_reload && loaded_node == node) {
-						queue_image_load(bostree_node_weak_ref(node));
-					}
-
-					unload_image(loaded_node);
-					// It is important to unref after unloading, because the image data structure
-					// might be reduced to zero if it has been deleted before!
-					bostree_node_weak_unref(file_tree, (BOSNode *)node_list->data);
-					loaded_files_list = g_list_delete_link(loaded_files_list, node_list);
-				}
+		const guint gc_request = ++image_loader_gc_requests_queued;
+		g_async_queue_push(image_loader_gc_queue, bostree_node_weak_ref(node));
+		if(FILE(node)->force_reload || option_lowmem) {
+			while((gint)(image_loader_gc_requests_done - gc_request) < 0) {
+				D_COND_WAIT(&image_loader_threads_currently_loading_cond, file_tree);
 			}
-
-			node_list = next;
 		}
 		D_UNLOCK(file_tree);
 
 		// Now take care of the queued image, unless it has been loaded above
-		if(option_lowmem && !FILE(node)->is_loaded) {
-			// Load image
-			image_loader_thread_currently_loading = node;
-			image_loader_load_single(node, FALSE);
-			image_loader_thread_currently_loading = NULL;
+		if(option_lowmem) {
+			if(!FILE(node)->is_loaded) {
+				image_loader_load_single(node, FALSE);
+			}
+			else if(needs_higher_resolution) {
+				resolution_increased = image_loader_load_single_at_higher_resolution(node);
+			}
 		}
 		if(FILE(node)->is_loaded) {
 #ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
 			D_LOCK(file_tree);
-			test_and_invalidate_thumbnail(FILE(node));
-			if(!FILE(node)->thumbnail && (option_thumbnails.enabled || application_mode == MONTAGE)) {
-				if(option_thumbnails.persist == THUMBNAILS_PERSIST_OFF || load_thumbnail_from_cache(FILE(node), option_thumbnails.width, option_thumbnails.height, option_thumbnails.persist, option_thumbnails.special_thumbnail_directory) == FALSE) {
-					D_UNLOCK(file_tree);
-					image_loader_create_thumbnail(FILE(node));
+			const gboolean needs_thumbnail = !test_and_invalidate_thumbnail(FILE(node)) && (option_thumbnails.enabled || application_mode == MONTAGE);
+			D_UNLOCK(file_tree);
+			if(needs_thumbnail) {
+				cairo_surface_t *thumbnail = NULL;
+				gboolean is_new_thumbnail = FALSE;
+				if(!thumbnail_cache_checked) {
+					thumbnail = thumbnail_cache_lookup(FILE(node));
+				}
+				if(!thumbnail) {
+					thumbnail = image_loader_create_thumbnail(FILE(node));
+					is_new_thumbnail = TRUE;
+				}
+				if(thumbnail) {
 					D_LOCK(file_tree);
-					if(FILE(node)->thumbnail && option_thumbnails.persist != THUMBNAILS_PERSIST_OFF && option_thumbnails.persist != THUMBNAILS_PERSIST_RO) {
-						store_thumbnail_to_cache(FILE(node), option_thumbnails.width, option_thumbnails.height, option_thumbnails.persist, option_thumbnails.special_thumbnail_directory);
+					if(is_new_thumbnail) {
+						queue_thumbnail_store(node, thumbnail);
 					}
+					image_loader_set_thumbnail(FILE(node), thumbnail);
+					D_UNLOCK(file_tree);
 				}
 			}
-			D_UNLOCK(file_tree);
 #endif
-			if(node == current_file_node) {
+			if(node == current_file_node && !resolution_increased) {
 				current_image_drawn = FALSE;
 			}
 
-			// Prerender the default scaled view of the image for faster image transitions
+			// Prerender the default scaled view of the image for faster image transitions,
+			// and the reductions used as sources when zooming
+			image_generate_prerendered_pyramid(FILE(node));
 			image_generate_prerendered_view(FILE(node), FALSE, -1);
 
-			gdk_threads_add_idle((GSourceFunc)image_loaded_handler, node);
+			gdk_threads_add_idle((GSourceFunc)(resolution_increased ? image_resolution_increased_handler : image_loaded_handler), node);
 		}
 
 		D_LOCK(file_tree);
+		image_loader_threads_currently_loading[thread_index] = NULL;
+		g_cond_broadcast(&image_loader_threads_currently_loading_cond);
 		bostree_node_weak_unref(file_tree, node);
 		D_UNLOCK(file_tree);
 	}
 }/*}}}*/
-void image_loader_queue_destroy(gpointer data) {/*{{{*/
-	bostree_node_weak_unref(file_tree, ((struct image_loader_queue_item *)data)->node_ref);
-	g_slice_free(struct image_loader_queue_item, data);
+void image_loader_set_thread_count() {/*{{{*/
+	// In low memory mode, there is no point in loading more than one image at
+	// a time
+	if(option_lowmem) {
+		option_loader_threads = 1;
+	}
+	else if(option_loader_threads <= 0) {
+		#if GLIB_CHECK_VERSION(2, 36, 0)
+			option_loader_threads = g_get_num_processors();
+		#else
+			option_loader_threads = 1;
+		#endif
+	}
 }/*}}}*/
 gboolean initialize_image_loader() {/*{{{*/
 	if(image_loader_initialization_succeeded) {
 		return TRUE;
 	}
 	if(image_loader_queue == NULL) {
-		image_loader_queue = g_async_queue_new_full(image_loader_queue_destroy);
-		image_loader_cancellable = g_cancellable_new();
+		image_loader_queue = g_new0(struct image_loader_queue, 1);
+		g_mutex_init(&image_loader_queue->lock);
+		g_cond_init(&image_loader_queue->cond);
+		for(int i=0; i<LOAD_PRIORITY_COUNT; i++) {
+			g_queue_init(&image_loader_queue->items[i]);
+		}
+		image_loader_queue->index = g_hash_table_new(g_direct_hash, g_direct_equal);
+		image_loader_gc_queue = g_async_queue_new();
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+		thumbnail_store_queue = g_async_queue_new();
+#endif
 	}
 	D_LOCK(file_tree);
 	if(current_file_node != NULL) {
@@ -2803,39 +4800,190 @@ gboolean initialize_image_loader() {/*{{{*/
 	if(bostree_node_count(file_tree) == 0) {
 		return FALSE;
 	}
-	g_thread_new("image-loader", image_loader_thread, NULL);
+	image_loader_set_thread_count();
+	image_loader_threads_currently_loading = g_new0(BOSNode *, option_loader_threads);
+	image_loader_threads_cancellables = g_new(GCancellable *, option_loader_threads);
+	for(int i=0; i<option_loader_threads; i++) {
+		image_loader_threads_cancellables[i] = g_cancellable_new();
+	}
+	g_thread_new("image-loader-gc", image_loader_gc_thread, NULL);
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+	g_thread_new("thumbnail-store", thumbnail_store_thread, NULL);
+#endif
+	for(int i=0; i<option_loader_threads; i++) {
+		g_thread_new("image-loader", image_loader_thread, GINT_TO_POINTER(i));
+	}
 
 	preload_adjacent_images();
 
 	image_loader_initialization_succeeded = TRUE;
 	return TRUE;
 }/*}}}*/
+void image_loader_queue_push_full(BOSNode *node, image_loader_purpose_t purpose, image_loader_priority_t priority, gboolean thumbnail_cache_checked) {/*{{{*/
+	// The node must be weak_ref'ed by the caller, and file_tree must be locked.
+	g_mutex_lock(&image_loader_queue->lock);
+	GList *link = g_hash_table_lookup(image_loader_queue->index, node);
+	if(link) {
+		// Merge with the pending item for this node
+		struct image_loader_queue_item *it = link->data;
+		bostree_node_weak_unref(file_tree, node);
+
+		// A full load also creates the thumbnail
+		if(purpose == DEFAULT) {
+			it->purpose = DEFAULT;
+		}
+		if(thumbnail_cache_checked) {
+			it->thumbnail_cache_checked = TRUE;
+		}
+		if(priority < it->priority) {
+			g_queue_unlink(&image_loader_queue->items[it->priority], link);
+			g_queue_push_tail_link(&image_loader_queue->items[priority], link);
+			it->priority = priority;
+		}
+	}
+	else {
+		struct image_loader_queue_item *it = g_slice_new(struct image_loader_queue_item);
+		it->node_ref = node;
+		it->purpose = purpose;
+		it->priority = priority;
+		it->thumbnail_cache_checked = thumbnail_cache_checked;
+		it->queued_at = g_get_monotonic_time();
+		g_queue_push_tail(&image_loader_queue->items[priority], it);
+		g_hash_table_insert(image_loader_queue->index, node, image_loader_queue->items[priority].tail);
+		g_cond_signal(&image_loader_queue->cond);
+	}
+	g_mutex_unlock(&image_loader_queue->lock);
+}/*}}}*/
+void image_loader_queue_push(BOSNode *node, image_loader_purpose_t purpose, image_loader_priority_t priority) {/*{{{*/
+	image_loader_queue_push_full(node, purpose, priority, FALSE);
+}/*}}}*/
+struct image_loader_queue_item *image_loader_queue_pop(struct scaled_image_render_job **render_job) {/*{{{*/
+	// Block until an item is available and return the one with the highest
+	// priority. The caller takes over the item's node reference.
+	// A pending render job is handed out first, via render_job, in which case
+	// NULL is returned.
+	g_mutex_lock(&image_loader_queue->lock);
+	while(TRUE) {
+		if(image_loader_queue->render_job) {
+			*render_job = image_loader_queue->render_job;
+			image_loader_queue->render_job = NULL;
+			g_mutex_unlock(&image_loader_queue->lock);
+			return NULL;
+		}
+		for(int i=0; i<LOAD_PRIORITY_COUNT; i++) {
+			struct image_loader_queue_item *it = g_queue_pop_head(&image_loader_queue->items[i]);
+			if(it) {
+				g_hash_table_remove(image_loader_queue->index, it->node_ref);
+				const gint64 wait_time = g_get_monotonic_time() - it->queued_at;
+				image_loader_queue->waits++;
+				image_loader_queue->wait_time += wait_time;
+				if(wait_time > image_loader_queue->max_wait_time) {
+					image_loader_queue->max_wait_time = wait_time;
+				}
+				g_mutex_unlock(&image_loader_queue->lock);
+				return it;
+			}
+		}
+		g_cond_wait(&image_loader_queue->cond, &image_loader_queue->lock);
+	}
+}/*}}}*/
+void image_loader_queue_remove_link(image_loader_priority_t priority, GList *link) {/*{{{*/
+	// Must be called with both the queue and file_tree locked
+	struct image_loader_queue_item *it = link->data;
+	g_queue_delete_link(&image_loader_queue->items[priority], link);
+	g_hash_table_remove(image_loader_queue->index, it->node_ref);
+	bostree_node_weak_unref(file_tree, it->node_ref);
+	g_slice_free(struct image_loader_queue_item, it);
+}/*}}}*/
+void cancel_running_image_loads(BOSNode *new_pos) {/*{{{*/
+	// Must be called with file_tree locked
+	//
+	// Cancel the loads that became stale because the user moved on to
+	// new_pos, i.e. the ones of images that are not within preloading
+	// distance of it. Loads of new_pos itself and of its neighbours continue.
+	// If new_pos is NULL, all running loads are cancelled.
+	if(image_loader_threads_currently_loading == NULL) {
+		return;
+	}
+	const int depth = option_lowmem ? 0 : MAX(option_preload.ahead, option_preload.behind);
+	const int count = bostree_node_count(file_tree);
+	const int new_rank = new_pos ? (int)bostree_rank(new_pos) : 0;
+	for(int i=0; i<option_loader_threads; i++) {
+		BOSNode *node = image_loader_threads_currently_loading[i];
+		if(node == NULL || node == new_pos) {
+			continue;
+		}
+		// The loader threads only hold weak references; the node might have
+		// been removed from the tree meanwhile
+		if(!bostree_node_weak_unref(file_tree, bostree_node_weak_ref(node))) {
+			continue;
+		}
+		if(new_pos) {
+			const int distance = abs((int)bostree_rank(node) - new_rank);
+			if(MIN(distance, count - distance) <= depth) {
+				continue;
+			}
+		}
+		g_cancellable_cancel(image_loader_threads_cancellables[i]);
+	}
+}/*}}}*/
 void abort_pending_image_loads(BOSNode *new_pos) {/*{{{*/
-	struct image_loader_queue_item *ref;
+	// Must be called with file_tree locked
 	if(image_loader_queue == NULL) {
 		return;
 	}
 
-	while((ref = g_async_queue_try_pop(image_loader_queue)) != NULL) {
-		bostree_node_weak_unref(file_tree, ref->node_ref);
-		g_slice_free(struct image_loader_queue_item, ref);
+	g_mutex_lock(&image_loader_queue->lock);
+	for(int i=0; i<LOAD_PRIORITY_COUNT; i++) {
+		while(image_loader_queue->items[i].head) {
+			image_loader_queue_remove_link(i, image_loader_queue->items[i].head);
+		}
 	}
-	if(image_loader_thread_currently_loading != NULL && image_loader_thread_currently_loading != new_pos) {
-		g_cancellable_cancel(image_loader_cancellable);
+	g_mutex_unlock(&image_loader_queue->lock);
+
+	cancel_running_image_loads(new_pos);
+}/*}}}*/
+void demote_pending_image_loads(BOSNode *new_pos) {/*{{{*/
+	// Must be called with file_tree locked
+	//
+	// Called if the user moved on to new_pos. Pending full loads of other images
+	// are now pointless, because the GC would unload them right away, but
+	// thumbnails are still worth generating once nothing else is left to do.
+	// The caller subsequently queues whatever is important now.
+	if(image_loader_queue == NULL) {
+		return;
 	}
+
+	g_mutex_lock(&image_loader_queue->lock);
+	for(int i=0; i<LOAD_PRIORITY_BACKGROUND; i++) {
+		for(GList *link = image_loader_queue->items[i].head; link; ) {
+			GList *next = link->next;
+			struct image_loader_queue_item *it = link->data;
+
+			if(it->node_ref != new_pos) {
+				if(it->purpose == DEFAULT) {
+					image_loader_queue_remove_link(i, link);
+				}
+				else {
+					g_queue_unlink(&image_loader_queue->items[i], link);
+					g_queue_push_tail_link(&image_loader_queue->items[LOAD_PRIORITY_BACKGROUND], link);
+					it->priority = LOAD_PRIORITY_BACKGROUND;
+				}
+			}
+
+			link = next;
+		}
+	}
+	g_mutex_unlock(&image_loader_queue->lock);
 }/*}}}*/
 void queue_image_load(BOSNode *node) {/*{{{*/
-	struct image_loader_queue_item *it = g_slice_new(struct image_loader_queue_item);
-	it->node_ref = node; // Must be weak_ref'ed by caller. (Simplifies thread safety.)
-	it->purpose = DEFAULT;
-	g_async_queue_push(image_loader_queue, it);
+	// Must be weak_ref'ed by caller. (Simplifies thread safety.)
+	image_loader_queue_push(node, DEFAULT, node == current_file_node ? LOAD_PRIORITY_CURRENT : LOAD_PRIORITY_ADJACENT);
 }/*}}}*/
 #ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
-void queue_thumbnail_load(BOSNode *node) {/*{{{*/
-	struct image_loader_queue_item *it = g_slice_new(struct image_loader_queue_item);
-	it->node_ref = node; // Must be weak_ref'ed by caller.
-	it->purpose = MONTAGE;
-	g_async_queue_push(image_loader_queue, it);
+void queue_thumbnail_load(BOSNode *node, image_loader_priority_t priority) {/*{{{*/
+	// Must be weak_ref'ed by caller.
+	image_loader_queue_push(node, MONTAGE, priority);
 }/*}}}*/
 #endif
 void unload_image(BOSNode *node) {/*{{{*/
@@ -2848,11 +4996,11 @@ void unload_image(BOSNode *node) {/*{{{*/
 		file->file_type->unload_fn(file);
 		g_mutex_unlock(&file->lock);
 	}
-	if(file->prerendered_view) {
-		cairo_surface_destroy(file->prerendered_view);
-		file->prerendered_view = NULL;
-	}
+	image_unload_prerendered_views(file);
 	file->is_loaded = FALSE;
+	if(file->force_reload) {
+		file->file_flags |= FILE_FLAGS_RELOAD;
+	}
 	file->force_reload = FALSE;
 	if(file->file_monitor != NULL) {
 		g_file_monitor_cancel(file->file_monitor);
@@ -2862,6 +5010,20 @@ void unload_image(BOSNode *node) {/*{{{*/
 		file->file_monitor = NULL;
 	}
 }/*}}}*/
+void unload_image_immediately(BOSNode *node) {/*{{{*/
+	// Unload an image right away, instead of leaving that to the
+	// image-loader's next pass over loaded_files_list. For the headless
+	// modes, in which the image-loader thread does not run.
+	D_LOCK(file_tree);
+	GList *link = FILE(node)->loaded_files_link;
+	if(link) {
+		FILE(node)->loaded_files_link = NULL;
+		g_queue_delete_link(&loaded_files_list, link);
+		bostree_node_weak_unref(file_tree, node);
+	}
+	D_UNLOCK(file_tree);
+	unload_image(node);
+}/*}}}*/
 void remove_image(BOSNode *node) {/*{{{*/
 	D_LOCK(file_tree);
 
@@ -2877,7 +5039,9 @@ void remove_image(BOSNode *node) {/*{{{*/
 		// mechanism from the loader thread to handle this situation.
 		CURRENT_FILE->force_reload = TRUE;
 		if(CURRENT_FILE->file_name) {
-			CURRENT_FILE->file_name[0] = 0;
+			// The name is interned, and may be shared with other files
+			file_name_release(CURRENT_FILE->file_name);
+			CURRENT_FILE->file_name = file_name_intern(g_strdup(""));
 		}
 		if(CURRENT_FILE->file_data) {
 			g_bytes_unref(CURRENT_FILE->file_data);
@@ -2894,15 +5058,13 @@ void remove_image(BOSNode *node) {/*{{{*/
 void preload_adjacent_images() {/*{{{*/
 	if(!option_lowmem) {
 		D_LOCK(file_tree);
-		BOSNode *new_prev = previous_file();
-		BOSNode *new_next = next_file();
-
-		if(!FILE(new_next)->is_loaded) {
-			queue_image_load(bostree_node_weak_ref(new_next));
-		}
-		if(!FILE(new_prev)->is_loaded) {
-			queue_image_load(bostree_node_weak_ref(new_prev));
+		GList *preload_window = preload_window_nodes();
+		for(GList *window_node = preload_window; window_node; window_node = window_node->next) {
+			if(!FILE((BOSNode *)window_node->data)->is_loaded) {
+				queue_image_load(bostree_node_weak_ref((BOSNode *)window_node->data));
+			}
 		}
+		g_list_free(preload_window);
 		D_UNLOCK(file_tree);
 	}
 
@@ -2922,7 +5084,7 @@ void preload_adjacent_images() {/*{{{*/
 		BOSNode *thumbnail_node = bostree_select(file_tree, thumbnail_rank);
 		for(; thumbnail_node && count > 0; thumbnail_node = bostree_next_node(thumbnail_node), count--) {
 			if(!test_and_invalidate_thumbnail(FILE(thumbnail_node))) {
-				queue_thumbnail_load(bostree_node_weak_ref(thumbnail_node));
+				queue_thumbnail_load(bostree_node_weak_ref(thumbnail_node), LOAD_PRIORITY_BACKGROUND);
 			}
 		}
 		D_UNLOCK(file_tree);
@@ -2946,7 +5108,8 @@ gboolean absolute_image_movement(BOSNode *ref) {/*{{{*/
 	}
 
 	// No need to continue the other pending loads
-	abort_pending_image_loads(node);
+	demote_pending_image_loads(node);
+	cancel_running_image_loads(node);
 
 #ifndef CONFIGURED_WITHOUT_ACTIONS
 	// Set the new image as current
@@ -3010,7 +5173,10 @@ BOSNode *image_pointer_by_name(gchar *display_name) {/*{{{*/
 	// Note that this is only fast (O(log n)) if the file tree is sorted,
 	// elsewise a linear search is used!
 	if(option_sort && option_sort_key == NAME) {
-		return bostree_lookup(file_tree, display_name);
+		char *sort_key = strnatcasekey(display_name);
+		BOSNode *node = bostree_lookup(file_tree, sort_key);
+		free(sort_key);
+		return node;
 	}
 	else {
 		for(BOSNode *iter = bostree_select(file_tree, 0); iter; iter = bostree_next_node(iter)) {
@@ -3259,6 +5425,9 @@ void relative_image_movement(ptrdiff_t movement) {/*{{{*/
 	// Only perform the movement if the file actually changed.
 	// Important for slideshows if only one file was available and said file has been deleted.
 	if(movement == 0 || target != current_file_node) {
+		if(movement != 0) {
+			preload_direction = movement > 0 ? 1 : -1;
+		}
 		absolute_image_movement(target);
 	}
 	else {
@@ -3408,14 +5577,22 @@ void transform_current_image(cairo_matrix_t *transformation) {/*{{{*/
 	double old_scale_level = current_scale_level;
 	set_scale_level_for_screen();
 	if(fabs(old_scale_level - current_scale_level) > DBL_EPSILON) {
+		// The draw callback has the image rendered at the new scale level
 		invalidate_current_scaled_image_surface();
-		image_generate_prerendered_view(CURRENT_FILE, FALSE, current_scale_level);
 	}
 	main_window_adjust_for_image();
 
 	gtk_widget_queue_draw(GTK_WIDGET(main_window));
 }/*}}}*/
 #ifndef CONFIGURED_WITHOUT_EXTERNAL_COMMANDS /* option --without-external-commands: Do not include support for calling external programs */
+void external_command_child_setup(gpointer user_data) {/*{{{*/
+	// This runs in the child, between fork() and exec(). pqiv ignores
+	// SIGPIPE, see main(), and ignored signals are inherited; external
+	// commands expect the default behaviour.
+#ifndef _WIN32
+	signal(SIGPIPE, SIG_DFL);
+#endif
+}/*}}}*/
 gchar *apply_external_image_filter_prepare_command(gchar *command) { /*{{{*/
 		D_LOCK(file_tree);
 		if((CURRENT_FILE->file_flags & FILE_FLAGS_MEMORY_IMAGE) != 0) {
@@ -3499,6 +5676,193 @@ gpointer apply_external_image_filter_image_writer_thread(gpointer data) {/*{{{*/
 	cairo_surface_destroy(surface);
 	return NULL;
 }/*}}}*/
+void apply_external_image_filter_print_status(gint status) {/*{{{*/
+	// Report a non-zero status from apply_external_image_filter_wait()
+	#ifndef _WIN32
+		if(status != -1 && WIFSIGNALED(status)) {
+			g_printerr("External command was terminated by signal %d\n", WTERMSIG(status));
+			return;
+		}
+		if(status != -1 && WIFEXITED(status)) {
+			status = WEXITSTATUS(status);
+		}
+	#endif
+	g_printerr("External command failed with exit status %d\n", status);
+}/*}}}*/
+gint apply_external_image_filter_wait(GPid child_pid) {/*{{{*/
+	// Wait for a child spawned with G_SPAWN_DO_NOT_REAP_CHILD and return its
+	// status as waitpid() reports it, or its exit code on Windows
+	gint status = -1;
+	#ifdef _WIN32
+		WaitForSingleObject(child_pid, INFINITE);
+		DWORD exit_code = 0;
+		GetExitCodeProcess(child_pid, &exit_code);
+		status = (gint)exit_code;
+	#else
+		if(waitpid(child_pid, &status, 0) == -1) {
+			status = -1;
+		}
+	#endif
+	g_spawn_close_pid(child_pid);
+	return status;
+}/*}}}*/
+void apply_external_image_filter_add_output(const gchar *command, GBytes *image_data) {/*{{{*/
+	// Construct a new file for the output of command, and load it. Takes
+	// ownership of image_data.
+	file_t *new_image = g_slice_new0(file_t);
+	D_LOCK(file_tree);
+	new_image->display_name = file_name_intern(g_strdup_printf("%s [Output of `%s`]", CURRENT_FILE->display_name, command));
+	if(option_sort) {
+		new_image->sort_name = file_name_intern(g_strdup_printf("%s;%s", CURRENT_FILE->sort_name, command));
+	}
+	D_UNLOCK(file_tree);
+	new_image->file_name = file_name_intern(g_strdup("-"));
+	new_image->file_type = &file_type_handlers[0];
+	gsize image_size;
+	const gchar *image_bytes = g_bytes_get_data(image_data, &image_size);
+	if(image_size > 2 && image_bytes[0] == 'P' && image_bytes[1] >= '5' && image_bytes[1] <= '7' && g_ascii_isspace(image_bytes[2])) {
+		// Output in one of the netpbm formats, see backends/netpbm.c. Since
+		// gdk-pixbuf does not read all of them, look for the handler
+		// registered for PAM files
+		GtkFileFilterInfo mime_guesser;
+		mime_guesser.contains = GTK_FILE_FILTER_MIME_TYPE;
+		mime_guesser.mime_type = "image/x-portable-arbitrarymap";
+		for(file_type_handler_t *file_type_handler = &file_type_handlers[0]; file_type_handler->file_types_handled; file_type_handler++) {
+			if(gtk_file_filter_filter(file_type_handler->file_types_handled, &mime_guesser)) {
+				new_image->file_type = file_type_handler;
+				break;
+			}
+		}
+	}
+	new_image->file_flags = FILE_FLAGS_MEMORY_IMAGE;
+	new_image->file_data = image_data;
+	g_mutex_init(&new_image->lock);
+
+	BOSNode *loaded_file = new_image->file_type->alloc_fn(FILTER_OUTPUT, new_image);
+	absolute_image_movement(bostree_node_weak_ref(loaded_file));
+}/*}}}*/
+typedef struct {
+	cairo_surface_t *surface;
+	gint fd;
+} apply_external_image_filter_pam_writer_t;
+gpointer apply_external_image_filter_pam_writer_thread(gpointer data) {/*{{{*/
+	apply_external_image_filter_pam_writer_t *writer = data;
+	if(!netpbm_write_pam(writer->surface, writer->fd) && errno != EPIPE) {
+		g_printerr("Failed to write image to external command: %s\n", g_strerror(errno));
+	}
+	close(writer->fd);
+	return NULL;
+}/*}}}*/
+GBytes *apply_external_image_filter_run_pipes(gchar **argv, cairo_surface_t *surface) {/*{{{*/
+	// Pipe surface into the program as PAM, and read its output from its stdout
+	GError *error_pointer = NULL;
+	GPid child_pid;
+	apply_external_image_filter_pam_writer_t writer = { surface, -1 };
+	gint child_stdout;
+	if(!g_spawn_async_with_pipes(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, external_command_child_setup, NULL, &child_pid, &writer.fd, &child_stdout, NULL, &error_pointer)) {
+		g_printerr("Failed execute external command `%s': %s\n", argv[2], error_pointer->message);
+		g_clear_error(&error_pointer);
+		return NULL;
+	}
+
+	GThread *writer_thread = g_thread_new("image-filter-writer", apply_external_image_filter_pam_writer_thread, &writer);
+
+	gchar *image_data = NULL;
+	gsize image_data_length = 0;
+	GIOChannel *stdout_channel = g_io_channel_unix_new(child_stdout);
+	g_io_channel_set_encoding(stdout_channel, NULL, NULL);
+	g_io_channel_set_close_on_unref(stdout_channel, TRUE);
+	if(g_io_channel_read_to_end(stdout_channel, &image_data, &image_data_length, &error_pointer) != G_IO_STATUS_NORMAL) {
+		g_printerr("Failed to load image from external command: %s\n", error_pointer->message);
+		g_clear_error(&error_pointer);
+		image_data = NULL;
+	}
+	g_io_channel_unref(stdout_channel);
+	g_thread_join(writer_thread);
+
+	gint status = apply_external_image_filter_wait(child_pid);
+	if(image_data && status != 0) {
+		apply_external_image_filter_print_status(status);
+		g_free(image_data);
+		image_data = NULL;
+	}
+	return image_data ? g_bytes_new_take(image_data, image_data_length) : NULL;
+}/*}}}*/
+#if defined(__linux__) && defined(SYS_memfd_create)
+// Exchange images with || filters through memory files instead of pipes: The
+// program reads its input from and writes its output to them, and pqiv maps
+// the output instead of copying it
+#define PQIV_FILTER_MEMFD
+#define PQIV_MFD_CLOEXEC 1U
+typedef struct {
+	int input;
+	int output;
+} apply_external_image_filter_memfd_t;
+void apply_external_image_filter_memfd_child_setup(gpointer user_data) {/*{{{*/
+	// This runs in the child, between fork() and exec(). dup2() clears the
+	// close-on-exec flag of the copies.
+	apply_external_image_filter_memfd_t *fds = user_data;
+	dup2(fds->input, 0);
+	dup2(fds->output, 1);
+	external_command_child_setup(NULL);
+}/*}}}*/
+void apply_external_image_filter_mapped_file_unref(gpointer mapped_file) {/*{{{*/
+	g_mapped_file_unref((GMappedFile *)mapped_file);
+}/*}}}*/
+gboolean apply_external_image_filter_run_memfd(gchar **argv, cairo_surface_t *surface, GBytes **output) {/*{{{*/
+	// Returns FALSE if memory files are unavailable, and the caller should fall
+	// back to pipes. Otherwise, *output is the program's output, or NULL if it
+	// failed.
+	*output = NULL;
+	apply_external_image_filter_memfd_t fds;
+	fds.input = syscall(SYS_memfd_create, "pqiv-filter-input", PQIV_MFD_CLOEXEC);
+	if(fds.input < 0) {
+		return FALSE;
+	}
+	fds.output = syscall(SYS_memfd_create, "pqiv-filter-output", PQIV_MFD_CLOEXEC);
+	if(fds.output < 0) {
+		close(fds.input);
+		return FALSE;
+	}
+
+	GError *error_pointer = NULL;
+	GPid child_pid;
+	if(!netpbm_write_pam(surface, fds.input) || lseek(fds.input, 0, SEEK_SET) != 0) {
+		g_printerr("Failed to write image for external command: %s\n", g_strerror(errno));
+	}
+	else if(!g_spawn_async(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, apply_external_image_filter_memfd_child_setup, &fds, &child_pid, &error_pointer)) {
+		g_printerr("Failed execute external command `%s': %s\n", argv[2], error_pointer->message);
+		g_clear_error(&error_pointer);
+	}
+	else {
+		gint status = apply_external_image_filter_wait(child_pid);
+		struct stat output_stat;
+		if(status != 0) {
+			apply_external_image_filter_print_status(status);
+		}
+		else if(fstat(fds.output, &output_stat) != 0 || output_stat.st_size == 0) {
+			g_printerr("Failed to load image from external command: It wrote no output\n");
+		}
+		else {
+			// A private, writable mapping, such that a surface may use the
+			// pixels in place
+			GMappedFile *mapped_file = g_mapped_file_new_from_fd(fds.output, TRUE, &error_pointer);
+			if(!mapped_file) {
+				g_printerr("Failed to load image from external command: %s\n", error_pointer->message);
+				g_clear_error(&error_pointer);
+			}
+			else {
+				*output = g_bytes_new_with_free_func(g_mapped_file_get_contents(mapped_file), g_mapped_file_get_length(mapped_file), apply_external_image_filter_mapped_file_unref, mapped_file);
+			}
+		}
+	}
+
+	// The mapping stays valid after the memory file is closed
+	close(fds.input);
+	close(fds.output);
+	return TRUE;
+}/*}}}*/
+#endif
 void apply_external_image_filter(gchar *external_filter) {/*{{{*/
 	gchar *argv[4];
 	argv[0] = (gchar*)"/bin/sh"; // Ok: These are not changed below
@@ -3512,7 +5876,7 @@ void apply_external_image_filter(gchar *external_filter) {/*{{{*/
 		argv[2] = apply_external_image_filter_prepare_command(external_filter + 1);
 		gchar *child_stdout = NULL;
 		gchar *child_stderr = NULL;
-		if(g_spawn_sync(NULL, argv, NULL, 0, NULL, NULL, &child_stdout, &child_stderr, NULL, &error_pointer) == FALSE) {
+		if(g_spawn_sync(NULL, argv, NULL, 0, external_command_child_setup, NULL, &child_stdout, &child_stderr, NULL, &error_pointer) == FALSE) {
 			g_printerr("Failed execute external command `%s': %s\n", argv[2], error_pointer->message);
 			g_clear_error(&error_pointer);
 		}
@@ -3525,6 +5889,37 @@ void apply_external_image_filter(gchar *external_filter) {/*{{{*/
 		// Reminder: Do not free the others, they are string constants
 		g_free(argv[2]);
 	}
+	else if(external_filter[0] == '|' && external_filter[1] == '|') {
+		// Exchange the image with the program as uncompressed PAM
+		argv[2] = external_filter + 2;
+		BOSNode *current_file_node_at_start = bostree_node_weak_ref(current_file_node);
+		D_LOCK(file_tree);
+		cairo_surface_t *surface = get_scaled_image_surface_for_current_image();
+		D_UNLOCK(file_tree);
+
+		if(surface) {
+			GBytes *image_data = NULL;
+			gboolean ran_command = FALSE;
+			#ifdef PQIV_FILTER_MEMFD
+				ran_command = apply_external_image_filter_run_memfd(argv, surface, &image_data);
+			#endif
+			if(!ran_command) {
+				image_data = apply_external_image_filter_run_pipes(argv, surface);
+			}
+			cairo_surface_destroy(surface);
+
+			if(image_data && current_file_node_at_start != current_file_node) {
+				// The user navigated away from this image. Abort.
+				g_bytes_unref(image_data);
+			}
+			else if(image_data) {
+				apply_external_image_filter_add_output(argv[2], image_data);
+			}
+		}
+		D_LOCK(file_tree);
+		bostree_node_weak_unref(file_tree, current_file_node_at_start);
+		D_UNLOCK(file_tree);
+	}
 	else if(external_filter[0] == '|') {
 		// Pipe image into program, read image from its stdout
 		argv[2] = external_filter + 1;
@@ -3532,15 +5927,7 @@ void apply_external_image_filter(gchar *external_filter) {/*{{{*/
 		gint child_stdin;
 		gint child_stdout;
 		BOSNode *current_file_node_at_start = bostree_node_weak_ref(current_file_node);
-		if(!g_spawn_async_with_pipes(NULL, argv, NULL,
-			// In win32, the G_SPAWN_DO_NOT_REAP_CHILD is required to get the process handle
-			#ifdef _WIN32
-				G_SPAWN_DO_NOT_REAP_CHILD,
-			#else
-				0,
-			#endif
-			NULL, NULL, &child_pid, &child_stdin, &child_stdout, NULL, &error_pointer)
-		) {
+		if(!g_spawn_async_with_pipes(NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD, external_command_child_setup, NULL, &child_pid, &child_stdin, &child_stdout, NULL, &error_pointer)) {
 			g_printerr("Failed execute external command `%s': %s\n", argv[2], error_pointer->message);
 			g_clear_error(&error_pointer);
 		}
@@ -3557,51 +5944,31 @@ void apply_external_image_filter(gchar *external_filter) {/*{{{*/
 				g_clear_error(&error_pointer);
 			}
 			else {
-				gint status;
-				#ifdef _WIN32
-					WaitForSingleObject(child_pid, INFINITE);
-					DWORD exit_code = 0;
-					GetExitCodeProcess(child_pid, &exit_code);
-					status = (gint)exit_code;
-				#else
-					waitpid(child_pid, &status, 0);
-				#endif
-				g_spawn_close_pid(child_pid);
+				gint status = apply_external_image_filter_wait(child_pid);
 
 				if(current_file_node_at_start != current_file_node) {
 					// The user navigated away from this image. Abort.
 					g_free(image_data);
 				}
 				else if(status != 0) {
-					g_printerr("External command failed with exit status %d\n", status);
+					apply_external_image_filter_print_status(status);
 					g_free(image_data);
 				}
 				else {
-					// We now have a new image in memory in the char buffer image_data. Construct a new file
-					// for the result, and load it
-					//
-					file_t *new_image = g_slice_new0(file_t);
-					new_image->display_name = g_strdup_printf("%s [Output of `%s`]", CURRENT_FILE->display_name, argv[2]);
-					if(option_sort) {
-						new_image->sort_name = g_strdup_printf("%s;%s", CURRENT_FILE->sort_name, argv[2]);
-					}
-					new_image->file_name = g_strdup("-");
-					new_image->file_type = &file_type_handlers[0];
-					new_image->file_flags = FILE_FLAGS_MEMORY_IMAGE;
-					new_image->file_data = g_bytes_new_take(image_data, image_data_length);
-					g_mutex_init(&new_image->lock);
-
-					BOSNode *loaded_file = new_image->file_type->alloc_fn(FILTER_OUTPUT, new_image);
-					absolute_image_movement(bostree_node_weak_ref(loaded_file));
+					// We now have a new image in memory in the char buffer image_data
+					apply_external_image_filter_add_output(argv[2], g_bytes_new_take(image_data, image_data_length));
 				}
 			}
 			g_io_channel_unref(stdin_channel);
 		}
+		D_LOCK(file_tree);
+		bostree_node_weak_unref(file_tree, current_file_node_at_start);
+		D_UNLOCK(file_tree);
 	}
 	else {
 		// Plain system() call
 		argv[2] = apply_external_image_filter_prepare_command(external_filter);
-		if(g_spawn_async(NULL, argv, NULL, 0, NULL, NULL, NULL, &error_pointer) == FALSE) {
+		if(g_spawn_async(NULL, argv, NULL, 0, external_command_child_setup, NULL, NULL, &error_pointer) == FALSE) {
 			g_printerr("Failed execute external command `%s': %s\n", argv[2], error_pointer->message);
 			g_clear_error(&error_pointer);
 		}
@@ -3740,6 +6107,22 @@ void calculate_current_image_transformed_size(int *image_width, int *image_heigh
 	*image_width = (int)fabs(transform_width);
 	*image_height = (int)fabs(transform_height);
 }/*}}}*/
+gboolean pixbuf_import_rows_to_surface(GdkPixbuf *pixbuf, cairo_surface_t *surface, int first_row, int row_count) {/*{{{*/
+	if(cairo_image_surface_get_format(surface) != CAIRO_FORMAT_ARGB32
+			|| gdk_pixbuf_get_colorspace(pixbuf) != GDK_COLORSPACE_RGB
+			|| gdk_pixbuf_get_bits_per_sample(pixbuf) != 8
+			|| gdk_pixbuf_get_n_channels(pixbuf) != (gdk_pixbuf_get_has_alpha(pixbuf) ? 4 : 3)
+			|| gdk_pixbuf_get_width(pixbuf) != cairo_image_surface_get_width(surface)
+			|| gdk_pixbuf_get_height(pixbuf) != cairo_image_surface_get_height(surface)
+			|| first_row < 0 || row_count < 0 || first_row + row_count > gdk_pixbuf_get_height(pixbuf)) {
+		return FALSE;
+	}
+	pixel_kernels_import_rows_to_surface(surface, gdk_pixbuf_get_pixels(pixbuf), gdk_pixbuf_get_rowstride(pixbuf), gdk_pixbuf_get_n_channels(pixbuf), first_row, row_count);
+	return TRUE;
+}/*}}}*/
+gboolean pixbuf_import_to_surface(GdkPixbuf *pixbuf, cairo_surface_t *surface) {/*{{{*/
+	return pixbuf_import_rows_to_surface(pixbuf, surface, 0, gdk_pixbuf_get_height(pixbuf));
+}/*}}}*/
 void apply_interpolation_quality(cairo_t *cr) {/*{{{*/
 	switch(option_interpolation_quality) {
 		case AUTO:
@@ -3789,43 +6172,49 @@ void setup_checkerboard_pattern() {/*{{{*/
     cairo_pattern_set_extend(background_checkerboard_pattern, CAIRO_EXTEND_REPEAT);
     cairo_pattern_set_filter(background_checkerboard_pattern, CAIRO_FILTER_NEAREST);
 }/*}}}*/
-cairo_surface_t *get_scaled_image_surface_for_current_image() {/*{{{*/
+cairo_surface_t *lookup_scaled_image_surface_for_current_image() {/*{{{*/
+	// Return the cached scaled image surface, or NULL if it must be rendered
 	if(current_scaled_image_surface != NULL) {
 		return cairo_surface_reference(current_scaled_image_surface);
 	}
 	if(!CURRENT_FILE->is_loaded) {
 		return NULL;
 	}
-	if(CURRENT_FILE->prerendered_view &&
-			fabs(current_scale_level * CURRENT_FILE->width + .5 - cairo_image_surface_get_width(CURRENT_FILE->prerendered_view)) < 2 &&
-			fabs(current_scale_level * CURRENT_FILE->height + .5 - cairo_image_surface_get_height(CURRENT_FILE->prerendered_view)) < 2) {
-		// If the file has a prerender at the correct size attached, we can reuse it here.
-		cairo_surface_t *retval = cairo_surface_reference(CURRENT_FILE->prerendered_view);
-		if(!option_lowmem) {
-			current_scaled_image_surface = cairo_surface_reference(retval);
+	cairo_surface_t *renders[] = { PRERENDERED_VIEW(CURRENT_FILE), PRERENDERED_SCALED(CURRENT_FILE) };
+	for(int i=0; i<2; i++) {
+		cairo_surface_t *prerendered_view = renders[i];
+		if(prerendered_view &&
+				fabs(current_scale_level * CURRENT_FILE->width + .5 - cairo_image_surface_get_width(prerendered_view)) < 2 &&
+				fabs(current_scale_level * CURRENT_FILE->height + .5 - cairo_image_surface_get_height(prerendered_view)) < 2) {
+			// If the file has a prerender at the correct size attached, we can reuse it here.
+			g_atomic_int_inc(&statistics_prerender_hits);
+			cairo_surface_t *retval = cairo_surface_reference(prerendered_view);
+			if(!option_lowmem) {
+				current_scaled_image_surface = cairo_surface_reference(retval);
+			}
+			return retval;
 		}
-		return retval;
 	}
-	/*
-	else if(CURRENT_FILE->prerendered_view) {
-		printf("Info: Cache miss! %dx%d (cached) vs %dx%d (requested)\n", cairo_image_surface_get_width(CURRENT_FILE->prerendered_view), cairo_image_surface_get_height(CURRENT_FILE->prerendered_view),
-			(int)(current_scale_level * CURRENT_FILE->width + .5), (int)(current_scale_level * CURRENT_FILE->height + .5));
-	}
-	else {
-		printf("Info: Cache miss! Nothing present %dx%d (requested)\n", (int)(current_scale_level * CURRENT_FILE->width + .5), (int)(current_scale_level * CURRENT_FILE->height + .5));
+	// Misses are counted where the view is rendered instead, since callers
+	// might look up more than once
+	return NULL;
+}/*}}}*/
+cairo_surface_t *get_scaled_image_surface_for_current_image() {/*{{{*/
+	cairo_surface_t *retval = lookup_scaled_image_surface_for_current_image();
+	if(retval || !CURRENT_FILE->is_loaded) {
+		return retval;
 	}
-	*/
 
-	cairo_surface_t *retval = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, current_scale_level * CURRENT_FILE->width + .5, current_scale_level * CURRENT_FILE->height + .5);
+	g_atomic_int_inc(&statistics_prerender_misses);
+	retval = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, current_scale_level * CURRENT_FILE->width + .5, current_scale_level * CURRENT_FILE->height + .5);
 	if(cairo_surface_status(retval) != CAIRO_STATUS_SUCCESS) {
 		cairo_surface_destroy(retval);
 		return NULL;
 	}
 
 	cairo_t *cr = cairo_create(retval);
-	cairo_scale(cr, current_scale_level, current_scale_level);
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-	draw_current_image_to_context(cr);
+	image_draw_at_size(CURRENT_FILE, cr, current_scale_level, cairo_image_surface_get_width(retval), cairo_image_surface_get_height(retval));
 	cairo_destroy(cr);
 
 	if(!option_lowmem) {
@@ -3834,6 +6223,350 @@ cairo_surface_t *get_scaled_image_surface_for_current_image() {/*{{{*/
 
 	return retval;
 }/*}}}*/
+gboolean scaled_image_render_done_callback(gpointer user_data) {/*{{{*/
+	D_LOCK(file_tree);
+	if(GPOINTER_TO_UINT(user_data) == scaled_image_render_generation) {
+		gtk_widget_queue_draw(GTK_WIDGET(main_window));
+	}
+	D_UNLOCK(file_tree);
+	return FALSE;
+}/*}}}*/
+cairo_surface_t *image_record_at_size(file_t *file, double scale_level, int width, int height) {/*{{{*/
+	// Record drawing an image at the given size, see image_draw_at_size(). The
+	// file's lock is only held while recording; the recording keeps snapshots
+	// of the surfaces it draws from and is replayed without the lock. Returns
+	// NULL if cairo does not support recording surfaces.
+#if CAIRO_VERSION >= CAIRO_VERSION_ENCODE(1, 10, 0)
+	cairo_surface_t *recording = cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA, NULL);
+	cairo_t *cr = cairo_create(recording);
+	image_draw_at_size(file, cr, scale_level, width, height);
+	cairo_destroy(cr);
+	if(cairo_surface_status(recording) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(recording);
+		return NULL;
+	}
+	return recording;
+#else
+	return NULL;
+#endif
+}/*}}}*/
+void scaled_image_render_job_run(struct scaled_image_render_job *job, int thread_index) {/*{{{*/
+	// Called by the loader threads. Renders the image at the job's scale level
+	// and stores the result as the image's scaled render, from where the main
+	// thread picks it up.
+	D_LOCK(file_tree);
+	BOSNode *node = job->node_ref;
+	if(bostree_node_weak_unref(file_tree, bostree_node_weak_ref(node))) {
+		// Keep the GC from unloading the image while rendering, and wait for
+		// other threads working on it
+		while(image_loader_node_is_being_loaded(node, thread_index)) {
+			D_COND_WAIT(&image_loader_threads_currently_loading_cond, file_tree);
+		}
+	}
+	if(job->generation != scaled_image_render_generation || !bostree_node_weak_unref(file_tree, bostree_node_weak_ref(node)) || !FILE(node)->is_loaded || FILE(node)->force_reload) {
+		// Superseded, or the image is gone
+		if(job->generation == scaled_image_render_generation) {
+			scaled_image_render_in_progress = FALSE;
+		}
+		bostree_node_weak_unref(file_tree, node);
+		g_slice_free(struct scaled_image_render_job, job);
+		D_UNLOCK(file_tree);
+		return;
+	}
+	image_loader_threads_currently_loading[thread_index] = node;
+	D_UNLOCK(file_tree);
+
+	file_t *file = FILE(node);
+	const int width = job->scale_level * file->width + .5;
+	const int height = job->scale_level * file->height + .5;
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	gboolean superseded = FALSE;
+	if(cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS) {
+		cairo_surface_t *recording = image_record_at_size(file, job->scale_level, width, height);
+		cairo_t *cr = cairo_create(surface);
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		if(recording) {
+			// Rasterize in bands, and give up as soon as a newer request
+			// supersedes this one
+			cairo_set_source_surface(cr, recording, 0, 0);
+			for(int y=0; y<height && !superseded; y+=SCALED_IMAGE_RENDER_BAND_HEIGHT) {
+				cairo_rectangle(cr, 0, y, width, MIN(SCALED_IMAGE_RENDER_BAND_HEIGHT, height - y));
+				cairo_fill(cr);
+				superseded = (guint)g_atomic_int_get(&scaled_image_render_generation) != job->generation;
+			}
+			cairo_surface_destroy(recording);
+		}
+		else {
+			image_draw_at_size(file, cr, job->scale_level, width, height);
+		}
+		cairo_destroy(cr);
+	}
+
+	D_LOCK(file_tree);
+	image_loader_threads_currently_loading[thread_index] = NULL;
+	g_cond_broadcast(&image_loader_threads_currently_loading_cond);
+	if(job->generation == scaled_image_render_generation) {
+		scaled_image_render_in_progress = FALSE;
+		if(cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS && !superseded) {
+			G_LOCK(prerendered_views);
+			prerendered_views_t *views = image_prerendered_views(file);
+			if(views->scaled) {
+				cairo_surface_destroy(views->scaled);
+			}
+			views->scaled = cairo_surface_reference(surface);
+			G_UNLOCK(prerendered_views);
+			gdk_threads_add_idle(scaled_image_render_done_callback, GUINT_TO_POINTER(job->generation));
+		}
+	}
+	cairo_surface_destroy(surface);
+	bostree_node_weak_unref(file_tree, node);
+	g_slice_free(struct scaled_image_render_job, job);
+	D_UNLOCK(file_tree);
+}/*}}}*/
+void queue_scaled_image_render() {/*{{{*/
+	// Have a loader thread render the current image at the current scale
+	// level. Must be called with file_tree locked.
+	if(scaled_image_render_in_progress && scaled_image_render_node == current_file_node && fabs(scaled_image_render_scale_level - current_scale_level) < DBL_EPSILON) {
+		return;
+	}
+	g_atomic_int_inc(&statistics_prerender_misses);
+	g_atomic_int_inc(&scaled_image_render_generation);
+	scaled_image_render_node = current_file_node;
+	scaled_image_render_scale_level = current_scale_level;
+	scaled_image_render_in_progress = TRUE;
+
+	struct scaled_image_render_job *job = g_slice_new(struct scaled_image_render_job);
+	job->node_ref = bostree_node_weak_ref(current_file_node);
+	job->scale_level = current_scale_level;
+	job->generation = scaled_image_render_generation;
+
+	g_mutex_lock(&image_loader_queue->lock);
+	struct scaled_image_render_job *superseded_job = image_loader_queue->render_job;
+	image_loader_queue->render_job = job;
+	g_cond_signal(&image_loader_queue->cond);
+	g_mutex_unlock(&image_loader_queue->lock);
+
+	if(superseded_job) {
+		bostree_node_weak_unref(file_tree, superseded_job->node_ref);
+		g_slice_free(struct scaled_image_render_job, superseded_job);
+	}
+}/*}}}*/
+cairo_surface_t *get_scaled_image_stand_in_for_current_image() {/*{{{*/
+	// Return the prerendered surface closest to the current scale level,
+	// preferably a larger one, or the thumbnail. NULL if there is none.
+	const int width = current_scale_level * CURRENT_FILE->width + .5;
+	const int height = current_scale_level * CURRENT_FILE->height + .5;
+	cairo_surface_t *retval = image_prerendered_source_for_size(CURRENT_FILE, width, height);
+	if(retval) {
+		return retval;
+	}
+
+	G_LOCK(prerendered_views);
+	retval = PRERENDERED_VIEW(CURRENT_FILE);
+	cairo_surface_t *scaled = PRERENDERED_SCALED(CURRENT_FILE);
+	if(scaled && (!retval || cairo_image_surface_get_width(scaled) > cairo_image_surface_get_width(retval))) {
+		retval = scaled;
+	}
+	for(int i=0; i<PRERENDERED_PYRAMID_LEVELS; i++) {
+		cairo_surface_t *level = PRERENDERED_PYRAMID_LEVEL(CURRENT_FILE, i);
+		if(level && (!retval || cairo_image_surface_get_width(level) > cairo_image_surface_get_width(retval))) {
+			retval = level;
+		}
+	}
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+	if(!retval) {
+		retval = CURRENT_FILE->thumbnail;
+	}
+#endif
+	if(retval) {
+		cairo_surface_reference(retval);
+	}
+	G_UNLOCK(prerendered_views);
+	return retval;
+}/*}}}*/
+cairo_surface_t *get_scaled_image_tile_for_current_image(int column, int row) {/*{{{*/
+	// Return (a new reference to) the tile at the given position of the scaled
+	// current image, rendering it if it is not cached
+	for(GList *link = scaled_image_tiles.head; link; link = g_list_next(link)) {
+		struct scaled_image_tile *tile = link->data;
+		if(tile->column == column && tile->row == row) {
+			g_queue_unlink(&scaled_image_tiles, link);
+			g_queue_push_head_link(&scaled_image_tiles, link);
+			return cairo_surface_reference(tile->surface);
+		}
+	}
+
+	const int scaled_width = current_scale_level * CURRENT_FILE->width + .5;
+	const int scaled_height = current_scale_level * CURRENT_FILE->height + .5;
+	const int tile_x = column * SCALED_IMAGE_TILE_SIZE;
+	const int tile_y = row * SCALED_IMAGE_TILE_SIZE;
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, MIN(SCALED_IMAGE_TILE_SIZE, scaled_width - tile_x), MIN(SCALED_IMAGE_TILE_SIZE, scaled_height - tile_y));
+	if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		return NULL;
+	}
+
+	cairo_t *cr = cairo_create(surface);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_translate(cr, -tile_x, -tile_y);
+	image_draw_at_size(CURRENT_FILE, cr, current_scale_level, scaled_width, scaled_height);
+	cairo_destroy(cr);
+
+	struct scaled_image_tile *tile = g_slice_new(struct scaled_image_tile);
+	tile->column = column;
+	tile->row = row;
+	tile->surface = cairo_surface_reference(surface);
+	g_queue_push_head(&scaled_image_tiles, tile);
+	return surface;
+}/*}}}*/
+cairo_surface_t *get_negated_image_surface(cairo_surface_t *surface) {/*{{{*/
+	// Returns a new reference to a copy of surface with inverted colors, or
+	// NULL if the surface's format is not supported. Unless in low memory
+	// mode, the copy is kept with the surface, such that redraws of the same
+	// scaled image or tile do not invert it again.
+	static cairo_user_data_key_t negated_surface_key;
+
+	if(cairo_surface_get_type(surface) != CAIRO_SURFACE_TYPE_IMAGE || cairo_image_surface_get_format(surface) != CAIRO_FORMAT_ARGB32) {
+		return NULL;
+	}
+	cairo_surface_t *negated = cairo_surface_get_user_data(surface, &negated_surface_key);
+	if(negated) {
+		return cairo_surface_reference(negated);
+	}
+
+	const int width = cairo_image_surface_get_width(surface);
+	const int height = cairo_image_surface_get_height(surface);
+	negated = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	if(cairo_surface_status(negated) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(negated);
+		return NULL;
+	}
+	cairo_surface_flush(surface);
+	const uint8_t *source_data = cairo_image_surface_get_data(surface);
+	const int source_stride = cairo_image_surface_get_stride(surface);
+	uint8_t *target_data = cairo_image_surface_get_data(negated);
+	const int target_stride = cairo_image_surface_get_stride(negated);
+	for(int y=0; y<height; y++) {
+		pixel_kernels_negate((uint32_t *)(target_data + (size_t)y * target_stride), (const uint32_t *)(source_data + (size_t)y * source_stride), width);
+	}
+	cairo_surface_mark_dirty(negated);
+
+	if(!option_lowmem) {
+		cairo_surface_set_user_data(surface, &negated_surface_key, cairo_surface_reference(negated), (cairo_destroy_func_t)cairo_surface_destroy);
+	}
+	return negated;
+}/*}}}*/
+void paint_scaled_image_surface(cairo_t *cr, cairo_surface_t *surface, double x, double y) {/*{{{*/
+	cairo_surface_t *negated = option_negate ? get_negated_image_surface(surface) : NULL;
+	if(negated) {
+		cairo_set_source_surface(cr, negated, x, y);
+		cairo_paint(cr);
+		cairo_surface_destroy(negated);
+	}
+	else if(option_negate) {
+		// Negated color mode for surfaces we can not invert directly: To do
+		// alpha channels correctly, draw white using the image's alpha channel
+		// as a mask first.
+		// Note that cairo_mask_surface already paints, despite the name.
+		cairo_save(cr);
+		cairo_set_source_rgb(cr, 1., 1., 1.);
+		cairo_mask_surface(cr, surface, x, y);
+		cairo_restore(cr);
+
+		// Now take the difference to the image: This will invert the colors.
+		cairo_save(cr);
+		cairo_set_operator(cr, CAIRO_OPERATOR_DIFFERENCE);
+		cairo_set_source_surface(cr, surface, x, y);
+		cairo_paint(cr);
+		cairo_restore(cr);
+	}
+	else {
+		cairo_set_source_surface(cr, surface, x, y);
+		cairo_paint(cr);
+	}
+}/*}}}*/
+void window_draw_scaled_image(cairo_t *cr) {/*{{{*/
+	// Draw the scaled current image. cr must be set up such that user space
+	// coordinates are those of the scaled image.
+	//
+	// If the scaled image is not cached, rendering it may take a while for
+	// large images. Unless in low memory mode, or for animations, which are
+	// redrawn continuously anyway, have a loader thread do it, and draw a
+	// stand-in stretched to the right size meanwhile.
+	cairo_surface_t *surface = lookup_scaled_image_surface_for_current_image();
+	if(!surface && !option_lowmem && (CURRENT_FILE->file_flags & FILE_FLAGS_ANIMATION) == 0 && image_loader_queue != NULL) {
+		surface = get_scaled_image_stand_in_for_current_image();
+		if(surface) {
+			queue_scaled_image_render();
+
+			cairo_save(cr);
+			cairo_scale(cr, current_scale_level * CURRENT_FILE->width / cairo_image_surface_get_width(surface), current_scale_level * CURRENT_FILE->height / cairo_image_surface_get_height(surface));
+			paint_scaled_image_surface(cr, surface, 0, 0);
+			cairo_restore(cr);
+			cairo_surface_destroy(surface);
+			return;
+		}
+	}
+	if(!surface) {
+		// Nothing to show meanwhile: render synchronously
+		surface = get_scaled_image_surface_for_current_image();
+	}
+	if(surface) {
+		paint_scaled_image_surface(cr, surface, 0, 0);
+		cairo_surface_destroy(surface);
+	}
+}/*}}}*/
+void window_draw_scaled_image_tiles(cairo_t *cr) {/*{{{*/
+	// Draw the current image from tiles. cr must be set up such that user space
+	// coordinates are those of the scaled image.
+	const int scaled_width = current_scale_level * CURRENT_FILE->width + .5;
+	const int scaled_height = current_scale_level * CURRENT_FILE->height + .5;
+
+	// Not every change of the scale level invalidates the scaled image surface
+	// explicitly, so double check that the tiles are still valid
+	if(scaled_image_tiles_file != CURRENT_FILE || fabs(scaled_image_tiles_scale_level - current_scale_level) > DBL_EPSILON) {
+		invalidate_current_scaled_image_surface();
+		scaled_image_tiles_file = CURRENT_FILE;
+		scaled_image_tiles_scale_level = current_scale_level;
+	}
+
+	// The clip extents are the visible part of the image. Render an extra tile
+	// in each direction, such that panning usually finds them ready.
+	double x1, y1, x2, y2;
+	cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+	const int first_column = MAX(0, (int)floor(x1 / SCALED_IMAGE_TILE_SIZE) - 1);
+	const int first_row = MAX(0, (int)floor(y1 / SCALED_IMAGE_TILE_SIZE) - 1);
+	const int last_column = MIN((scaled_width - 1) / SCALED_IMAGE_TILE_SIZE, (int)floor(x2 / SCALED_IMAGE_TILE_SIZE) + 1);
+	const int last_row = MIN((scaled_height - 1) / SCALED_IMAGE_TILE_SIZE, (int)floor(y2 / SCALED_IMAGE_TILE_SIZE) + 1);
+
+	for(int row = first_row; row <= last_row; row++) {
+		for(int column = first_column; column <= last_column; column++) {
+			const double tile_x = column * SCALED_IMAGE_TILE_SIZE;
+			const double tile_y = row * SCALED_IMAGE_TILE_SIZE;
+			cairo_surface_t *tile = get_scaled_image_tile_for_current_image(column, row);
+			if(!tile) {
+				continue;
+			}
+			if(tile_x < x2 && tile_y < y2 && tile_x + SCALED_IMAGE_TILE_SIZE > x1 && tile_y + SCALED_IMAGE_TILE_SIZE > y1) {
+				cairo_save(cr);
+				cairo_rectangle(cr, tile_x, tile_y, cairo_image_surface_get_width(tile), cairo_image_surface_get_height(tile));
+				cairo_clip(cr);
+				paint_scaled_image_surface(cr, tile, tile_x, tile_y);
+				cairo_restore(cr);
+			}
+			cairo_surface_destroy(tile);
+		}
+	}
+
+	// Age out the least recently used tiles; keep about twice what fills the
+	// window
+	const guint max_tiles = 2 * (main_window_width / SCALED_IMAGE_TILE_SIZE + 3) * (main_window_height / SCALED_IMAGE_TILE_SIZE + 3);
+	while(g_queue_get_length(&scaled_image_tiles) > max_tiles) {
+		struct scaled_image_tile *old_tile = g_queue_pop_tail(&scaled_image_tiles);
+		cairo_surface_destroy(old_tile->surface);
+		g_slice_free(struct scaled_image_tile, old_tile);
+	}
+}/*}}}*/
 static void status_output() {/*{{{*/
 #ifndef CONFIGURED_WITHOUT_ACTIONS
 	if(!option_status_output) {
@@ -3850,51 +6583,203 @@ static void status_output() {/*{{{*/
 // }}}
 /* Jump dialog {{{ */
 #ifndef CONFIGURED_WITHOUT_JUMP_DIALOG /* option --without-jump-dialog: Do not build with -j support */
-gboolean jump_dialog_search_list_filter_callback(GtkTreeModel *model, GtkTreeIter *iter, gpointer user_data) { /* {{{ */
-	/**
-	 * List filter function for the jump dialog
-	 */
-	gchar *entry_text = (gchar*)gtk_entry_get_text(GTK_ENTRY(user_data));
+// The jump dialog's list is a virtual tree model over the matches of the
+// current query in an index of the file names, which is built once when the
+// dialog opens: The names and their lower case versions are stored in one
+// block each, such that filtering does not allocate per file. If the query
+// grows, only the previous matches are searched.
+struct jump_dialog_index {
+	guint n_files;
+	gchar *names;
+	gchar *lower_names;
+	gsize *name_offsets;
+	BOSNode **nodes;
+	GtkWidget *tree_view;
+};
+typedef struct {
+	GObject parent;
+	struct jump_dialog_index *index;
+	gchar *query;
+	guint *rows;
+	guint n_rows;
+	gint stamp;
+} PqivJumpDialogModel;
+typedef struct {
+	GObjectClass parent_class;
+} PqivJumpDialogModelClass;
+static void pqiv_jump_dialog_model_tree_model_init(GtkTreeModelIface *iface);
+G_DEFINE_TYPE_WITH_CODE(PqivJumpDialogModel, pqiv_jump_dialog_model, G_TYPE_OBJECT, G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, pqiv_jump_dialog_model_tree_model_init))
+#define PQIV_JUMP_DIALOG_MODEL(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), pqiv_jump_dialog_model_get_type(), PqivJumpDialogModel))
 
-	if(entry_text[0] == 0) {
-		return TRUE;
+static void pqiv_jump_dialog_model_finalize(GObject *object) {/*{{{*/
+	PqivJumpDialogModel *model = PQIV_JUMP_DIALOG_MODEL(object);
+	g_free(model->query);
+	g_free(model->rows);
+	G_OBJECT_CLASS(pqiv_jump_dialog_model_parent_class)->finalize(object);
+}/*}}}*/
+static void pqiv_jump_dialog_model_class_init(PqivJumpDialogModelClass *klass) {/*{{{*/
+	G_OBJECT_CLASS(klass)->finalize = pqiv_jump_dialog_model_finalize;
+}/*}}}*/
+static void pqiv_jump_dialog_model_init(PqivJumpDialogModel *model) {/*{{{*/
+	model->stamp = g_random_int();
+}/*}}}*/
+static GtkTreeModelFlags pqiv_jump_dialog_model_get_flags(GtkTreeModel *tree_model) {/*{{{*/
+	return GTK_TREE_MODEL_LIST_ONLY | GTK_TREE_MODEL_ITERS_PERSIST;
+}/*}}}*/
+static gint pqiv_jump_dialog_model_get_n_columns(GtkTreeModel *tree_model) {/*{{{*/
+	return 3;
+}/*}}}*/
+static GType pqiv_jump_dialog_model_get_column_type(GtkTreeModel *tree_model, gint column) {/*{{{*/
+	// The columns are the 1-based index, the display name and the node
+	return column == 0 ? G_TYPE_LONG : (column == 1 ? G_TYPE_STRING : G_TYPE_POINTER);
+}/*}}}*/
+static gboolean pqiv_jump_dialog_model_iter_nth_child(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent, gint n) {/*{{{*/
+	PqivJumpDialogModel *model = PQIV_JUMP_DIALOG_MODEL(tree_model);
+	if(parent || n < 0 || (guint)n >= model->n_rows) {
+		return FALSE;
 	}
-
-	gboolean retval;
-	if(entry_text[0] == '#') {
-		ssize_t desired_index = atoi(&entry_text[1]);
-
-		GValue col_data;
-		memset(&col_data, 0, sizeof(GValue));
-		gtk_tree_model_get_value(model, iter, 0, &col_data);
-		retval = g_value_get_long(&col_data) == desired_index;
-		g_value_unset(&col_data);
+	iter->stamp = model->stamp;
+	iter->user_data = GUINT_TO_POINTER(n);
+	return TRUE;
+}/*}}}*/
+static gboolean pqiv_jump_dialog_model_get_iter(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path) {/*{{{*/
+	if(gtk_tree_path_get_depth(path) != 1) {
+		return FALSE;
+	}
+	return pqiv_jump_dialog_model_iter_nth_child(tree_model, iter, NULL, gtk_tree_path_get_indices(path)[0]);
+}/*}}}*/
+static GtkTreePath *pqiv_jump_dialog_model_get_path(GtkTreeModel *tree_model, GtkTreeIter *iter) {/*{{{*/
+	return gtk_tree_path_new_from_indices(GPOINTER_TO_UINT(iter->user_data), -1);
+}/*}}}*/
+static void pqiv_jump_dialog_model_get_value(GtkTreeModel *tree_model, GtkTreeIter *iter, gint column, GValue *value) {/*{{{*/
+	PqivJumpDialogModel *model = PQIV_JUMP_DIALOG_MODEL(tree_model);
+	const guint file = model->rows[GPOINTER_TO_UINT(iter->user_data)];
+	g_value_init(value, pqiv_jump_dialog_model_get_column_type(tree_model, column));
+	if(column == 0) {
+		g_value_set_long(value, file + 1);
+	}
+	else if(column == 1) {
+		g_value_set_static_string(value, model->index->names + model->index->name_offsets[file]);
 	}
 	else {
-		entry_text = g_ascii_strdown(entry_text, -1);
-		GValue col_data;
-		memset(&col_data, 0, sizeof(GValue));
-		gtk_tree_model_get_value(model, iter, 1, &col_data);
-		gchar *compare_in = (char*)g_value_get_string(&col_data);
-		compare_in = g_ascii_strdown(compare_in, -1);
-		retval = (g_strstr_len(compare_in, -1, entry_text) != NULL);
-		g_free(compare_in);
-		g_value_unset(&col_data);
-		g_free(entry_text);
+		g_value_set_pointer(value, model->index->nodes[file]);
+	}
+}/*}}}*/
+static gboolean pqiv_jump_dialog_model_iter_next(GtkTreeModel *tree_model, GtkTreeIter *iter) {/*{{{*/
+	return pqiv_jump_dialog_model_iter_nth_child(tree_model, iter, NULL, GPOINTER_TO_UINT(iter->user_data) + 1);
+}/*}}}*/
+static gboolean pqiv_jump_dialog_model_iter_children(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent) {/*{{{*/
+	return pqiv_jump_dialog_model_iter_nth_child(tree_model, iter, parent, 0);
+}/*}}}*/
+static gboolean pqiv_jump_dialog_model_iter_has_child(GtkTreeModel *tree_model, GtkTreeIter *iter) {/*{{{*/
+	return FALSE;
+}/*}}}*/
+static gint pqiv_jump_dialog_model_iter_n_children(GtkTreeModel *tree_model, GtkTreeIter *iter) {/*{{{*/
+	return iter ? 0 : PQIV_JUMP_DIALOG_MODEL(tree_model)->n_rows;
+}/*}}}*/
+static gboolean pqiv_jump_dialog_model_iter_parent(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *child) {/*{{{*/
+	return FALSE;
+}/*}}}*/
+static void pqiv_jump_dialog_model_tree_model_init(GtkTreeModelIface *iface) {/*{{{*/
+	iface->get_flags = pqiv_jump_dialog_model_get_flags;
+	iface->get_n_columns = pqiv_jump_dialog_model_get_n_columns;
+	iface->get_column_type = pqiv_jump_dialog_model_get_column_type;
+	iface->get_iter = pqiv_jump_dialog_model_get_iter;
+	iface->get_path = pqiv_jump_dialog_model_get_path;
+	iface->get_value = pqiv_jump_dialog_model_get_value;
+	iface->iter_next = pqiv_jump_dialog_model_iter_next;
+	iface->iter_children = pqiv_jump_dialog_model_iter_children;
+	iface->iter_has_child = pqiv_jump_dialog_model_iter_has_child;
+	iface->iter_n_children = pqiv_jump_dialog_model_iter_n_children;
+	iface->iter_nth_child = pqiv_jump_dialog_model_iter_nth_child;
+	iface->iter_parent = pqiv_jump_dialog_model_iter_parent;
+}/*}}}*/
+struct jump_dialog_index *jump_dialog_index_new() {/*{{{*/
+	// Must be called with the file tree locked. Takes a weak reference to
+	// each node.
+	struct jump_dialog_index *index = g_slice_new0(struct jump_dialog_index);
+	index->n_files = bostree_node_count(file_tree);
+	index->name_offsets = g_new(gsize, index->n_files);
+	index->nodes = g_new(BOSNode *, index->n_files);
+
+	gsize names_size = 0;
+	guint i = 0;
+	for(BOSNode *node = bostree_select(file_tree, 0); node && i < index->n_files; node = bostree_next_node(node), i++) {
+		index->name_offsets[i] = names_size;
+		index->nodes[i] = bostree_node_weak_ref(node);
+		names_size += strlen(FILE(node)->display_name) + 1;
+	}
+	index->n_files = i;
+
+	index->names = g_malloc(names_size);
+	index->lower_names = g_malloc(names_size);
+	for(i = 0; i < index->n_files; i++) {
+		const gchar *name = FILE(index->nodes[i])->display_name;
+		gchar *target = index->names + index->name_offsets[i];
+		gchar *lower_target = index->lower_names + index->name_offsets[i];
+		do {
+			*lower_target++ = g_ascii_tolower(*name);
+		} while((*target++ = *name++));
+	}
+	return index;
+}/*}}}*/
+void jump_dialog_index_free(struct jump_dialog_index *index) {/*{{{*/
+	D_LOCK(file_tree);
+	for(guint i = 0; i < index->n_files; i++) {
+		bostree_node_weak_unref(file_tree, index->nodes[i]);
 	}
+	D_UNLOCK(file_tree);
+	g_free(index->nodes);
+	g_free(index->name_offsets);
+	g_free(index->names);
+	g_free(index->lower_names);
+	g_slice_free(struct jump_dialog_index, index);
+}/*}}}*/
+GtkTreeModel *jump_dialog_index_filter(struct jump_dialog_index *index, const gchar *entry_text, PqivJumpDialogModel *previous) {/*{{{*/
+	// Returns a model with the files matching entry_text, a substring of the
+	// name or, if entry_text is #<number>, a file's index. previous may be the
+	// model for the previous query.
+	PqivJumpDialogModel *model = g_object_new(pqiv_jump_dialog_model_get_type(), NULL);
+	model->index = index;
+	model->query = g_ascii_strdown(entry_text, -1);
 
-	return retval;
-} /* }}} */
+	if(entry_text[0] == '#') {
+		const long desired_index = atol(&entry_text[1]);
+		model->rows = g_new(guint, 1);
+		if(desired_index >= 1 && desired_index <= index->n_files) {
+			model->rows[model->n_rows++] = desired_index - 1;
+		}
+		return GTK_TREE_MODEL(model);
+	}
+
+	// Every name containing the query also contains the previous query if that
+	// is a substring of the new one, so only the previous matches need to be
+	// searched then
+	const gboolean narrow = previous && previous->query[0] != '#' && strstr(model->query, previous->query) != NULL;
+	const guint n_candidates = narrow ? previous->n_rows : index->n_files;
+	model->rows = g_new(guint, MAX(n_candidates, 1));
+	for(guint i = 0; i < n_candidates; i++) {
+		const guint file = narrow ? previous->rows[i] : i;
+		if(model->query[0] == 0 || strstr(index->lower_names + index->name_offsets[file], model->query) != NULL) {
+			model->rows[model->n_rows++] = file;
+		}
+	}
+	return GTK_TREE_MODEL(model);
+}/*}}}*/
 gint jump_dialog_entry_changed_callback(GtkWidget *entry, gpointer user_data) { /*{{{*/
 	/**
 	 * Refilter the list when the entry text is changed
 	 */
-	gtk_tree_model_filter_refilter(GTK_TREE_MODEL_FILTER(gtk_tree_view_get_model(GTK_TREE_VIEW(user_data))));
+	struct jump_dialog_index *index = user_data;
+	GtkTreeView *tree_view = GTK_TREE_VIEW(index->tree_view);
+	GtkTreeModel *model = jump_dialog_index_filter(index, gtk_entry_get_text(GTK_ENTRY(entry)), PQIV_JUMP_DIALOG_MODEL(gtk_tree_view_get_model(tree_view)));
+	gtk_tree_view_set_model(tree_view, model);
+	g_object_unref(model);
 
 	GtkTreeIter iter;
 	memset(&iter, 0, sizeof(GtkTreeIter));
-	if(gtk_tree_model_get_iter_first(gtk_tree_view_get_model(GTK_TREE_VIEW(user_data)), &iter)) {
-		gtk_tree_selection_select_iter(gtk_tree_view_get_selection(GTK_TREE_VIEW(user_data)), &iter);
+	if(gtk_tree_model_get_iter_first(model, &iter)) {
+		gtk_tree_selection_select_iter(gtk_tree_view_get_selection(tree_view), &iter);
 	}
 	return FALSE;
 } /* }}} */
@@ -3938,7 +6823,6 @@ void do_jump_dialog() { /* {{{ */
 	 * Show the jump dialog to jump directly
 	 * to an image
 	 */
-	GtkTreeIter search_list_iter;
 
 	// If in fullscreen, show the cursor again
 	if(main_window_in_fullscreen) {
@@ -3961,29 +6845,17 @@ void do_jump_dialog() { /* {{{ */
 		TRUE,
 		0);
 
-	// Build list for searching
-	GtkListStore *search_list = gtk_list_store_new(3, G_TYPE_LONG, G_TYPE_STRING, G_TYPE_POINTER);
-	size_t id = 1;
+	// Build the index for searching
 	D_LOCK(file_tree);
-	for(BOSNode *node = bostree_select(file_tree, 0); node; node = bostree_next_node(node)) {
-		gtk_list_store_append(search_list, &search_list_iter);
-
-		gtk_list_store_set(search_list, &search_list_iter,
-			0, id++,
-			1, FILE(node)->display_name,
-			2, bostree_node_weak_ref(node),
-			-1);
-	}
+	struct jump_dialog_index *search_index = jump_dialog_index_new();
 	D_UNLOCK(file_tree);
+	GtkTreeModel *search_list = jump_dialog_index_filter(search_index, "", NULL);
 
-	GtkTreeModel *search_list_filter = gtk_tree_model_filter_new(GTK_TREE_MODEL(search_list), NULL);
-	gtk_tree_model_filter_set_visible_func(GTK_TREE_MODEL_FILTER(search_list_filter),
-		jump_dialog_search_list_filter_callback,
-		search_entry,
-		NULL);
-
-	// Create tree view
-	GtkWidget *search_list_box = gtk_tree_view_new_with_model(GTK_TREE_MODEL(search_list_filter));
+	// Create tree view. The rows have a fixed height, such that the view need
+	// not measure all of them.
+	GtkWidget *search_list_box = gtk_tree_view_new_with_model(search_list);
+	g_object_unref(search_list);
+	search_index->tree_view = search_list_box;
 	gtk_tree_view_set_search_column(GTK_TREE_VIEW(search_list_box), 0);
 	gtk_tree_view_set_enable_search(GTK_TREE_VIEW(search_list_box), TRUE);
 
@@ -4001,6 +6873,12 @@ void do_jump_dialog() { /* {{{ */
 		search_list_renderer_1,
 		"text", 1,
 		NULL);
+	for(int i=0; i<2; i++) {
+		GtkTreeViewColumn *column = gtk_tree_view_get_column(GTK_TREE_VIEW(search_list_box), i);
+		gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+		gtk_tree_view_column_set_fixed_width(column, i == 0 ? 80 : 520);
+	}
+	gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(search_list_box), TRUE);
 	GtkWidget *scroll_bar = gtk_scrolled_window_new(NULL, NULL);
 	gtk_container_add(GTK_CONTAINER(scroll_bar),
 		search_list_box);
@@ -4022,7 +6900,7 @@ void do_jump_dialog() { /* {{{ */
 	gtk_tree_path_free(goto_active_path);
 
 	// Show dialog
-	g_signal_connect(search_entry, "changed", G_CALLBACK(jump_dialog_entry_changed_callback), search_list_box);
+	g_signal_connect(search_entry, "changed", G_CALLBACK(jump_dialog_entry_changed_callback), search_index);
 	g_signal_connect(search_entry, "key-press-event", G_CALLBACK(jump_dialog_exit_on_enter_callback), dlg_window);
 	g_signal_connect(search_list_box, "key-press-event", G_CALLBACK(jump_dialog_exit_on_enter_callback), dlg_window);
 	g_signal_connect(search_list_box, "button-press-event", G_CALLBACK(jump_dialog_exit_on_dbl_click_callback), dlg_window);
@@ -4036,24 +6914,13 @@ void do_jump_dialog() { /* {{{ */
 			NULL);
 	}
 
-	// Free the references again
-	GtkTreeIter iter;
-	memset(&iter, 0, sizeof(GtkTreeIter));
-	if(gtk_tree_model_get_iter_first(gtk_tree_view_get_model(GTK_TREE_VIEW(search_list_box)), &iter)) {
-		GValue col_data;
-		memset(&col_data, 0, sizeof(GValue));
-		gtk_tree_model_get_value(GTK_TREE_MODEL(search_list_filter), &iter, 2, &col_data);
-		bostree_node_weak_unref(file_tree, (BOSNode *)g_value_get_pointer(&col_data));
-		g_value_unset(&col_data);
-	}
-
 	if(main_window_in_fullscreen) {
 		window_hide_cursor();
 	}
 
+	// Free the references again
 	gtk_widget_destroy(dlg_window);
-	g_object_unref(search_list);
-	g_object_unref(search_list_filter);
+	jump_dialog_index_free(search_index);
 } /* }}} */
 #endif
 // }}}
@@ -4508,20 +7375,23 @@ void montage_window_move_cursor(int move_x, int move_y, int move_y_pages) {/*{{{
 
 	montage_window_control.selected_node = bostree_node_weak_ref(selected_node);
 
-	// Queue loading of thumbnails
-	abort_pending_image_loads(selected_node);
+	// Queue loading of thumbnails. Those of the visible cells take precedence
+	// over the ones that are generated in advance.
+	demote_pending_image_loads(selected_node);
+
+	const int thumb_preload_count = option_thumbnails.auto_generate_for_adjacents > 0 ? option_thumbnails.auto_generate_for_adjacents : 0;
 
-	int thumb_node_fwd_ctr = (n_thumbs_y - pos_y - 1) * n_thumbs_x + (n_thumbs_x - pos_x - 1) + (option_thumbnails.auto_generate_for_adjacents > 0 ? option_thumbnails.auto_generate_for_adjacents : 0) + 1;
+	int thumb_node_fwd_ctr = (n_thumbs_y - pos_y - 1) * n_thumbs_x + (n_thumbs_x - pos_x - 1) + thumb_preload_count + 1;
 	BOSNode *thumb_node_fwd = selected_node;
 
-	int thumb_node_bwd_ctr = pos_y  * n_thumbs_x + pos_x + (option_thumbnails.auto_generate_for_adjacents > 0 ? option_thumbnails.auto_generate_for_adjacents : 0);
+	int thumb_node_bwd_ctr = pos_y  * n_thumbs_x + pos_x + thumb_preload_count;
 	BOSNode *thumb_node_bwd = bostree_previous_node(selected_node);
 
 	while(TRUE) {
 		gboolean did_something = FALSE;
 		if(thumb_node_fwd && thumb_node_fwd_ctr) {
 			if(!test_and_invalidate_thumbnail(FILE(thumb_node_fwd))) {
-				queue_thumbnail_load(bostree_node_weak_ref(thumb_node_fwd));
+				queue_thumbnail_load(bostree_node_weak_ref(thumb_node_fwd), thumb_node_fwd_ctr > thumb_preload_count ? LOAD_PRIORITY_VISIBLE : LOAD_PRIORITY_BACKGROUND);
 			}
 			thumb_node_fwd = bostree_next_node(thumb_node_fwd);
 			thumb_node_fwd_ctr--;
@@ -4529,7 +7399,7 @@ void montage_window_move_cursor(int move_x, int move_y, int move_y_pages) {/*{{{
 		}
 		if(thumb_node_bwd && thumb_node_bwd_ctr) {
 			if(!test_and_invalidate_thumbnail(FILE(thumb_node_bwd))) {
-				queue_thumbnail_load(bostree_node_weak_ref(thumb_node_bwd));
+				queue_thumbnail_load(bostree_node_weak_ref(thumb_node_bwd), thumb_node_bwd_ctr > thumb_preload_count ? LOAD_PRIORITY_VISIBLE : LOAD_PRIORITY_BACKGROUND);
 			}
 			thumb_node_bwd = bostree_previous_node(thumb_node_bwd);
 			thumb_node_bwd_ctr--;
@@ -4689,16 +7559,97 @@ void window_draw_thumbnail_montage_show_binding_overlays_looper(gpointer key, gp
 	free(data.active_prefix);
 }/*}}}*/
 #endif
+void montage_page_cell_reset(struct montage_page_cell *cell) {/*{{{*/
+	if(cell->content) {
+		cairo_surface_destroy(cell->content);
+	}
+	memset(cell, 0, sizeof(struct montage_page_cell));
+}/*}}}*/
+void montage_page_invalidate() {/*{{{*/
+	// Drop the composited montage page, e.g. when leaving montage mode
+	if(montage_page.surface) {
+		cairo_surface_destroy(montage_page.surface);
+		montage_page.surface = NULL;
+	}
+	for(unsigned i=0; i<montage_page.n_cells; i++) {
+		montage_page_cell_reset(&montage_page.cells[i]);
+	}
+	g_free(montage_page.cells);
+	montage_page.cells = NULL;
+	montage_page.n_cells = 0;
+}/*}}}*/
+void montage_page_draw_cell(cairo_t *cr, const struct montage_page_cell *cell, int cell_x, int cell_y) {/*{{{*/
+	cairo_save(cr);
+	cairo_translate(cr, cell_x, cell_y);
+	cairo_rectangle(cr, 0, 0, option_thumbnails.width + 10, option_thumbnails.height + 10);
+	cairo_clip(cr);
+	cairo_set_source_rgba(cr, 0., 0., 0., option_transparent_background ? 0. : 1.);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_paint(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+	if(cell->content && !cell->is_preview) {
+		const int thumbnail_width = cairo_image_surface_get_width(cell->content);
+		const int thumbnail_height = cairo_image_surface_get_height(cell->content);
+		cairo_translate(cr, (option_thumbnails.width + 10 - thumbnail_width)/2, (option_thumbnails.height + 10 - thumbnail_height)/2);
+		cairo_set_source_surface(cr, cell->content, 0, 0);
+		cairo_new_path(cr);
+		cairo_rectangle(cr, 0, 0, thumbnail_width, thumbnail_height);
+		cairo_close_path(cr);
+		cairo_save(cr);
+		cairo_clip(cr);
+		cairo_paint(cr);
+		cairo_restore(cr);
+
+		if(cell->selected) {
+			cairo_rectangle(cr, 0, 0, thumbnail_width, thumbnail_height);
+			cairo_set_source_rgb(cr, option_box_colors.bg_red, option_box_colors.bg_green, option_box_colors.bg_blue);
+			cairo_set_line_width(cr, 8.);
+			cairo_stroke(cr);
+		}
+	}
+	else {
+		// While the image is being loaded, show what has been decoded so far
+		if(cell->content) {
+			cairo_save(cr);
+			cairo_translate(cr, 5, 5);
+			draw_progressive_preview(cr, cell->content, option_thumbnails.width, option_thumbnails.height, FALSE);
+			cairo_restore(cr);
+		}
+		if(cell->selected) {
+			cairo_translate(cr, (option_thumbnails.width - 5)/2, (option_thumbnails.height - 5)/2);
+			cairo_rectangle(cr, 0, 0, 5, 5);
+			cairo_set_source_rgb(cr, option_box_colors.bg_red, option_box_colors.bg_green, option_box_colors.bg_blue);
+			cairo_set_line_width(cr, 8.);
+			cairo_stroke(cr);
+		}
+	}
+	cairo_restore(cr);
+}/*}}}*/
+void montage_window_queue_draw_node(gconstpointer node) {/*{{{*/
+	// Invalidate the cell showing node, if it is visible. node is only
+	// compared against, it need not be valid anymore.
+	D_LOCK(file_tree);
+	const unsigned n_thumbs_x = main_window_width / (option_thumbnails.width + 10);
+	const unsigned n_thumbs_y = main_window_height / (option_thumbnails.height + 10);
+	BOSNode *thumb_node = file_tree_valid ? bostree_select(file_tree, montage_window_control.scroll_y * n_thumbs_x) : NULL;
+	for(size_t draw_now = 0; draw_now < n_thumbs_x * n_thumbs_y && thumb_node; draw_now++, thumb_node = bostree_next_node(thumb_node)) {
+		if(thumb_node == node) {
+			gtk_widget_queue_draw_area(GTK_WIDGET(main_window),
+				(main_window_width - n_thumbs_x * (option_thumbnails.width + 10)) / 2   + (draw_now % n_thumbs_x) * (option_thumbnails.width + 10),
+				(main_window_height - n_thumbs_y * (option_thumbnails.height + 10)) / 2 + (draw_now / n_thumbs_x) * (option_thumbnails.height + 10),
+				option_thumbnails.width + 10, option_thumbnails.height + 10);
+			break;
+		}
+	}
+	D_UNLOCK(file_tree);
+}/*}}}*/
 gboolean window_draw_thumbnail_montage(cairo_t *cr_arg) {/*{{{*/
+	// The montage is composited into montage_page, where only cells whose
+	// content or selection state changed are redrawn. The file tree is locked
+	// only to take a snapshot of the visible cells.
 	D_LOCK(file_tree);
 
-	// Draw black background
-	cairo_save(cr_arg);
-	cairo_set_source_rgba(cr_arg, 0., 0., 0., option_transparent_background ? 0. : 1.);
-	cairo_set_operator(cr_arg, CAIRO_OPERATOR_SOURCE);
-	cairo_paint(cr_arg);
-	cairo_restore(cr_arg);
-
 	// Calculate how many thumbnails to draw
 	const unsigned n_thumbs_x = main_window_width / (option_thumbnails.width + 10);
 	const unsigned n_thumbs_y = main_window_height / (option_thumbnails.height + 10);
@@ -4724,63 +7675,107 @@ gboolean window_draw_thumbnail_montage(cairo_t *cr_arg) {/*{{{*/
 		D_UNLOCK(file_tree);
 		return FALSE;
 	}
+
+	const unsigned n_cells = n_thumbs_x * n_thumbs_y;
+	struct montage_page_cell *cells = g_new0(struct montage_page_cell, n_cells);
 	BOSNode *thumb_node = bostree_select(file_tree, top_left_id);
-	for(size_t draw_now = 0; draw_now < n_thumbs_x * n_thumbs_y && thumb_node; draw_now++, thumb_node = bostree_next_node(thumb_node)) {
-		if(!file_tree_valid || !thumb_node) {
-			break;
-		}
+	for(size_t draw_now = 0; draw_now < n_cells && thumb_node; draw_now++, thumb_node = bostree_next_node(thumb_node)) {
 		file_t *thumb_file = FILE(thumb_node);
-
-		/*/ Debug: Draw a red box around the thumbnail box
-		cairo_save(cr_arg);
-		cairo_translate(cr_arg,
-			(main_window_width - n_thumbs_x * (option_thumbnails.width + 10)) / 2   + (draw_now % n_thumbs_x) * (option_thumbnails.width + 10),
-			(main_window_height - n_thumbs_y * (option_thumbnails.height + 10)) / 2 + (draw_now / n_thumbs_x) * (option_thumbnails.height + 10)
-		);
-		cairo_set_source_rgb(cr_arg, 1., 0, 0);
-		cairo_rectangle(cr_arg, 0, 0, option_thumbnails.width + 10, option_thumbnails.height + 10);
-		cairo_stroke(cr_arg);
-		cairo_restore(cr_arg);*/
-
+		cells[draw_now].valid = TRUE;
+		cells[draw_now].selected = top_left_id + draw_now == selection_rank;
 		if(thumb_file->thumbnail) {
-			cairo_save(cr_arg);
-			cairo_translate(cr_arg,
-				(main_window_width - n_thumbs_x * (option_thumbnails.width + 10)) / 2   + (draw_now % n_thumbs_x) * (option_thumbnails.width + 10)  + (option_thumbnails.width + 10 - cairo_image_surface_get_width(thumb_file->thumbnail))/2,
-				(main_window_height - n_thumbs_y * (option_thumbnails.height + 10)) / 2 + (draw_now / n_thumbs_x) * (option_thumbnails.height + 10) + (option_thumbnails.height + 10 - cairo_image_surface_get_height(thumb_file->thumbnail))/2
-			);
-			cairo_set_source_surface(cr_arg, thumb_file->thumbnail, 0, 0);
-			cairo_new_path(cr_arg);
-			cairo_rectangle(cr_arg, 0, 0, cairo_image_surface_get_width(thumb_file->thumbnail), cairo_image_surface_get_height(thumb_file->thumbnail));
-			cairo_close_path(cr_arg);
-			cairo_clip(cr_arg);
-			cairo_paint(cr_arg);
+			cells[draw_now].content = cairo_surface_reference(thumb_file->thumbnail);
+		}
+		else {
+			cells[draw_now].content = get_progressive_preview(thumb_file);
+			cells[draw_now].is_preview = cells[draw_now].content != NULL;
+		}
+	}
+	const int scroll_y = montage_window_control.scroll_y;
+	D_UNLOCK(file_tree);
 
-			if(top_left_id + draw_now == selection_rank) {
-				cairo_rectangle(cr_arg, 0, 0, cairo_image_surface_get_width(thumb_file->thumbnail), cairo_image_surface_get_height(thumb_file->thumbnail));
-				cairo_set_source_rgb(cr_arg, option_box_colors.bg_red, option_box_colors.bg_green, option_box_colors.bg_blue);
-				cairo_set_line_width(cr_arg, 8.);
-				cairo_stroke(cr_arg);
-			}
+	// (Re)create the page if the geometry changed. If the page was scrolled by
+	// less than a screen, move the rows that remain visible.
+	const int page_x = (main_window_width - n_thumbs_x * (option_thumbnails.width + 10)) / 2;
+	const int page_y = (main_window_height - n_thumbs_y * (option_thumbnails.height + 10)) / 2;
+	if(montage_page.surface && (montage_page.width != main_window_width || montage_page.height != main_window_height
+			|| montage_page.thumbnail_width != option_thumbnails.width || montage_page.thumbnail_height != option_thumbnails.height)) {
+		montage_page_invalidate();
+	}
+	if(!montage_page.surface) {
+		montage_page.surface = cairo_surface_create_similar(cairo_get_target(cr_arg), CAIRO_CONTENT_COLOR_ALPHA, main_window_width, main_window_height);
+		montage_page.width = main_window_width;
+		montage_page.height = main_window_height;
+		montage_page.thumbnail_width = option_thumbnails.width;
+		montage_page.thumbnail_height = option_thumbnails.height;
+		montage_page.scroll_y = scroll_y;
+		montage_page.n_cells = n_cells;
+		montage_page.cells = g_new0(struct montage_page_cell, n_cells);
+
+		cairo_t *cr = cairo_create(montage_page.surface);
+		cairo_set_source_rgba(cr, 0., 0., 0., option_transparent_background ? 0. : 1.);
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		cairo_paint(cr);
+		cairo_destroy(cr);
+	}
+	else if(montage_page.scroll_y != scroll_y) {
+		const int scrolled_rows = scroll_y - montage_page.scroll_y;
+		cairo_surface_t *surface = cairo_surface_create_similar(montage_page.surface, CAIRO_CONTENT_COLOR_ALPHA, main_window_width, main_window_height);
+		cairo_t *cr = cairo_create(surface);
+		cairo_set_source_rgba(cr, 0., 0., 0., option_transparent_background ? 0. : 1.);
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		cairo_paint(cr);
+		if((unsigned)abs(scrolled_rows) < n_thumbs_y) {
+			cairo_rectangle(cr, page_x, page_y, n_thumbs_x * (option_thumbnails.width + 10), n_thumbs_y * (option_thumbnails.height + 10));
+			cairo_clip(cr);
+			cairo_set_source_surface(cr, montage_page.surface, 0, -scrolled_rows * (option_thumbnails.height + 10));
+			cairo_paint(cr);
+		}
+		cairo_destroy(cr);
+		cairo_surface_destroy(montage_page.surface);
+		montage_page.surface = surface;
 
-			cairo_restore(cr_arg);
+		struct montage_page_cell *scrolled_cells = g_new0(struct montage_page_cell, n_cells);
+		for(unsigned i=0; i<n_cells; i++) {
+			const ptrdiff_t source = (ptrdiff_t)i + scrolled_rows * (ptrdiff_t)n_thumbs_x;
+			if(source >= 0 && source < n_cells) {
+				scrolled_cells[i] = montage_page.cells[source];
+				memset(&montage_page.cells[source], 0, sizeof(struct montage_page_cell));
+			}
 		}
-		else if(top_left_id + draw_now == selection_rank) {
-			cairo_save(cr_arg);
-			cairo_translate(cr_arg,
-				(main_window_width - n_thumbs_x * (option_thumbnails.width + 10)) / 2   + (draw_now % n_thumbs_x) * (option_thumbnails.width + 10) + (option_thumbnails.width - 5)/2,
-				(main_window_height - n_thumbs_y * (option_thumbnails.height + 10)) / 2 + (draw_now / n_thumbs_x) * (option_thumbnails.height + 10) + (option_thumbnails.height - 5)/2
-			);
-			cairo_rectangle(cr_arg, 0, 0, 5, 5);
-			cairo_set_source_rgb(cr_arg, option_box_colors.bg_red, option_box_colors.bg_green, option_box_colors.bg_blue);
-			cairo_set_line_width(cr_arg, 8.);
-			cairo_stroke(cr_arg);
-			cairo_restore(cr_arg);
+		for(unsigned i=0; i<n_cells; i++) {
+			montage_page_cell_reset(&montage_page.cells[i]);
 		}
+		g_free(montage_page.cells);
+		montage_page.cells = scrolled_cells;
+		montage_page.scroll_y = scroll_y;
 	}
 
+	// Redraw the cells that changed
+	cairo_t *cr = cairo_create(montage_page.surface);
+	for(unsigned i=0; i<n_cells; i++) {
+		struct montage_page_cell *cell = &montage_page.cells[i];
+		if(cell->valid == cells[i].valid && cell->content == cells[i].content && cell->selected == cells[i].selected) {
+			montage_page_cell_reset(&cells[i]);
+			continue;
+		}
+		montage_page_draw_cell(cr, &cells[i], page_x + (i % n_thumbs_x) * (option_thumbnails.width + 10), page_y + (i / n_thumbs_x) * (option_thumbnails.height + 10));
+		montage_page_cell_reset(cell);
+		*cell = cells[i];
+	}
+	cairo_destroy(cr);
+	g_free(cells);
+
+	cairo_save(cr_arg);
+	cairo_set_source_surface(cr_arg, montage_page.surface, 0, 0);
+	cairo_set_operator(cr_arg, CAIRO_OPERATOR_SOURCE);
+	cairo_paint(cr_arg);
+	cairo_restore(cr_arg);
+
 #ifndef CONFIGURED_WITHOUT_ACTIONS
 	// In follow mode, draw the key mappings on top of the images
 	if(montage_window_control.show_binding_overlays) {
+		D_LOCK(file_tree);
 		const int selected_x = selection_rank % n_thumbs_x;
 		const int selected_y = selection_rank / n_thumbs_x - montage_window_control.scroll_y;
 
@@ -4794,10 +7789,10 @@ gboolean window_draw_thumbnail_montage(cairo_t *cr_arg) {/*{{{*/
 					key_bindings[active_key_binding_context],
 				window_draw_thumbnail_montage_show_binding_overlays_looper,
 				&data);
+		D_UNLOCK(file_tree);
 	}
 #endif
 
-	D_UNLOCK(file_tree);
 	return TRUE;
 }/*}}}*/
 #endif
@@ -4948,7 +7943,77 @@ gboolean window_show_background_pixmap_cb(gpointer user_data) {/*{{{*/
 
 	return FALSE;
 }/*}}}*/
+#ifndef CONFIGURED_WITHOUT_INFO_TEXT
+void window_draw_info_text(cairo_t *cr, int x, int y) {/*{{{*/
+	// Draw the info box to cr, which must be set up in device pixels. x and y
+	// are where the image is drawn, see calculate_base_draw_pos_and_size.
+	double x1 = 0., x2 = 0., y1 = 0., y2 = 0.;
+	cairo_save(cr);
+	// Attempt this multiple times: If it does not fit the window,
+	// retry with a smaller font size
+	int font_size;
+	if(current_info_text_cached_font_size < 0) {
+		font_size = 12*screen_scale_factor;
+		current_info_text_cached_font_size = 0;
+	}
+	else {
+		font_size = current_info_text_cached_font_size;
+	}
+	for(; font_size > 6; font_size--) {
+		cairo_set_font_size(cr, font_size);
+
+		if(main_window_in_fullscreen == FALSE) {
+			// Tiling WMs, at least i3, react weird on our window size changing.
+			// Drawing the info box on the image helps to avoid users noticing that.
+			cairo_translate(cr, x < 0 ? 0 : x, y < 0 ? 0 : y);
+		}
+
+		cairo_set_source_rgb(cr, option_box_colors.bg_red, option_box_colors.bg_green, option_box_colors.bg_blue);
+		cairo_translate(cr, 10 * screen_scale_factor, 20 * screen_scale_factor);
+		cairo_text_path(cr, current_info_text);
+		cairo_path_extents(cr, &x1, &y1, &x2, &y2);
+
+		if(x2 > main_window_width - 10 * screen_scale_factor && !main_window_in_fullscreen) {
+			cairo_new_path(cr);
+			cairo_restore(cr);
+			cairo_save(cr);
+			continue;
+		}
+
+		current_info_text_cached_font_size = font_size;
+		cairo_path_t *text_path = cairo_copy_path(cr);
+		cairo_new_path(cr);
+		cairo_rectangle(cr, -5, -(y2 - y1) - 2, x2 - x1 + 10, y2 - y1 + 8);
+		cairo_close_path(cr);
+		cairo_fill(cr);
+		cairo_set_source_rgb(cr, option_box_colors.fg_red, option_box_colors.fg_green, option_box_colors.fg_blue);
+		cairo_append_path(cr, text_path);
+		cairo_fill(cr);
+		cairo_path_destroy(text_path);
+
+		break;
+	}
+
+	cairo_restore(cr);
+
+	// Store where the box was drawn to allow for partial updates of the screen
+	current_info_text_bounding_box.x = (main_window_in_fullscreen == TRUE ? 0 : (x < 0 ? 0 : x)) + 10 - 5;
+	current_info_text_bounding_box.y = (main_window_in_fullscreen == TRUE ? 0 : (y < 0 ? 0 : y)) + 20 -(y2 - y1) - 2;
+
+	 // Redraw some extra pixels to make sure a wider new box would be covered:
+	current_info_text_bounding_box.width = x2 - x1 + 10 + 30;
+	current_info_text_bounding_box.height = y2 - y1 + 8;
+}/*}}}*/
+#endif
 gboolean window_draw_callback(GtkWidget *widget, cairo_t *cr_arg, gpointer user_data) {/*{{{*/
+#ifdef PQIV_OPENGL
+	// If OpenGL is available, let GTK draw the GtkGLArea covering the window
+	// instead. Montage mode and offscreen drawing (user_data != NULL) use Cairo.
+	if(opengl_area_usable && application_mode != MONTAGE && user_data == NULL) {
+		return FALSE;
+	}
+#endif
+
 	// Drawing can generally mean that we succeeded in performing some action.
 	// Resume the action queue
 	action_done();
@@ -4973,6 +8038,14 @@ gboolean window_draw_callback(GtkWidget *widget, cairo_t *cr_arg, gpointer user_
 	cairo_scale(cr_arg, 1./screen_scale_factor, 1./screen_scale_factor);
 
 	if(is_current_file_loaded()) {
+		// If the image has been decoded at a reduced resolution, but the user
+		// zoomed in further, decode it again at full resolution. It remains
+		// loaded and visible meanwhile, see image_loader_thread().
+		if(CURRENT_FILE->decoded_scale_level < 1. && current_scale_level > CURRENT_FILE->decoded_scale_level + 1e-3 && !CURRENT_FILE->force_reload && (CURRENT_FILE->file_flags & FILE_FLAGS_FULL_RESOLUTION) == 0) {
+			CURRENT_FILE->file_flags |= FILE_FLAGS_FULL_RESOLUTION;
+			queue_image_load(bostree_node_weak_ref(current_file_node));
+		}
+
 		// Calculate where to draw the image and the transformation matrix to use
 		int image_transform_width, image_transform_height;
 		calculate_base_draw_pos_and_size(&image_transform_width, &image_transform_height, &x, &y);
@@ -5049,28 +8122,17 @@ gboolean window_draw_callback(GtkWidget *widget, cairo_t *cr_arg, gpointer user_
 		}
 
 		// Draw the scaled image.
-		if(option_negate) {
+		if(cr != cr_arg && (!option_lowmem || option_negate) && scaled_image_size_requires_tiles(current_scale_level * CURRENT_FILE->width, current_scale_level * CURRENT_FILE->height)) {
+			// Huge scaled images are drawn from tiles covering the visible part
+			// only, such that memory use is proportional to the screen's size
+			window_draw_scaled_image_tiles(cr);
+		}
+		else if(option_negate) {
 			// Negated color mode: The drawing operation is more complex; to do
 			// alpha channels correctly we _need_ to have a image surface copy
 			// of the image, regardless of lowmem mode. So this drawing mode comes
 			// before the option_lowmem special case.
-			cairo_surface_t *temporary_scaled_image_surface = get_scaled_image_surface_for_current_image();
-			cairo_save(cr);
-
-			// Draw white using the image's alpha channel as a mask.
-			// Note that cairo_mask_surface already paints, despite the name.
-			cairo_set_source_rgb(cr, 1., 1., 1.);
-			cairo_mask_surface(cr, temporary_scaled_image_surface, 0, 0);
-			cairo_restore(cr);
-
-			// Now take the difference to the image: This will invert the colors.
-			cairo_save(cr);
-			cairo_set_operator(cr, CAIRO_OPERATOR_DIFFERENCE);
-			cairo_set_source_surface(cr, temporary_scaled_image_surface, 0, 0);
-			cairo_paint(cr);
-			cairo_restore(cr);
-
-			cairo_surface_destroy(temporary_scaled_image_surface);
+			window_draw_scaled_image(cr);
 		}
 		else if(option_lowmem || cr == cr_arg) {
 			// In low memory mode, we scale here and draw on the fly
@@ -5087,10 +8149,7 @@ gboolean window_draw_callback(GtkWidget *widget, cairo_t *cr_arg, gpointer user_
 		else {
 			// Elsewise, we cache a scaled copy in a separate image surface
 			// to speed up movement/redraws of scaled images
-			cairo_surface_t *temporary_scaled_image_surface = get_scaled_image_surface_for_current_image();
-			cairo_set_source_surface(cr, temporary_scaled_image_surface, 0, 0);
-			cairo_paint(cr);
-			cairo_surface_destroy(temporary_scaled_image_surface);
+			window_draw_scaled_image(cr);
 		}
 
 		// If we drew to an off-screen buffer before, render to the window now
@@ -5150,9 +8209,20 @@ gboolean window_draw_callback(GtkWidget *widget, cairo_t *cr_arg, gpointer user_
 		current_image_drawn = TRUE;
 	}
 	else {
-		// The image has not yet been loaded. If available, draw from the
-		// temporary image surface from the last call
-		if(last_visible_surface != NULL) {
+		// The image has not yet been loaded. If it is being decoded
+		// incrementally, draw what is available. Elsewise, if available, draw
+		// from the temporary image surface from the last call
+		cairo_surface_t *preview = current_file_node ? get_progressive_preview(CURRENT_FILE) : NULL;
+		if(preview != NULL) {
+			cairo_save(cr_arg);
+			cairo_set_source_rgba(cr_arg, 0., 0., 0., option_transparent_background ? 0. : 1.);
+			cairo_set_operator(cr_arg, CAIRO_OPERATOR_SOURCE);
+			cairo_paint(cr_arg);
+			cairo_restore(cr_arg);
+			draw_progressive_preview(cr_arg, preview, main_window_width, main_window_height, TRUE);
+			cairo_surface_destroy(preview);
+		}
+		else if(last_visible_surface != NULL) {
 			// But only do it if the window size hasn't changed. It looks weird
 			// to have an image drawn somewhere into the window.
 			// TODO An overall neater solution would be to have
@@ -5177,85 +8247,576 @@ gboolean window_draw_callback(GtkWidget *widget, cairo_t *cr_arg, gpointer user_
 			cairo_paint(cr_arg);
 			cairo_restore(cr_arg);
 		}
-	}
-	D_UNLOCK(file_tree);
+	}
+	D_UNLOCK(file_tree);
+
+	// Draw info box (directly to the screen)
+#ifndef CONFIGURED_WITHOUT_INFO_TEXT
+	if(current_info_text != NULL) {
+		window_draw_info_text(cr_arg, x, y);
+	}
+#endif
+
+	// TODO Maybe this will need to be changed someday; the GDK Wayland backend
+	// currently does not draw window borders if the draw callback reports
+	// success. Anyway, it also draws the borders at the wrong place (well
+	// within the window rather than around it), so I'll leave things as they
+	// are for the time being.
+	return TRUE;
+}/*}}}*/
+#if GTK_MAJOR_VERSION < 3
+	gboolean window_expose_callback(GtkWidget *widget, GdkEvent *event, gpointer user_data) {/*{{{*/
+		cairo_t *cr = gdk_cairo_create(widget->window);
+		window_draw_callback(widget, cr, user_data);
+		cairo_destroy(cr);
+		return TRUE;
+	}/*}}}*/
+#endif
+#ifdef PQIV_OPENGL
+/* OpenGL presentation {{{ */
+static const gchar opengl_vertex_shader[] =
+	"in vec2 position;\n"
+	"in vec2 coordinate;\n"
+	"out vec2 v_coordinate;\n"
+	"void main() {\n"
+	"	v_coordinate = coordinate;\n"
+	"	gl_Position = vec4(position, 0., 1.);\n"
+	"}\n";
+static const gchar opengl_fragment_shader[] =
+	// Cairo stores pixels as native endian 32 bit integers ARGB, premultiplied.
+	// Textures are uploaded byte-wise as RGBA, hence the swizzle.
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+	"#define CAIRO_SWIZZLE bgra\n"
+#else
+	"#define CAIRO_SWIZZLE gbar\n"
+#endif
+	"uniform sampler2D u_texture;\n"
+	"uniform int u_mode;\n"
+	"uniform vec4 u_color;\n"
+	"uniform float u_alpha;\n"
+	"uniform bool u_negate;\n"
+	"in vec2 v_coordinate;\n"
+	"out vec4 f_color;\n"
+	"void main() {\n"
+	"	vec4 color;\n"
+	"	if(u_mode == 0) {\n"
+	"		color = texture(u_texture, v_coordinate).CAIRO_SWIZZLE;\n"
+	"	}\n"
+	"	else if(u_mode == 1) {\n"
+	"		color = texture(u_texture, v_coordinate);\n"
+	"	}\n"
+	"	else if(u_mode == 2) {\n"
+	"		color = mod(floor(v_coordinate.x / 8.) + floor(v_coordinate.y / 8.), 2.) < .5 ? vec4(1.) : vec4(.5, .5, .5, 1.);\n"
+	"	}\n"
+	"	else {\n"
+	"		color = u_color;\n"
+	"	}\n"
+	"	if(u_negate) {\n"
+	"		color.rgb = color.a - color.rgb;\n"
+	"	}\n"
+	"	f_color = color * u_alpha;\n"
+	"}\n";
+static GLuint opengl_compile_shader(GLenum type, const gchar *header, const gchar *source, GError **error_pointer) {/*{{{*/
+	const gchar *sources[] = { header, source };
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 2, sources, NULL);
+	glCompileShader(shader);
+
+	GLint status;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if(status == GL_FALSE) {
+		gchar info_log[1024] = { 0 };
+		glGetShaderInfoLog(shader, sizeof(info_log) - 1, NULL, info_log);
+		*error_pointer = g_error_new(g_quark_from_static_string("pqiv-opengl-error"), 1, "Failed to compile shader: %s", info_log);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}/*}}}*/
+static gboolean opengl_create_program(GdkGLContext *context, GError **error_pointer) {/*{{{*/
+	// The shaders are written such that they are valid GLSL 1.50 (OpenGL 3.2,
+	// which GTK requests by default) and GLSL ES 3.00
+	const gchar *header = "#version 150\n";
+	#if GTK_CHECK_VERSION(3, 22, 0)
+		if(gdk_gl_context_get_use_es(context)) {
+			header = "#version 300 es\nprecision highp float;\n";
+		}
+	#endif
+
+	GLuint vertex_shader = opengl_compile_shader(GL_VERTEX_SHADER, header, opengl_vertex_shader, error_pointer);
+	if(!vertex_shader) {
+		return FALSE;
+	}
+	GLuint fragment_shader = opengl_compile_shader(GL_FRAGMENT_SHADER, header, opengl_fragment_shader, error_pointer);
+	if(!fragment_shader) {
+		glDeleteShader(vertex_shader);
+		return FALSE;
+	}
+
+	opengl.program = glCreateProgram();
+	glAttachShader(opengl.program, vertex_shader);
+	glAttachShader(opengl.program, fragment_shader);
+	glBindAttribLocation(opengl.program, 0, "position");
+	glBindAttribLocation(opengl.program, 1, "coordinate");
+	glLinkProgram(opengl.program);
+	glDetachShader(opengl.program, vertex_shader);
+	glDetachShader(opengl.program, fragment_shader);
+	glDeleteShader(vertex_shader);
+	glDeleteShader(fragment_shader);
+
+	GLint status;
+	glGetProgramiv(opengl.program, GL_LINK_STATUS, &status);
+	if(status == GL_FALSE) {
+		gchar info_log[1024] = { 0 };
+		glGetProgramInfoLog(opengl.program, sizeof(info_log) - 1, NULL, info_log);
+		*error_pointer = g_error_new(g_quark_from_static_string("pqiv-opengl-error"), 1, "Failed to link shaders: %s", info_log);
+		glDeleteProgram(opengl.program);
+		opengl.program = 0;
+		return FALSE;
+	}
+
+	opengl.uniform_mode = glGetUniformLocation(opengl.program, "u_mode");
+	opengl.uniform_color = glGetUniformLocation(opengl.program, "u_color");
+	opengl.uniform_alpha = glGetUniformLocation(opengl.program, "u_alpha");
+	opengl.uniform_negate = glGetUniformLocation(opengl.program, "u_negate");
+	opengl.uniform_texture = glGetUniformLocation(opengl.program, "u_texture");
+	return TRUE;
+}/*}}}*/
+static void opengl_upload_surface(GLuint texture, cairo_surface_t *surface, gboolean mipmap) {/*{{{*/
+	cairo_surface_flush(surface);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, cairo_image_surface_get_stride(surface) / 4);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cairo_image_surface_get_width(surface), cairo_image_surface_get_height(surface), 0, GL_RGBA, GL_UNSIGNED_BYTE, cairo_image_surface_get_data(surface));
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	if(mipmap) {
+		glGenerateMipmap(GL_TEXTURE_2D);
+	}
+	else {
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+}/*}}}*/
+static void opengl_draw_quad(const cairo_matrix_t *matrix, double x, double y, double width, double height, GLfloat s0, GLfloat t0, GLfloat s1, GLfloat t1) {/*{{{*/
+	// Draw the rectangle x, y, width, height, transformed by matrix to window
+	// device pixels, as a triangle strip
+	const double corners[4][2] = { { x, y }, { x + width, y }, { x, y + height }, { x + width, y + height } };
+	const GLfloat coordinates[4][2] = { { s0, t0 }, { s1, t0 }, { s0, t1 }, { s1, t1 } };
+	GLfloat vertices[4][4];
+	for(int i = 0; i < 4; i++) {
+		double px = corners[i][0];
+		double py = corners[i][1];
+		if(matrix) {
+			cairo_matrix_transform_point(matrix, &px, &py);
+		}
+		vertices[i][0] = 2. * px / opengl.frame_width - 1.;
+		vertices[i][1] = 1. - 2. * py / opengl.frame_height;
+		vertices[i][2] = coordinates[i][0];
+		vertices[i][3] = coordinates[i][1];
+	}
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STREAM_DRAW);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}/*}}}*/
+static void opengl_draw_frame_texture(int index, double alpha) {/*{{{*/
+	// Frame textures are rendered by OpenGL, i.e. upside down
+	glBindTexture(GL_TEXTURE_2D, opengl.frame_textures[index]);
+	glUniform1i(opengl.uniform_mode, OPENGL_SHADE_TEXTURE);
+	glUniform1f(opengl.uniform_alpha, alpha);
+	opengl_draw_quad(NULL, 0, 0, opengl.frame_width, opengl.frame_height, 0., 1., 1., 0.);
+	glUniform1f(opengl.uniform_alpha, 1.);
+}/*}}}*/
+static void opengl_prepare_frame_textures(int width, int height) {/*{{{*/
+	if(width == opengl.frame_width && height == opengl.frame_height) {
+		return;
+	}
+	for(int i = 0; i < 2; i++) {
+		glBindTexture(GL_TEXTURE_2D, opengl.frame_textures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	opengl.frame_width = width;
+	opengl.frame_height = height;
+	// Like last_visible_surface, the last frame is not shown at another size
+	opengl.last_frame_valid = FALSE;
+	g_free(opengl.overlay_text);
+	opengl.overlay_text = NULL;
+}/*}}}*/
+static void opengl_free_image_textures() {/*{{{*/
+	for(guint i = 0; i < opengl.image_tiles->len; i++) {
+		glDeleteTextures(1, &g_array_index(opengl.image_tiles, struct opengl_image_tile, i).texture);
+	}
+	g_array_set_size(opengl.image_tiles, 0);
+	opengl.image_file = NULL;
+}/*}}}*/
+static void opengl_upload_image_textures(cairo_surface_t *recording, double texture_scale, int width, int height) {/*{{{*/
+	// Upload the current image in tiles, rasterized from recording, or drawn
+	// directly if that is NULL; the file tree must be locked then
+	opengl_free_image_textures();
+
+	GLint max_texture_size;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+	const int tile_size = MIN(max_texture_size, OPENGL_TILE_SIZE) - 2;
+
+	for(int y = 0; y < height; y += tile_size) {
+		for(int x = 0; x < width; x += tile_size) {
+			struct opengl_image_tile tile;
+			tile.x = x;
+			tile.y = y;
+			tile.width = MIN(tile_size, width - x);
+			tile.height = MIN(tile_size, height - y);
+
+			const int x1 = MAX(0, x - 1);
+			const int y1 = MAX(0, y - 1);
+			const int x2 = MIN(width, x + tile.width + 1);
+			const int y2 = MIN(height, y + tile.height + 1);
+			cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, x2 - x1, y2 - y1);
+			if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+				cairo_surface_destroy(surface);
+				continue;
+			}
+			cairo_t *cr = cairo_create(surface);
+			cairo_translate(cr, -x1, -y1);
+			cairo_rectangle(cr, x1, y1, x2 - x1, y2 - y1);
+			cairo_clip(cr);
+			if(recording) {
+				cairo_set_source_surface(cr, recording, 0, 0);
+				cairo_paint(cr);
+			}
+			else {
+				image_draw_at_size(CURRENT_FILE, cr, texture_scale, width, height);
+			}
+			cairo_destroy(cr);
+
+			glGenTextures(1, &tile.texture);
+			opengl_upload_surface(tile.texture, surface, TRUE);
+			cairo_surface_destroy(surface);
+
+			tile.s0 = (GLfloat)(x - x1) / (x2 - x1);
+			tile.t0 = (GLfloat)(y - y1) / (y2 - y1);
+			tile.s1 = (GLfloat)(x + tile.width - x1) / (x2 - x1);
+			tile.t1 = (GLfloat)(y + tile.height - y1) / (y2 - y1);
+			g_array_append_val(opengl.image_tiles, tile);
+		}
+	}
+}/*}}}*/
+static cairo_surface_t *opengl_record_stale_image_textures(double *texture_scale, int *width, int *height) {/*{{{*/
+	// If the textures of the current image are out of date, record the image
+	// at the textures' size, see image_record_at_size(), such that
+	// opengl_upload_image_textures() can rasterize it after the file tree has
+	// been unlocked. Must be called with the file tree locked. Returns NULL if
+	// the textures are up to date; if they are not, but recording is not
+	// supported, uploads them right away instead.
+	double scale = CURRENT_FILE->decoded_scale_level > 0. && CURRENT_FILE->decoded_scale_level < 1. ? CURRENT_FILE->decoded_scale_level : 1.;
+	const double pixels = (double)CURRENT_FILE->width * CURRENT_FILE->height;
+	if(pixels * scale * scale > OPENGL_TEXTURE_BUDGET) {
+		scale = sqrt(OPENGL_TEXTURE_BUDGET / pixels);
+	}
+	if(!opengl.image_stale && opengl.image_file == CURRENT_FILE && fabs(opengl.image_scale - scale) < 1e-6) {
+		return NULL;
+	}
+	opengl.image_file = CURRENT_FILE;
+	opengl.image_scale = scale;
+	opengl.image_stale = FALSE;
+
+	*texture_scale = scale;
+	*width = MAX(1, (int)(CURRENT_FILE->width * scale + .5));
+	*height = MAX(1, (int)(CURRENT_FILE->height * scale + .5));
+	cairo_surface_t *recording = image_record_at_size(CURRENT_FILE, scale, *width, *height);
+	if(!recording) {
+		opengl_upload_image_textures(NULL, scale, *width, *height);
+	}
+	return recording;
+}/*}}}*/
+#ifndef CONFIGURED_WITHOUT_INFO_TEXT
+static void opengl_update_overlay_texture(int x, int y) {/*{{{*/
+	// The info box is drawn using Cairo, to a texture covering the top of the
+	// window. Redo this only if anything it depends on has changed.
+	if(current_info_text_cached_font_size >= 0 && opengl.overlay_text && strcmp(opengl.overlay_text, current_info_text) == 0 &&
+			opengl.overlay_x == x && opengl.overlay_y == y) {
+		return;
+	}
+
+	// The box is drawn such that the text's base line is 20 pixels below the
+	// top of the image (or of the window, in fullscreen), and it ends 6 pixels
+	// below the base line
+	const int top = main_window_in_fullscreen ? 0 : MAX(0, y);
+	const int height = MAX(1, MIN(opengl.frame_height, top + 30 * screen_scale_factor));
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, opengl.frame_width, height);
+	if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(surface);
+		return;
+	}
+	cairo_t *cr = cairo_create(surface);
+	window_draw_info_text(cr, x, y);
+	cairo_destroy(cr);
+	opengl_upload_surface(opengl.overlay_texture, surface, FALSE);
+	cairo_surface_destroy(surface);
+
+	g_free(opengl.overlay_text);
+	opengl.overlay_text = g_strdup(current_info_text);
+	opengl.overlay_x = x;
+	opengl.overlay_y = y;
+	opengl.overlay_height = height;
+}/*}}}*/
+#endif
+static void opengl_area_realize_callback(GtkGLArea *area, gpointer user_data) {/*{{{*/
+	gtk_gl_area_make_current(area);
+	GError *error_pointer = NULL;
+	if(gtk_gl_area_get_error(area) != NULL) {
+		g_printerr("Failed to initialize OpenGL, falling back to Cairo: %s\n", gtk_gl_area_get_error(area)->message);
+		return;
+	}
+	if(!opengl_create_program(gtk_gl_area_get_context(area), &error_pointer)) {
+		g_printerr("Failed to initialize OpenGL, falling back to Cairo: %s\n", error_pointer->message);
+		g_clear_error(&error_pointer);
+		return;
+	}
+
+	glGenVertexArrays(1, &opengl.vertex_array);
+	glBindVertexArray(opengl.vertex_array);
+	glGenBuffers(1, &opengl.vertex_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, opengl.vertex_buffer);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void *)0);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void *)(2 * sizeof(GLfloat)));
+	glBindVertexArray(0);
+
+	glGenFramebuffers(1, &opengl.framebuffer);
+	glGenTextures(2, opengl.frame_textures);
+	glGenTextures(1, &opengl.overlay_texture);
+	glGenTextures(1, &opengl.preview_texture);
+	opengl.frame_width = opengl.frame_height = 0;
+	opengl.last_frame_valid = FALSE;
+	if(!opengl.image_tiles) {
+		opengl.image_tiles = g_array_new(FALSE, FALSE, sizeof(struct opengl_image_tile));
+	}
+
+	opengl_area_usable = TRUE;
+	gtk_widget_queue_draw(GTK_WIDGET(main_window));
+}/*}}}*/
+static void opengl_area_unrealize_callback(GtkGLArea *area, gpointer user_data) {/*{{{*/
+	if(!opengl_area_usable) {
+		return;
+	}
+	opengl_area_usable = FALSE;
+	gtk_gl_area_make_current(area);
+	if(gtk_gl_area_get_error(area) != NULL) {
+		return;
+	}
+
+	opengl_free_image_textures();
+	glDeleteTextures(1, &opengl.overlay_texture);
+	glDeleteTextures(1, &opengl.preview_texture);
+	g_free(opengl.overlay_text);
+	opengl.overlay_text = NULL;
+	glDeleteTextures(2, opengl.frame_textures);
+	glDeleteFramebuffers(1, &opengl.framebuffer);
+	glDeleteBuffers(1, &opengl.vertex_buffer);
+	glDeleteVertexArrays(1, &opengl.vertex_array);
+	glDeleteProgram(opengl.program);
+	opengl.program = 0;
+}/*}}}*/
+static gboolean opengl_area_render_callback(GtkGLArea *area, GdkGLContext *context, gpointer user_data) {/*{{{*/
+	// This is the OpenGL counterpart of window_draw_callback
+	action_done();
+	if(!opengl_area_usable) {
+		return FALSE;
+	}
+
+	const int scale_factor = gtk_widget_get_scale_factor(GTK_WIDGET(area));
+	const int frame_width = gtk_widget_get_allocated_width(GTK_WIDGET(area)) * scale_factor;
+	const int frame_height = gtk_widget_get_allocated_height(GTK_WIDGET(area)) * scale_factor;
+	if(frame_width <= 0 || frame_height <= 0) {
+		return TRUE;
+	}
+	opengl_prepare_frame_textures(frame_width, frame_height);
+
+	// Render the scene to the first frame texture
+	glBindFramebuffer(GL_FRAMEBUFFER, opengl.framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, opengl.frame_textures[0], 0);
+	glViewport(0, 0, opengl.frame_width, opengl.frame_height);
+	glUseProgram(opengl.program);
+	glBindVertexArray(opengl.vertex_array);
+	glBindBuffer(GL_ARRAY_BUFFER, opengl.vertex_buffer);
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(opengl.uniform_texture, 0);
+	glUniform1i(opengl.uniform_negate, 0);
+	glUniform1f(opengl.uniform_alpha, 1.);
+	glClearColor(0., 0., 0., option_transparent_background ? 0. : 1.);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	int x = 0;
+	int y = 0;
+	gboolean scene_complete = FALSE;
+	D_LOCK(file_tree);
+	cairo_surface_t *preview = current_file_node && !CURRENT_FILE->is_loaded ? get_progressive_preview(CURRENT_FILE) : NULL;
+	cairo_matrix_t matrix;
+	double background_x = 0, background_y = 0, background_width = 0, background_height = 0;
+	gboolean nearest = FALSE;
+	cairo_surface_t *recording = NULL;
+	double texture_scale = 1.;
+	int texture_width = 0, texture_height = 0;
+	if(is_current_file_loaded()) {
+		// See window_draw_callback
+		if(CURRENT_FILE->decoded_scale_level < 1. && current_scale_level > CURRENT_FILE->decoded_scale_level + 1e-3 && !CURRENT_FILE->force_reload && (CURRENT_FILE->file_flags & FILE_FLAGS_FULL_RESOLUTION) == 0) {
+			CURRENT_FILE->file_flags |= FILE_FLAGS_FULL_RESOLUTION;
+			queue_image_load(bostree_node_weak_ref(current_file_node));
+		}
 
-	// Draw info box (directly to the screen)
-#ifndef CONFIGURED_WITHOUT_INFO_TEXT
-	if(current_info_text != NULL) {
-		double x1 = 0., x2 = 0., y1 = 0., y2 = 0.;
-		cairo_save(cr_arg);
-		// Attempt this multiple times: If it does not fit the window,
-		// retry with a smaller font size
-		int font_size;
-		if(current_info_text_cached_font_size < 0) {
-			font_size = 12*screen_scale_factor;
-			current_info_text_cached_font_size = 0;
+		// The transformation from image pixels to window device pixels is the
+		// same as the one the Cairo path sets up
+		int image_transform_width, image_transform_height;
+		calculate_base_draw_pos_and_size(&image_transform_width, &image_transform_height, &x, &y);
+		cairo_matrix_t apply_transformation = current_transformation;
+		apply_transformation.x0 *= current_scale_level;
+		apply_transformation.y0 *= current_scale_level;
+		cairo_matrix_init_translate(&matrix, current_shift_x + x, current_shift_y + y);
+		cairo_matrix_multiply(&matrix, &apply_transformation, &matrix);
+		cairo_matrix_scale(&matrix, current_scale_level, current_scale_level);
+
+		// The background pattern is drawn a pixel into the image, as in
+		// window_draw_callback
+		const unsigned skip_px = MAX(1, (unsigned)(1./current_scale_level));
+		if(CURRENT_FILE->width > 2*skip_px && CURRENT_FILE->height > 2*skip_px) {
+			background_x = background_y = skip_px;
+			background_width = CURRENT_FILE->width - 2*skip_px;
+			background_height = CURRENT_FILE->height - 2*skip_px;
 		}
 		else {
-			font_size = current_info_text_cached_font_size;
+			background_width = CURRENT_FILE->width;
+			background_height = CURRENT_FILE->height;
 		}
-		for(; font_size > 6; font_size--) {
-			cairo_set_font_size(cr_arg, font_size);
 
-			if(main_window_in_fullscreen == FALSE) {
-				// Tiling WMs, at least i3, react weird on our window size changing.
-				// Drawing the info box on the image helps to avoid users noticing that.
-				cairo_translate(cr_arg, x < 0 ? 0 : x, y < 0 ? 0 : y);
-			}
+		// Only record the image here; rasterizing and uploading it happens
+		// below, without holding the lock
+		recording = opengl_record_stale_image_textures(&texture_scale, &texture_width, &texture_height);
+		nearest = option_interpolation_quality == FAST || (option_interpolation_quality == AUTO && (CURRENT_FILE->width < 100 || CURRENT_FILE->height < 100));
+		scene_complete = TRUE;
+
+		// If we have an active slideshow, resume now.
+		if(slideshow_timeout_id == 0) {
+			slideshow_timeout_id = gdk_threads_add_timeout(option_slideshow_interval * 1000, slideshow_timeout_callback, NULL);
+		}
 
-			cairo_set_source_rgb(cr_arg, option_box_colors.bg_red, option_box_colors.bg_green, option_box_colors.bg_blue);
-			cairo_translate(cr_arg, 10 * screen_scale_factor, 20 * screen_scale_factor);
-			cairo_text_path(cr_arg, current_info_text);
-			cairo_path_extents(cr_arg, &x1, &y1, &x2, &y2);
+		current_image_drawn = TRUE;
+	}
+	D_UNLOCK(file_tree);
 
-			if(x2 > main_window_width - 10 * screen_scale_factor && !main_window_in_fullscreen) {
-				cairo_new_path(cr_arg);
-				cairo_restore(cr_arg);
-				cairo_save(cr_arg);
-				continue;
+	if(scene_complete) {
+		// Draw background pattern
+		if(background_checkerboard_pattern != NULL && !option_transparent_background) {
+			if(option_background_pattern == CHECKERBOARD) {
+				glUniform1i(opengl.uniform_mode, OPENGL_SHADE_CHECKERBOARD);
 			}
+			else {
+				const GLfloat intensity = option_background_pattern == WHITE ? 1. : 0.;
+				glUniform1i(opengl.uniform_mode, OPENGL_SHADE_COLOR);
+				glUniform4f(opengl.uniform_color, intensity, intensity, intensity, 1.);
+			}
+			opengl_draw_quad(&matrix, background_x, background_y, background_width, background_height, background_x, background_y, background_x + background_width, background_y + background_height);
+		}
+
+		// Draw the image
+		if(recording) {
+			opengl_upload_image_textures(recording, texture_scale, texture_width, texture_height);
+			cairo_surface_destroy(recording);
+		}
+		glUniform1i(opengl.uniform_mode, OPENGL_SHADE_CAIRO_TEXTURE);
+		glUniform1i(opengl.uniform_negate, option_negate);
+		for(guint i = 0; i < opengl.image_tiles->len; i++) {
+			struct opengl_image_tile *tile = &g_array_index(opengl.image_tiles, struct opengl_image_tile, i);
+			glBindTexture(GL_TEXTURE_2D, tile->texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, nearest ? GL_NEAREST : GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, nearest ? GL_NEAREST : GL_LINEAR);
+			opengl_draw_quad(&matrix, tile->x / opengl.image_scale, tile->y / opengl.image_scale, tile->width / opengl.image_scale, tile->height / opengl.image_scale, tile->s0, tile->t0, tile->s1, tile->t1);
+		}
+		glUniform1i(opengl.uniform_negate, 0);
+	}
+	else if(preview) {
+		// The image is being decoded incrementally. Draw what is available,
+		// rendered by Cairo at the size of the frame.
+		cairo_surface_t *preview_frame = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, opengl.frame_width, opengl.frame_height);
+		cairo_t *cr = cairo_create(preview_frame);
+		draw_progressive_preview(cr, preview, opengl.frame_width, opengl.frame_height, TRUE);
+		cairo_destroy(cr);
+		if(cairo_surface_status(preview_frame) == CAIRO_STATUS_SUCCESS) {
+			opengl_upload_surface(opengl.preview_texture, preview_frame, FALSE);
+			glUniform1i(opengl.uniform_mode, OPENGL_SHADE_CAIRO_TEXTURE);
+			opengl_draw_quad(NULL, 0, 0, opengl.frame_width, opengl.frame_height, 0., 0., 1., 1.);
+		}
+		cairo_surface_destroy(preview_frame);
+	}
+	else if(opengl.last_frame_valid) {
+		// The image has not yet been loaded. Keep showing the last frame.
+		glDisable(GL_BLEND);
+		opengl_draw_frame_texture(1, 1.);
+	}
+	if(preview) {
+		cairo_surface_destroy(preview);
+	}
 
-			current_info_text_cached_font_size = font_size;
-			cairo_path_t *text_path = cairo_copy_path(cr_arg);
-			cairo_new_path(cr_arg);
-			cairo_rectangle(cr_arg, -5, -(y2 - y1) - 2, x2 - x1 + 10, y2 - y1 + 8);
-			cairo_close_path(cr_arg);
-			cairo_fill(cr_arg);
-			cairo_set_source_rgb(cr_arg, option_box_colors.fg_red, option_box_colors.fg_green, option_box_colors.fg_blue);
-			cairo_append_path(cr_arg, text_path);
-			cairo_fill(cr_arg);
-			cairo_path_destroy(text_path);
+	// Present the scene, fading from the last frame if requested
+	gtk_gl_area_attach_buffers(area);
+	glViewport(0, 0, opengl.frame_width, opengl.frame_height);
+	glDisable(GL_BLEND);
+	if(scene_complete && option_fading && fading_current_alpha_stage < 1. && fading_current_alpha_stage > 0. && opengl.last_frame_valid) {
+		opengl_draw_frame_texture(1, 1.);
+		glEnable(GL_BLEND);
+		opengl_draw_frame_texture(0, fading_current_alpha_stage);
 
-			break;
+		// If this was the first draw, start the fading clock
+		if(fading_initial_time < 0) {
+			fading_initial_time = g_get_monotonic_time();
 		}
+	}
+	else {
+		opengl_draw_frame_texture(0, 1.);
 
-		cairo_restore(cr_arg);
-
-		// Store where the box was drawn to allow for partial updates of the screen
-		current_info_text_bounding_box.x = (main_window_in_fullscreen == TRUE ? 0 : (x < 0 ? 0 : x)) + 10 - 5;
-		current_info_text_bounding_box.y = (main_window_in_fullscreen == TRUE ? 0 : (y < 0 ? 0 : y)) + 20 -(y2 - y1) - 2;
+		// Keep the frame, for fading and to have something to display if no
+		// image is loaded
+		if(scene_complete) {
+			GLuint last_frame = opengl.frame_textures[1];
+			opengl.frame_textures[1] = opengl.frame_textures[0];
+			opengl.frame_textures[0] = last_frame;
+			opengl.last_frame_valid = TRUE;
+		}
+	}
 
-		 // Redraw some extra pixels to make sure a wider new box would be covered:
-		current_info_text_bounding_box.width = x2 - x1 + 10 + 30;
-		current_info_text_bounding_box.height = y2 - y1 + 8;
+	// Draw info box
+#ifndef CONFIGURED_WITHOUT_INFO_TEXT
+	if(current_info_text != NULL) {
+		opengl_update_overlay_texture(x, y);
+		glEnable(GL_BLEND);
+		glBindTexture(GL_TEXTURE_2D, opengl.overlay_texture);
+		glUniform1i(opengl.uniform_mode, OPENGL_SHADE_CAIRO_TEXTURE);
+		opengl_draw_quad(NULL, 0, 0, opengl.frame_width, opengl.overlay_height, 0., 0., 1., 1.);
 	}
 #endif
 
-	// TODO Maybe this will need to be changed someday; the GDK Wayland backend
-	// currently does not draw window borders if the draw callback reports
-	// success. Anyway, it also draws the borders at the wrong place (well
-	// within the window rather than around it), so I'll leave things as they
-	// are for the time being.
+	glBindVertexArray(0);
+	glUseProgram(0);
 	return TRUE;
 }/*}}}*/
-#if GTK_MAJOR_VERSION < 3
-	gboolean window_expose_callback(GtkWidget *widget, GdkEvent *event, gpointer user_data) {/*{{{*/
-		cairo_t *cr = gdk_cairo_create(widget->window);
-		window_draw_callback(widget, cr, user_data);
-		cairo_destroy(cr);
-		return TRUE;
-	}/*}}}*/
+void opengl_area_create() {/*{{{*/
+	// Add a GtkGLArea covering main_window. If OpenGL turns out not to be
+	// available once it is realized, opengl_area_usable remains FALSE and
+	// window_draw_callback draws using Cairo, as without --opengl.
+	opengl_area = gtk_gl_area_new();
+	gtk_gl_area_set_has_alpha(GTK_GL_AREA(opengl_area), option_transparent_background);
+	g_signal_connect(opengl_area, "realize", G_CALLBACK(opengl_area_realize_callback), NULL);
+	g_signal_connect(opengl_area, "unrealize", G_CALLBACK(opengl_area_unrealize_callback), NULL);
+	g_signal_connect(opengl_area, "render", G_CALLBACK(opengl_area_render_callback), NULL);
+	gtk_container_add(GTK_CONTAINER(main_window), opengl_area);
+	gtk_widget_show(opengl_area);
+}/*}}}*/
+/* }}} */
 #endif
 double calculate_scale_level_to_fit(int image_width, int image_height, int window_width, int window_height) {/*{{{*/
 	if(scale_override || option_scale == FIXED_SCALE) {
@@ -5473,6 +9034,77 @@ void queue_action_from_binding(key_binding_t *binding) {/*{{{*/
 	}
 }/*}}}*/
 #endif
+void output_statistics() {/*{{{*/
+	// Implementation of the output_statistics action: Print the diagnostic
+	// counters, in the format of output_cache_statistics. Times are converted
+	// to milliseconds.
+	guint queue_depth = 0;
+	guint64 queue_waits = 0;
+	gint64 queue_wait_time = 0;
+	gint64 queue_max_wait_time = 0;
+	if(image_loader_queue) {
+		g_mutex_lock(&image_loader_queue->lock);
+		for(int i=0; i<LOAD_PRIORITY_COUNT; i++) {
+			queue_depth += g_queue_get_length(&image_loader_queue->items[i]);
+		}
+		queue_waits = image_loader_queue->waits;
+		queue_wait_time = image_loader_queue->wait_time;
+		queue_max_wait_time = image_loader_queue->max_wait_time;
+		g_mutex_unlock(&image_loader_queue->lock);
+	}
+
+	D_LOCK(file_tree);
+	guint loaded_count = 0;
+	gsize image_bytes = 0;
+	gsize prerendered_bytes = 0;
+	gsize thumbnail_bytes = 0;
+	loaded_images_memory_usage(&loaded_count, &image_bytes, &prerendered_bytes, &thumbnail_bytes);
+	// Copied, such that printing is not accounted to the lock
+	const struct lock_statistics file_tree_lock = file_tree_lock_statistics;
+	D_UNLOCK(file_tree);
+
+	// The surfaces the window draws from. Only the main thread uses them.
+	gsize view_bytes = surface_memory_usage(current_scaled_image_surface);
+	for(GList *iter = scaled_image_tiles.head; iter; iter = iter->next) {
+		view_bytes += surface_memory_usage(((struct scaled_image_tile *)iter->data)->surface);
+	}
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+	view_bytes += surface_memory_usage(montage_page.surface);
+#endif
+
+	g_print("LOADER_QUEUE_DEPTH=%u\nLOADER_QUEUE_WAITS=%" G_GUINT64_FORMAT "\nLOADER_QUEUE_WAIT_MEAN_MS=%.3f\nLOADER_QUEUE_WAIT_MAX_MS=%.3f\n",
+		queue_depth,
+		queue_waits,
+		queue_waits ? queue_wait_time / 1000. / queue_waits : 0.,
+		queue_max_wait_time / 1000.);
+	g_print("FILE_TREE_LOCK_ACQUISITIONS=%" G_GUINT64_FORMAT "\nFILE_TREE_LOCK_CONTENTIONS=%" G_GUINT64_FORMAT "\nFILE_TREE_LOCK_WAIT_MS=%.3f\nFILE_TREE_LOCK_HOLD_MS=%.3f\nFILE_TREE_LOCK_HOLD_MAX_MS=%.3f\n",
+		file_tree_lock.acquisitions,
+		file_tree_lock.contentions,
+		file_tree_lock.wait_time / 1000.,
+		file_tree_lock.hold_time / 1000.,
+		file_tree_lock.max_hold_time / 1000.);
+	g_print("PRERENDER_HITS=%d\nPRERENDER_MISSES=%d\nTHUMBNAIL_CACHE_HITS=%d\nTHUMBNAIL_CACHE_MISSES=%d\n",
+		g_atomic_int_get(&statistics_prerender_hits),
+		g_atomic_int_get(&statistics_prerender_misses),
+		g_atomic_int_get(&statistics_thumbnail_cache_hits),
+		g_atomic_int_get(&statistics_thumbnail_cache_misses));
+
+	G_LOCK(statistics);
+	g_print("DECODED_BYTES=%" G_GUINT64_FORMAT "\nSURFACE_BYTES=%" G_GSIZE_FORMAT "\n",
+		statistics_decoded_bytes,
+		image_bytes + prerendered_bytes + thumbnail_bytes + view_bytes);
+	for(int i=0; i<STAGE_COUNT; i++) {
+		gchar *stage_name = g_ascii_strup(stage_names[i], -1);
+		const struct stage_statistics *stage = &stage_statistics[i];
+		g_print("STAGE_%s_COUNT=%" G_GUINT64_FORMAT "\nSTAGE_%s_MEAN_MS=%.3f\nSTAGE_%s_MAX_MS=%.3f\n",
+			stage_name, stage->count,
+			stage_name, stage->count ? stage->total_time / 1000. / stage->count : 0.,
+			stage_name, stage->max_time / 1000.);
+		g_free(stage_name);
+	}
+	G_UNLOCK(statistics);
+	g_print("\n");
+}/*}}}*/
 void UNUSED_FUNCTION action_done() {/*{{{*/
 #ifndef CONFIGURED_WITHOUT_ACTIONS
 	if(!g_queue_is_empty(&action_queue) && action_queue_idle_id == -1) {
@@ -5529,8 +9161,8 @@ void action(pqiv_action_t action_id, pqiv_action_parameter_t parameter) {/*{{{*/
 			if((option_scale == AUTO_SCALEDOWN && current_scale_level > 1) || option_scale == NO_SCALING) {
 				scale_override = TRUE;
 			}
+			// The draw callback has the image rendered at the new scale level
 			invalidate_current_scaled_image_surface();
-			image_generate_prerendered_view(CURRENT_FILE, FALSE, current_scale_level);
 			current_image_drawn = FALSE;
 			if(main_window_in_fullscreen) {
 				gtk_widget_queue_draw(GTK_WIDGET(main_window));
@@ -6029,6 +9661,7 @@ void action(pqiv_action_t action_id, pqiv_action_parameter_t parameter) {/*{{{*/
 				g_source_remove(current_image_animation_timeout_id);
 				current_image_animation_timeout_id = 0;
 			}
+			current_image_animation_frame_pending = FALSE;
 			current_image_animation_speed_scale = 0;
 			D_LOCK(file_tree);
 			if(parameter.pint > 0 && CURRENT_FILE->file_type->animation_next_frame_fn != NULL) {
@@ -6118,10 +9751,7 @@ void action(pqiv_action_t action_id, pqiv_action_parameter_t parameter) {/*{{{*/
 
 			D_LOCK(file_tree);
 			for(BOSNode *node = bostree_select(file_tree, 0); node; node = bostree_next_node(node)) {
-				if(FILE(node)->thumbnail) {
-					cairo_surface_destroy(FILE(node)->thumbnail);
-					FILE(node)->thumbnail = NULL;
-				}
+				image_loader_set_thumbnail(FILE(node), NULL);
 			}
 			D_UNLOCK(file_tree);
 
@@ -6155,6 +9785,7 @@ void action(pqiv_action_t action_id, pqiv_action_parameter_t parameter) {/*{{{*/
 				g_source_remove(current_image_animation_timeout_id);
 				current_image_animation_timeout_id = 0;
 			}
+			current_image_animation_frame_pending = FALSE;
 			if(last_visible_surface) {
 				cairo_surface_destroy(last_visible_surface);
 				last_visible_surface = NULL;
@@ -6422,6 +10053,7 @@ void action(pqiv_action_t action_id, pqiv_action_parameter_t parameter) {/*{{{*/
 			}
 			application_mode = DEFAULT;
 			active_key_binding_context = DEFAULT;
+			montage_page_invalidate();
 			main_window_adjust_for_image();
 			gtk_widget_queue_draw(GTK_WIDGET(main_window));
 			if(main_window_in_fullscreen) {
@@ -6463,10 +10095,7 @@ void action(pqiv_action_t action_id, pqiv_action_parameter_t parameter) {/*{{{*/
 				// probably not have many images loaded, this might suffice. But an asymptotically better
 				// approach would be neat.
 				for(BOSNode *node = bostree_select(file_tree, 0); node; node = bostree_next_node(node)) {
-					if(FILE(node)->thumbnail) {
-						cairo_surface_destroy(FILE(node)->thumbnail);
-						FILE(node)->thumbnail = NULL;
-					}
+					image_loader_set_thumbnail(FILE(node), NULL);
 				}
 				D_UNLOCK(file_tree);
 			}
@@ -6515,6 +10144,36 @@ void action(pqiv_action_t action_id, pqiv_action_parameter_t parameter) {/*{{{*/
 			gtk_widget_queue_draw(GTK_WIDGET(main_window));
 			break;
 
+		case ACTION_OUTPUT_CACHE_STATISTICS:
+			{
+				D_LOCK(file_tree);
+				guint loaded_count = 0;
+				gsize image_bytes = 0;
+				gsize prerendered_bytes = 0;
+				gsize thumbnail_bytes = 0;
+				loaded_images_memory_usage(&loaded_count, &image_bytes, &prerendered_bytes, &thumbnail_bytes);
+				g_print("CACHE_SIZE_LIMIT=%" G_GSIZE_FORMAT "\nCACHE_LOADED_IMAGES=%u\nCACHE_IMAGE_BYTES=%" G_GSIZE_FORMAT "\nCACHE_PRERENDERED_BYTES=%" G_GSIZE_FORMAT "\nCACHE_THUMBNAIL_BYTES=%" G_GSIZE_FORMAT "\nCACHE_HITS=%u\nCACHE_MISSES=%u\n\n",
+					(gsize)option_cache_size * 1024 * 1024,
+					loaded_count,
+					image_bytes,
+					prerendered_bytes,
+					thumbnail_bytes,
+					image_cache_hits,
+					image_cache_misses);
+				D_UNLOCK(file_tree);
+			}
+			break;
+
+		case ACTION_COMPACT_THUMBNAIL_CACHE:
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+			queue_thumbnail_cache_compaction();
+#endif
+			break;
+
+		case ACTION_OUTPUT_STATISTICS:
+			output_statistics();
+			break;
+
 #ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
 		case ACTION_MONTAGE_MODE_SHIFT_Y_ROWS:
 			if(application_mode != MONTAGE) {
@@ -7231,6 +10890,12 @@ void create_window() { /*{{{*/
 	if(option_transparent_background) {
 		window_screen_activate_rgba();
 	}
+
+#ifdef PQIV_OPENGL
+	if(option_opengl) {
+		opengl_area_create();
+	}
+#endif
 }/*}}}*/
 gboolean initialize_gui() {/*{{{*/
 	setup_checkerboard_pattern();
@@ -7907,6 +11572,13 @@ gpointer load_images_thread(gpointer user_data) {/*{{{*/
 
 	load_images();
 
+	if(directory_caches_pending_validation) {
+		if(file_tree_valid) {
+			g_thread_new("directory-cache", directory_cache_validate_thread, directory_caches_pending_validation);
+		}
+		directory_caches_pending_validation = NULL;
+	}
+
 	gboolean tree_empty = TRUE;
 	if(file_tree_valid) {
 		tree_empty = bostree_node_count(file_tree) == 0;
@@ -7932,6 +11604,395 @@ gpointer load_images_thread(gpointer user_data) {/*{{{*/
 #endif
 	return NULL;
 }/*}}}*/
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+// Headless thumbnail generation {{{
+struct thumbnail_generator {
+	BOSNode **nodes;
+	guint n_nodes;
+	gint next_node;
+	gint generated;
+	gint up_to_date;
+	gint failed;
+};
+G_LOCK_DEFINE_STATIC(thumbnail_generator_store);
+gpointer generate_thumbnails_thread(gpointer user_data) {/*{{{*/
+	struct thumbnail_generator *generator = user_data;
+
+	while(TRUE) {
+		const guint i = (guint)g_atomic_int_add(&generator->next_node, 1);
+		if(i >= generator->n_nodes) {
+			break;
+		}
+		BOSNode *node = generator->nodes[i];
+		file_t *file = FILE(node);
+
+		cairo_surface_t *thumbnail = thumbnail_cache_lookup(file);
+		if(thumbnail) {
+			cairo_surface_destroy(thumbnail);
+			g_atomic_int_inc(&generator->up_to_date);
+			continue;
+		}
+
+		D_LOCK(file_tree);
+		file->load_resolution = LOAD_RESOLUTION_THUMBNAIL;
+		D_UNLOCK(file_tree);
+
+		// Failures are reported by image_loader_load_single(), which also
+		// removes the file from the tree. The weak reference keeps it valid.
+		// Since there is no main loop, it must be told it is called from main.
+		if(!image_loader_load_single(node, TRUE)) {
+			g_atomic_int_inc(&generator->failed);
+			continue;
+		}
+
+		thumbnail = image_loader_create_thumbnail(file);
+		gboolean stored = FALSE;
+		if(thumbnail) {
+			// The stores are serialized, like those of the thumbnail-store
+			// thread, because they might write to the same pack file
+			G_LOCK(thumbnail_generator_store);
+			stored = thumbnail_cache_store(file, thumbnail);
+			G_UNLOCK(thumbnail_generator_store);
+			cairo_surface_destroy(thumbnail);
+		}
+		if(stored) {
+			g_atomic_int_inc(&generator->generated);
+		}
+		else {
+			g_printerr("Failed to store the thumbnail of %s\n", file->display_name);
+			g_atomic_int_inc(&generator->failed);
+		}
+
+		unload_image_immediately(node);
+	}
+
+	return NULL;
+}/*}}}*/
+gboolean generate_thumbnails() {/*{{{*/
+	// Implementation of --generate-thumbnails: Load the images given on the
+	// command line the usual way, and store the thumbnails of all those whose
+	// thumbnails are not cached yet, using all loader threads. Does not need
+	// a display. Returns whether there were no failures.
+	if(option_thumbnails.persist == THUMBNAILS_PERSIST_OFF) {
+		g_printerr("Error: --generate-thumbnails conflicts with --thumbnail-persistence=no.\n");
+		return FALSE;
+	}
+	if(option_thumbnails.persist == THUMBNAILS_PERSIST_RO && option_thumbnail_persistence_given) {
+		g_printerr("Error: --generate-thumbnails conflicts with --thumbnail-persistence=read-only.\n");
+		return FALSE;
+	}
+	if(option_thumbnails.persist == THUMBNAILS_PERSIST_RO) {
+		option_thumbnails.persist = THUMBNAILS_PERSIST_ON;
+	}
+	option_watch_directories = FALSE;
+	option_lazy_load = FALSE;
+
+	load_images();
+
+	struct thumbnail_generator generator = { NULL, 0, 0, 0, 0, 0 };
+	D_LOCK(file_tree);
+	generator.n_nodes = bostree_node_count(file_tree);
+	generator.nodes = g_new(BOSNode *, generator.n_nodes);
+	guint n = 0;
+	for(BOSNode *node = bostree_select(file_tree, 0); node; node = bostree_next_node(node)) {
+		generator.nodes[n++] = bostree_node_weak_ref(node);
+	}
+	D_UNLOCK(file_tree);
+
+	if(generator.n_nodes == 0) {
+		g_printerr("No images found.\n");
+		g_free(generator.nodes);
+		return FALSE;
+	}
+
+	GTimer *timer = g_timer_new();
+	image_loader_set_thread_count();
+	GThread **threads = g_new(GThread *, option_loader_threads);
+	for(int i=0; i<option_loader_threads; i++) {
+		threads[i] = g_thread_new("thumbnail-generator", generate_thumbnails_thread, &generator);
+	}
+	for(int i=0; i<option_loader_threads; i++) {
+		g_thread_join(threads[i]);
+	}
+	g_free(threads);
+	const double elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	D_LOCK(file_tree);
+	for(guint i=0; i<generator.n_nodes; i++) {
+		bostree_node_weak_unref(file_tree, generator.nodes[i]);
+	}
+	D_UNLOCK(file_tree);
+	g_free(generator.nodes);
+
+	printf("%u images: %d thumbnails generated, %d up to date, %d failed in %.2fs using %d threads (%.1f images/s, %.1f generated/s)\n",
+		generator.n_nodes, generator.generated, generator.up_to_date, generator.failed, elapsed, option_loader_threads,
+		generator.n_nodes / fmax(elapsed, 1e-3), generator.generated / fmax(elapsed, 1e-3));
+
+	return generator.failed == 0;
+}/*}}}*/
+// }}}
+#endif
+// Benchmark {{{
+#define BENCHMARK_SCREEN_WIDTH 1920
+#define BENCHMARK_SCREEN_HEIGHT 1080
+gboolean benchmark_visit(BOSNode *node, cairo_surface_t *target) {/*{{{*/
+	// Take an image through the stages that displaying it in the window
+	// would: Loading, the thumbnail, the prerendered views and the first draw.
+	// node is a weak reference. Returns FALSE if the image failed to load, in
+	// which case it is removed from the tree.
+	file_t *file = FILE(node);
+
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+	cairo_surface_t *thumbnail = NULL;
+	if(option_thumbnails.persist != THUMBNAILS_PERSIST_OFF) {
+		thumbnail = thumbnail_cache_lookup(file);
+	}
+#endif
+
+	// Since there is no main loop, it must be told it is called from main.
+	if(!image_loader_load_single(node, TRUE)) {
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+		if(thumbnail) {
+			cairo_surface_destroy(thumbnail);
+		}
+#endif
+		return FALSE;
+	}
+
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+	if(!thumbnail) {
+		thumbnail = image_loader_create_thumbnail(file);
+		if(thumbnail && option_thumbnails.persist != THUMBNAILS_PERSIST_OFF && option_thumbnails.persist != THUMBNAILS_PERSIST_RO) {
+			thumbnail_cache_store(file, thumbnail);
+		}
+	}
+	if(thumbnail) {
+		cairo_surface_destroy(thumbnail);
+	}
+#endif
+
+	image_generate_prerendered_pyramid(file);
+	image_generate_prerendered_view(file, FALSE, -1);
+
+	const gint64 begin = stage_timer_begin();
+	const double scale_level = calculate_auto_scale_level_for_screen(file->width, file->height);
+	const int width = scale_level * file->width + .5;
+	const int height = scale_level * file->height + .5;
+	cairo_t *cr = cairo_create(target);
+	cairo_set_source_rgb(cr, 0, 0, 0);
+	cairo_paint(cr);
+	cairo_translate(cr, (BENCHMARK_SCREEN_WIDTH - width) / 2, (BENCHMARK_SCREEN_HEIGHT - height) / 2);
+	image_draw_at_size(file, cr, scale_level, width, height);
+	cairo_destroy(cr);
+	cairo_surface_flush(target);
+	stage_timer_end(STAGE_DRAW, begin);
+
+	unload_image_immediately(node);
+	return TRUE;
+}/*}}}*/
+#ifndef CONFIGURED_WITHOUT_ACTIONS
+BOSNode *benchmark_action_target(key_binding_t *binding, BOSNode *position, BOSNode *earlier) {/*{{{*/
+	// Resolve a navigation action the way action() would, relative to
+	// position. Returns a weak reference to the target, or NULL.
+	BOSNode *target = NULL;
+
+	D_LOCK(file_tree);
+	switch(binding->action) {
+		case ACTION_GOTO_FILE_RELATIVE:
+			// relative_image_pointer() moves from current_file_node, which is
+			// otherwise left NULL, see run_benchmark()
+			current_file_node = position;
+			target = relative_image_pointer(binding->parameter.pint);
+			current_file_node = NULL;
+			break;
+
+		case ACTION_GOTO_FILE_BYINDEX:
+			{
+				int index = binding->parameter.pint;
+				if(index < 0) {
+					index += bostree_node_count(file_tree);
+				}
+				target = bostree_select(file_tree, index);
+				if(!target) {
+					g_printerr("Image #%d not found.\n", binding->parameter.pint);
+				}
+			}
+			break;
+
+		case ACTION_GOTO_EARLIER_FILE:
+			target = earlier;
+			break;
+
+		case ACTION_NOP:
+			break;
+
+		default:
+			g_printerr("Warning: Skipping action %s, --benchmark only follows file navigation.\n", pqiv_action_descriptors[binding->action].name);
+			break;
+	}
+	if(target) {
+		target = bostree_node_weak_ref(target);
+	}
+	D_UNLOCK(file_tree);
+
+	return target;
+}/*}}}*/
+#endif
+int benchmark_compare_samples(gconstpointer a, gconstpointer b) {/*{{{*/
+	const gint64 sample_a = *(const gint64 *)a;
+	const gint64 sample_b = *(const gint64 *)b;
+	return sample_a < sample_b ? -1 : (sample_a > sample_b ? 1 : 0);
+}/*}}}*/
+double benchmark_percentile_ms(GArray *sorted_samples, double percentile) {/*{{{*/
+	// Nearest-rank percentile of samples in microseconds, sorted ascendingly
+	guint rank = (guint)ceil(percentile / 100. * sorted_samples->len);
+	if(rank > 0) {
+		rank--;
+	}
+	return g_array_index(sorted_samples, gint64, rank) / 1000.;
+}/*}}}*/
+gboolean run_benchmark() {/*{{{*/
+	// Implementation of --benchmark: Load the images given on the command line
+	// the usual way and visit them the way the window would show them, the
+	// ones that the navigation actions in option_benchmark_actions lead to
+	// or else all of them in order. There is no window; images are drawn to
+	// an offscreen surface the size of a full HD screen, one at a time. Then
+	// write the wall times of all stages, as JSON. Returns whether there were
+	// no failures.
+	option_watch_directories = FALSE;
+	option_lazy_load = FALSE;
+	screen_geometry.x = screen_geometry.y = 0;
+	screen_geometry.width = main_window_width = BENCHMARK_SCREEN_WIDTH;
+	screen_geometry.height = main_window_height = BENCHMARK_SCREEN_HEIGHT;
+
+#ifndef CONFIGURED_WITHOUT_ACTIONS
+	if(option_benchmark_actions && !perform_string_action(option_benchmark_actions)) {
+		g_printerr("Error: Failed to parse the actions given to --benchmark.\n");
+		return FALSE;
+	}
+#endif
+
+	const gint64 begin = g_get_monotonic_time();
+	load_images();
+
+	D_LOCK(file_tree);
+	const guint n_images = bostree_node_count(file_tree);
+	D_UNLOCK(file_tree);
+	if(n_images == 0) {
+		g_printerr("No images found.\n");
+		return FALSE;
+	}
+
+	cairo_surface_t *target = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, BENCHMARK_SCREEN_WIDTH, BENCHMARK_SCREEN_HEIGHT);
+	guint steps = 0;
+	guint failed = 0;
+
+	// All images are visited with current_file_node left NULL, so that
+	// remove_image() drops those that fail to load right away instead of
+	// queueing a reload. position always is a weak reference to an image
+	// that was visited successfully, if any.
+	BOSNode *position = NULL;
+	BOSNode *earlier = NULL;
+	while(TRUE) {
+		BOSNode *target_node = NULL;
+		if(!position) {
+			// Start at the first image, like the window would
+			D_LOCK(file_tree);
+			target_node = bostree_select(file_tree, 0);
+			if(target_node) {
+				target_node = bostree_node_weak_ref(target_node);
+			}
+			D_UNLOCK(file_tree);
+		}
+#ifndef CONFIGURED_WITHOUT_ACTIONS
+		else if(option_benchmark_actions) {
+			key_binding_t *binding = g_queue_pop_head(&action_queue);
+			if(!binding) {
+				break;
+			}
+			target_node = benchmark_action_target(binding, position, earlier);
+			key_binding_t_destroy_callback(binding);
+			if(!target_node) {
+				continue;
+			}
+		}
+#endif
+		else {
+			D_LOCK(file_tree);
+			target_node = bostree_next_node(position);
+			if(target_node) {
+				target_node = bostree_node_weak_ref(target_node);
+			}
+			D_UNLOCK(file_tree);
+		}
+		if(!target_node) {
+			break;
+		}
+
+		steps++;
+		if(!benchmark_visit(target_node, target)) {
+			// The image is gone now. Do not move relative to it anymore.
+			failed++;
+			D_LOCK(file_tree);
+			if(target_node == earlier) {
+				bostree_node_weak_unref(file_tree, earlier);
+				earlier = NULL;
+			}
+			if(target_node == position) {
+				bostree_node_weak_unref(file_tree, position);
+				position = NULL;
+			}
+			bostree_node_weak_unref(file_tree, target_node);
+			D_UNLOCK(file_tree);
+			continue;
+		}
+
+		D_LOCK(file_tree);
+		if(earlier) {
+			bostree_node_weak_unref(file_tree, earlier);
+		}
+		earlier = position;
+		position = target_node;
+		D_UNLOCK(file_tree);
+	}
+
+	D_LOCK(file_tree);
+	if(earlier) {
+		bostree_node_weak_unref(file_tree, earlier);
+	}
+	if(position) {
+		bostree_node_weak_unref(file_tree, position);
+	}
+	D_UNLOCK(file_tree);
+	cairo_surface_destroy(target);
+	const gint64 elapsed = g_get_monotonic_time() - begin;
+
+	printf("{\n  \"images\": %u,\n  \"steps\": %u,\n  \"failed\": %u,\n  \"total_ms\": %.3f,\n  \"stages\": {", n_images, steps, failed, elapsed / 1000.);
+	G_LOCK(statistics);
+	for(int i=0; i<STAGE_COUNT; i++) {
+		GArray *samples = stage_samples[i];
+		printf("%s\n    \"%s\": ", i > 0 ? "," : "", stage_names[i]);
+		if(!samples || samples->len == 0) {
+			printf("{ \"count\": 0 }");
+			continue;
+		}
+		g_array_sort(samples, benchmark_compare_samples);
+		gint64 sum = 0;
+		for(guint j=0; j<samples->len; j++) {
+			sum += g_array_index(samples, gint64, j);
+		}
+		printf("{ \"count\": %u, \"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f }",
+			samples->len, sum / 1000. / samples->len,
+			benchmark_percentile_ms(samples, 50), benchmark_percentile_ms(samples, 90), benchmark_percentile_ms(samples, 99),
+			g_array_index(samples, gint64, samples->len - 1) / 1000.);
+	}
+	G_UNLOCK(statistics);
+	printf("\n  }\n}\n");
+
+	return failed == 0;
+}/*}}}*/
+// }}}
 gboolean inner_main(void *user_data) {/*{{{*/
 	if(option_lazy_load) {
 		if(option_allow_empty_window) {
@@ -7970,6 +12031,11 @@ int main(int argc, char *argv[]) {
 	#if defined(GDK_WINDOWING_X11)
 		XInitThreads();
 	#endif
+	#if !defined(_WIN32) && !defined(CONFIGURED_WITHOUT_EXTERNAL_COMMANDS)
+		// An external filter that exits without reading all of its input must
+		// not terminate pqiv. Writing to it fails with EPIPE instead.
+		signal(SIGPIPE, SIG_IGN);
+	#endif
 	#if (!GLIB_CHECK_VERSION(2, 32, 0))
 		g_thread_init(NULL);
 		gdk_threads_init();
@@ -7986,8 +12052,8 @@ int main(int argc, char *argv[]) {
 	parse_configuration_file();
 	parse_command_line();
 
-	if(!windowing_available) {
-		g_warn_if_reached(); // this should never be called because parse_command_line() calls gtk_init() again.
+	if(!windowing_available && !option_generate_thumbnails && !option_benchmark) {
+		g_printerr("Failed to open display %s\n", gdk_get_display_arg_name() ? gdk_get_display_arg_name() : "");
 		return 1;
 	}
 
@@ -8034,6 +12100,19 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+#ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
+	if(option_generate_thumbnails) {
+		const gboolean success = generate_thumbnails();
+		statistics_write_trace();
+		return success ? 0 : 1;
+	}
+#endif
+	if(option_benchmark) {
+		const gboolean success = run_benchmark();
+		statistics_write_trace();
+		return success ? 0 : 1;
+	}
+
 	// Start image loader & show window inside main loop, in order to have
 	// gtk_main_quit() available.
 	gdk_threads_add_idle(inner_main, NULL);
@@ -8063,6 +12142,8 @@ int main(int argc, char *argv[]) {
 	bostree_destroy(file_tree);
 	D_UNLOCK(file_tree);
 
+	statistics_write_trace();
+
 	return 0;
 }
 
@@ -34,14 +34,37 @@
 
 #define FILE_FLAGS_ANIMATION      (guint)(1)
 #define FILE_FLAGS_MEMORY_IMAGE   (guint)(1<<1)
+#define FILE_FLAGS_FULL_RESOLUTION (guint)(1<<2)
+#define FILE_FLAGS_RELOAD         (guint)(1<<3)
 
 #define FALSE_POINTER ((void*)-1)
 
+#define PRERENDERED_PYRAMID_LEVELS 6
+
 // The structure for images {{{
 typedef struct _file file_t;
+typedef enum { LOAD_RESOLUTION_FULL, LOAD_RESOLUTION_SCREEN, LOAD_RESOLUTION_THUMBNAIL } load_resolution_t;
 typedef GBytes *(*file_data_loader_fn_t)(file_t *file, GError **error_pointer);
 
 typedef struct file_type_handler_struct_t file_type_handler_t;
+
+// Renders of an image made from its backend's draw_fn, see file_t
+typedef struct {
+	// Default render, not guaranteed to be present, not guaranteed to have the
+	// correct scale level.
+	cairo_surface_t *view;
+
+	// Power-of-two reductions of the image (1/2, 1/4, ..), down to the size of
+	// the default render. Other scale levels are rendered from the nearest
+	// larger one instead of the full image.
+	cairo_surface_t *pyramid[PRERENDERED_PYRAMID_LEVELS];
+
+	// Render at the scale level the main window last asked a loader thread
+	// for, see queue_scaled_image_render(). Kept apart from the default
+	// render, which stays available for the fit-to-screen scale level.
+	cairo_surface_t *scaled;
+} prerendered_views_t;
+
 struct _file {
 	// File type
 	const file_type_handler_t *file_type;
@@ -50,10 +73,17 @@ struct _file {
 	// FILE_FLAGS_ANIMATION        -> Animation functions are invoked
 	//                                Set by file type handlers
 	// FILE_FLAGS_MEMORY_IMAGE     -> File lives in memory
+	// FILE_FLAGS_FULL_RESOLUTION  -> Never decode at a reduced resolution,
+	//                                set once the user zoomed in further
+	// FILE_FLAGS_RELOAD           -> The file is loaded again because it was
+	//                                force_reload'ed, and might be changing
 	guint file_flags;
 
+	// The names are interned, see file_name_intern(). Equal names share one
+	// copy, e.g. the display and file names of most files, or the file names
+	// of the pages of a document. Never modify them in place.
+
 	// The file name to display
-	// Must be different from file_name, because it is free()d seperately
 	gchar *display_name;
 
 	// The name to sort by
@@ -83,6 +113,10 @@ struct _file {
 	// if not, you can NOT assume that it does not.
 	gboolean is_loaded;
 
+	// The file's link in the image loader's list of loaded files, if it is in
+	// there. Protected by file_tree's lock.
+	GList *loaded_files_link;
+
 	// This flag determines whether this file should be reloaded
 	// despite is_loaded being set
 	gboolean force_reload;
@@ -91,18 +125,28 @@ struct _file {
 	guint width;
 	guint height;
 
+	// The resolution the image is needed at by the current load, and the scale
+	// level relative to width/height the backend actually decoded it at. Backends
+	// that are able to decode at a reduced resolution use
+	// image_loader_get_decode_scale_level() to make use of this, all others
+	// always decode at full resolution, i.e. at scale level 1.
+	load_resolution_t load_resolution;
+	double decoded_scale_level;
+
 #ifndef CONFIGURED_WITHOUT_MONTAGE_MODE
 	// Cached thumbnail
 	cairo_surface_t *thumbnail;
 #endif
 
 	// Lock to prevent multiple threads from accessing the backend at the same
-	// time
+	// time. It is held while the backend decodes or draws the image, which
+	// may take long, so every file has its own.
 	GMutex lock;
 
-	// Default render, automatically unloaded with the image, not guaranteed to
-	// be present, not guaranteed to have the correct scale level.
-	cairo_surface_t *prerendered_view;
+	// Prerendered views, automatically unloaded with the image, protected by
+	// a lock shared by all files, see pqiv.c. Allocated along with the first
+	// one, such that files that were never shown stay small.
+	prerendered_views_t *prerendered;
 
 	// File-type specific data, allocated and freed by the file type handlers
 	void *private;
@@ -133,6 +177,10 @@ typedef BOSNode *(*file_type_alloc_fn_t)(load_images_state_t state, file_t *file
 typedef void (*file_type_free_fn_t)(file_t *file);
 
 // Actually load a file into memory
+// Backends that decode at a reduced resolution are called again for a file
+// that is still loaded once it is needed at a higher resolution. They must
+// keep the old decode, including width/height, available until the new one
+// is complete, because it is still being displayed.
 typedef void (*file_type_load_fn_t)(file_t *file, GInputStream *data, GError **error_pointer);
 
 // Unload a file
@@ -144,11 +192,22 @@ typedef double (*file_type_animation_initialize_fn_t)(file_t *file);
 
 // Animation support: Advance to the next frame, return ms until next frame
 // Optional, you can also set the pointer to this function to NULL.
+//
+// Backends that decode frames in the background return
+// FILE_TYPE_ANIMATION_FRAME_PENDING if the next frame is not ready yet, and
+// call image_animation_frame_ready() once it is, from any thread.
+#define FILE_TYPE_ANIMATION_FRAME_PENDING -2
 typedef double (*file_type_animation_next_frame_fn_t)(file_t *file);
 
 // Draw the current view to a cairo context
 typedef void (*file_type_draw_fn_t)(file_t *file, cairo_t *cr);
 
+// Drop data kept across loads that has not been used since the last call,
+// e.g. archives kept open for reading their entries. Called on each pass of
+// the image garbage collector, without any locks held.
+// Optional, you can also set the pointer to this function to NULL.
+typedef void (*file_type_gc_fn_t)();
+
 struct file_type_handler_struct_t {
 	// All files will be filtered with this filter. If it lets it pass,
 	// a handler is assigned to a file. If none do, the file is
@@ -157,6 +216,11 @@ struct file_type_handler_struct_t {
 	// parameter.
 	GtkFileFilter *file_types_handled;
 
+	// pqiv loads images using multiple threads. Set this to TRUE if load_fn
+	// must not run concurrently for different files, e.g. because the
+	// underlying library is not thread safe or uses a global lock anyway.
+	gboolean load_not_parallel_safe;
+
 	// Pointers to the functions defined above
 	file_type_alloc_fn_t alloc_fn;
 	file_type_free_fn_t free_fn;
@@ -165,6 +229,7 @@ struct file_type_handler_struct_t {
 	file_type_animation_initialize_fn_t animation_initialize_fn;
 	file_type_animation_next_frame_fn_t animation_next_frame_fn;
 	file_type_draw_fn_t draw_fn;
+	file_type_gc_fn_t gc_fn;
 };
 
 // Initialization function: Tell pqiv about a backend
@@ -172,8 +237,9 @@ typedef void (*file_type_initializer_fn_t)(file_type_handler_t *info);
 
 // pqiv symbols available to plugins {{{
 
-// Global cancellable that should be used for every i/o operation
-extern GCancellable *image_loader_cancellable;
+// Cancellable that should be used for every i/o operation. Each loader
+// thread has its own; NULL in other threads.
+GCancellable *image_loader_get_cancellable();
 
 // Current scale level. For backends that don't support cairo natively.
 extern gdouble current_scale_level;
@@ -185,8 +251,16 @@ GInputStream *image_loader_stream_file(file_t *file, GError **error_pointer);
 GFile *gfile_for_commandline_arg(const char *parameter);
 
 // Duplicate a file_t; the private section does not get duplicated, only the pointer gets copied
+// Takes ownership of the custom names, which may be NULL to use those of file.
 file_t *image_loader_duplicate_file(file_t *file, gchar *custom_file_name, gchar *custom_display_name, gchar *custom_sort_name);
 
+// Intern a name for a file_t. Takes ownership of name and returns the shared
+// copy of it, which is released by file_free(). file_name_ref() adds a
+// reference to an interned name, e.g. for a file_t that reuses another's.
+gchar *file_name_intern(gchar *name);
+gchar *file_name_ref(gchar *name);
+void file_name_release(gchar *name);
+
 // Add a file to the list of loaded files
 // Should be called at least once in a file_type_alloc_fn_t, with the state being
 // forwarded unaltered.
@@ -205,6 +279,37 @@ void file_free(file_t *file);
 // Set the interpolation filter in a cairo context for the current file based on the user settings
 void apply_interpolation_quality(cairo_t *cr);
 
+// For backends that can decode at a reduced resolution: Given the full size of
+// an image that is being loaded, return the smallest scale level it is needed
+// at. Store the scale level actually used in file->decoded_scale_level, and
+// the full size in width/height.
+double image_loader_get_decode_scale_level(file_t *file, int width, int height);
+
+// Fill an ARGB32 image surface with the contents of a pixbuf of the same size.
+// Returns FALSE without touching the surface if the pixbuf's format is not
+// supported; use gdk_cairo_set_source_pixbuf() then.
+gboolean pixbuf_import_to_surface(GdkPixbuf *pixbuf, cairo_surface_t *surface);
+
+// The same, but only for row_count rows starting at first_row
+gboolean pixbuf_import_rows_to_surface(GdkPixbuf *pixbuf, cairo_surface_t *surface, int first_row, int row_count);
+
+// For backends that decode incrementally: If the image being loaded is
+// visible, they may publish what they have decoded so far, from within
+// load_fn. image_loader_progress_wanted() tells whether to decode
+// incrementally at all, image_loader_progress_due() whether it is time for
+// another update, which avoids preparing surfaces nobody will see.
+// image_loader_publish_progress() takes over the reference to surface, an
+// image surface showing the whole image at any resolution. The backend must
+// not modify it afterwards, unless it kept a reference of its own, has
+// published another surface since, and that reference is the only one left.
+gboolean image_loader_progress_wanted(file_t *file);
+gboolean image_loader_progress_due(file_t *file);
+void image_loader_publish_progress(file_t *file, cairo_surface_t *surface);
+
+// Have the current image's animation advance, after animation_next_frame_fn
+// returned FILE_TYPE_ANIMATION_FRAME_PENDING. May be called from any thread.
+void image_animation_frame_ready();
+
 // Wrapper for string vector contains function
 gboolean strv_contains(const gchar * const *strv, const gchar *str);
 
@@ -285,6 +390,9 @@ typedef enum {
 	ACTION_MOVE_WINDOW,
 	ACTION_TOGGLE_BACKGROUND_PATTERN,
 	ACTION_TOGGLE_NEGATE_MODE,
+	ACTION_OUTPUT_CACHE_STATISTICS,
+	ACTION_COMPACT_THUMBNAIL_CACHE,
+	ACTION_OUTPUT_STATISTICS,
 } pqiv_action_t;
 
 typedef union {